@@ -0,0 +1,257 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "exporters/trace/gcp_exporter/recordable.h"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * A Recordable that keeps the raw span fields in a compact, flat layout, and only builds the
+ * protobuf Span when the span is exported. All strings (name, attribute keys and string
+ * values) are appended to one slab, and the first few attributes are stored inline. Spans
+ * with more attributes index them by key, and the slab is compacted once most of it holds
+ * overwritten values.
+ */
+class CompactRecordable final : public sdk::trace::Recordable
+{
+public:
+  /* Types an attribute value is stored as, matching the Cloud Trace attribute types */
+  enum class AttributeType : uint8_t
+  {
+    kBool,
+    kInt,
+    kString
+  };
+
+  /* One attribute, whose key and string value live in the slab */
+  struct Attribute
+  {
+    uint32_t key_offset;
+    uint32_t key_size;
+    union
+    {
+      bool bool_value;
+      int64_t int_value;
+      struct
+      {
+        uint32_t offset;
+        uint32_t size;
+      } string_value;
+    };
+    uint32_t truncated_byte_count;
+    AttributeType type;
+  };
+
+  /* Number of attributes stored without any allocation */
+  static constexpr size_t kInlineAttributes = 4;
+
+  static void *operator new(std::size_t size);
+  static void *operator new(std::size_t size, ThreadStagingTag);
+  static void operator delete(void *ptr) noexcept;
+  static void operator delete(void *ptr, ThreadStagingTag) noexcept;
+
+  CompactRecordable() noexcept;
+
+  /* Classifies the span with the given options */
+  explicit CompactRecordable(const RecordableOptions *options) noexcept;
+
+  ~CompactRecordable() override;
+
+  void SetIds(opentelemetry::trace::TraceId trace_id,
+              opentelemetry::trace::SpanId span_id,
+              opentelemetry::trace::SpanId parent_span_id) noexcept override;
+
+  void SetAttribute(nostd::string_view key,
+                    const opentelemetry::common::AttributeValue &value) noexcept override;
+
+  void AddEvent(
+      nostd::string_view name,
+      core::SystemTimestamp timestamp,
+      const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+
+  void AddLink(
+      const opentelemetry::trace::SpanContext &span_context,
+      const opentelemetry::common::KeyValueIterable &attributes) noexcept override;
+
+  void SetStatus(opentelemetry::trace::CanonicalCode code,
+                 nostd::string_view description) noexcept override;
+
+  void SetName(nostd::string_view name) noexcept override;
+
+  void SetStartTime(opentelemetry::core::SystemTimestamp start_time) noexcept override;
+
+  void SetDuration(std::chrono::nanoseconds duration) noexcept override;
+
+  /* Typed setters, storing each value as the matching Cloud Trace attribute type */
+  void SetTypedAttribute(nostd::string_view key, bool value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, int value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, int64_t value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, double value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept;
+
+  /* Sets a string value already cut to fit, recording the number of bytes cut from it */
+  void SetTruncatedAttribute(nostd::string_view key,
+                             nostd::string_view value,
+                             size_t truncated_byte_count) noexcept;
+
+  /**
+   * Builds the protobuf form of the span
+   * 
+   * @param project_id - The Id of the Google Cloud project the span name is addressed to
+   * @param span - The span to populate
+   */
+  void ToProto(nostd::string_view project_id, google::devtools::cloudtrace::v2::Span *span) const noexcept;
+
+  /* Returns the bytes the span reserved from the memory budget, leaving none, for the
+     exporter to release with those of the rest of the request */
+  size_t TakeReservedBytes() noexcept { return charge_.TakeReservedBytes(); }
+
+  /* Raw accessors */
+  const std::array<uint8_t, 16> &trace_id() const noexcept { return trace_id_; }
+  const std::array<uint8_t, 8> &span_id() const noexcept { return span_id_; }
+  const std::array<uint8_t, 8> &parent_span_id() const noexcept { return parent_span_id_; }
+  int64_t start_time_nanos() const noexcept { return start_time_nanos_; }
+  int64_t end_time_nanos() const noexcept { return end_time_nanos_; }
+  nostd::string_view name() const noexcept { return SlabString(name_offset_, name_size_); }
+  uint32_t name_truncated_byte_count() const noexcept { return name_truncated_byte_count_; }
+  bool priority() const noexcept { return priority_; }
+  const CapturedStack *stack() const noexcept { return stack_.get(); }
+  bool dropped() const noexcept { return charge_.dropped(); }
+  bool has_status() const noexcept { return has_status_; }
+  int32_t status_code() const noexcept { return status_code_; }
+  nostd::string_view status_message() const noexcept
+  {
+    return SlabString(status_message_offset_, status_message_size_);
+  }
+  uint32_t dropped_attributes_count() const noexcept { return dropped_attributes_count_; }
+  /* The annotations the events were recorded as, null if no event was added */
+  const google::devtools::cloudtrace::v2::Span_TimeEvents *time_events() const noexcept
+  {
+    return time_events_.get();
+  }
+  size_t num_attributes() const noexcept { return num_attributes_; }
+  /* The attribute stored under a key, null if there is none. Keys are unique. */
+  const Attribute *FindAttribute(nostd::string_view key) const noexcept
+  {
+    const size_t index = AttributeIndex(key);
+    return index < num_attributes_ ? &attribute(index) : nullptr;
+  }
+  const Attribute &attribute(size_t index) const noexcept
+  {
+    return index < kInlineAttributes ? inline_attributes_[index]
+                                     : overflow_attributes_[index - kInlineAttributes];
+  }
+  nostd::string_view SlabString(uint32_t offset, uint32_t size) const noexcept
+  {
+    return nostd::string_view(slab_.data() + offset, size);
+  }
+
+private:
+  /* Test Fixture Class meant for testing purposes only */
+  friend class CompactRecordableTestPeer;
+
+  /* Appends a string to the slab and returns its offset */
+  uint32_t AppendToSlab(nostd::string_view str) noexcept;
+
+  /* Returns the attribute stored under a key for its value to be set, appending it if the
+     key is new, or null if the memory budget refuses the value, which then counts as
+     dropped. value_size is the number of bytes the value takes in the slab. */
+  Attribute *MutableAttribute(nostd::string_view key, size_t value_size) noexcept;
+
+  /* MutableAttribute without the dropped count, null if the budget refuses the value */
+  Attribute *StoreAttribute(nostd::string_view key, size_t value_size) noexcept;
+
+  /* Removes an attribute, moving the later ones down */
+  void RemoveAttribute(size_t index) noexcept;
+
+  /* Returns the position of the attribute stored under a key, num_attributes() if none */
+  size_t AttributeIndex(nostd::string_view key) const noexcept;
+
+  /* Adds the attribute at a position to the index of keys, growing it as needed */
+  void IndexAttribute(size_t index) noexcept;
+
+  /* Builds the index of keys anew, or frees it if the attributes fit inline */
+  void RebuildAttributeIndex() noexcept;
+
+  /* Counts the string value of an attribute as overwritten, and leaves it without one */
+  void DiscardStringValue(Attribute *attribute) noexcept;
+
+  /* Copies the strings still in use to a new slab, dropping the overwritten ones */
+  void CompactSlab() noexcept;
+
+  Attribute &mutable_attribute(size_t index) noexcept
+  {
+    return index < kInlineAttributes ? inline_attributes_[index]
+                                     : overflow_attributes_[index - kInlineAttributes];
+  }
+
+  /* Charges stored bytes to the memory budget, returning whether they may be stored */
+  bool Charge(size_t bytes, bool required = false) noexcept
+  {
+    return charge_.Add(options_ ? options_->memory_budget : nullptr, bytes, required);
+  }
+
+  std::array<uint8_t, 16> trace_id_{};
+  std::array<uint8_t, 8> span_id_{};
+  std::array<uint8_t, 8> parent_span_id_{};
+  int64_t start_time_nanos_ = 0;
+  int64_t end_time_nanos_ = 0;
+
+  uint32_t name_offset_ = 0;
+  uint32_t name_size_ = 0;
+  uint32_t name_truncated_byte_count_ = 0;
+  uint32_t num_attributes_ = 0;
+  uint32_t dropped_attributes_count_ = 0;
+
+  bool has_status_ = false;
+  int32_t status_code_ = 0;
+  uint32_t status_message_offset_ = 0;
+  uint32_t status_message_size_ = 0;
+  /* Bytes of the slab no longer referenced, which compaction reclaims */
+  uint32_t slab_garbage_bytes_ = 0;
+
+  std::array<Attribute, kInlineAttributes> inline_attributes_;
+  std::vector<Attribute> overflow_attributes_;
+  std::string slab_;
+  /* Open addressing table of the attributes by key, holding their position plus one and
+     zero for empty slots. Empty while the attributes fit inline. */
+  std::vector<uint32_t> attribute_index_;
+  std::unique_ptr<google::devtools::cloudtrace::v2::Span_TimeEvents> time_events_;
+
+  const RecordableOptions *options_ = nullptr;
+  bool priority_ = false;
+  std::unique_ptr<CapturedStack> stack_;
+  MemoryCharge charge_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
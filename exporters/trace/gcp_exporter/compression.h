@@ -0,0 +1,141 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.pb.h"
+#include "opentelemetry/version.h"
+
+#include <grpc/compression.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * A compression algorithm requests can be sent with. gRPC compresses the request itself;
+ * the codec compresses sample payloads so the exporter can measure what compressing costs
+ * and saves.
+ */
+class CompressionCodec
+{
+public:
+    virtual ~CompressionCodec() = default;
+
+    /* The algorithm gRPC compresses requests with for this codec */
+    virtual grpc_compression_algorithm algorithm() const noexcept = 0;
+
+    /**
+     * Compresses a payload the way gRPC would
+     * 
+     * @param input - The serialized payload
+     * @param output - The compressed payload
+     * @return Whether the payload could be compressed
+     */
+    virtual bool Compress(const std::string &input, std::string *output) const noexcept = 0;
+};
+
+/**
+ * The gzip codec, backed by zlib
+ */
+class GzipCodec final : public CompressionCodec
+{
+public:
+    grpc_compression_algorithm algorithm() const noexcept override { return GRPC_COMPRESS_GZIP; }
+
+    bool Compress(const std::string &input, std::string *output) const noexcept override;
+};
+
+/**
+ * Struct to hold the options deciding which requests get compressed
+ */
+struct CompressionOptions
+{
+    /* Requests smaller than this many encoded bytes are always sent uncompressed */
+    size_t min_request_bytes = 8 * 1024;
+
+    /* Compress only if it is expected to save at least this many bytes per microsecond of
+       CPU spent compressing */
+    double min_bytes_saved_per_cpu_us = 4.0;
+
+    /* One in this many requests above the minimum size is compressed on the side to update
+       the estimates */
+    uint32_t probe_interval = 32;
+
+    /* Weight of the newest probe in the moving averages, in (0, 1] */
+    double smoothing = 0.2;
+};
+
+/**
+ * Chooses, for every request, whether gRPC should compress it. The choice weighs the bytes
+ * compression is expected to save against the CPU time it is expected to cost, both
+ * estimated from exponentially weighted moving averages of periodic probes.
+ * Thread safe.
+ */
+class AdaptiveCompressor
+{
+public:
+    /**
+     * @param codec - The codec to compress requests with
+     * @param options - The options deciding which requests get compressed
+     */
+    AdaptiveCompressor(std::shared_ptr<const CompressionCodec> codec, const CompressionOptions &options);
+
+    /**
+     * Chooses the compression algorithm for a request, probing it if it is its turn
+     * 
+     * @param request - The request about to be sent
+     * @return The codec's algorithm, or GRPC_COMPRESS_NONE to send the request as is
+     */
+    grpc_compression_algorithm Choose(
+        const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept;
+
+    /* Moving average of the compressed size over the encoded size */
+    double compression_ratio() const noexcept;
+
+    /* Moving average of the CPU time spent compressing one encoded byte */
+    double cpu_nanos_per_byte() const noexcept;
+
+private:
+    /**
+     * Compresses a request with the codec and folds the outcome into the moving averages
+     */
+    void Probe(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept;
+
+    const std::shared_ptr<const CompressionCodec> codec_;
+    const CompressionOptions options_;
+
+    /* Number of requests large enough to be compressed, to schedule the probes */
+    std::atomic<uint64_t> num_candidates_;
+
+    /* Guards the moving averages */
+    mutable std::mutex mu_;
+    bool has_estimates_;
+    double compression_ratio_;
+    double cpu_nanos_per_byte_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -17,10 +17,21 @@
 #pragma once
 
 #include "opentelemetry/sdk/trace/exporter.h"
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/compression.h"
+#include "exporters/trace/gcp_exporter/memory_budget.h"
+#include "exporters/trace/gcp_exporter/runtime_config.h"
 #include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/shared_export_service.h"
+#include "exporters/trace/gcp_exporter/span_metrics.h"
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
 #include <memory>
 #include <string>
+#include <vector>
 
 
 OPENTELEMETRY_BEGIN_NAMESPACE
@@ -29,6 +40,164 @@ namespace exporter
 namespace gcp 
 {
 
+class BatchQueue;
+class ChannelWarmer;
+class RequestHedger;
+class SpanCaptureWriter;
+class StackTraceCache;
+class WorkerPool;
+
+/**
+ * Struct to hold all the tuning options of the GcpExporter
+ */
+struct GcpExporterOptions
+{
+    /* Number of extra threads used to build and send the sub-batches of a large batch in
+       parallel. Zero disables parallel export. Export fails if any sub-batch fails, and a
+       processor that retries the batch then sends the other sub-batches again; see
+       num_failed_sub_requests(). */
+    size_t num_export_threads = 0;
+
+    /* Minimum number of spans a batch must hold to be split into sub-batches */
+    size_t parallel_export_threshold = 1000;
+
+    /* Whether to allocate recordables from per-thread staging chunks, so that recordables
+       freed on the export thread are recycled to the thread that created them instead of
+       going through the global allocator. Recordables carry a 16 byte header naming their
+       owning chunk either way, since a recordable is freed by the same operator delete
+       whichever allocator made it, so turning this off saves no memory per span. */
+    bool thread_local_staging = false;
+
+    /* Whether to make CompactRecordables, which hold the raw span fields while the span is
+       buffered and only build the protobuf span inside Export */
+    bool compact_recordables = false;
+
+    /* The codec to compress requests with, null to send every request uncompressed.
+       Ignored with a shared service. */
+    std::shared_ptr<const CompressionCodec> compression_codec;
+
+    /* Which requests get compressed, when a codec is set */
+    CompressionOptions compression;
+
+    /* Aggregates metrics from every span handed to the exporter, before sampling, null to
+       skip them. Keep a reference to collect the metrics. */
+    std::shared_ptr<SpanMetricsAggregator> span_metrics;
+
+    /* Fraction of the traces to export. Every span of a trace is kept or dropped together,
+       based on its trace id, and spans with an error status are always exported. */
+    double export_ratio = 1.0;
+
+    /* Name of a string attribute holding the project each span is exported to. Spans are
+       sent in one request per project; spans without the attribute, or whose value is not
+       a valid project id, go to the exporter's project. Empty to send every span to the
+       exporter's project. As with parallel export, a failed project request fails the
+       whole batch, including the projects whose requests succeeded. */
+    std::string project_id_attribute;
+
+    /* Number of gRPC channels requests are spread over, round robin. Ignored with a shared
+       service, which has channels of its own. */
+    size_t num_channels = 1;
+
+    /* Path of a file every request sent is also written to, to replay the traffic offline
+       (see internal/span_capture.h). Empty to capture nothing. Capturing costs every send a
+       second serialization of its request, and a write to the file under a lock shared by
+       the sending threads, so it is meant for short captures rather than for production. */
+    std::string capture_path;
+
+    /* Size the capture file stops growing at, later requests being sent but not captured.
+       Zero for no limit. */
+    uint64_t capture_max_bytes = 1ULL << 30;
+
+    /* Whether the constructor connects every channel and fetches the credentials' token,
+       with an empty warm-up call, instead of leaving both to the first export. Blocks the
+       constructor for up to warm_up_timeout. Ignored with a shared service. */
+    bool eager_connect = false;
+
+    /* Interval between the warm-ups of a background thread, which refresh the token ahead
+       of its expiry and reconnect channels dropped while idle. Zero disables them, as does
+       a shared service. */
+    std::chrono::milliseconds warm_up_interval{0};
+
+    /* Deadline of each warm-up */
+    std::chrono::milliseconds warm_up_timeout{5000};
+
+    /* Interval between HTTP/2 keepalive pings, sent even without calls in flight so that
+       idle connections stay open. Zero leaves keepalive off. Servers may close connections
+       that ping too often. Ignored with a shared service. */
+    std::chrono::milliseconds keepalive_interval{0};
+
+    /* The service to send requests through, shared with other exporters, instead of
+       channels of the exporter's own (see shared_export_service.h). Null for own channels.
+       The service's options then govern sending, and these options, which tune the
+       exporter's own channels, are ignored: num_channels, keepalive_interval,
+       compression_codec and compression, hedge_percentile, priority_lane, eager_connect and
+       warm_up_interval. Export blocks until the service sent the batch's spans, waiting
+       for up to the service's max_delay for spans of other exporters to share requests. */
+    std::shared_ptr<SharedExportService> shared_service;
+
+    /* Whether spans with an error status, or with one of priority_attribute_keys, are sent
+       through a lane of their own: small requests sent from a single thread of the lane's,
+       so that they do not wait for the request of the rest of their batch. The lane only
+       splits the batches Export is given, so priority spans still wait behind earlier
+       batches in the span processor's queue. Export neither waits for the priority requests
+       nor reports their failures, see num_failed_priority_requests(). The lane needs
+       channels of the exporter's own, so it is off with a shared service. */
+    bool priority_lane = false;
+
+    /* Keys of the attributes that make a span a priority span */
+    std::vector<std::string> priority_attribute_keys;
+
+    /* Number of priority spans at which a request is sent without waiting for more */
+    size_t priority_max_batch_size = 64;
+
+    /* Longest time a priority span waits for other priority spans to share its request */
+    std::chrono::milliseconds priority_max_delay{1};
+
+    /* When spans capture the stack of the thread recording them. Stacks are symbolized on
+       the export thread, and sent in full only the first time (see stack_trace_cache_size). */
+    StackCapture stack_capture = StackCapture::kNone;
+
+    /* Maximum number of frames of a captured stack, at most 128 */
+    int max_stack_frames = 32;
+
+    /* Number of stacks remembered as received by a project, once a request sending them
+       succeeded, which later spans to the project reference by hash id alone. Zero sends
+       every stack in full. */
+    size_t stack_trace_cache_size = 4096;
+
+    /* Bounds the bytes held by the spans the exporter buffers, together with every other
+       exporter sharing the budget (see memory_budget.h). Null for no bound. */
+    std::shared_ptr<MemoryBudget> memory_budget;
+
+    /* Percentile of the recent request latencies after which a request still in flight is
+       sent again on the next channel, the first successful response winning and the other
+       call being cancelled. Zero disables hedging, which needs at least two channels of the
+       exporter's own, so it is off with a shared service. */
+    double hedge_percentile = 0.0;
+
+    /* Shortest time a request waits before it is hedged */
+    std::chrono::milliseconds hedge_min_delay{10};
+
+    /* Fraction of the requests that may be hedged, which bounds the extra load on the
+       service. Hedges not taken are saved up to hedge_max_burst. */
+    double hedge_budget_ratio = 0.05;
+
+    /* Largest number of hedges sent in a row */
+    size_t hedge_max_burst = 10;
+
+    /* Tuning that can change while the exporter runs (see runtime_config.h), read on every
+       export and by every recordable the exporter makes. It replaces export_ratio and
+       parallel_export_threshold, and also drives what has no option here: the number of
+       sub-batches, whether requests are compressed, and the truncation limits of strings.
+       Null to keep the options given here, with no cap on sub-batches, compression on, and
+       Cloud Trace's truncation limits. */
+    std::shared_ptr<ConfigStore> runtime_config;
+
+    /* Longest time shutting down waits for the priority lane to send its requests, when
+       Shutdown is given no timeout */
+    std::chrono::milliseconds shutdown_timeout{5000};
+};
+
 /**
  * This class handles all the functionality of exporting traces to Google Cloud
  */
@@ -40,6 +209,15 @@ public:
      */
     GcpExporter();
 
+    /**
+     * Class Constructor which uses the given tuning options
+     * 
+     * @param options - The tuning options of the exporter
+     */
+    explicit GcpExporter(const GcpExporterOptions &options);
+
+    ~GcpExporter();
+
     /**
      * Creates a Recordable(Span) object
      */
@@ -53,15 +231,37 @@ public:
      */
     sdk::trace::ExportResult Export(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
 
-    /**/
-    void Shutdown(std::chrono::microseconds timeout = std::chrono::microseconds(0)) noexcept {}
+    /**
+     * Sends the requests waiting in the priority lane and stops it, stops the export threads
+     * and the background warm-ups, and flushes the capture file, if any. Priority spans of
+     * later exports are sent with the rest of their batch, on the calling thread.
+     * 
+     * @param timeout - The longest time to wait for the priority lane, zero for the
+     *                  shutdown_timeout option
+     */
+    void Shutdown(std::chrono::microseconds timeout = std::chrono::microseconds(0)) noexcept;
+
+    /**
+     * @return The number of requests of the priority lane that failed
+     */
+    size_t num_failed_priority_requests() const noexcept { return num_failed_priority_requests_; }
+
+    /**
+     * @return The number of requests that failed out of batches exported in parallel or
+     * routed by project. Every such failure fails its whole batch, whatever the other
+     * requests of the batch did.
+     */
+    size_t num_failed_sub_requests() const noexcept { return num_failed_sub_requests_; }
 
 private:
     /* Test Fixture Class meant for testing purposes only */
     friend class GcpExporterTestPeer;
+    friend class SoakTest;
 
-    /* Fixture Class for benchmark purposes only */
+    /* Fixture Classes for benchmark purposes only */
     friend class GcpExporterBenchmark;
+    friend class ReplayBenchmark;
+    friend class StartupBenchmark;
 
     /**
      * Internal constructor to initialize the RPC communication stub and the Google project ID
@@ -69,15 +269,173 @@ private:
      * 
      * @param stub - The stub to inject into the member variable 'trace_service_stub_'
      * @param project_id - The Id of the Google Cloud project to export the traces to 
+     * @param options - The tuning options of the exporter
      */
     explicit GcpExporter(std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface> stub,
-                         const char* project_id);
+                         const char* project_id,
+                         const GcpExporterOptions &options = GcpExporterOptions());
 
-    /* The stub to communicate via gRPC to the Google Cloud */
-    const std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface> trace_service_stub_;
+    /**
+     * Internal constructor sending requests over a pool of stubs, round robin
+     * 
+     * @param stubs - The stubs to inject into the member variable 'trace_service_stubs_'
+     * @param project_id - The Id of the Google Cloud project to export the traces to 
+     * @param options - The tuning options of the exporter
+     * @param channels - The channels of the stubs, to connect when warming up, empty if unknown
+     */
+    GcpExporter(std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>> stubs,
+                const char* project_id,
+                const GcpExporterOptions &options,
+                const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels = {});
+
+    /**
+     * Internal constructor sending requests over one stub per channel
+     * 
+     * @param channels - The channels to make the stubs of
+     * @param project_id - The Id of the Google Cloud project to export the traces to 
+     * @param options - The tuning options of the exporter
+     */
+    GcpExporter(const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels,
+                const char* project_id,
+                const GcpExporterOptions &options);
+
+    /**
+     * Moves a range of spans into a request addressed to a project
+     * 
+     * @param spans - The spans to move into the request
+     * @param project_id - The Id of the Google Cloud project to export the spans to
+     * @param request - The request to populate
+     */
+    void BuildRequest(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans,
+                      const std::string &project_id,
+                      google::devtools::cloudtrace::v2::BatchWriteSpansRequest* request) const noexcept;
+
+    /**
+     * Gives the bytes of exported spans back to the memory budget, if there is one
+     */
+    void ReleaseMemory(size_t bytes) const noexcept;
+
+    /**
+     * Returns the tuning in effect, from the runtime config if there is one
+     */
+    const RuntimeConfig &Config() const noexcept;
+
+    /**
+     * Returns the project a span is routed to by the project id attribute
+     */
+    std::string RoutedProjectId(const sdk::trace::Recordable &recordable) const noexcept;
+
+    /**
+     * Sends a request to the cloud, or through the shared service
+     * 
+     * @param request - The request to send, whose spans the shared service takes
+     * @return Whether the RPC completed successfully
+     */
+    bool SendRequest(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request) const noexcept;
+
+    /**
+     * Exports a batch, sending its priority spans through the priority lane if there is one
+     * 
+     * @param spans - List of spans to export to google cloud
+     * @return Success if every request was exported successfully
+     */
+    sdk::trace::ExportResult ExportSpans(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
+
+    /**
+     * Moves the priority spans of a batch to the priority lane, one request per project,
+     * and the other spans to the front of the batch. The priority requests are not waited for.
+     * 
+     * @param spans - List of spans to export to google cloud
+     * @return The number of spans left at the front of the batch
+     */
+    size_t SubmitPrioritySpans(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
+
+    /**
+     * Exports a batch without a lane, in one request or several
+     * 
+     * @param spans - List of spans to export to google cloud
+     * @return Success if every request was exported successfully
+     */
+    sdk::trace::ExportResult ExportBulk(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
+
+    /**
+     * Whether a recordable made by this exporter is a priority span
+     */
+    bool IsPriority(const sdk::trace::Recordable &recordable) const noexcept;
+
+    /**
+     * Sends a request on the stubs of the exporter
+     * 
+     * @param request - The request to send
+     * @return Whether the RPC completed successfully
+     */
+    bool SendOnStub(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) const noexcept;
+
+    /**
+     * Splits a large batch into one sub-batch per worker, and builds and sends them in parallel
+     * 
+     * @param spans - List of spans to export to google cloud
+     * @return Success if every sub-batch was exported successfully
+     */
+    sdk::trace::ExportResult ExportParallel(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
+
+    /**
+     * Groups a batch by project, and sends one request per project, in parallel if there
+     * are workers
+     * 
+     * @param spans - List of spans to export to google cloud
+     * @return Success if the request of every project was exported successfully
+     */
+    sdk::trace::ExportResult ExportRouted(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept;
+
+    /* The stubs to communicate via gRPC to the Google Cloud, each on its own channel */
+    const std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>> trace_service_stubs_;
+
+    /* Index of the stub the next request is sent on */
+    mutable std::atomic<size_t> next_stub_;
 
     /* The Id of the Google Cloud project to export the traces to */
     const std::string project_id_;
+
+    /* The tuning options of the exporter */
+    const GcpExporterOptions options_;
+
+    /* The tuning the options set, used without a runtime config */
+    const RuntimeConfig static_config_;
+
+    /* The workers that export sub-batches in parallel, null if disabled */
+    std::unique_ptr<WorkerPool> worker_pool_;
+
+    /* Chooses whether to compress every request, null if compression is disabled */
+    std::unique_ptr<AdaptiveCompressor> compressor_;
+
+    /* Writes every request sent to the capture file, null if capture is disabled */
+    std::unique_ptr<SpanCaptureWriter> capture_;
+
+    /* Warms the channels up, null if neither eager connect nor background warm-ups are on */
+    std::unique_ptr<ChannelWarmer> warmer_;
+
+    /* Remembers the stacks sent in full, null if stacks are not captured */
+    std::unique_ptr<StackTraceCache> stack_traces_;
+
+    /* Shared by every recordable the exporter makes */
+    const RecordableOptions recordable_options_;
+
+    /* Hedges slow requests, null if hedging is disabled */
+    std::unique_ptr<RequestHedger> hedger_;
+
+    /* Number of requests of the priority lane that failed, which Export does not report */
+    std::atomic<size_t> num_failed_priority_requests_{0};
+
+    /* Number of failed requests of parallel and routed exports */
+    std::atomic<size_t> num_failed_sub_requests_{0};
+
+    /* Whether Shutdown stopped the priority lane */
+    std::atomic<bool> priority_lane_stopped_{false};
+
+    /* Sends the priority spans, null if there is no priority lane. Last, so that it is
+       destroyed, sending what is pending, while the exporter can still send. */
+    std::unique_ptr<BatchQueue> priority_lane_;
 };
 
 } // gcp
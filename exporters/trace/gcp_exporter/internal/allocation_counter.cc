@@ -0,0 +1,158 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/allocation_counter.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+
+namespace
+{
+
+/* Every block is prefixed with its size, keeping the payload aligned for any type */
+constexpr size_t kHeaderSize = alignof(std::max_align_t);
+
+std::atomic<int64_t> allocations(0);
+std::atomic<int64_t> deallocations(0);
+std::atomic<int64_t> allocated_bytes(0);
+std::atomic<int64_t> live_bytes(0);
+
+/* Over-aligned blocks take a header as large as their alignment, so the payload keeps it */
+size_t HeaderSize(size_t alignment) noexcept
+{
+    return alignment > kHeaderSize ? alignment : kHeaderSize;
+}
+
+void* CountedAllocate(size_t size, size_t alignment = kHeaderSize) noexcept
+{
+    const size_t header_size = HeaderSize(alignment);
+    void* block = nullptr;
+    if(alignment <= kHeaderSize){
+        block = malloc(header_size + size);
+    } else if(posix_memalign(&block, alignment, header_size + size) != 0){
+        block = nullptr;
+    }
+    if(block == nullptr){
+        return nullptr;
+    }
+    *static_cast<size_t*>(block) = size;
+
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+    live_bytes.fetch_add(size, std::memory_order_relaxed);
+    return static_cast<char*>(block) + header_size;
+}
+
+void CountedFree(void* ptr, size_t alignment = kHeaderSize) noexcept
+{
+    if(ptr == nullptr){
+        return;
+    }
+    void* block = static_cast<char*>(ptr) - HeaderSize(alignment);
+
+    deallocations.fetch_add(1, std::memory_order_relaxed);
+    live_bytes.fetch_sub(*static_cast<size_t*>(block), std::memory_order_relaxed);
+    free(block);
+}
+
+void* CountedAllocateOrThrow(size_t size, size_t alignment = kHeaderSize)
+{
+    void* ptr = CountedAllocate(size, alignment);
+    if(ptr == nullptr){
+        throw std::bad_alloc();
+    }
+    return ptr;
+}
+
+} // namespace
+
+
+void* operator new(size_t size) { return CountedAllocateOrThrow(size); }
+void* operator new[](size_t size) { return CountedAllocateOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return CountedAllocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return CountedAllocate(size); }
+void operator delete(void* ptr) noexcept { CountedFree(ptr); }
+void operator delete[](void* ptr) noexcept { CountedFree(ptr); }
+void operator delete(void* ptr, size_t) noexcept { CountedFree(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { CountedFree(ptr); }
+void operator delete(void* ptr, const std::nothrow_t&) noexcept { CountedFree(ptr); }
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept { CountedFree(ptr); }
+
+// Types aligned past the default, which the default overloads above never see
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return CountedAllocateOrThrow(size, static_cast<size_t>(alignment));
+}
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr, std::align_val_t alignment) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, std::align_val_t alignment) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr, size_t, std::align_val_t alignment) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, size_t, std::align_val_t alignment) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete(void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+void operator delete[](void* ptr, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    CountedFree(ptr, static_cast<size_t>(alignment));
+}
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+AllocationStats GetAllocationStats() noexcept
+{
+    AllocationStats stats;
+    stats.allocations = allocations.load(std::memory_order_relaxed);
+    stats.deallocations = deallocations.load(std::memory_order_relaxed);
+    stats.allocated_bytes = allocated_bytes.load(std::memory_order_relaxed);
+    stats.live_bytes = live_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,67 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "opentelemetry/version.h"
+
+#include <cstdint>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Process-wide heap usage, as seen by the counting global allocator. Linking the
+ * 'allocation_counter' library into a binary replaces the global operator new and delete,
+ * the aligned overloads included.
+ */
+struct AllocationStats
+{
+    /* Number of calls to operator new */
+    int64_t allocations = 0;
+
+    /* Number of calls to operator delete */
+    int64_t deallocations = 0;
+
+    /* Total bytes requested from operator new */
+    int64_t allocated_bytes = 0;
+
+    /* Bytes currently allocated and not yet freed */
+    int64_t live_bytes = 0;
+
+    AllocationStats operator-(const AllocationStats &other) const noexcept
+    {
+        AllocationStats diff;
+        diff.allocations = allocations - other.allocations;
+        diff.deallocations = deallocations - other.deallocations;
+        diff.allocated_bytes = allocated_bytes - other.allocated_bytes;
+        diff.live_bytes = live_bytes - other.live_bytes;
+        return diff;
+    }
+};
+
+/**
+ * Returns a snapshot of the heap usage of the process so far
+ */
+AllocationStats GetAllocationStats() noexcept;
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,242 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+#include "exporters/trace/gcp_exporter/internal/probes.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <limits>
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+// Taken from the Unilib namespace 
+// Link: http://35.193.25.4/TensorFlow/models/research/syntaxnet/util/utf8/unilib_utf8_utils.h
+bool IsTrailByte(char x)
+{
+    return static_cast<signed char>(x) < -0x40;
+}
+
+size_t TruncatedSize(const int limit, nostd::string_view string_name)
+{
+    if (limit < 0 || string_name.size() <= limit) 
+    {
+        return string_name.size();
+    }
+
+    GCP_EXPORTER_PROBE2(string_truncated, string_name.size(), limit);
+
+    // If limit points to beginning of utf8 character, truncate at the limit,
+    // backtrack to the beginning of utf8 character otherwise.
+    int truncation_pos = limit;
+
+    while (truncation_pos > 0 && IsTrailByte(string_name[truncation_pos])) 
+    {
+        --truncation_pos;
+    }
+    return truncation_pos;
+}
+
+void SetTruncatableString(const int limit,
+                          nostd::string_view string_name,
+                          google::devtools::cloudtrace::v2::TruncatableString* str) 
+{ 
+    const size_t truncated_size = TruncatedSize(limit, string_name);
+    str->set_value(string_name.data(), truncated_size);
+    str->set_truncated_byte_count(string_name.size() - truncated_size);
+}
+
+void EncodeLowerBase16(const uint8_t* bytes, size_t size, char* out) noexcept
+{
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    for (size_t i = 0; i < size; ++i)
+    {
+        out[2 * i] = kHexDigits[bytes[i] >> 4];
+        out[2 * i + 1] = kHexDigits[bytes[i] & 0xF];
+    }
+}
+
+void SetTimestamp(int64_t unix_nanos, google::protobuf::Timestamp* timestamp) noexcept
+{
+    constexpr int64_t kNanosPerSecond = 1000000000;
+    int64_t seconds = unix_nanos / kNanosPerSecond;
+    int64_t nanos = unix_nanos % kNanosPerSecond;
+    // Timestamps before the epoch still need non-negative nanos
+    if (nanos < 0)
+    {
+        --seconds;
+        nanos += kNanosPerSecond;
+    }
+    timestamp->set_seconds(seconds);
+    timestamp->set_nanos(static_cast<int32_t>(nanos));
+}
+
+std::string FormatDouble(double value)
+{
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%.15g", value);
+    if (strtod(buf, nullptr) != value)
+    {
+        snprintf(buf, sizeof(buf), "%.17g", value);
+    }
+    return buf;
+}
+
+void AppendArrayElement(bool value, std::string* out)
+{
+    out->append(value ? "true" : "false");
+}
+
+void AppendArrayElement(int64_t value, std::string* out)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%" PRId64, value);
+    out->append(buf);
+}
+
+void AppendArrayElement(uint64_t value, std::string* out)
+{
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%" PRIu64, value);
+    out->append(buf);
+}
+
+void AppendArrayElement(int value, std::string* out)
+{
+    AppendArrayElement(static_cast<int64_t>(value), out);
+}
+
+void AppendArrayElement(unsigned int value, std::string* out)
+{
+    AppendArrayElement(static_cast<uint64_t>(value), out);
+}
+
+void AppendArrayElement(double value, std::string* out)
+{
+    out->append(FormatDouble(value));
+}
+
+void AppendArrayElement(nostd::string_view value, std::string* out)
+{
+    static const char kHexDigits[] = "0123456789abcdef";
+    out->push_back('"');
+    for (const char c : value)
+    {
+        switch (c)
+        {
+            case '"':  out->append("\\\""); break;
+            case '\\': out->append("\\\\"); break;
+            case '\b': out->append("\\b"); break;
+            case '\f': out->append("\\f"); break;
+            case '\n': out->append("\\n"); break;
+            case '\r': out->append("\\r"); break;
+            case '\t': out->append("\\t"); break;
+            default:
+                // JSON allows no other control character unescaped
+                if (static_cast<unsigned char>(c) < 0x20)
+                {
+                    out->append("\\u00");
+                    out->push_back(kHexDigits[static_cast<unsigned char>(c) >> 4]);
+                    out->push_back(kHexDigits[static_cast<unsigned char>(c) & 0xf]);
+                }
+                else
+                {
+                    out->push_back(c);
+                }
+        }
+    }
+    out->push_back('"');
+}
+
+google::devtools::cloudtrace::v2::AttributeValue &AttributeMapWriter::MutableAttribute(nostd::string_view key) noexcept
+{
+    return (*attributes->mutable_attribute_map())[std::string(key.data(), key.size())];
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, bool value) noexcept
+{
+    MutableAttribute(key).set_bool_value(value);
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, int value) noexcept
+{
+    MutableAttribute(key).set_int_value(value);
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, int64_t value) noexcept
+{
+    MutableAttribute(key).set_int_value(value);
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept
+{
+    MutableAttribute(key).set_int_value(value);
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept
+{
+    // Cloud Trace integers are signed, so larger values are kept exact as strings
+    if (value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max()))
+    {
+        SetTypedAttribute(key, nostd::string_view(std::to_string(value)));
+        return;
+    }
+    MutableAttribute(key).set_int_value(static_cast<int64_t>(value));
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, double value) noexcept
+{
+    SetTypedAttribute(key, nostd::string_view(FormatDouble(value)));
+}
+
+void AttributeMapWriter::SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept
+{
+    SetTruncatableString(string_len, value, MutableAttribute(key).mutable_string_value());
+}
+
+void AttributeMapWriter::SetTruncatedAttribute(nostd::string_view key,
+                                               nostd::string_view value,
+                                               size_t truncated_byte_count) noexcept
+{
+    auto* str = MutableAttribute(key).mutable_string_value();
+    str->set_value(value.data(), value.size());
+    str->set_truncated_byte_count(truncated_byte_count);
+}
+
+void MakeAnnotation(nostd::string_view name,
+                    int64_t unix_nanos,
+                    const common::KeyValueIterable &attributes,
+                    size_t string_len,
+                    google::devtools::cloudtrace::v2::Span_TimeEvent *event)
+{
+    SetTimestamp(unix_nanos, event->mutable_time());
+    auto* annotation = event->mutable_annotation();
+    SetTruncatableString(string_len, name, annotation->mutable_description());
+    AttributeMapWriter writer{annotation->mutable_attributes(), string_len};
+    attributes.ForEachKeyValue([&writer](nostd::string_view key, common::AttributeValue value) noexcept {
+        nostd::visit(AttributeValueSetter<AttributeMapWriter>{&writer, key, writer.string_len}, value);
+        return true;
+    });
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
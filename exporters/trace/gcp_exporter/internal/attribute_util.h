@@ -0,0 +1,212 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/trace.pb.h"
+#include "opentelemetry/common/key_value_iterable.h"
+#include "opentelemetry/nostd/span.h"
+#include "opentelemetry/nostd/string_view.h"
+#include "opentelemetry/version.h"
+
+#include <cstdint>
+#include <string>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Cloud Trace limits, in bytes, on the length of attribute values and display names */
+constexpr size_t kAttributeStringLen = 256;
+constexpr size_t kDisplayNameStringLen = 128;
+
+/* Approximate bytes a stored attribute costs besides its key and value, as charged to a
+   memory budget */
+constexpr size_t kAttributeOverheadBytes = 48;
+
+/* Approximate bytes a stored scalar attribute value costs, as charged to a memory budget */
+constexpr size_t kScalarValueBytes = sizeof(int64_t);
+
+/**
+ * Whether a byte continues a multi-byte utf8 character
+ */
+bool IsTrailByte(char x);
+
+/**
+ * Returns the length a string is cut down to so that it fits the limit without splitting a
+ * utf8 character
+ * 
+ * @param limit - The maximum length in bytes, negative for no limit
+ * @param string_name - The string to truncate
+ */
+size_t TruncatedSize(const int limit, nostd::string_view string_name);
+
+/**
+ * Sets a protobuf truncatable string, truncating the value to the limit if needed
+ */
+void SetTruncatableString(const int limit,
+                          nostd::string_view string_name,
+                          google::devtools::cloudtrace::v2::TruncatableString* str);
+
+/**
+ * Writes the lowercase hex encoding of a byte array
+ * 
+ * @param bytes - The bytes to encode
+ * @param size - Number of bytes to encode
+ * @param out - Buffer of at least 2 * size chars receiving the encoding
+ */
+void EncodeLowerBase16(const uint8_t* bytes, size_t size, char* out) noexcept;
+
+/**
+ * Sets a protobuf timestamp from nanoseconds since the Unix epoch
+ */
+void SetTimestamp(int64_t unix_nanos, google::protobuf::Timestamp* timestamp) noexcept;
+
+/**
+ * Formats a double with as few digits as possible while still round-tripping it
+ */
+std::string FormatDouble(double value);
+
+/* Append one element of an array attribute to its JSON encoding */
+void AppendArrayElement(bool value, std::string* out);
+void AppendArrayElement(int value, std::string* out);
+void AppendArrayElement(int64_t value, std::string* out);
+void AppendArrayElement(unsigned int value, std::string* out);
+void AppendArrayElement(uint64_t value, std::string* out);
+void AppendArrayElement(double value, std::string* out);
+void AppendArrayElement(nostd::string_view value, std::string* out);
+
+/**
+ * Encodes an array as a JSON array, since Cloud Trace has no array attribute type. An
+ * encoding longer than the limit keeps only the leading elements that fit, so that it stays
+ * valid JSON, rather than being cut mid-element.
+ * 
+ * @param values - The elements of the array
+ * @param limit - The maximum length in bytes, below which only the brackets are kept
+ * @param dropped_bytes - Receives the number of bytes of the elements left out
+ */
+template <typename T>
+std::string FormatArray(nostd::span<const T> values, size_t limit, size_t* dropped_bytes)
+{
+    std::string out("[");
+    size_t kept_size = out.size();
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        if (i > 0)
+        {
+            out.push_back(',');
+        }
+        AppendArrayElement(values[i], &out);
+        // Room is left for the closing bracket
+        if (out.size() < limit)
+        {
+            kept_size = out.size();
+        }
+    }
+    out.push_back(']');
+    *dropped_bytes = 0;
+    if (out.size() > limit)
+    {
+        *dropped_bytes = out.size() - kept_size - 1;
+        out.resize(kept_size);
+        out.push_back(']');
+    }
+    return out;
+}
+
+/**
+ * Visitor converting each alternative of an AttributeValue, scalars going through the same
+ * typed setters as the compile-time typed attribute API of the recordable
+ */
+template <typename RecordableT>
+struct AttributeValueSetter
+{
+    template <typename T>
+    void operator()(T value) noexcept
+    {
+        recordable->SetTypedAttribute(key, value);
+    }
+
+    void operator()(const char* value) noexcept
+    {
+        recordable->SetTypedAttribute(key, nostd::string_view(value));
+    }
+
+    template <typename T>
+    void operator()(nostd::span<const T> values) noexcept
+    {
+        size_t dropped_bytes;
+        const std::string json = FormatArray(values, string_len, &dropped_bytes);
+        recordable->SetTruncatedAttribute(key, json, dropped_bytes);
+    }
+
+    RecordableT* recordable;
+    nostd::string_view key;
+
+    /* Length in bytes string values are truncated to */
+    size_t string_len;
+};
+
+/**
+ * Writes attributes into a protobuf attribute map, such as that of an annotation, with the
+ * same conversions as the typed setters of the recordable
+ */
+struct AttributeMapWriter
+{
+    void SetTypedAttribute(nostd::string_view key, bool value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, int value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, int64_t value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, double value) noexcept;
+    void SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept;
+
+    /* Sets a string value already cut to fit, recording the number of bytes cut from it */
+    void SetTruncatedAttribute(nostd::string_view key,
+                               nostd::string_view value,
+                               size_t truncated_byte_count) noexcept;
+
+    /* Returns the attribute stored under the key, inserting it if missing */
+    google::devtools::cloudtrace::v2::AttributeValue &MutableAttribute(nostd::string_view key) noexcept;
+
+    google::devtools::cloudtrace::v2::Span_Attributes* attributes;
+
+    /* Length in bytes string values are truncated to */
+    size_t string_len;
+};
+
+/**
+ * Builds the annotation Cloud Trace records an event as
+ * 
+ * @param name - The name of the event, which becomes the description of the annotation
+ * @param unix_nanos - The time of the event, in nanoseconds since the Unix epoch
+ * @param attributes - The attributes of the event
+ * @param string_len - The length in bytes the description and string attribute values are
+ * truncated to
+ * @param event - The time event to populate
+ */
+void MakeAnnotation(nostd::string_view name,
+                    int64_t unix_nanos,
+                    const common::KeyValueIterable &attributes,
+                    size_t string_len,
+                    google::devtools::cloudtrace::v2::Span_TimeEvent *event);
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/batch_queue.h"
+
+#include <algorithm>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+BatchQueue::BatchQueue(size_t max_batch_size,
+                       std::chrono::milliseconds max_delay,
+                       size_t max_in_flight,
+                       std::function<bool(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&)> send):
+    max_batch_size_(max_batch_size), max_delay_(max_delay), send_(std::move(send))
+{
+    for(size_t i = 0; i < std::max<size_t>(max_in_flight, 1); ++i){
+        send_threads_.emplace_back(&BatchQueue::SendLoop, this);
+    }
+}
+
+BatchQueue::~BatchQueue()
+{
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for(auto& thread: send_threads_){
+        thread.join();
+    }
+}
+
+bool BatchQueue::Shutdown(std::chrono::microseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mu_);
+    stopping_ = true;
+    cv_.notify_all();
+    return sent_cv_.wait_for(lock, timeout, [this]{ return pending_.empty() && num_sending_ == 0; });
+}
+
+std::shared_future<bool> BatchQueue::Submit(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request)
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    if(stopping_){
+        std::promise<bool> failed;
+        failed.set_value(false);
+        return failed.get_future().share();
+    }
+    auto &pending = pending_[request->name()];
+    // The threads sleep until the earliest deadline, so they are woken for a new one too
+    bool wake_up = !pending;
+    if(!pending){
+        pending.reset(new PendingRequest());
+        pending->request.set_name(request->name());
+        pending->deadline = std::chrono::steady_clock::now() + max_delay_;
+        pending->future = pending->sent.get_future().share();
+    }
+
+    // Swapping moves the spans without copying them
+    auto* from = request->mutable_spans();
+    auto* to = pending->request.mutable_spans();
+    if(to->empty()){
+        to->Swap(from);
+    } else {
+        to->Reserve(to->size() + from->size());
+        for(auto& span: *from){
+            to->Add()->Swap(&span);
+        }
+        from->Clear();
+    }
+
+    std::shared_future<bool> future = pending->future;
+    wake_up = wake_up || static_cast<size_t>(to->size()) >= max_batch_size_;
+    if(wake_up){
+        cv_.notify_all();
+    }
+    return future;
+}
+
+void BatchQueue::SendLoop()
+{
+    std::unique_lock<std::mutex> lock(mu_);
+    while(true){
+        // Take one request that is full, past its deadline, or left when stopping, leaving
+        // the others to the other threads so that up to max_in_flight requests are sent at once
+        const auto now = std::chrono::steady_clock::now();
+        auto next_deadline = std::chrono::steady_clock::time_point::max();
+        std::unique_ptr<PendingRequest> due;
+        for(auto it = pending_.begin(); it != pending_.end(); ++it){
+            if(stopping_ || it->second->deadline <= now ||
+               static_cast<size_t>(it->second->request.spans_size()) >= max_batch_size_){
+                due = std::move(it->second);
+                pending_.erase(it);
+                break;
+            }
+            next_deadline = std::min(next_deadline, it->second->deadline);
+        }
+
+        if(due){
+            if(!pending_.empty()){
+                // Another thread checks whether the rest is due as well
+                cv_.notify_one();
+            }
+            ++num_sending_;
+            lock.unlock();
+            due->sent.set_value(send_(due->request));
+            lock.lock();
+            if(--num_sending_ == 0 && pending_.empty()){
+                sent_cv_.notify_all();
+            }
+            continue;
+        }
+        if(stopping_){
+            return;
+        }
+        if(next_deadline == std::chrono::steady_clock::time_point::max()){
+            cv_.wait(lock);
+        } else {
+            cv_.wait_until(lock, next_deadline);
+        }
+    }
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.pb.h"
+#include "opentelemetry/version.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Coalesces the requests submitted from any thread into one request per project, and sends
+ * them from threads of its own once they are large enough, or old enough
+ */
+class BatchQueue
+{
+public:
+    /**
+     * @param max_batch_size - Number of spans at which a coalesced request is sent right away
+     * @param max_delay - Longest time a span waits for other spans to be coalesced with
+     * @param max_in_flight - Number of requests sent at once, each from a thread of the queue's
+     * @param send - Sends a request and returns whether it succeeded, called from the queue's threads
+     */
+    BatchQueue(size_t max_batch_size,
+               std::chrono::milliseconds max_delay,
+               size_t max_in_flight,
+               std::function<bool(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&)> send);
+
+    /* Sends everything still pending, then stops the queue's threads */
+    ~BatchQueue();
+
+    /**
+     * Sends everything still pending right away, and waits for it to be sent. Requests
+     * submitted afterwards fail without being sent.
+     * 
+     * @param timeout - Longest time to wait
+     * @return Whether everything was sent in time, the requests still being sent then
+     * completing in the background
+     */
+    bool Shutdown(std::chrono::microseconds timeout);
+
+    /**
+     * Moves the spans of a request into the pending request of its project
+     * 
+     * @param request - The request, addressed to its project by its name. Its spans are taken.
+     * @return Becomes whether the request the spans were sent in succeeded, once it is sent,
+     * or false right away once the queue is shut down
+     */
+    std::shared_future<bool> Submit(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request);
+
+private:
+    /* The spans waiting to be sent to one project */
+    struct PendingRequest
+    {
+        google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+        std::chrono::steady_clock::time_point deadline;
+        std::promise<bool> sent;
+        std::shared_future<bool> future;
+    };
+
+    void SendLoop();
+
+    const size_t max_batch_size_;
+    const std::chrono::milliseconds max_delay_;
+    const std::function<bool(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&)> send_;
+
+    /* Guards the pending requests and stopping_, and wakes the threads up when a request is
+       full or the queue is stopping */
+    std::mutex mu_;
+    std::condition_variable cv_;
+    std::map<std::string, std::unique_ptr<PendingRequest>> pending_;
+    bool stopping_ = false;
+
+    /* Number of requests being sent, and signalled when a send completes */
+    size_t num_sending_ = 0;
+    std::condition_variable sent_cv_;
+
+    std::vector<std::thread> send_threads_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
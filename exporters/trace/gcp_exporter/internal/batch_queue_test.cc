@@ -0,0 +1,231 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/batch_queue.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <thread>
+#include <vector>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Makes a request to a project holding spans with the given display names
+ */
+cloudtrace_v2::BatchWriteSpansRequest MakeRequest(const std::string &project, const std::vector<std::string> &names)
+{
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    request.set_name("projects/" + project);
+    for(const auto& name: names){
+        request.add_spans()->mutable_display_name()->set_value(name);
+    }
+    return request;
+}
+
+/**
+ * Records the requests sent by a queue
+ */
+class SentRequests
+{
+public:
+    bool Send(const cloudtrace_v2::BatchWriteSpansRequest &request)
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        std::vector<std::string> names;
+        for(const auto& span: request.spans()){
+            names.push_back(span.display_name().value());
+        }
+        requests_.emplace_back(request.name(), names);
+        return request.name() != "projects/failing";
+    }
+
+    std::vector<std::pair<std::string, std::vector<std::string>>> requests()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        return requests_;
+    }
+
+private:
+    std::mutex mu_;
+    std::vector<std::pair<std::string, std::vector<std::string>>> requests_;
+};
+
+TEST(BatchQueue, TestCoalescesPerProject)
+{
+    SentRequests sent;
+    std::vector<std::shared_future<bool>> futures;
+    {
+        BatchQueue queue(100, std::chrono::milliseconds(60000), 1,
+                         [&sent](const cloudtrace_v2::BatchWriteSpansRequest &request){ return sent.Send(request); });
+        for(auto request: {MakeRequest("a", {"a1", "a2"}), MakeRequest("b", {"b1"}), MakeRequest("a", {"a3"}),
+                           MakeRequest("failing", {"f1"})}){
+            futures.push_back(queue.Submit(&request));
+            EXPECT_EQ(0, request.spans_size());
+        }
+        // Nothing is full or due, so nothing is sent before the queue stops
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        EXPECT_TRUE(sent.requests().empty());
+    }
+
+    const std::vector<std::pair<std::string, std::vector<std::string>>> expected = {
+        {"projects/a", {"a1", "a2", "a3"}}, {"projects/b", {"b1"}}, {"projects/failing", {"f1"}}};
+    EXPECT_EQ(expected, sent.requests());
+    EXPECT_TRUE(futures[0].get());
+    EXPECT_TRUE(futures[1].get());
+    EXPECT_TRUE(futures[2].get());
+    EXPECT_FALSE(futures[3].get());
+}
+
+TEST(BatchQueue, TestSendsFullRequests)
+{
+    SentRequests sent;
+    BatchQueue queue(3, std::chrono::milliseconds(60000), 1,
+                     [&sent](const cloudtrace_v2::BatchWriteSpansRequest &request){ return sent.Send(request); });
+    auto first = MakeRequest("a", {"a1", "a2"});
+    auto second = MakeRequest("a", {"a3"});
+    auto first_future = queue.Submit(&first);
+    auto second_future = queue.Submit(&second);
+
+    // Both submitters wait on the same request
+    EXPECT_TRUE(first_future.get());
+    EXPECT_TRUE(second_future.get());
+    const std::vector<std::pair<std::string, std::vector<std::string>>> expected = {
+        {"projects/a", {"a1", "a2", "a3"}}};
+    EXPECT_EQ(expected, sent.requests());
+}
+
+TEST(BatchQueue, TestShutdownSendsPending)
+{
+    SentRequests sent;
+    BatchQueue queue(100, std::chrono::milliseconds(60000), 1,
+                     [&sent](const cloudtrace_v2::BatchWriteSpansRequest &request){ return sent.Send(request); });
+    auto request = MakeRequest("a", {"a1"});
+    auto future = queue.Submit(&request);
+
+    EXPECT_TRUE(queue.Shutdown(std::chrono::seconds(10)));
+    EXPECT_EQ(std::future_status::ready, future.wait_for(std::chrono::seconds(0)));
+    EXPECT_TRUE(future.get());
+    EXPECT_EQ(1, sent.requests().size());
+
+    // Nothing is sent once the queue is shut down
+    request = MakeRequest("a", {"a2"});
+    EXPECT_FALSE(queue.Submit(&request).get());
+    EXPECT_EQ(1, sent.requests().size());
+}
+
+TEST(BatchQueue, TestShutdownTimesOut)
+{
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    BatchQueue queue(100, std::chrono::milliseconds(60000), 1,
+                     [released](const cloudtrace_v2::BatchWriteSpansRequest&){
+                         released.wait();
+                         return true;
+                     });
+    auto request = MakeRequest("a", {"a1"});
+    auto future = queue.Submit(&request);
+
+    // The send in progress is left to complete in the background
+    EXPECT_FALSE(queue.Shutdown(std::chrono::milliseconds(20)));
+    release.set_value();
+    EXPECT_TRUE(future.get());
+}
+
+TEST(BatchQueue, TestSendsAfterDelay)
+{
+    SentRequests sent;
+    BatchQueue queue(1000, std::chrono::milliseconds(10), 1,
+                     [&sent](const cloudtrace_v2::BatchWriteSpansRequest &request){ return sent.Send(request); });
+    auto request = MakeRequest("a", {"a1"});
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(queue.Submit(&request).get());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(10));
+
+    // A request submitted after the first was sent goes in a new one
+    request = MakeRequest("a", {"a2"});
+    EXPECT_TRUE(queue.Submit(&request).get());
+    EXPECT_EQ(2, sent.requests().size());
+}
+
+TEST(BatchQueue, TestConcurrentSubmits)
+{
+    std::atomic<int> num_spans_sent(0);
+    std::atomic<int> num_requests_sent(0);
+    {
+        BatchQueue queue(50, std::chrono::milliseconds(5), 1,
+                         [&](const cloudtrace_v2::BatchWriteSpansRequest &request){
+                             num_spans_sent += request.spans_size();
+                             ++num_requests_sent;
+                             return true;
+                         });
+        std::vector<std::thread> threads;
+        for(int t = 0; t < 4; ++t){
+            threads.emplace_back([&queue]{
+                for(int i = 0; i < 100; ++i){
+                    auto request = MakeRequest("a", {"span"});
+                    queue.Submit(&request).get();
+                }
+            });
+        }
+        for(auto& thread: threads){
+            thread.join();
+        }
+    }
+    EXPECT_EQ(400, num_spans_sent.load());
+    // Submits from different threads share requests
+    EXPECT_LT(num_requests_sent.load(), 400);
+}
+
+TEST(BatchQueue, TestSendsConcurrently)
+{
+    std::mutex mu;
+    std::condition_variable cv;
+    int num_in_flight = 0;
+    int max_in_flight = 0;
+    BatchQueue queue(1, std::chrono::milliseconds(60000), 2,
+                     [&](const cloudtrace_v2::BatchWriteSpansRequest &){
+                         // Each send waits for the other, up to a timeout
+                         std::unique_lock<std::mutex> lock(mu);
+                         max_in_flight = std::max(max_in_flight, ++num_in_flight);
+                         cv.notify_all();
+                         cv.wait_for(lock, std::chrono::seconds(5), [&]{ return max_in_flight == 2; });
+                         --num_in_flight;
+                         return true;
+                     });
+    auto first = MakeRequest("a", {"a1"});
+    auto second = MakeRequest("b", {"b1"});
+    auto first_future = queue.Submit(&first);
+    auto second_future = queue.Submit(&second);
+    EXPECT_TRUE(first_future.get());
+    EXPECT_TRUE(second_future.get());
+    EXPECT_EQ(2, max_in_flight);
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/channel_warmer.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+ChannelWarmer::ChannelWarmer(std::vector<std::shared_ptr<grpc::ChannelInterface>> channels,
+                             std::vector<google::devtools::cloudtrace::v2::TraceService::StubInterface*> stubs,
+                             const std::string &project_id,
+                             std::chrono::milliseconds timeout):
+    channels_(std::move(channels)), stubs_(std::move(stubs)), timeout_(timeout)
+{
+    request_.set_name(kProjectsPathStr + project_id);
+}
+
+ChannelWarmer::~ChannelWarmer()
+{
+    Stop();
+}
+
+bool ChannelWarmer::WarmUp() noexcept
+{
+    const auto deadline = std::chrono::system_clock::now() + timeout_;
+
+    // Start every connection before waiting on any, so that they are made concurrently
+    for(const auto& channel: channels_){
+        channel->GetState(true);
+    }
+    bool warm = true;
+    for(const auto& channel: channels_){
+        warm = channel->WaitForConnected(deadline) && warm;
+    }
+
+    for(auto* stub: stubs_){
+        grpc::ClientContext context;
+        context.set_deadline(deadline);
+        google::protobuf::Empty response;
+        const grpc::Status status = stub->BatchWriteSpans(&context, request_, &response);
+        // A service rejecting the empty batch has still authenticated the call
+        warm = (status.ok() || status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) && warm;
+    }
+    return warm;
+}
+
+void ChannelWarmer::Start(std::chrono::milliseconds interval)
+{
+    Stop();
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = false;
+    }
+    refresh_thread_ = std::thread(&ChannelWarmer::RefreshLoop, this, interval);
+}
+
+void ChannelWarmer::Stop() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        stopping_ = true;
+    }
+    stop_cv_.notify_all();
+    if(refresh_thread_.joinable()){
+        refresh_thread_.join();
+    }
+}
+
+void ChannelWarmer::RefreshLoop(std::chrono::milliseconds interval)
+{
+    std::unique_lock<std::mutex> lock(mu_);
+    while(!stop_cv_.wait_for(lock, interval, [this]{ return stopping_; })){
+        lock.unlock();
+        WarmUp();
+        lock.lock();
+    }
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
+#include "opentelemetry/version.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Keeps the channels of an exporter ready to send. Channels connect lazily and Google
+ * credentials fetch their token on the first call, so without warming up the first export
+ * pays for name resolution, the TLS handshake and the token fetch.
+ *
+ * A warm-up connects every channel, then sends an empty request on every stub. The call
+ * carries the credentials, which fetches the token, or refreshes it when it is close to
+ * expiry. Warming up periodically in the background keeps the token fresh and idle
+ * channels connected.
+ */
+class ChannelWarmer
+{
+public:
+    /**
+     * @param channels - The channels to connect, empty when the stubs were injected
+     * @param stubs - The stubs to send warm-up calls on, which must outlive the warmer
+     * @param project_id - The project warm-up calls are addressed to
+     * @param timeout - The deadline of each warm-up
+     */
+    ChannelWarmer(std::vector<std::shared_ptr<grpc::ChannelInterface>> channels,
+                  std::vector<google::devtools::cloudtrace::v2::TraceService::StubInterface*> stubs,
+                  const std::string &project_id,
+                  std::chrono::milliseconds timeout);
+
+    /* Stops warming up in the background */
+    ~ChannelWarmer();
+
+    /**
+     * Connects every channel and sends a warm-up call on every stub, blocking until they
+     * are done or the timeout expires
+     * 
+     * @return Whether every channel connected and every call reached the service in time
+     */
+    bool WarmUp() noexcept;
+
+    /**
+     * Warms up on a background thread, every interval, until stopped
+     * 
+     * @param interval - The interval between two warm-ups
+     */
+    void Start(std::chrono::milliseconds interval);
+
+    /* Stops warming up in the background, waiting for a warm-up in progress */
+    void Stop() noexcept;
+
+private:
+    void RefreshLoop(std::chrono::milliseconds interval);
+
+    const std::vector<std::shared_ptr<grpc::ChannelInterface>> channels_;
+    const std::vector<google::devtools::cloudtrace::v2::TraceService::StubInterface*> stubs_;
+    const std::chrono::milliseconds timeout_;
+
+    /* The empty request sent by every warm-up call */
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request_;
+
+    /* Guards stopping_ and wakes the background thread up to stop */
+    std::mutex mu_;
+    std::condition_variable stop_cv_;
+    bool stopping_ = false;
+    std::thread refresh_thread_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
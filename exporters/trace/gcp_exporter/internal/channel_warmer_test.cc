@@ -0,0 +1,94 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/channel_warmer.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+TEST(ChannelWarmer, TestWarmUpConnectsEveryChannel)
+{
+    LocalTraceServer server;
+    std::vector<std::shared_ptr<grpc::ChannelInterface>> channels = {
+        server.MakeChannel(std::chrono::milliseconds(0)), server.MakeChannel(std::chrono::milliseconds(0))};
+    std::vector<std::unique_ptr<cloudtrace_v2::TraceService::Stub>> stubs;
+    std::vector<cloudtrace_v2::TraceService::StubInterface*> stub_ptrs;
+    for(const auto& channel: channels){
+        EXPECT_EQ(GRPC_CHANNEL_IDLE, channel->GetState(false));
+        stubs.push_back(cloudtrace_v2::TraceService::NewStub(channel));
+        stub_ptrs.push_back(stubs.back().get());
+    }
+
+    ChannelWarmer warmer(channels, stub_ptrs, "test_project", std::chrono::milliseconds(5000));
+    EXPECT_TRUE(warmer.WarmUp());
+    for(const auto& channel: channels){
+        EXPECT_EQ(GRPC_CHANNEL_READY, channel->GetState(false));
+    }
+    EXPECT_EQ(2, server.num_calls());
+    EXPECT_EQ(2, server.num_empty_calls());
+}
+
+TEST(ChannelWarmer, TestWarmUpTimesOut)
+{
+    std::shared_ptr<grpc::ChannelInterface> channel;
+    {
+        // Nothing listens on the port of a stopped server
+        LocalTraceServer server;
+        channel = server.MakeChannel(std::chrono::milliseconds(0));
+    }
+    auto stub = cloudtrace_v2::TraceService::NewStub(channel);
+
+    ChannelWarmer warmer({channel}, {stub.get()}, "test_project", std::chrono::milliseconds(200));
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(warmer.WarmUp());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST(ChannelWarmer, TestBackgroundWarmUps)
+{
+    LocalTraceServer server;
+    auto channel = server.MakeChannel(std::chrono::milliseconds(0));
+    auto server_stub = cloudtrace_v2::TraceService::NewStub(channel);
+
+    ChannelWarmer warmer({channel}, {server_stub.get()}, "test_project", std::chrono::milliseconds(5000));
+    warmer.Start(std::chrono::milliseconds(10));
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while(server.num_calls() < 3 && std::chrono::steady_clock::now() < deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_GE(server.num_calls(), 3);
+
+    // No warm-up runs once stopped
+    warmer.Stop();
+    const int num_calls = server.num_calls();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(num_calls, server.num_calls());
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,507 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+#include "exporters/trace/gcp_exporter/internal/stack_trace.h"
+#include "exporters/trace/gcp_exporter/internal/thread_staging.h"
+
+#include <limits>
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+static_assert(sizeof(CompactRecordable) <= staging::kMaxObjectSize, 
+              "CompactRecordable must fit in a staged slot");
+
+namespace
+{
+
+// Overwritten bytes below which the slab is never compacted
+constexpr uint32_t kMinSlabGarbageBytes = 256;
+
+/**
+ * FNV-1a hash of an attribute key
+ */
+size_t HashKey(nostd::string_view key) noexcept
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for(const char c: key){
+        hash = (hash ^ static_cast<uint8_t>(c)) * 1099511628211ULL;
+    }
+    return static_cast<size_t>(hash);
+}
+
+} // namespace
+
+void *CompactRecordable::operator new(std::size_t size)
+{
+    return staging::AllocateFromHeap(size);
+}
+
+void *CompactRecordable::operator new(std::size_t size, ThreadStagingTag)
+{
+    return staging::Allocate(size);
+}
+
+void CompactRecordable::operator delete(void *ptr) noexcept
+{
+    staging::Free(ptr);
+}
+
+void CompactRecordable::operator delete(void *ptr, ThreadStagingTag) noexcept
+{
+    staging::Free(ptr);
+}
+
+CompactRecordable::CompactRecordable() noexcept = default;
+
+CompactRecordable::CompactRecordable(const RecordableOptions *options) noexcept : options_(options) {}
+
+CompactRecordable::~CompactRecordable()
+{
+    // Spans the exporter never took, such as those a processor dropped
+    if(options_ && options_->memory_budget){
+        options_->memory_budget->Release(charge_.TakeReservedBytes());
+    }
+}
+
+void CompactRecordable::SetIds(trace::TraceId trace_id,
+                               trace::SpanId span_id,
+                               trace::SpanId parent_span_id) noexcept
+{
+    trace_id.CopyBytesTo(trace_id_);
+    span_id.CopyBytesTo(span_id_);
+    parent_span_id.CopyBytesTo(parent_span_id_);
+}
+
+void CompactRecordable::SetAttribute(nostd::string_view key,
+                                     const common::AttributeValue &value) noexcept
+{
+    nostd::visit(AttributeValueSetter<CompactRecordable>{
+        this, key, RecordableOptions::Config(options_).attribute_string_len}, value);
+}
+
+uint32_t CompactRecordable::AppendToSlab(nostd::string_view str) noexcept
+{
+    // Compacting here, rather than when values are overwritten, keeps it amortized over the
+    // bytes appended since the last compaction
+    if(slab_garbage_bytes_ >= kMinSlabGarbageBytes && 2 * slab_garbage_bytes_ > slab_.size()){
+        CompactSlab();
+    }
+    const auto offset = static_cast<uint32_t>(slab_.size());
+    slab_.append(str.data(), str.size());
+    return offset;
+}
+
+CompactRecordable::Attribute *CompactRecordable::MutableAttribute(nostd::string_view key, size_t value_size) noexcept
+{
+    Attribute* attribute = StoreAttribute(key, value_size);
+    if(!attribute){
+        if(!dropped()){
+            ++dropped_attributes_count_;
+        }
+        return nullptr;
+    }
+    // A priority attribute the budget dropped does not make the span a priority span
+    if(!priority_ && options_ && options_->IsPriorityKey(key)){
+        priority_ = true;
+    }
+    return attribute;
+}
+
+CompactRecordable::Attribute *CompactRecordable::StoreAttribute(nostd::string_view key, size_t value_size) noexcept
+{
+    const size_t index = AttributeIndex(key);
+    if(index < num_attributes_){
+        Attribute &attribute = mutable_attribute(index);
+        // Setting a key again only grows the slab by the new value, unless it fits in place
+        // of the old one
+        const bool fits = attribute.type == AttributeType::kString && attribute.string_value.size >= value_size;
+        if(fits || Charge(value_size)){
+            return &attribute;
+        }
+        // The old value is stale, so it goes as well
+        RemoveAttribute(index);
+        return nullptr;
+    }
+
+    if(!Charge(sizeof(Attribute) + key.size() + value_size)){
+        return nullptr;
+    }
+    // Appended first, since appending may compact the slab
+    const uint32_t key_offset = AppendToSlab(key);
+    Attribute* attribute;
+    if (num_attributes_ < kInlineAttributes)
+    {
+        attribute = &inline_attributes_[num_attributes_];
+    }
+    else
+    {
+        overflow_attributes_.emplace_back();
+        attribute = &overflow_attributes_.back();
+    }
+    ++num_attributes_;
+
+    attribute->key_offset = key_offset;
+    attribute->key_size = static_cast<uint32_t>(key.size());
+    attribute->truncated_byte_count = 0;
+    // No value yet, so a string value is appended to the slab
+    attribute->type = AttributeType::kInt;
+    IndexAttribute(num_attributes_ - 1);
+    return attribute;
+}
+
+void CompactRecordable::RemoveAttribute(size_t index) noexcept
+{
+    slab_garbage_bytes_ += attribute(index).key_size;
+    DiscardStringValue(&mutable_attribute(index));
+    for(size_t i = index + 1; i < num_attributes_; ++i){
+        mutable_attribute(i - 1) = attribute(i);
+    }
+    --num_attributes_;
+    if(num_attributes_ >= kInlineAttributes){
+        overflow_attributes_.pop_back();
+    }
+    // Removals only follow a refusal of the budget, so they are rare enough to rebuild
+    RebuildAttributeIndex();
+}
+
+size_t CompactRecordable::AttributeIndex(nostd::string_view key) const noexcept
+{
+    if(attribute_index_.empty()){
+        for(size_t i = 0; i < num_attributes_; ++i){
+            const Attribute &candidate = attribute(i);
+            if(SlabString(candidate.key_offset, candidate.key_size) == key){
+                return i;
+            }
+        }
+        return num_attributes_;
+    }
+    const size_t mask = attribute_index_.size() - 1;
+    for(size_t slot = HashKey(key) & mask; attribute_index_[slot] != 0; slot = (slot + 1) & mask){
+        const size_t index = attribute_index_[slot] - 1;
+        const Attribute &candidate = attribute(index);
+        if(SlabString(candidate.key_offset, candidate.key_size) == key){
+            return index;
+        }
+    }
+    return num_attributes_;
+}
+
+void CompactRecordable::IndexAttribute(size_t index) noexcept
+{
+    if(num_attributes_ <= kInlineAttributes){
+        return;
+    }
+    // Kept at most half full, so that probes stay short
+    if(2 * num_attributes_ > attribute_index_.size()){
+        RebuildAttributeIndex();
+        return;
+    }
+    const Attribute &indexed = attribute(index);
+    const size_t mask = attribute_index_.size() - 1;
+    size_t slot = HashKey(SlabString(indexed.key_offset, indexed.key_size)) & mask;
+    while(attribute_index_[slot] != 0){
+        slot = (slot + 1) & mask;
+    }
+    attribute_index_[slot] = static_cast<uint32_t>(index + 1);
+}
+
+void CompactRecordable::RebuildAttributeIndex() noexcept
+{
+    if(num_attributes_ <= kInlineAttributes){
+        std::vector<uint32_t>().swap(attribute_index_);
+        return;
+    }
+    size_t num_slots = 4 * kInlineAttributes;
+    while(num_slots < 4 * num_attributes_){
+        num_slots *= 2;
+    }
+    attribute_index_.assign(num_slots, 0);
+    const size_t mask = num_slots - 1;
+    for(size_t i = 0; i < num_attributes_; ++i){
+        const Attribute &indexed = attribute(i);
+        size_t slot = HashKey(SlabString(indexed.key_offset, indexed.key_size)) & mask;
+        while(attribute_index_[slot] != 0){
+            slot = (slot + 1) & mask;
+        }
+        attribute_index_[slot] = static_cast<uint32_t>(i + 1);
+    }
+}
+
+void CompactRecordable::DiscardStringValue(Attribute *attribute) noexcept
+{
+    if(attribute->type == AttributeType::kString){
+        slab_garbage_bytes_ += attribute->string_value.size;
+        attribute->type = AttributeType::kInt;
+        attribute->int_value = 0;
+    }
+}
+
+void CompactRecordable::CompactSlab() noexcept
+{
+    std::string slab;
+    slab.reserve(slab_.size() - slab_garbage_bytes_);
+    const auto keep = [this, &slab](uint32_t *offset, uint32_t size){
+        const uint32_t from = *offset;
+        *offset = static_cast<uint32_t>(slab.size());
+        slab.append(slab_, from, size);
+    };
+    keep(&name_offset_, name_size_);
+    keep(&status_message_offset_, status_message_size_);
+    for(size_t i = 0; i < num_attributes_; ++i){
+        Attribute &kept = mutable_attribute(i);
+        keep(&kept.key_offset, kept.key_size);
+        if(kept.type == AttributeType::kString){
+            keep(&kept.string_value.offset, kept.string_value.size);
+        }
+    }
+    slab_.swap(slab);
+    slab_garbage_bytes_ = 0;
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, bool value) noexcept
+{
+    Attribute *attribute = MutableAttribute(key, 0);
+    if(!attribute){
+        return;
+    }
+    DiscardStringValue(attribute);
+    attribute->type = AttributeType::kBool;
+    attribute->bool_value = value;
+    attribute->truncated_byte_count = 0;
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, int value) noexcept
+{
+    SetTypedAttribute(key, static_cast<int64_t>(value));
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, int64_t value) noexcept
+{
+    Attribute *attribute = MutableAttribute(key, 0);
+    if(!attribute){
+        return;
+    }
+    DiscardStringValue(attribute);
+    attribute->type = AttributeType::kInt;
+    attribute->int_value = value;
+    attribute->truncated_byte_count = 0;
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept
+{
+    SetTypedAttribute(key, static_cast<int64_t>(value));
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept
+{
+    // Cloud Trace integers are signed, so larger values are kept exact as strings
+    if(value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+        SetTypedAttribute(key, nostd::string_view(std::to_string(value)));
+        return;
+    }
+    SetTypedAttribute(key, static_cast<int64_t>(value));
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, double value) noexcept
+{
+    // Cloud Trace has no floating point attribute type
+    SetTypedAttribute(key, nostd::string_view(FormatDouble(value)));
+}
+
+void CompactRecordable::SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept
+{
+    const size_t truncated_size = TruncatedSize(
+        RecordableOptions::Config(options_).attribute_string_len, value);
+    SetTruncatedAttribute(key, value.substr(0, truncated_size), value.size() - truncated_size);
+}
+
+void CompactRecordable::SetTruncatedAttribute(nostd::string_view key,
+                                              nostd::string_view value,
+                                              size_t truncated_byte_count) noexcept
+{
+    const size_t truncated_size = value.size();
+    Attribute *attribute = MutableAttribute(key, truncated_size);
+    if(!attribute){
+        return;
+    }
+    if(attribute->type == AttributeType::kString && attribute->string_value.size >= truncated_size){
+        slab_garbage_bytes_ += attribute->string_value.size - static_cast<uint32_t>(truncated_size);
+        slab_.replace(attribute->string_value.offset, truncated_size, value.data(), truncated_size);
+    } else {
+        DiscardStringValue(attribute);
+        const uint32_t offset = AppendToSlab(value.substr(0, truncated_size));
+        attribute->type = AttributeType::kString;
+        attribute->string_value.offset = offset;
+    }
+    attribute->string_value.size = static_cast<uint32_t>(truncated_size);
+    attribute->truncated_byte_count = static_cast<uint32_t>(truncated_byte_count);
+}
+
+void CompactRecordable::AddEvent(nostd::string_view name, 
+                                 core::SystemTimestamp timestamp,
+                                 const opentelemetry::common::KeyValueIterable &attributes) noexcept
+{
+    // Cloud Trace records events as annotations, which are rare enough to be kept as protobuf
+    google::devtools::cloudtrace::v2::Span_TimeEvent event;
+    MakeAnnotation(name, timestamp.time_since_epoch().count(), attributes,
+                   RecordableOptions::Config(options_).attribute_string_len, &event);
+
+    if(!time_events_){
+        time_events_.reset(new google::devtools::cloudtrace::v2::Span_TimeEvents());
+    }
+    if(!Charge(event.ByteSizeLong())){
+        if(!dropped()){
+            time_events_->set_dropped_annotations_count(time_events_->dropped_annotations_count() + 1);
+        }
+        return;
+    }
+    time_events_->add_time_event()->Swap(&event);
+}
+
+void CompactRecordable::AddLink(
+      const opentelemetry::trace::SpanContext &span_context,
+      const opentelemetry::common::KeyValueIterable &attributes) noexcept
+{
+    (void)span_context;
+    (void)attributes;
+}
+
+void CompactRecordable::SetStatus(trace::CanonicalCode code, nostd::string_view description) noexcept
+{
+    if(code != trace::CanonicalCode::OK){
+        priority_ = true;
+        if(!stack_ && options_ && options_->stack_capture == StackCapture::kOnError){
+            stack_ = CaptureStack(1, options_->max_stack_frames);
+        }
+    }
+    // The code is kept past the budget, the message only if it fits
+    if(!Charge(description.size())){
+        description = nostd::string_view();
+    }
+    has_status_ = true;
+    status_code_ = static_cast<int32_t>(code);
+    slab_garbage_bytes_ += status_message_size_;
+    status_message_size_ = 0;
+    status_message_offset_ = AppendToSlab(description);
+    status_message_size_ = static_cast<uint32_t>(description.size());
+}
+
+void CompactRecordable::SetName(nostd::string_view name) noexcept
+{
+    const size_t truncated_size = TruncatedSize(
+        RecordableOptions::Config(options_).display_name_string_len, name);
+    // Names are bounded, and kept past the budget unless the whole span is dropped
+    if(!Charge(truncated_size, true)){
+        return;
+    }
+    slab_garbage_bytes_ += name_size_;
+    name_size_ = 0;
+    name_offset_ = AppendToSlab(name.substr(0, truncated_size));
+    name_size_ = static_cast<uint32_t>(truncated_size);
+    name_truncated_byte_count_ = static_cast<uint32_t>(name.size() - truncated_size);
+}
+
+void CompactRecordable::SetStartTime(opentelemetry::core::SystemTimestamp start_time) noexcept
+{
+    if(options_ && options_->stack_capture == StackCapture::kOnStart){
+        stack_ = CaptureStack(1, options_->max_stack_frames);
+    }
+    start_time_nanos_ = start_time.time_since_epoch().count();
+}
+
+void CompactRecordable::SetDuration(std::chrono::nanoseconds duration) noexcept
+{
+    end_time_nanos_ = start_time_nanos_ + duration.count();
+}
+
+void CompactRecordable::ToProto(nostd::string_view project_id, 
+                                google::devtools::cloudtrace::v2::Span *span) const noexcept
+{
+    char hex_trace[2 * 16];
+    EncodeLowerBase16(trace_id_.data(), trace_id_.size(), hex_trace);
+    char hex_span[2 * 8];
+    EncodeLowerBase16(span_id_.data(), span_id_.size(), hex_span);
+    char hex_parent_span[2 * 8];
+    EncodeLowerBase16(parent_span_id_.data(), parent_span_id_.size(), hex_parent_span);
+
+    std::string* name = span->mutable_name();
+    name->reserve(sizeof(kProjectsPathStr) + project_id.size() + sizeof(kTracesPathStr) + 
+                  sizeof(hex_trace) + sizeof(kSpansPathStr) + sizeof(hex_span));
+    name->append(kProjectsPathStr);
+    name->append(project_id.data(), project_id.size());
+    name->append(kTracesPathStr);
+    name->append(hex_trace, sizeof(hex_trace));
+    name->append(kSpansPathStr);
+    name->append(hex_span, sizeof(hex_span));
+    span->set_span_id(hex_span, sizeof(hex_span));
+    span->set_parent_span_id(hex_parent_span, sizeof(hex_parent_span));
+
+    auto* display_name = span->mutable_display_name();
+    display_name->set_value(slab_.data() + name_offset_, name_size_);
+    display_name->set_truncated_byte_count(name_truncated_byte_count_);
+
+    SetTimestamp(start_time_nanos_, span->mutable_start_time());
+    SetTimestamp(end_time_nanos_, span->mutable_end_time());
+
+    if (has_status_)
+    {
+        span->mutable_status()->set_code(status_code_);
+        span->mutable_status()->set_message(slab_.data() + status_message_offset_, status_message_size_);
+    }
+
+    if (time_events_)
+    {
+        *span->mutable_time_events() = *time_events_;
+    }
+    if (dropped_attributes_count_ > 0)
+    {
+        span->mutable_attributes()->set_dropped_attributes_count(dropped_attributes_count_);
+    }
+    if (num_attributes_ == 0)
+    {
+        return;
+    }
+    auto* map = span->mutable_attributes()->mutable_attribute_map();
+    for (size_t i = 0; i < num_attributes_; ++i)
+    {
+        const Attribute &attribute = this->attribute(i);
+        auto &value = (*map)[std::string(slab_.data() + attribute.key_offset, attribute.key_size)];
+        switch (attribute.type)
+        {
+            case AttributeType::kBool:
+                value.set_bool_value(attribute.bool_value);
+                break;
+            case AttributeType::kInt:
+                value.set_int_value(attribute.int_value);
+                break;
+            case AttributeType::kString:
+                value.mutable_string_value()->set_value(slab_.data() + attribute.string_value.offset,
+                                                        attribute.string_value.size);
+                value.mutable_string_value()->set_truncated_byte_count(attribute.truncated_byte_count);
+                break;
+        }
+    }
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
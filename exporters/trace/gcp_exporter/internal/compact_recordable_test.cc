@@ -0,0 +1,302 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <google/protobuf/util/message_differencer.h>
+#include <gtest/gtest.h>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Checks that a compact recordable materializes exactly the span a Recordable holds
+ */
+void ExpectSameSpan(const SpanShape &shape)
+{
+    const SpanGenerator generator(shape);
+
+    Recordable rec;
+    generator.Fill(rec);
+    CompactRecordable compact_rec;
+    generator.Fill(compact_rec);
+
+    google::devtools::cloudtrace::v2::Span expected;
+    rec.ToProto("test_project", &expected);
+    google::devtools::cloudtrace::v2::Span span;
+    compact_rec.ToProto("test_project", &span);
+
+    EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(expected, span))
+        << "Expected:\n" << expected.DebugString() << "Actual:\n" << span.DebugString();
+}
+
+TEST(CompactRecordable, MatchesRecordableForSparseSpan)
+{
+    ExpectSameSpan(SparseSpanShape());
+}
+
+TEST(CompactRecordable, MatchesRecordableForDenseSpan)
+{
+    ExpectSameSpan(DenseSpanShape());
+}
+
+TEST(CompactRecordable, MatchesRecordableForTruncatedStrings)
+{
+    SpanShape shape = SparseSpanShape();
+    shape.num_str_attributes = 3;
+    shape.str_value_length = 300;
+    ExpectSameSpan(shape);
+}
+
+TEST(CompactRecordable, MatchesRecordableForErrorStatus)
+{
+    SpanShape shape = SparseSpanShape();
+    shape.has_error_status = true;
+    ExpectSameSpan(shape);
+}
+
+TEST(CompactRecordable, MatchesRecordableForEvents)
+{
+    SpanShape shape = SparseSpanShape();
+    shape.num_int_attributes = 2;
+    shape.num_events = 3;
+    ExpectSameSpan(shape);
+}
+
+TEST(CompactRecordable, MatchesRecordableForLargeUint64AndTruncatedArrays)
+{
+    RuntimeConfig config;
+    config.attribute_string_len = 24;
+    ConfigStore store(config);
+    RecordableOptions options;
+    options.config = &store;
+
+    const int64_t ints[] = {100, 200, 300, 400, 500, 600, 700, 800};
+    Recordable rec(&options);
+    CompactRecordable compact_rec(&options);
+    for(auto* recordable : {static_cast<sdk::trace::Recordable*>(&rec),
+                            static_cast<sdk::trace::Recordable*>(&compact_rec)}){
+        recordable->SetAttribute("max_uint64", common::AttributeValue(uint64_t{18446744073709551615ULL}));
+        recordable->SetAttribute("int_array", common::AttributeValue(nostd::span<const int64_t>(ints)));
+    }
+
+    google::devtools::cloudtrace::v2::Span expected;
+    rec.ToProto("test_project", &expected);
+    google::devtools::cloudtrace::v2::Span span;
+    compact_rec.ToProto("test_project", &span);
+
+    EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(expected.attributes(), span.attributes()))
+        << "Expected:\n" << expected.DebugString() << "Actual:\n" << span.DebugString();
+    EXPECT_EQ("18446744073709551615", span.attributes().attribute_map().at("max_uint64").string_value().value());
+    EXPECT_EQ("[100,200,300,400,500]", span.attributes().attribute_map().at("int_array").string_value().value());
+}
+
+TEST(CompactRecordable, TestSetIds)
+{
+    const opentelemetry::trace::TraceId trace_id(
+    std::array<const uint8_t, opentelemetry::trace::TraceId::kSize>(
+    {0, 1, 0, 2, 1, 3, 1, 4, 1, 5, 1, 6, 3, 7, 0, 0}));
+
+    const opentelemetry::trace::SpanId span_id(
+    std::array<const uint8_t, opentelemetry::trace::SpanId::kSize>(
+    {1, 2, 3, 4, 5, 6, 7, 8}));
+
+    const opentelemetry::trace::SpanId parent_span_id(
+    std::array<const uint8_t, opentelemetry::trace::SpanId::kSize>(
+    {4, 5, 0, 1, 1, 1, 1, 3}));
+
+    CompactRecordable rec;
+    rec.SetIds(trace_id, span_id, parent_span_id);
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("other_project", &span);
+
+    // The project comes from the exporter rather than the environment
+    EXPECT_EQ("projects/other_project/traces/00010002010301040105010603070000/spans/0102030405060708", 
+              span.name());
+    EXPECT_EQ("0102030405060708", span.span_id());
+    EXPECT_EQ("0405000101010103", span.parent_span_id());
+}
+
+TEST(CompactRecordable, TestLastAttributeValueWins)
+{
+    CompactRecordable rec;
+    for(int64_t i = 0; i < 10; ++i){
+        rec.SetAttribute("key", i);
+    }
+    rec.SetAttribute("other_key", true);
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
+
+    auto attr_map = span.attributes().attribute_map();
+    ASSERT_EQ(2, attr_map.size());
+    EXPECT_EQ(9, attr_map["key"].int_value());
+    EXPECT_TRUE(attr_map["other_key"].bool_value());
+}
+
+TEST(CompactRecordable, TestManyAttributes)
+{
+    CompactRecordable rec;
+    for(int round = 0; round < 3; ++round){
+        for(int64_t i = 0; i < 100; ++i){
+            const std::string key = "key_" + std::to_string(i);
+            if(round == 1){
+                rec.SetAttribute(key, nostd::string_view(key));
+            } else {
+                rec.SetAttribute(key, 10 * i + round);
+            }
+        }
+    }
+    EXPECT_EQ(100, rec.num_attributes());
+    ASSERT_NE(nullptr, rec.FindAttribute("key_42"));
+    EXPECT_EQ(422, rec.FindAttribute("key_42")->int_value);
+    EXPECT_EQ(nullptr, rec.FindAttribute("key_100"));
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
+    const auto &attr_map = span.attributes().attribute_map();
+    ASSERT_EQ(100, attr_map.size());
+    EXPECT_EQ(992, attr_map.at("key_99").int_value());
+}
+
+class CompactRecordableTestPeer : public ::testing::Test
+{
+public:
+    size_t SlabSize(const CompactRecordable &rec) { return rec.slab_.size(); }
+};
+
+TEST_F(CompactRecordableTestPeer, TestOverwrittenValuesAreReclaimed)
+{
+    CompactRecordable rec;
+    rec.SetName("span");
+    rec.SetAttribute("other_key", nostd::string_view("other value"));
+    for(int i = 0; i < 1000; ++i){
+        // Most values are longer than the one before, so they do not fit in its place
+        rec.SetAttribute("key", nostd::string_view(std::string(10 + i % 200, 'a' + i % 26)));
+        rec.SetAttribute("flag", nostd::string_view(std::string(i % 2 ? 100 : 0, 'x')));
+        rec.SetAttribute("flag", i % 2 == 0);
+    }
+    EXPECT_LT(SlabSize(rec), 2000);
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
+    const auto &attr_map = span.attributes().attribute_map();
+    ASSERT_EQ(3, attr_map.size());
+    EXPECT_EQ(std::string(10 + 999 % 200, 'a' + 999 % 26), attr_map.at("key").string_value().value());
+    EXPECT_EQ("other value", attr_map.at("other_key").string_value().value());
+    EXPECT_FALSE(attr_map.at("flag").bool_value());
+    EXPECT_EQ("span", span.display_name().value());
+}
+
+TEST(CompactRecordable, TestPriority)
+{
+    const RecordableOptions options{{"priority_key"}};
+
+    CompactRecordable ok_span(&options);
+    ok_span.SetStatus(trace::CanonicalCode::OK, "");
+    ok_span.SetAttribute("other_key", true);
+    EXPECT_FALSE(ok_span.priority());
+
+    CompactRecordable error_span(&options);
+    error_span.SetStatus(trace::CanonicalCode::INTERNAL, "Failed");
+    EXPECT_TRUE(error_span.priority());
+
+    CompactRecordable attribute_span(&options);
+    attribute_span.SetTypedAttribute("priority_key", int64_t{1});
+    EXPECT_TRUE(attribute_span.priority());
+}
+
+TEST(CompactRecordable, TestPriorityAttributeDropped)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropAttributes);
+    RecordableOptions options{{"priority_key"}};
+    options.memory_budget = &budget;
+
+    // An attribute the budget drops does not make the span a priority span
+    CompactRecordable rec(&options);
+    const std::string value(200, 'x');
+    for(int i = 0; i < 8; ++i){
+        rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+    }
+    rec.SetAttribute("priority_key", nostd::string_view(value));
+    EXPECT_FALSE(rec.priority());
+}
+
+TEST(CompactRecordable, TestMemoryBudget)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropAttributes);
+    RecordableOptions options;
+    options.memory_budget = &budget;
+    const std::string value(200, 'x');
+    CompactRecordable rec(&options);
+    rec.SetName("Test Span");
+    for(int i = 0; i < 8; ++i){
+        rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+    }
+    EXPECT_EQ(4, rec.num_attributes());
+    EXPECT_EQ(4, rec.dropped_attributes_count());
+    EXPECT_EQ("Test Span", rec.name());
+    EXPECT_FALSE(rec.dropped());
+
+    // A value that fits in place of the old one costs nothing more
+    for(int i = 0; i < 100; ++i){
+        rec.SetAttribute("key_0", nostd::string_view(value));
+        rec.SetAttribute("key_1", i);
+    }
+    EXPECT_EQ(4, rec.num_attributes());
+    EXPECT_EQ(4, rec.dropped_attributes_count());
+
+    // A refused value drops the stale one too
+    rec.SetAttribute("key_1", nostd::string_view(value));
+    EXPECT_EQ(3, rec.num_attributes());
+    EXPECT_EQ(5, rec.dropped_attributes_count());
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
+    EXPECT_EQ(5, span.attributes().dropped_attributes_count());
+    EXPECT_EQ(0, span.attributes().attribute_map().count("key_1"));
+    EXPECT_EQ(value, span.attributes().attribute_map().at("key_0").string_value().value());
+    EXPECT_EQ(1024, rec.TakeReservedBytes());
+}
+
+TEST(CompactRecordable, TestTimestamps)
+{
+    CompactRecordable rec;
+    const core::SystemTimestamp start_timestamp(std::chrono::nanoseconds(1500000000123));
+    rec.SetStartTime(start_timestamp);
+    rec.SetDuration(std::chrono::nanoseconds(999999999));
+
+    EXPECT_EQ(1500000000123, rec.start_time_nanos());
+    EXPECT_EQ(1501000000122, rec.end_time_nanos());
+
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
+
+    EXPECT_EQ(1500, span.start_time().seconds());
+    EXPECT_EQ(123, span.start_time().nanos());
+    EXPECT_EQ(1501, span.end_time().seconds());
+    EXPECT_EQ(122, span.end_time().nanos());
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
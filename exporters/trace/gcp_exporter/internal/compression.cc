@@ -0,0 +1,131 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/compression.h"
+
+#include <zlib.h>
+
+#include <chrono>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+// zlib window bits selecting the gzip wrapper, as gRPC's gzip compression uses
+constexpr int kGzipWindowBits = 15 + 16;
+constexpr int kGzipMemLevel = 8;
+
+bool GzipCodec::Compress(const std::string &input, std::string *output) const noexcept
+{
+    z_stream stream = {};
+    if(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, kGzipWindowBits, kGzipMemLevel,
+                    Z_DEFAULT_STRATEGY) != Z_OK){
+        return false;
+    }
+    output->resize(deflateBound(&stream, input.size()));
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+    stream.avail_in = static_cast<uInt>(input.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&(*output)[0]);
+    stream.avail_out = static_cast<uInt>(output->size());
+    const int result = deflate(&stream, Z_FINISH);
+    output->resize(stream.total_out);
+    deflateEnd(&stream);
+    return result == Z_STREAM_END;
+}
+
+
+AdaptiveCompressor::AdaptiveCompressor(std::shared_ptr<const CompressionCodec> codec,
+                                       const CompressionOptions &options) :
+    codec_(std::move(codec)), options_(options), num_candidates_(0),
+    // Assume compression pays off until the first probe says otherwise
+    has_estimates_(false), compression_ratio_(0.0), cpu_nanos_per_byte_(0.0) {}
+
+grpc_compression_algorithm AdaptiveCompressor::Choose(
+    const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept
+{
+    const size_t size = request.ByteSizeLong();
+    if(size < options_.min_request_bytes){
+        return GRPC_COMPRESS_NONE;
+    }
+
+    const uint32_t probe_interval = options_.probe_interval > 0 ? options_.probe_interval : 1;
+    if(num_candidates_.fetch_add(1, std::memory_order_relaxed) % probe_interval == 0){
+        Probe(request);
+    }
+
+    double ratio, nanos_per_byte;
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        ratio = compression_ratio_;
+        nanos_per_byte = cpu_nanos_per_byte_;
+    }
+    const double saved_bytes = size * (1.0 - ratio);
+    const double cpu_us = size * nanos_per_byte / 1000.0;
+    if(saved_bytes > 0 && saved_bytes >= options_.min_bytes_saved_per_cpu_us * cpu_us){
+        return codec_->algorithm();
+    }
+    return GRPC_COMPRESS_NONE;
+}
+
+void AdaptiveCompressor::Probe(
+    const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept
+{
+    std::string encoded;
+    request.SerializeToString(&encoded);
+    if(encoded.empty()){
+        return;
+    }
+
+    std::string compressed;
+    const auto start = std::chrono::steady_clock::now();
+    const bool ok = codec_->Compress(encoded, &compressed);
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // A failed compression saves nothing
+    const double ratio = ok ? static_cast<double>(compressed.size()) / encoded.size() : 1.0;
+    const double nanos_per_byte = 
+        static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / encoded.size();
+
+    std::lock_guard<std::mutex> lock(mu_);
+    if(!has_estimates_){
+        // The first probe replaces the initial guess outright
+        compression_ratio_ = ratio;
+        cpu_nanos_per_byte_ = nanos_per_byte;
+        has_estimates_ = true;
+        return;
+    }
+    compression_ratio_ += options_.smoothing * (ratio - compression_ratio_);
+    cpu_nanos_per_byte_ += options_.smoothing * (nanos_per_byte - cpu_nanos_per_byte_);
+}
+
+double AdaptiveCompressor::compression_ratio() const noexcept
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    return compression_ratio_;
+}
+
+double AdaptiveCompressor::cpu_nanos_per_byte() const noexcept
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    return cpu_nanos_per_byte_;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
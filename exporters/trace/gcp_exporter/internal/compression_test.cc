@@ -0,0 +1,156 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/compression.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+#include <zlib.h>
+
+#include <random>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * A codec that shrinks payloads by a fixed ratio without doing any work
+ */
+class FixedRatioCodec final : public CompressionCodec
+{
+public:
+    explicit FixedRatioCodec(double ratio) : ratio_(ratio) {}
+
+    grpc_compression_algorithm algorithm() const noexcept override { return GRPC_COMPRESS_DEFLATE; }
+
+    bool Compress(const std::string &input, std::string *output) const noexcept override
+    {
+        output->assign(static_cast<size_t>(input.size() * ratio_), 'x');
+        return true;
+    }
+
+private:
+    const double ratio_;
+};
+
+/**
+ * Builds a request holding spans of the given shape
+ */
+google::devtools::cloudtrace::v2::BatchWriteSpansRequest MakeRequest(const SpanShape &shape, 
+                                                                     int num_spans)
+{
+    setenv(kGCPEnvVar, "test_project", 1);
+    const SpanGenerator generator(shape);
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    for(int i = 0; i < num_spans; ++i){
+        Recordable rec;
+        generator.Fill(rec);
+        *request.add_spans() = rec.span();
+    }
+    return request;
+}
+
+TEST(GzipCodec, TestRoundTrip)
+{
+    const std::string input(10000, 'a');
+    std::string compressed;
+    ASSERT_TRUE(GzipCodec().Compress(input, &compressed));
+    EXPECT_LT(compressed.size(), input.size() / 10);
+
+    // Inflate with the gzip wrapper
+    z_stream stream = {};
+    ASSERT_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+    std::string output(input.size(), '\0');
+    stream.next_in = reinterpret_cast<Bytef*>(&compressed[0]);
+    stream.avail_in = static_cast<uInt>(compressed.size());
+    stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+    stream.avail_out = static_cast<uInt>(output.size());
+    EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+    inflateEnd(&stream);
+    EXPECT_EQ(input, output);
+}
+
+TEST(AdaptiveCompressor, TestSmallRequestsAreNotCompressed)
+{
+    AdaptiveCompressor compressor(std::make_shared<FixedRatioCodec>(0.1), CompressionOptions());
+    EXPECT_EQ(GRPC_COMPRESS_NONE, compressor.Choose(MakeRequest(SparseSpanShape(), 1)));
+}
+
+TEST(AdaptiveCompressor, TestCompressibleRequestsAreCompressed)
+{
+    AdaptiveCompressor compressor(std::make_shared<FixedRatioCodec>(0.1), CompressionOptions());
+    const auto request = MakeRequest(DenseSpanShape(), 20);
+    ASSERT_GE(request.ByteSizeLong(), CompressionOptions().min_request_bytes);
+
+    EXPECT_EQ(GRPC_COMPRESS_DEFLATE, compressor.Choose(request));
+    EXPECT_DOUBLE_EQ(0.1, compressor.compression_ratio());
+}
+
+TEST(AdaptiveCompressor, TestIncompressibleRequestsAreNotCompressed)
+{
+    AdaptiveCompressor compressor(std::make_shared<FixedRatioCodec>(1.0), CompressionOptions());
+    EXPECT_EQ(GRPC_COMPRESS_NONE, compressor.Choose(MakeRequest(DenseSpanShape(), 20)));
+}
+
+TEST(AdaptiveCompressor, TestEstimatesFollowTheProbes)
+{
+    CompressionOptions options;
+    options.probe_interval = 1;
+    options.smoothing = 0.5;
+    const auto request = MakeRequest(DenseSpanShape(), 20);
+
+    AdaptiveCompressor compressor(std::make_shared<FixedRatioCodec>(0.5), options);
+    compressor.Choose(request);
+    EXPECT_NEAR(0.5, compressor.compression_ratio(), 0.01);
+
+    // The same payload keeps the same estimate
+    compressor.Choose(request);
+    EXPECT_NEAR(0.5, compressor.compression_ratio(), 0.01);
+}
+
+TEST(AdaptiveCompressor, TestGzipOnRepetitiveAttributes)
+{
+    AdaptiveCompressor compressor(std::make_shared<GzipCodec>(), CompressionOptions());
+    EXPECT_EQ(GRPC_COMPRESS_GZIP, compressor.Choose(MakeRequest(DenseSpanShape(), 20)));
+    EXPECT_LT(compressor.compression_ratio(), 0.5);
+    EXPECT_GT(compressor.cpu_nanos_per_byte(), 0.0);
+}
+
+TEST(AdaptiveCompressor, TestGzipOnRandomAttributes)
+{
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> byte(0, 255);
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    for(int i = 0; i < 100; ++i){
+        std::string value(200, '\0');
+        for(auto& c: value){
+            c = static_cast<char>(byte(random));
+        }
+        (*request.add_spans()->mutable_attributes()->mutable_attribute_map())["k"]
+            .mutable_string_value()->set_value(value);
+    }
+
+    AdaptiveCompressor compressor(std::make_shared<GzipCodec>(), CompressionOptions());
+    EXPECT_EQ(GRPC_COMPRESS_NONE, compressor.Choose(request));
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
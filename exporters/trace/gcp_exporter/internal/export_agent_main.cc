@@ -0,0 +1,106 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * The export agent: drains the shared memory rings of every process using ShmRingExporter
+ * on the host, and exports their spans to Google Cloud through one GcpExporter.
+ *
+ * Usage: export_agent [--ring_prefix=<prefix>] [--max_batch_size=<spans>]
+ *                     [--poll_interval_ms=<milliseconds>] [--num_export_threads=<threads>]
+ *
+ * The Google Cloud project is read from the GOOGLE_CLOUD_PROJECT_ID environment variable.
+ * The agent exits on SIGINT or SIGTERM, after a last poll.
+ */
+
+#include "exporters/trace/gcp_exporter/gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/shm_transport.h"
+
+#include <signal.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+namespace gcp = opentelemetry::exporter::gcp;
+
+namespace
+{
+
+std::atomic<bool> stop_requested(false);
+
+void HandleStopSignal(int)
+{
+    stop_requested.store(true);
+}
+
+/**
+ * Reads the value of a "--name=value" argument
+ * 
+ * @return Whether the argument has that name
+ */
+bool ParseFlag(const char *argument, const char *name, const char **value)
+{
+    const size_t name_size = strlen(name);
+    if(strncmp(argument, name, name_size) != 0 || argument[name_size] != '='){
+        return false;
+    }
+    *value = argument + name_size + 1;
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    if(getenv(kGCPEnvVar) == nullptr){
+        std::cerr << kGCPEnvVar << " must be set to the Google Cloud project to export to" << std::endl;
+        return 1;
+    }
+
+    gcp::ShmRingAgentOptions agent_options;
+    gcp::GcpExporterOptions exporter_options;
+    for(int i = 1; i < argc; ++i){
+        const char *value;
+        if(ParseFlag(argv[i], "--ring_prefix", &value)){
+            agent_options.ring_prefix = value;
+        } else if(ParseFlag(argv[i], "--max_batch_size", &value)){
+            agent_options.max_batch_size = strtoul(value, nullptr, 10);
+        } else if(ParseFlag(argv[i], "--poll_interval_ms", &value)){
+            agent_options.poll_interval = std::chrono::milliseconds(strtoul(value, nullptr, 10));
+        } else if(ParseFlag(argv[i], "--num_export_threads", &value)){
+            exporter_options.num_export_threads = strtoul(value, nullptr, 10);
+        } else {
+            std::cerr << "Unknown argument: " << argv[i] << std::endl;
+            return 1;
+        }
+    }
+
+    signal(SIGINT, HandleStopSignal);
+    signal(SIGTERM, HandleStopSignal);
+
+    // The agent hands gcp::Recordables to the exporter, so keep the default recordables
+    exporter_options.compact_recordables = false;
+    gcp::ShmRingAgent agent(std::unique_ptr<opentelemetry::sdk::trace::SpanExporter>(
+                                new gcp::GcpExporter(exporter_options)),
+                            agent_options);
+    agent.Run(stop_requested);
+    agent.Poll();
+    if(agent.num_failed_spans() > 0){
+        std::cerr << agent.num_failed_spans() << " spans failed to export" << std::endl;
+    }
+    return 0;
+}
@@ -15,10 +15,21 @@
  */
 
 #include "../gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/batch_queue.h"
+#include "exporters/trace/gcp_exporter/internal/channel_warmer.h"
+#include "exporters/trace/gcp_exporter/internal/probes.h"
+#include "exporters/trace/gcp_exporter/internal/request_hedger.h"
+#include "exporters/trace/gcp_exporter/internal/service_channels.h"
+#include "exporters/trace/gcp_exporter/internal/span_batch.h"
+#include "exporters/trace/gcp_exporter/internal/span_capture.h"
+#include "exporters/trace/gcp_exporter/internal/stack_trace.h"
+#include "exporters/trace/gcp_exporter/internal/worker_pool.h"
 #include <grpcpp/grpcpp.h>
 
-
-constexpr char kGoogleTraceAddress[] = "cloudtrace.googleapis.com";
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <map>
 
 
 OPENTELEMETRY_BEGIN_NAMESPACE
@@ -31,62 +42,557 @@ namespace gcp
 /* ################### INITIALIZATION/REGISTER FUNCTIONS ########################## */
 
 /**
- * Establishes gRPC communication channel to the Google Trace Address
- * 
- * @return A cloudtrace v2 API trace service stub to communicate over via gRPC
+ * Wraps a single injected stub into a pool
  */
-std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::Stub> MakeServiceStub()
+StubPool SingleStub(std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface> stub)
 {
-    grpc::ChannelArguments args;
-    args.SetUserAgentPrefix("opentelemetry-cpp/" OPENTELEMETRY_VERSION);
-    auto channel = grpc::CreateCustomChannel(kGoogleTraceAddress, 
-                                            grpc::GoogleDefaultCredentials(),
-                                            args);
-    return google::devtools::cloudtrace::v2::TraceService::NewStub(channel);
+    StubPool stubs;
+    stubs.push_back(std::move(stub));
+    return stubs;
 }
 
 
-GcpExporter::GcpExporter() : GcpExporter(MakeServiceStub(), getenv(kGCPEnvVar)) {}
+/**
+ * Returns the project named by the environment, empty if the variable is unset
+ */
+const char *EnvironmentProjectId() noexcept
+{
+    const char *project_id = getenv(kGCPEnvVar);
+    return project_id ? project_id : "";
+}
+
+
+GcpExporter::GcpExporter() : GcpExporter(GcpExporterOptions()) {}
+
+
+GcpExporter::GcpExporter(const GcpExporterOptions &options) : 
+    GcpExporter(options.shared_service ? std::vector<std::shared_ptr<grpc::ChannelInterface>>()
+                                       : MakeChannels(options.num_channels, options.keepalive_interval),
+                EnvironmentProjectId(), options) {}
+
+
+GcpExporter::GcpExporter(const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels,
+                         const char* project_id,
+                         const GcpExporterOptions &options):
+    GcpExporter(MakeServiceStubs(channels), project_id, options, channels) {}
 
 
 GcpExporter::GcpExporter(std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface> stub,
-                         const char* project_id):
-    trace_service_stub_(std::move(stub)), project_id_(project_id) {}
+                         const char* project_id,
+                         const GcpExporterOptions &options):
+    GcpExporter(SingleStub(std::move(stub)), project_id, options) {}
+
+
+/**
+ * Returns the tuning set by the options of an exporter
+ */
+RuntimeConfig StaticConfig(const GcpExporterOptions &options)
+{
+    RuntimeConfig config;
+    config.export_ratio = options.export_ratio;
+    config.parallel_export_threshold = options.parallel_export_threshold;
+    return config;
+}
+
+
+GcpExporter::GcpExporter(StubPool stubs,
+                         const char* project_id,
+                         const GcpExporterOptions &options,
+                         const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels):
+    trace_service_stubs_(std::move(stubs)), next_stub_(0), project_id_(project_id), options_(options),
+    static_config_(StaticConfig(options)),
+    recordable_options_(RecordableOptions{options.priority_attribute_keys, options.stack_capture,
+                                          options.max_stack_frames, options.memory_budget.get(),
+                                          options.runtime_config.get()})
+{
+    if(options_.num_export_threads > 0){
+        worker_pool_.reset(new WorkerPool(options_.num_export_threads));
+    }
+    if(options_.compression_codec && !options_.shared_service){
+        compressor_.reset(new AdaptiveCompressor(options_.compression_codec, options_.compression));
+    }
+    if(!options_.capture_path.empty()){
+        // Exporting goes on without capture if the file cannot be opened
+        capture_ = SpanCaptureWriter::Open(options_.capture_path, options_.capture_max_bytes);
+    }
+    if(options_.stack_capture != StackCapture::kNone){
+        stack_traces_.reset(new StackTraceCache(options_.stack_trace_cache_size));
+    }
+    if(options_.hedge_percentile > 0 && trace_service_stubs_.size() > 1){
+        hedger_.reset(new RequestHedger(options_.hedge_percentile, options_.hedge_min_delay,
+                                        options_.hedge_budget_ratio, options_.hedge_max_burst));
+    }
+    if(options_.priority_lane && !options_.shared_service){
+        priority_lane_.reset(new BatchQueue(options_.priority_max_batch_size, options_.priority_max_delay, 1,
+                                            [this](const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request){
+                                                const bool sent = SendOnStub(request);
+                                                if(!sent){
+                                                    num_failed_priority_requests_++;
+                                                }
+                                                return sent;
+                                            }));
+    }
+    if(options_.eager_connect || options_.warm_up_interval.count() > 0){
+        std::vector<google::devtools::cloudtrace::v2::TraceService::StubInterface*> stubs;
+        for(const auto& stub: trace_service_stubs_){
+            stubs.push_back(stub.get());
+        }
+        warmer_.reset(new ChannelWarmer(channels, std::move(stubs), project_id_, options_.warm_up_timeout));
+        if(options_.eager_connect){
+            // A failed warm-up leaves the remaining work to the first export
+            warmer_->WarmUp();
+        }
+        if(options_.warm_up_interval.count() > 0){
+            warmer_->Start(options_.warm_up_interval);
+        }
+    }
+}
+
+
+GcpExporter::~GcpExporter() = default;
+
+
+void GcpExporter::Shutdown(std::chrono::microseconds timeout) noexcept
+{
+    if(timeout.count() == 0){
+        timeout = options_.shutdown_timeout;
+    }
+    if(priority_lane_){
+        // Later exports send their priority spans with the rest of the batch
+        priority_lane_stopped_ = true;
+        priority_lane_->Shutdown(timeout);
+    }
+    if(worker_pool_){
+        worker_pool_->Stop();
+    }
+    if(warmer_){
+        warmer_->Stop();
+    }
+    if(capture_){
+        capture_->Flush();
+    }
+}
 
 
 /* ############################### EXPORT FUNCTIONS ################################## */
 
 
+/**
+ * Reads the low 64 bits of a trace id, which are random in generated ids
+ */
+uint64_t TraceIdLowBits(const std::array<uint8_t, 16> &trace_id) noexcept
+{
+    uint64_t bits = 0;
+    for(size_t i = 8; i < trace_id.size(); ++i){
+        bits = (bits << 8) | trace_id[i];
+    }
+    return bits;
+}
+
+/**
+ * Decides whether a span is exported
+ * 
+ * @param export_ratio - The fraction of traces to export
+ * @param trace_id_low_bits - The low 64 bits of the span's trace id
+ * @param error - Whether the span has an error status, in which case it is always exported
+ */
+bool ShouldExport(double export_ratio, uint64_t trace_id_low_bits, bool error) noexcept
+{
+    if(error || export_ratio >= 1.0){
+        return true;
+    }
+    // Written so that a NaN ratio exports nothing rather than reaching the conversion below
+    if(!(export_ratio > 0.0)){
+        return false;
+    }
+    // 2^64, so that the ratio maps onto the whole range of the low bits
+    constexpr double kTwoPow64 = 18446744073709551616.0;
+    return trace_id_low_bits < static_cast<uint64_t>(export_ratio * kTwoPow64);
+}
+
+
+
 std::unique_ptr<sdk::trace::Recordable> GcpExporter::MakeRecordable() noexcept
 {
-    return std::unique_ptr<sdk::trace::Recordable>(new Recordable);
+    GCP_EXPORTER_PROBE1(make_recordable, static_cast<int>(options_.compact_recordables));
+    if(options_.compact_recordables){
+        if(options_.thread_local_staging){
+            return std::unique_ptr<sdk::trace::Recordable>(new (kThreadStaging) CompactRecordable(&recordable_options_));
+        }
+        return std::unique_ptr<sdk::trace::Recordable>(new CompactRecordable(&recordable_options_));
+    }
+    if(options_.thread_local_staging){
+        return std::unique_ptr<sdk::trace::Recordable>(new (kThreadStaging) Recordable(&recordable_options_));
+    }
+    return std::unique_ptr<sdk::trace::Recordable>(new Recordable(&recordable_options_));
 }
 
 
 sdk::trace::ExportResult GcpExporter::Export(
       const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept 
 {
+    GCP_EXPORTER_PROBE1(export_start, spans.size());
+    const sdk::trace::ExportResult result = ExportSpans(spans);
+    GCP_EXPORTER_PROBE2(export_done, spans.size(), static_cast<int>(result));
+    return result;
+}
+
+
+sdk::trace::ExportResult GcpExporter::ExportSpans(
+      const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept 
+{
+    if(!priority_lane_ || priority_lane_stopped_){
+        return ExportBulk(spans);
+    }
+
+    // The priority spans are on their way before the rest of the batch is even converted, and
+    // the batch does not wait for them: their failures are counted rather than returned
+    const size_t num_bulk_spans = SubmitPrioritySpans(spans);
+    if(num_bulk_spans == 0){
+        return sdk::trace::ExportResult::kSuccess;
+    }
+    return ExportBulk(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(spans.data(), num_bulk_spans));
+}
+
+
+bool GcpExporter::IsPriority(const sdk::trace::Recordable &recordable) const noexcept
+{
+    if(options_.compact_recordables){
+        return static_cast<const CompactRecordable&>(recordable).priority();
+    }
+    return static_cast<const Recordable&>(recordable).priority();
+}
+
+
+size_t GcpExporter::SubmitPrioritySpans(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept
+{
+    size_t num_bulk_spans = 0;
+    std::map<std::string, std::vector<std::unique_ptr<sdk::trace::Recordable>>> projects;
+    for(auto& recordable: spans){
+        if(IsPriority(*recordable)){
+            const std::string project_id = options_.project_id_attribute.empty() ? project_id_ 
+                                                                                 : RoutedProjectId(*recordable);
+            projects[project_id].push_back(std::move(recordable));
+        } else {
+            spans[num_bulk_spans++] = std::move(recordable);
+        }
+    }
+
+    for(auto& project: projects){
+        google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+        BuildRequest(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(project.second.data(), project.second.size()),
+                     project.first, &request);
+        if(request.spans_size() > 0){
+            // A lane shut down during this export refuses the request without sending it
+            auto sent = priority_lane_->Submit(&request);
+            if(priority_lane_stopped_ && sent.wait_for(std::chrono::seconds(0)) == std::future_status::ready &&
+               !sent.get()){
+                num_failed_priority_requests_++;
+            }
+        }
+    }
+    return num_bulk_spans;
+}
+
+
+sdk::trace::ExportResult GcpExporter::ExportBulk(
+      const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept 
+{
+    if(!options_.project_id_attribute.empty()){
+        return ExportRouted(spans);
+    }
+    if(worker_pool_ && spans.size() >= Config().parallel_export_threshold){
+        return ExportParallel(spans);
+    }
+
     // Set up gRPC request
     google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
-    request.set_name(kProjectsPathStr + project_id_);
+    BuildRequest(spans, project_id_, &request);
+    if(request.spans_size() == 0 && spans.size() > 0){
+        // Every span was sampled out
+        return sdk::trace::ExportResult::kSuccess;
+    }
+
+    // Send the RPC and return results
+    if(SendRequest(&request)){
+        return sdk::trace::ExportResult::kSuccess;
+    } else {
+        return sdk::trace::ExportResult::kFailure;
+    }
+}
+
+
+sdk::trace::ExportResult GcpExporter::ExportParallel(
+      const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept
+{
+    // One shard per worker, plus one for the calling thread. Each shard is converted and
+    // serialized (by gRPC, inside the RPC) on its own thread.
+    size_t num_shards = worker_pool_->size() + 1;
+    const size_t max_shards = Config().max_export_shards;
+    if(max_shards > 0){
+        num_shards = std::min(num_shards, max_shards);
+    }
+    const size_t shard_size = (spans.size() + num_shards - 1) / num_shards;
+
+    std::atomic<bool> all_ok(true);
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(num_shards);
+    for(size_t begin = 0; begin < spans.size(); begin += shard_size){
+        const size_t end = std::min(begin + shard_size, spans.size());
+        const nostd::span<std::unique_ptr<sdk::trace::Recordable>> shard(spans.data() + begin, end - begin);
+        tasks.emplace_back([this, shard, &all_ok]{
+            google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+            BuildRequest(shard, project_id_, &request);
+            if(request.spans_size() > 0 && !SendRequest(&request)){
+                all_ok.store(false, std::memory_order_relaxed);
+                num_failed_sub_requests_++;
+            }
+        });
+    }
+    worker_pool_->Run(tasks);
+
+    if(all_ok.load(std::memory_order_relaxed)){
+        return sdk::trace::ExportResult::kSuccess;
+    } else {
+        return sdk::trace::ExportResult::kFailure;
+    }
+}
+
+
+sdk::trace::ExportResult GcpExporter::ExportRouted(
+      const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept
+{
+    // Group the spans by project, keeping their order within each project
+    std::map<std::string, std::vector<std::unique_ptr<sdk::trace::Recordable>>> projects;
     for(auto& recordable: spans){
-        auto span = std::unique_ptr<Recordable>(static_cast<Recordable*>(recordable.release()));
-        *request.add_spans() = std::move(span->span());
+        projects[RoutedProjectId(*recordable)].push_back(std::move(recordable));
     }
 
-    // Send the RPC
-    google::protobuf::Empty response;
-    grpc::ClientContext context;
-    grpc::Status status = trace_service_stub_->BatchWriteSpans(&context, request, &response);
+    std::atomic<bool> all_ok(true);
+    std::vector<std::function<void()>> tasks;
+    tasks.reserve(projects.size());
+    for(auto& project: projects){
+        auto* project_spans = &project;
+        tasks.emplace_back([this, project_spans, &all_ok]{
+            google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+            BuildRequest(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(project_spans->second.data(),
+                                                                             project_spans->second.size()),
+                         project_spans->first, &request);
+            if(request.spans_size() > 0 && !SendRequest(&request)){
+                all_ok.store(false, std::memory_order_relaxed);
+                num_failed_sub_requests_++;
+            }
+        });
+    }
+    if(worker_pool_ && tasks.size() > 1){
+        worker_pool_->Run(tasks);
+    } else {
+        for(auto& task: tasks){
+            task();
+        }
+    }
 
-    // Check status and return results
-    if(status.ok()){
+    if(all_ok.load(std::memory_order_relaxed)){
         return sdk::trace::ExportResult::kSuccess;
     } else {
         return sdk::trace::ExportResult::kFailure;
     }
 }
 
+
+/**
+ * Checks that a routed project is a valid Google Cloud project id, optionally scoped to a
+ * domain ("example.com:my-project"), so that it is safe to address a request to
+ */
+bool IsValidProjectId(nostd::string_view project_id) noexcept
+{
+    const size_t colon = project_id.rfind(':');
+    if(colon != nostd::string_view::npos){
+        if(colon == 0){
+            return false;
+        }
+        for(const char c: project_id.substr(0, colon)){
+            if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '.' || c == '-')){
+                return false;
+            }
+        }
+        project_id = project_id.substr(colon + 1);
+    }
+    // 6 to 30 lower case letters, digits or hyphens, starting with a letter and not ending
+    // with a hyphen
+    if(project_id.size() < 6 || project_id.size() > 30 || project_id.front() < 'a' || project_id.front() > 'z' ||
+       project_id.back() == '-'){
+        return false;
+    }
+    for(const char c: project_id){
+        if(!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-')){
+            return false;
+        }
+    }
+    return true;
+}
+
+
+std::string GcpExporter::RoutedProjectId(const sdk::trace::Recordable &recordable) const noexcept
+{
+    const std::string &key = options_.project_id_attribute;
+    nostd::string_view project_id;
+    if(options_.compact_recordables){
+        const auto &span = static_cast<const CompactRecordable&>(recordable);
+        const auto *attribute = span.FindAttribute(key);
+        if(attribute && attribute->type == CompactRecordable::AttributeType::kString){
+            project_id = span.SlabString(attribute->string_value.offset, attribute->string_value.size);
+        }
+    } else {
+        const auto &map = static_cast<const Recordable&>(recordable).span().attributes().attribute_map();
+        const auto it = map.find(key);
+        if(it != map.end() && it->second.has_string_value()){
+            project_id = it->second.string_value().value();
+        }
+    }
+    // The value becomes part of the request name, so anything else goes to the exporter's project
+    if(!IsValidProjectId(project_id)){
+        return project_id_;
+    }
+    return std::string(project_id.data(), project_id.size());
+}
+
+
+void GcpExporter::BuildRequest(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans,
+                               const std::string &project_id,
+                               google::devtools::cloudtrace::v2::BatchWriteSpansRequest* request) const noexcept
+{
+    SpanMetricsAggregator* span_metrics = options_.span_metrics.get();
+    const double export_ratio = Config().export_ratio;
+    if(options_.compact_recordables){
+        // Gather the spans into columns, freeing each recordable as soon as it is copied
+        SpanBatch batch;
+        batch.Reserve(spans.size());
+        // The stack traces of the spans, by index in the batch, set once the request is built
+        std::vector<std::pair<int, google::devtools::cloudtrace::v2::StackTrace>> stack_traces;
+        const std::string request_name = kProjectsPathStr + project_id;
+        size_t released_bytes = 0;
+        for(auto& recordable: spans){
+            auto &span = *static_cast<CompactRecordable*>(recordable.get());
+            if(span_metrics){
+                span_metrics->Record(span);
+            }
+            released_bytes += span.TakeReservedBytes();
+            if(!span.dropped() && ShouldExport(export_ratio, TraceIdLowBits(span.trace_id()),
+                                               span.has_status() && span.status_code() != 0)){
+                if(stack_traces_ && span.stack()){
+                    stack_traces.emplace_back(static_cast<int>(batch.size()), google::devtools::cloudtrace::v2::StackTrace());
+                    stack_traces_->Fill(request_name, *span.stack(), &stack_traces.back().second);
+                }
+                batch.Append(span);
+            }
+            recordable.reset();
+        }
+        ReleaseMemory(released_bytes);
+        batch.ToRequest(project_id, request);
+        for(auto& stack_trace: stack_traces){
+            request->mutable_spans(stack_trace.first)->mutable_stack_trace()->Swap(&stack_trace.second);
+        }
+        GCP_EXPORTER_PROBE2(request_built, request->spans_size(), spans.size());
+        return;
+    }
+    request->set_name(kProjectsPathStr + project_id);
+    request->mutable_spans()->Reserve(spans.size());
+    size_t released_bytes = 0;
+    for(auto& recordable: spans){
+        auto span = std::unique_ptr<Recordable>(static_cast<Recordable*>(recordable.release()));
+        if(span_metrics){
+            span_metrics->Record(*span);
+        }
+        released_bytes += span->TakeReservedBytes();
+        if(!span->dropped() && ShouldExport(export_ratio, TraceIdLowBits(span->trace_id()),
+                                            span->span().has_status() && span->span().status().code() != 0)){
+            auto* exported = request->add_spans();
+            span->ToProto(project_id, exported);
+            if(stack_traces_ && span->stack()){
+                stack_traces_->Fill(request->name(), *span->stack(), exported->mutable_stack_trace());
+            }
+        }
+    }
+    // The spans copied into the request are no longer buffered
+    ReleaseMemory(released_bytes);
+    GCP_EXPORTER_PROBE2(request_built, request->spans_size(), spans.size());
+}
+
+
+void GcpExporter::ReleaseMemory(size_t bytes) const noexcept
+{
+    if(options_.memory_budget){
+        options_.memory_budget->Release(bytes);
+    }
+}
+
+
+const RuntimeConfig &GcpExporter::Config() const noexcept
+{
+    return options_.runtime_config ? options_.runtime_config->Get() : static_config_;
+}
+
+
+bool GcpExporter::SendRequest(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request) const noexcept
+{
+    if(options_.shared_service){
+        if(capture_){
+            capture_->Write(*request);
+        }
+        // The service takes the spans, so the stacks they send are looked up beforehand
+        std::vector<int64_t> stack_hash_ids;
+        if(stack_traces_){
+            stack_hash_ids = FullStackHashIds(*request);
+        }
+        // The service coalesces the spans with those of the other exporters sharing it
+        const bool ok = options_.shared_service->Submit(request).get();
+        if(ok && !stack_hash_ids.empty()){
+            stack_traces_->Remember(request->name(), stack_hash_ids);
+        }
+        return ok;
+    }
+    return SendOnStub(*request);
+}
+
+
+bool GcpExporter::SendOnStub(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) const noexcept
+{
+    if(capture_){
+        capture_->Write(request);
+    }
+    const size_t stub_index = next_stub_.fetch_add(1, std::memory_order_relaxed) % trace_service_stubs_.size();
+    GCP_EXPORTER_PROBE2(rpc_start, request.spans_size(), stub_index);
+    grpc::Status status;
+    if(hedger_){
+        // A hedge goes on the next stub, with the compression chosen for the request
+        const bool compress = compressor_ != nullptr && Config().compression;
+        const grpc_compression_algorithm algorithm = compress ? compressor_->Choose(request) : GRPC_COMPRESS_NONE;
+        status = hedger_->Send(trace_service_stubs_[stub_index].get(),
+                               trace_service_stubs_[(stub_index + 1) % trace_service_stubs_.size()].get(),
+                               request,
+                               [compress, algorithm](grpc::ClientContext *context){
+                                   if(compress){
+                                       context->set_compression_algorithm(algorithm);
+                                   }
+                               });
+    } else {
+        google::protobuf::Empty response;
+        grpc::ClientContext context;
+        if(compressor_ && Config().compression){
+            context.set_compression_algorithm(compressor_->Choose(request));
+        }
+        status = trace_service_stubs_[stub_index]->BatchWriteSpans(&context, request, &response);
+    }
+    // Serializing the request inside the call cached its size
+    GCP_EXPORTER_PROBE3(rpc_done, request.spans_size(), request.GetCachedSize(), static_cast<int>(status.error_code()));
+    if(status.ok() && stack_traces_){
+        // Later spans to the project may reference the stacks it received
+        stack_traces_->Remember(request.name(), FullStackHashIds(request));
+    }
+    return status.ok();
+}
+
 } // gcp
 } // exporter
 OPENTELEMETRY_END_NAMESPACE
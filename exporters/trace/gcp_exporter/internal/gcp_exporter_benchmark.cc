@@ -16,15 +16,11 @@
 
 #include <benchmark/benchmark.h>
 #include "exporters/trace/gcp_exporter/gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
 
-namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+#include <vector>
 
-// These constants affect the overall runtime of the benchmark tests
-constexpr int kNumSpans = 200;
-constexpr int kNumIntAttributes = 30;
-constexpr int kNumStrAttributes = 30;
-constexpr int kNumBoolAttributes = 30;
-constexpr int kNumIterations = 1000;
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
 
 
 OPENTELEMETRY_BEGIN_NAMESPACE
@@ -33,60 +29,6 @@ namespace exporter
 namespace gcp 
 {
 
-/* ################################## CUSTOM MOCK STUB ######################################## */
-
-/**
- * This class implements a mock functionality of the StubInterface for benchmarking purposes
- */
-class MockStub final : public cloudtrace_v2::TraceService::StubInterface 
-{
-public:
-  grpc::Status BatchWriteSpans(grpc::ClientContext*,
-                               const cloudtrace_v2::BatchWriteSpansRequest&, 
-                               google::protobuf::Empty*)
-  {
-    return grpc::Status::OK;
-  }
-
-  grpc::Status CreateSpan(grpc::ClientContext*, 
-                          const cloudtrace_v2::Span&, 
-                          cloudtrace_v2::Span*)
-  {
-    return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
-  }
-
-private:
-  grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* AsyncBatchWriteSpansRaw(grpc::ClientContext*, 
-                                                                                             const cloudtrace_v2::BatchWriteSpansRequest&, 
-                                                                                             grpc::CompletionQueue*)
-  {
-    return nullptr;
-  }
-
-  grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* PrepareAsyncBatchWriteSpansRaw(grpc::ClientContext*, 
-                                                                                                    const cloudtrace_v2::BatchWriteSpansRequest&, 
-                                                                                                    grpc::CompletionQueue*)
-  {
-    return nullptr;
-  }
-
-  grpc::ClientAsyncResponseReaderInterface<cloudtrace_v2::Span>* AsyncCreateSpanRaw(grpc::ClientContext*, 
-                                                                                    const cloudtrace_v2::Span&, 
-                                                                                    grpc::CompletionQueue*)
-  {
-    return nullptr;
-  }
-
-  grpc::ClientAsyncResponseReaderInterface<cloudtrace_v2::Span>* PrepareAsyncCreateSpanRaw(grpc::ClientContext*, 
-                                                                                           const cloudtrace_v2::Span&, 
-                                                                                           grpc::CompletionQueue*)
-  {
-    return nullptr;
-  };
-
-};
-
-
 /* ################################# FIXTURE CLASS ####################################### */
 
 /**
@@ -110,143 +52,114 @@ public:
                                         "test_project"));
   }
 
-
   /**
-   * Generates a batch of empty spans
+   * Repeatedly exports batches of spans of the given shape. Only the call to Export is timed:
+   * the recordables are built with the timer paused.
    * 
-   * @param empty_spans - The array to populate with the generated empty spans 
+   * @param state - The benchmark state
+   * @param shape - The shape of every span in the batch
+   * @param batch_size - Number of spans in every exported batch
    */
-  void GenerateEmptySpans(std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans>& empty_spans){
-    for(int i = 0; i < kNumSpans; ++i){
-      // Make the span
-      auto rec = std::unique_ptr<sdk::trace::Recordable>(new Recordable);
+  void RunExportBenchmark(benchmark::State& state, const SpanShape &shape, size_t batch_size)
+  {
+    const auto gcp_exporter = GetMockExporter();
+    const SpanGenerator generator(shape);
+    std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables(batch_size);
+
+    for(auto _ : state)
+    {
+      state.PauseTiming();
+      for(auto& recordable: recordables){
+        recordable = gcp_exporter->MakeRecordable();
+        generator.Fill(*recordable);
+      }
+      state.ResumeTiming();
 
-      // Add to array
-      empty_spans[i] = std::move(rec);
+      gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                               recordables.size()));
     }
+    state.SetItemsProcessed(state.iterations() * batch_size);
   }
+};
 
+/* ############################### BENCHMARK ARGUMENTS ################################### */
 
-  /**
-   * Generates a batch of lightweight spans
-   * 
-   * @param sparse_spans - The array to populate with the generated sparse spans 
-   */
-  void GenerateSparseSpans(std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans>& sparse_spans){
-    for(int i = 0; i < kNumSpans; ++i){
-      // Make the span
-      auto rec = std::unique_ptr<sdk::trace::Recordable>(new Recordable);
-
-      rec->SetName("Test Span");
-
-      rec->SetIds(trace_id_, span_id_, parent_span_id_);
-
-      // Set start time (making it 0 in this case)
-      rec->SetStartTime(start_timestamp);
-
-      rec->SetDuration(std::chrono::nanoseconds(100));
+// Batch sizes every benchmark is run with
+const std::vector<int64_t> kBatchSizes = {200, 2000};
 
-      // Add to array
-      sparse_spans[i] = std::move(rec);
+/**
+ * Crosses every batch size with the attribute workloads:
+ * {batch size, attributes of each type, attribute key length, string value length}
+ */
+void AttributesArgs(benchmark::internal::Benchmark* benchmark)
+{
+  for(int64_t batch_size: kBatchSizes){
+    for(int64_t num_attributes: {1, 8, 32}){
+      for(int64_t key_length: {8, 64}){
+        for(int64_t value_length: {8, 256}){
+          benchmark->Args({batch_size, num_attributes, key_length, value_length});
+        }
+      }
     }
   }
+}
 
-
-  /**
-   * Generates a batch of heavyweight, dense spans
-   * 
-   * @param dense_spans - The array to populate with dense spans
-   */
-  void GenerateDenseSpans(std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans>& dense_spans){
-    for(int i = 0; i < kNumSpans; ++i){
-      // Make the span
-      auto rec = std::unique_ptr<sdk::trace::Recordable>(new Recordable);
-
-      rec->SetName("Test Span");
-
-      rec->SetIds(trace_id_, span_id_, parent_span_id_);
-
-      // Set start time (making it 0 in this case)
-      rec->SetStartTime(start_timestamp);
-
-      rec->SetDuration(std::chrono::nanoseconds(100));
-
-      // Add several 'integer' attributes 
-      for(int i = 0 ; i < kNumIntAttributes; ++i){
-        rec->SetAttribute("int_key_" + i, static_cast<int64_t>(i));
-      }
-
-      // Add several 'string' attributes 
-      for(int i = 0 ; i < kNumStrAttributes; ++i){
-        rec->SetAttribute("str_key_" + i, "string_val_" + i);
-      }
-
-      // Add several 'bool' attributes 
-      for(int i = 0 ; i < kNumBoolAttributes; ++i){
-        // Setting all to true
-        rec->SetAttribute("bool_key_" + i, true);
-      }
-      
-      // Add to array
-      dense_spans[i] = std::move(rec);
+/**
+ * Crosses every batch size with the event counts: {batch size, events}. Links are left out,
+ * since Cloud Trace spans are exported without them.
+ */
+void EventsArgs(benchmark::internal::Benchmark* benchmark)
+{
+  for(int64_t batch_size: kBatchSizes){
+    for(int64_t num_events: {0, 4, 16}){
+      benchmark->Args({batch_size, num_events});
     }
   }
-
-private:
-  const trace::TraceId trace_id_ = trace::TraceId(
-  std::array<const uint8_t, trace::TraceId::kSize>(
-  {0, 1, 0, 2, 1, 3, 1, 4, 1, 5, 1, 6, 3, 7, 0, 0}));
-
-  const trace::SpanId span_id_ = trace::SpanId(
-  std::array<const uint8_t, trace::SpanId::kSize>(
-  {1, 2, 3, 4, 5, 6, 7, 8}));
-
-  const trace::SpanId parent_span_id_ = trace::SpanId(
-  std::array<const uint8_t, trace::SpanId::kSize>(
-  {4, 5, 0, 1, 1, 1, 1, 3}));
-  
-  const core::SystemTimestamp start_timestamp;
-};
+}
 
 /* ################################## BENCHMARKS ######################################## */
 
-BENCHMARK_F(GcpExporterBenchmark, EmptySpansExportTest)(benchmark::State& state) {
-  // Get mock exporter
-  const auto gcp_exporter = GetMockExporter();
-
-  while(state.KeepRunningBatch(kNumIterations))
-  {
-    std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans> recordables;
-    GenerateEmptySpans(recordables);
-    gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables));
-  }
+// Args: {batch size}
+BENCHMARK_DEFINE_F(GcpExporterBenchmark, EmptySpansExportTest)(benchmark::State& state) {
+  RunExportBenchmark(state, EmptySpanShape(), state.range(0));
 }
+BENCHMARK_REGISTER_F(GcpExporterBenchmark, EmptySpansExportTest)->Arg(200)->Arg(2000);
 
 
-BENCHMARK_F(GcpExporterBenchmark, SparseSpansExportTest)(benchmark::State& state) {
-  // Get mock exporter
-  const auto gcp_exporter = GetMockExporter();
-
-  while(state.KeepRunningBatch(kNumIterations))
-  {
-    std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans> recordables;
-    GenerateSparseSpans(recordables);
-    gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables));
-  }
+// Args: {batch size}
+BENCHMARK_DEFINE_F(GcpExporterBenchmark, SparseSpansExportTest)(benchmark::State& state) {
+  RunExportBenchmark(state, SparseSpanShape(), state.range(0));
 }
+BENCHMARK_REGISTER_F(GcpExporterBenchmark, SparseSpansExportTest)->Arg(200)->Arg(2000);
 
 
-BENCHMARK_F(GcpExporterBenchmark, DenseSpansExportTest)(benchmark::State& state) {
-  // Get mock exporter
-  const auto gcp_exporter = GetMockExporter();
+// Args: {batch size}
+BENCHMARK_DEFINE_F(GcpExporterBenchmark, DenseSpansExportTest)(benchmark::State& state) {
+  RunExportBenchmark(state, DenseSpanShape(), state.range(0));
+}
+BENCHMARK_REGISTER_F(GcpExporterBenchmark, DenseSpansExportTest)->Arg(200)->Arg(2000);
+
+
+// Args: {batch size, attributes of each type, attribute key length, string value length}
+BENCHMARK_DEFINE_F(GcpExporterBenchmark, AttributesExportTest)(benchmark::State& state) {
+  SpanShape shape = SparseSpanShape();
+  shape.num_int_attributes = state.range(1);
+  shape.num_str_attributes = state.range(1);
+  shape.num_bool_attributes = state.range(1);
+  shape.key_length = state.range(2);
+  shape.str_value_length = state.range(3);
+  RunExportBenchmark(state, shape, state.range(0));
+}
+BENCHMARK_REGISTER_F(GcpExporterBenchmark, AttributesExportTest)->Apply(AttributesArgs);
 
-  while(state.KeepRunningBatch(kNumIterations))
-  {
-    std::array<std::unique_ptr<sdk::trace::Recordable>, kNumSpans> recordables;
-    GenerateDenseSpans(recordables);    
-    gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables));
-  }
+
+// Args: {batch size, events}
+BENCHMARK_DEFINE_F(GcpExporterBenchmark, EventsExportTest)(benchmark::State& state) {
+  SpanShape shape = SparseSpanShape();
+  shape.num_events = state.range(1);
+  RunExportBenchmark(state, shape, state.range(0));
 }
+BENCHMARK_REGISTER_F(GcpExporterBenchmark, EventsExportTest)->Apply(EventsArgs);
 
 
 } // gcp
@@ -16,7 +16,16 @@
 
 #include "gtest/gtest.h"
 #include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <mutex>
+#include <thread>
 #include "../gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/span_capture.h"
 #include "opentelemetry/sdk/trace/simple_processor.h"
 #include "opentelemetry/sdk/trace/tracer_provider.h"
 #include "opentelemetry/trace/provider.h"
@@ -39,10 +48,44 @@ namespace gcp {
 class GcpExporterTestPeer : public ::testing::Test
 {
 public:
-    std::unique_ptr<GcpExporter> GetExporter(cloudtrace_v2::TraceService::StubInterface* mock_stub) 
+    std::unique_ptr<GcpExporter> GetExporter(cloudtrace_v2::TraceService::StubInterface* mock_stub,
+                                             const GcpExporterOptions &options = GcpExporterOptions()) 
     {
         return std::unique_ptr<GcpExporter>(new GcpExporter(std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>(mock_stub),
-                                            "test_project"));
+                                            "test_project", options));
+    }
+
+    std::unique_ptr<GcpExporter> GetPooledExporter(const std::vector<cloudtrace_v2::TraceService::StubInterface*> &mock_stubs,
+                                                   const GcpExporterOptions &options) 
+    {
+        std::vector<std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>> stubs;
+        for(auto* mock_stub: mock_stubs){
+            stubs.emplace_back(mock_stub);
+        }
+        return std::unique_ptr<GcpExporter>(new GcpExporter(std::move(stubs), "test_project", options));
+    }
+
+    std::shared_ptr<SharedExportService> GetSharedService(cloudtrace_v2::TraceService::StubInterface* mock_stub,
+                                                          const SharedExportServiceOptions &options)
+    {
+        return GetSharedService(std::vector<cloudtrace_v2::TraceService::StubInterface*>{mock_stub}, options);
+    }
+
+    std::shared_ptr<SharedExportService> GetSharedService(const std::vector<cloudtrace_v2::TraceService::StubInterface*> &mock_stubs,
+                                                          const SharedExportServiceOptions &options)
+    {
+        std::vector<std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>> stubs;
+        for(auto* mock_stub: mock_stubs){
+            stubs.emplace_back(mock_stub);
+        }
+        return std::shared_ptr<SharedExportService>(new SharedExportService(std::move(stubs), options));
+    }
+
+    std::unique_ptr<GcpExporter> GetProjectExporter(const char* project_id, const GcpExporterOptions &options)
+    {
+        return std::unique_ptr<GcpExporter>(new GcpExporter(
+            std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>(new cloudtrace_v2::MockTraceServiceStub()),
+            project_id, options));
     }
 };
 
@@ -104,6 +147,608 @@ TEST_F(GcpExporterTestPeer, TestExportResults)
     EXPECT_EQ(sdk::trace::ExportResult::kFailure, result_2);
 }
 
+
+TEST_F(GcpExporterTestPeer, TestThreadLocalStagingExport)
+{
+    GcpExporterOptions options;
+    options.thread_local_staging = true;
+
+    // Set up mock stub
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    // Recordables are created on one thread and freed by the exporter on another
+    std::unique_ptr<sdk::trace::Recordable> recordable;
+    std::thread([&]{
+        recordable = gcp_exporter->MakeRecordable();
+        recordable->SetName("Staged span");
+    }).join();
+
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(1).WillOnce(Return(Status::OK));
+    auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1));
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+}
+
+TEST_F(GcpExporterTestPeer, TestCompactRecordableExport)
+{
+    GcpExporterOptions options;
+    options.compact_recordables = true;
+
+    // Set up mock stub
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    auto recordable = gcp_exporter->MakeRecordable();
+    ASSERT_NE(nullptr, dynamic_cast<CompactRecordable*>(recordable.get()));
+    recordable->SetName("Compact span");
+
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(1).WillOnce(
+        testing::Invoke([](grpc::ClientContext*, 
+                           const cloudtrace_v2::BatchWriteSpansRequest& request,
+                           google::protobuf::Empty*){
+            EXPECT_EQ(1, request.spans_size());
+            EXPECT_EQ("Compact span", request.spans(0).display_name().value());
+            EXPECT_EQ(0, request.spans(0).name().find("projects/test_project/traces/"));
+            return Status::OK;
+        }));
+    auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1));
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+}
+
+TEST_F(GcpExporterTestPeer, TestCompressedExport)
+{
+    GcpExporterOptions options;
+    options.compression_codec = std::make_shared<GzipCodec>();
+    options.compression.min_request_bytes = 1024;
+
+    // Set up mock stub
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    auto export_spans = [&](int num_spans){
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+        for(int i = 0; i < num_spans; ++i){
+            recordables.push_back(gcp_exporter->MakeRecordable());
+            recordables.back()->SetName("Repetitive span name");
+            recordables.back()->SetAttribute("repetitive.attribute.key", "repetitive attribute value");
+        }
+        gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(),
+                                                                                 recordables.size()));
+    };
+
+    // Small batches go out uncompressed, large repetitive ones compressed
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(2)
+        .WillOnce(testing::Invoke([](grpc::ClientContext* context, 
+                                     const cloudtrace_v2::BatchWriteSpansRequest&,
+                                     google::protobuf::Empty*){
+            EXPECT_EQ(GRPC_COMPRESS_NONE, context->compression_algorithm());
+            return Status::OK;
+        }))
+        .WillOnce(testing::Invoke([](grpc::ClientContext* context, 
+                                     const cloudtrace_v2::BatchWriteSpansRequest&,
+                                     google::protobuf::Empty*){
+            EXPECT_EQ(GRPC_COMPRESS_GZIP, context->compression_algorithm());
+            return Status::OK;
+        }));
+    export_spans(1);
+    export_spans(100);
+}
+
+TEST_F(GcpExporterTestPeer, TestSampledExport)
+{
+    for(bool compact: {false, true}){
+        GcpExporterOptions options;
+        options.compact_recordables = compact;
+        options.export_ratio = 0.0;
+        options.span_metrics = std::make_shared<SpanMetricsAggregator>();
+
+        // Set up mock stub
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        auto gcp_exporter = GetExporter(mock_stub, options);
+
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+        for(int i = 0; i < 10; ++i){
+            recordables.push_back(gcp_exporter->MakeRecordable());
+            recordables.back()->SetName("Sampled span");
+        }
+        recordables[3]->SetStatus(trace::CanonicalCode::UNAVAILABLE, "Failed");
+
+        // Only the error is exported, but every span is counted
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(1).WillOnce(
+            testing::Invoke([](grpc::ClientContext*, 
+                               const cloudtrace_v2::BatchWriteSpansRequest& request,
+                               google::protobuf::Empty*){
+                EXPECT_EQ(1, request.spans_size());
+                EXPECT_EQ(14, request.spans(0).status().code());
+                return Status::OK;
+            }));
+        auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(
+            recordables.data(), recordables.size()));
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+
+        const auto metrics = options.span_metrics->Collect();
+        ASSERT_EQ(1, metrics.size());
+        EXPECT_EQ(10, metrics[0].count);
+        EXPECT_EQ(1, metrics[0].error_count);
+
+        // A batch without errors sends nothing
+        auto recordable = gcp_exporter->MakeRecordable();
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess, 
+                  gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestRuntimeConfig)
+{
+    for(bool compact: {false, true}){
+        GcpExporterOptions options;
+        options.compact_recordables = compact;
+        RuntimeConfig config;
+        config.export_ratio = 0.0;
+        options.runtime_config = std::make_shared<ConfigStore>(config);
+
+        // Set up mock stub
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        auto gcp_exporter = GetExporter(mock_stub, options);
+
+        // Nothing is sent while the config samples every trace out
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(0);
+        auto recordable = gcp_exporter->MakeRecordable();
+        recordable->SetName("Sampled span");
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+                  gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+        testing::Mock::VerifyAndClearExpectations(mock_stub);
+
+        // The updated config applies to the next spans and batches
+        config.export_ratio = 1.0;
+        config.display_name_string_len = 4;
+        options.runtime_config->Update(config);
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(1).WillOnce(
+            testing::Invoke([](grpc::ClientContext*,
+                               const cloudtrace_v2::BatchWriteSpansRequest& request,
+                               google::protobuf::Empty*){
+                EXPECT_EQ(1, request.spans_size());
+                EXPECT_EQ("Samp", request.spans(0).display_name().value());
+                return Status::OK;
+            }));
+        recordable = gcp_exporter->MakeRecordable();
+        recordable->SetName("Sampled span");
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+                  gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestProjectRouting)
+{
+    // Spans are addressed to their project by the exporter alone
+    unsetenv(kGCPEnvVar);
+    for(bool compact: {false, true}){
+        GcpExporterOptions options;
+        options.compact_recordables = compact;
+        options.project_id_attribute = "tenant.project_id";
+
+        // Set up mock stub
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        auto gcp_exporter = GetExporter(mock_stub, options);
+
+        const std::vector<std::string> tenants = {"tenant-a", "", "example.com:tenant-b", "tenant-a",
+                                                  "example.com:tenant-b", "tenant-a", "tenant-a/traces/x",
+                                                  "Tenant_A", "tenant-"};
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+        for(size_t i = 0; i < tenants.size(); ++i){
+            recordables.push_back(gcp_exporter->MakeRecordable());
+            recordables.back()->SetIds(trace::TraceId(), trace::SpanId(), trace::SpanId());
+            recordables.back()->SetName("span " + std::to_string(i));
+            if(!tenants[i].empty()){
+                recordables.back()->SetAttribute("tenant.project_id", tenants[i]);
+            }
+        }
+
+        // One request per project, spans without a valid project going to the exporter's project
+        std::map<std::string, std::vector<std::string>> requests;
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(3).WillRepeatedly(
+            testing::Invoke([&requests](grpc::ClientContext*, 
+                                        const cloudtrace_v2::BatchWriteSpansRequest& request,
+                                        google::protobuf::Empty*){
+                for(const auto& span: request.spans()){
+                    EXPECT_EQ(0, span.name().find(request.name() + "/traces/")) << span.name();
+                    requests[request.name()].push_back(span.display_name().value());
+                }
+                return Status::OK;
+            }));
+        auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(
+            recordables.data(), recordables.size()));
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+
+        EXPECT_EQ(std::vector<std::string>({"span 0", "span 3", "span 5"}), requests["projects/tenant-a"]);
+        EXPECT_EQ(std::vector<std::string>({"span 2", "span 4"}), requests["projects/example.com:tenant-b"]);
+        EXPECT_EQ(std::vector<std::string>({"span 1", "span 6", "span 7", "span 8"}), requests["projects/test_project"]);
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestChannelPool)
+{
+    auto first_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto second_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetPooledExporter({first_stub, second_stub}, GcpExporterOptions());
+
+    // Requests alternate between the channels
+    EXPECT_CALL(*first_stub, BatchWriteSpans(_,_,_)).Times(2).WillRepeatedly(Return(Status::OK));
+    EXPECT_CALL(*second_stub, BatchWriteSpans(_,_,_)).Times(2).WillRepeatedly(Return(Status::OK));
+    for(int i = 0; i < 4; ++i){
+        auto recordable = gcp_exporter->MakeRecordable();
+        gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1));
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestParallelExport)
+{
+    GcpExporterOptions options;
+    options.num_export_threads = 3;
+    options.parallel_export_threshold = 8;
+
+    // Set up mock stub
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+    for(int i = 0; i < 10; ++i){
+        recordables.push_back(gcp_exporter->MakeRecordable());
+        recordables.back()->SetName("Sample span");
+    }
+
+    // The batch is split into one sub-batch per thread, and every span is sent exactly once
+    std::atomic<int> num_spans_sent(0);
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(4).WillRepeatedly(
+        testing::Invoke([&num_spans_sent](grpc::ClientContext*, 
+                                          const cloudtrace_v2::BatchWriteSpansRequest& request,
+                                          google::protobuf::Empty*){
+            EXPECT_EQ("projects/test_project", request.name());
+            num_spans_sent += request.spans_size();
+            return Status::OK;
+        }));
+    auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                                           recordables.size()));
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+    EXPECT_EQ(10, num_spans_sent.load());
+
+    EXPECT_EQ(0, gcp_exporter->num_failed_sub_requests());
+
+    // Any failing sub-batch fails the whole export, and is counted
+    for(auto& recordable: recordables){
+        recordable = gcp_exporter->MakeRecordable();
+    }
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(4)
+        .WillOnce(Return(Status::CANCELLED))
+        .WillRepeatedly(Return(Status::OK));
+    result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                                      recordables.size()));
+    EXPECT_EQ(sdk::trace::ExportResult::kFailure, result);
+    EXPECT_EQ(1, gcp_exporter->num_failed_sub_requests());
+}
+
+TEST_F(GcpExporterTestPeer, TestCaptureExport)
+{
+    const std::string capture_path = "/tmp/gcp_exporter_test.capture." + std::to_string(getpid());
+    GcpExporterOptions options;
+    options.capture_path = capture_path;
+
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(2).WillRepeatedly(Return(Status::OK));
+    for(const char *name: {"first span", "second span"}){
+        auto recordable = gcp_exporter->MakeRecordable();
+        recordable->SetName(name);
+        gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1));
+    }
+    gcp_exporter->Shutdown();
+
+    // Every request sent is in the capture, in order
+    auto reader = SpanCaptureReader::Open(capture_path);
+    ASSERT_NE(nullptr, reader);
+    std::vector<std::string> names;
+    CapturedRequest captured;
+    while(reader->Next(&captured)){
+        cloudtrace_v2::BatchWriteSpansRequest request;
+        ASSERT_TRUE(request.ParseFromArray(captured.payload.data(), static_cast<int>(captured.payload.size())));
+        EXPECT_EQ("projects/test_project", request.name());
+        ASSERT_EQ(1, request.spans_size());
+        names.push_back(request.spans(0).display_name().value());
+    }
+    EXPECT_EQ(std::vector<std::string>({"first span", "second span"}), names);
+    unlink(capture_path.c_str());
+}
+
+TEST_F(GcpExporterTestPeer, TestEagerConnect)
+{
+    GcpExporterOptions options;
+    options.eager_connect = true;
+
+    // The constructor sends an empty warm-up call, before anything is exported
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).WillOnce(
+        testing::Invoke([](grpc::ClientContext*, 
+                           const cloudtrace_v2::BatchWriteSpansRequest& request,
+                           google::protobuf::Empty*){
+            EXPECT_EQ("projects/test_project", request.name());
+            EXPECT_EQ(0, request.spans_size());
+            return Status::OK;
+        }));
+    auto gcp_exporter = GetExporter(mock_stub, options);
+    testing::Mock::VerifyAndClearExpectations(mock_stub);
+
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).WillOnce(Return(Status::OK));
+    auto recordable = gcp_exporter->MakeRecordable();
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+              gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+}
+
+TEST_F(GcpExporterTestPeer, TestSharedService)
+{
+    SharedExportServiceOptions service_options;
+    service_options.max_batch_size = 4;
+    service_options.max_delay = std::chrono::milliseconds(60000);
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    GcpExporterOptions options;
+    options.shared_service = GetSharedService(mock_stub, service_options);
+
+    // The exporters send nothing themselves
+    auto first_exporter = GetExporter(new cloudtrace_v2::MockTraceServiceStub(), options);
+    auto second_exporter = GetExporter(new cloudtrace_v2::MockTraceServiceStub(), options);
+
+    // Two spans from each exporter fill one request
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).WillOnce(
+        testing::Invoke([](grpc::ClientContext*, 
+                           const cloudtrace_v2::BatchWriteSpansRequest& request,
+                           google::protobuf::Empty*){
+            EXPECT_EQ("projects/test_project", request.name());
+            EXPECT_EQ(4, request.spans_size());
+            return Status::OK;
+        }));
+    std::vector<std::thread> threads;
+    for(auto* exporter: {first_exporter.get(), second_exporter.get()}){
+        threads.emplace_back([exporter]{
+            std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+            recordables.push_back(exporter->MakeRecordable());
+            recordables.push_back(exporter->MakeRecordable());
+            EXPECT_EQ(sdk::trace::ExportResult::kSuccess, 
+                      exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                                           recordables.size())));
+        });
+    }
+    for(auto& thread: threads){
+        thread.join();
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestSharedServiceSendsConcurrently)
+{
+    SharedExportServiceOptions service_options;
+    service_options.num_channels = 2;
+    service_options.max_delay = std::chrono::milliseconds(1);
+    std::mutex mu;
+    std::condition_variable cv;
+    int num_in_flight = 0;
+    int max_in_flight = 0;
+    // A slow stub, which holds each call until the other call is in flight, up to a timeout
+    auto slow_call = [&](grpc::ClientContext*, const cloudtrace_v2::BatchWriteSpansRequest&, google::protobuf::Empty*){
+        std::unique_lock<std::mutex> lock(mu);
+        max_in_flight = std::max(max_in_flight, ++num_in_flight);
+        cv.notify_all();
+        cv.wait_for(lock, std::chrono::seconds(5), [&]{ return max_in_flight == 2; });
+        --num_in_flight;
+        return Status::OK;
+    };
+    std::vector<cloudtrace_v2::TraceService::StubInterface*> mock_stubs;
+    for(int i = 0; i < 2; ++i){
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).WillRepeatedly(testing::Invoke(slow_call));
+        mock_stubs.push_back(mock_stub);
+    }
+    GcpExporterOptions options;
+    options.shared_service = GetSharedService(mock_stubs, service_options);
+
+    // The requests to two projects cannot be coalesced, and go out on both channels at once
+    auto first_exporter = GetProjectExporter("project_a", options);
+    auto second_exporter = GetProjectExporter("project_b", options);
+    std::vector<std::thread> threads;
+    for(auto* exporter: {first_exporter.get(), second_exporter.get()}){
+        threads.emplace_back([exporter]{
+            auto recordable = exporter->MakeRecordable();
+            EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+                      exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+        });
+    }
+    for(auto& thread: threads){
+        thread.join();
+    }
+    EXPECT_EQ(2, max_in_flight);
+}
+
+TEST_F(GcpExporterTestPeer, TestPriorityLane)
+{
+    GcpExporterOptions options;
+    options.priority_lane = true;
+    options.priority_attribute_keys = {"critical"};
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+    for(const char *name: {"bulk span", "error span", "critical span", "other bulk span"}){
+        recordables.push_back(gcp_exporter->MakeRecordable());
+        recordables.back()->SetName(name);
+    }
+    recordables[1]->SetStatus(trace::CanonicalCode::UNAVAILABLE, "Failed");
+    recordables[2]->SetAttribute("critical", true);
+
+    // The priority request is held up until Export has returned, which it does without it
+    std::promise<void> exported;
+    auto exported_future = exported.get_future().share();
+    std::promise<void> priority_sent;
+    auto priority_sent_future = priority_sent.get_future();
+    std::map<std::string, std::vector<std::string>> requests;
+    std::mutex requests_mu;
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(2).WillRepeatedly(
+        testing::Invoke([&](grpc::ClientContext*, 
+                            const cloudtrace_v2::BatchWriteSpansRequest& request,
+                            google::protobuf::Empty*){
+            const bool is_priority = request.spans(0).display_name().value() == "error span";
+            if(is_priority){
+                EXPECT_EQ(std::future_status::ready, exported_future.wait_for(std::chrono::seconds(10)));
+            }
+            {
+                std::lock_guard<std::mutex> lock(requests_mu);
+                for(const auto& span: request.spans()){
+                    requests[is_priority ? "priority" : "bulk"].push_back(span.display_name().value());
+                }
+            }
+            if(is_priority){
+                priority_sent.set_value();
+                return Status(grpc::StatusCode::UNAVAILABLE, "Unavailable");
+            }
+            return Status::OK;
+        }));
+    auto result = gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                                           recordables.size()));
+    exported.set_value();
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, result);
+    ASSERT_EQ(std::future_status::ready, priority_sent_future.wait_for(std::chrono::seconds(10)));
+
+    // The failure of the priority request is counted, not returned
+    gcp_exporter->Shutdown(std::chrono::seconds(10));
+    EXPECT_EQ(1, gcp_exporter->num_failed_priority_requests());
+    std::lock_guard<std::mutex> lock(requests_mu);
+    EXPECT_EQ(std::vector<std::string>({"error span", "critical span"}), requests["priority"]);
+    EXPECT_EQ(std::vector<std::string>({"bulk span", "other bulk span"}), requests["bulk"]);
+}
+
+TEST_F(GcpExporterTestPeer, TestShutdownSendsPriorityLane)
+{
+    GcpExporterOptions options;
+    options.priority_lane = true;
+    options.priority_max_delay = std::chrono::milliseconds(60000);
+    options.num_export_threads = 2;
+    auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+    auto gcp_exporter = GetExporter(mock_stub, options);
+
+    std::vector<std::string> names;
+    std::mutex names_mu;
+    EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(2).WillRepeatedly(
+        testing::Invoke([&](grpc::ClientContext*, 
+                            const cloudtrace_v2::BatchWriteSpansRequest& request,
+                            google::protobuf::Empty*){
+            std::lock_guard<std::mutex> lock(names_mu);
+            names.push_back(request.spans(0).display_name().value());
+            return Status::OK;
+        }));
+    bool shut_down = false;
+    for(const char *name: {"before shutdown", "after shutdown"}){
+        auto recordable = gcp_exporter->MakeRecordable();
+        recordable->SetName(name);
+        recordable->SetStatus(trace::CanonicalCode::INTERNAL, "Failed");
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+                  gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+
+        // The span waiting for the lane's delay is sent by the time Shutdown returns, and
+        // the priority spans of later exports go out with the rest of their batch
+        if(!shut_down){
+            gcp_exporter->Shutdown(std::chrono::seconds(10));
+            shut_down = true;
+        }
+        std::lock_guard<std::mutex> lock(names_mu);
+        EXPECT_EQ(name, names.back());
+    }
+    EXPECT_EQ(0, gcp_exporter->num_failed_priority_requests());
+}
+
+TEST_F(GcpExporterTestPeer, TestStackTraces)
+{
+    for(bool compact: {false, true}){
+        GcpExporterOptions options;
+        options.compact_recordables = compact;
+        options.stack_capture = StackCapture::kOnError;
+        options.project_id_attribute = "project";
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        auto gcp_exporter = GetExporter(mock_stub, options);
+
+        std::vector<cloudtrace_v2::BatchWriteSpansRequest> requests;
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).Times(4).WillRepeatedly(
+            testing::Invoke([&](grpc::ClientContext*, 
+                                const cloudtrace_v2::BatchWriteSpansRequest& request,
+                                google::protobuf::Empty*){
+                requests.push_back(request);
+                // The first request fails, so its stack must be sent in full again
+                return requests.size() == 1 ? Status::CANCELLED : Status::OK;
+            }));
+        for(int i = 0; i < 4; ++i){
+            // Every error span is recorded from the same call site, so has the same stack
+            std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+            for(int j = 0; j < 2; ++j){
+                recordables.push_back(gcp_exporter->MakeRecordable());
+                if(i == 3){
+                    // The last batch goes to a project that has not received the stack
+                    recordables.back()->SetAttribute("project", "other-project");
+                }
+                recordables.back()->SetStatus(j == 0 ? trace::CanonicalCode::UNKNOWN : trace::CanonicalCode::OK, "");
+            }
+            gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(),
+                                                                                     recordables.size()));
+        }
+
+        ASSERT_EQ(4, requests.size());
+        const int64_t hash_id = requests[0].spans(0).stack_trace().stack_trace_hash_id();
+        EXPECT_NE(0, hash_id);
+        for(const auto& request: requests){
+            ASSERT_EQ(2, request.spans_size());
+            EXPECT_EQ(hash_id, request.spans(0).stack_trace().stack_trace_hash_id());
+            EXPECT_FALSE(request.spans(1).has_stack_trace());
+        }
+        EXPECT_TRUE(requests[0].spans(0).stack_trace().has_stack_frames());
+        EXPECT_TRUE(requests[1].spans(0).stack_trace().has_stack_frames());
+        EXPECT_FALSE(requests[2].spans(0).stack_trace().has_stack_frames());
+        EXPECT_EQ("projects/other-project", requests[3].name());
+        EXPECT_TRUE(requests[3].spans(0).stack_trace().has_stack_frames());
+    }
+}
+
+TEST_F(GcpExporterTestPeer, TestMemoryBudget)
+{
+    for(bool compact: {false, true}){
+        GcpExporterOptions options;
+        options.compact_recordables = compact;
+        options.memory_budget = std::make_shared<MemoryBudget>(768,
+                                                               MemoryBudgetPolicy::kDropSpans);
+        auto mock_stub = new cloudtrace_v2::MockTraceServiceStub();
+        auto gcp_exporter = GetExporter(mock_stub, options);
+
+        // Each span reserves 384 bytes of chunks, so the third one is dropped
+        const std::string value(256, 'x');
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+        for(const char *name: {"span 1", "span 2", "span 3"}){
+            recordables.push_back(gcp_exporter->MakeRecordable());
+            recordables.back()->SetName(name);
+            recordables.back()->SetAttribute("value", nostd::string_view(value));
+        }
+        EXPECT_EQ(768, options.memory_budget->reserved_bytes());
+
+        std::vector<std::string> exported;
+        EXPECT_CALL(*mock_stub, BatchWriteSpans(_,_,_)).WillOnce(
+            testing::Invoke([&](grpc::ClientContext*, 
+                                const cloudtrace_v2::BatchWriteSpansRequest& request,
+                                google::protobuf::Empty*){
+                for(const auto& span: request.spans()){
+                    exported.push_back(span.display_name().value());
+                }
+                return Status::OK;
+            }));
+        gcp_exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(),
+                                                                                 recordables.size()));
+        EXPECT_EQ(std::vector<std::string>({"span 1", "span 2"}), exported);
+        EXPECT_EQ(0, options.memory_budget->reserved_bytes());
+        EXPECT_EQ(1, options.memory_budget->num_refused());
+    }
+}
+
 } // gcp
 } // exporter
 OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/memory_budget.h"
+
+#include <algorithm>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+MemoryBudget::MemoryBudget(size_t max_bytes, MemoryBudgetPolicy policy, std::function<void()> flush):
+    max_bytes_(max_bytes), policy_(policy), flush_(std::move(flush)), reserved_bytes_(0), num_refused_(0),
+    flush_requested_(false) {}
+
+bool MemoryBudget::Reserve(size_t bytes, bool required) noexcept
+{
+    const size_t reserved = reserved_bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    if(reserved <= max_bytes_){
+        return true;
+    }
+    if(policy_ == MemoryBudgetPolicy::kFlush){
+        if(flush_ && !flush_requested_.exchange(true, std::memory_order_relaxed)){
+            flush_();
+        }
+        return true;
+    }
+    if(required && policy_ == MemoryBudgetPolicy::kDropAttributes){
+        return true;
+    }
+    reserved_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+    num_refused_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void MemoryBudget::Release(size_t bytes) noexcept
+{
+    if(bytes == 0){
+        return;
+    }
+    const size_t reserved = reserved_bytes_.fetch_sub(bytes, std::memory_order_relaxed) - bytes;
+    if(reserved <= max_bytes_ && flush_requested_.load(std::memory_order_relaxed)){
+        flush_requested_.store(false, std::memory_order_relaxed);
+    }
+}
+
+bool MemoryCharge::ReserveChunk(MemoryBudget *budget, size_t bytes, bool required) noexcept
+{
+    if(dropped_){
+        used_bytes_ -= bytes;
+        return false;
+    }
+    // The reservation doubles up to the largest chunk, in whole minimum chunks that are
+    // enough to cover the bytes past it
+    const size_t missing = used_bytes_ - reserved_bytes_;
+    const size_t needed = (missing + MemoryBudget::kMinChargeChunkBytes - 1) / MemoryBudget::kMinChargeChunkBytes
+                          * MemoryBudget::kMinChargeChunkBytes;
+    const size_t growth = std::min(std::max(reserved_bytes_, MemoryBudget::kMinChargeChunkBytes),
+                                   MemoryBudget::kMaxChargeChunkBytes);
+    const size_t chunk = std::max(needed, growth);
+    if(budget->Reserve(chunk, required)){
+        reserved_bytes_ += chunk;
+        return true;
+    }
+    used_bytes_ -= bytes;
+    if(budget->policy() == MemoryBudgetPolicy::kDropSpans){
+        dropped_ = true;
+    }
+    return false;
+}
+
+size_t MemoryCharge::TakeReservedBytes() noexcept
+{
+    const size_t reserved = reserved_bytes_;
+    reserved_bytes_ = 0;
+    used_bytes_ = 0;
+    return reserved;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
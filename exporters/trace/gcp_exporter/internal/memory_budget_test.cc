@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/memory_budget.h"
+
+#include <gtest/gtest.h>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+TEST(MemoryBudget, TestReserveAndRelease)
+{
+    MemoryBudget budget(1000, MemoryBudgetPolicy::kDropAttributes);
+    EXPECT_TRUE(budget.Reserve(600));
+    EXPECT_FALSE(budget.Reserve(600));
+    EXPECT_EQ(600, budget.reserved_bytes());
+    EXPECT_EQ(1, budget.num_refused());
+
+    // Required bytes go past the budget
+    EXPECT_TRUE(budget.Reserve(600, true));
+    EXPECT_EQ(1200, budget.reserved_bytes());
+
+    budget.Release(1200);
+    EXPECT_TRUE(budget.Reserve(400));
+    EXPECT_EQ(400, budget.reserved_bytes());
+}
+
+TEST(MemoryBudget, TestDropSpansRefusesRequiredBytes)
+{
+    MemoryBudget budget(1000, MemoryBudgetPolicy::kDropSpans);
+    EXPECT_FALSE(budget.Reserve(2000, true));
+    EXPECT_EQ(0, budget.reserved_bytes());
+}
+
+TEST(MemoryBudget, TestFlushPolicy)
+{
+    int num_flushes = 0;
+    MemoryBudget budget(1000, MemoryBudgetPolicy::kFlush, [&num_flushes]{ ++num_flushes; });
+    EXPECT_TRUE(budget.Reserve(800));
+    EXPECT_EQ(0, num_flushes);
+
+    // Only the first reservation past the budget asks for a flush
+    EXPECT_TRUE(budget.Reserve(800));
+    EXPECT_TRUE(budget.Reserve(800));
+    EXPECT_EQ(1, num_flushes);
+    EXPECT_EQ(2400, budget.reserved_bytes());
+
+    // Once back under the budget, exceeding it asks again
+    budget.Release(1600);
+    EXPECT_TRUE(budget.Reserve(800));
+    EXPECT_EQ(2, num_flushes);
+}
+
+TEST(MemoryCharge, TestReservesChunks)
+{
+    const size_t min_chunk = MemoryBudget::kMinChargeChunkBytes;
+    MemoryBudget budget(1 << 20, MemoryBudgetPolicy::kDropAttributes);
+    MemoryCharge charge;
+    EXPECT_TRUE(charge.Add(&budget, 10));
+    EXPECT_EQ(min_chunk, budget.reserved_bytes());
+
+    // The chunk covers the next bytes without touching the budget
+    EXPECT_TRUE(charge.Add(&budget, min_chunk - 10));
+    EXPECT_EQ(min_chunk, budget.reserved_bytes());
+
+    // Each chunk doubles the reservation
+    EXPECT_TRUE(charge.Add(&budget, 1));
+    EXPECT_EQ(2 * min_chunk, budget.reserved_bytes());
+    EXPECT_TRUE(charge.Add(&budget, min_chunk));
+    EXPECT_EQ(4 * min_chunk, budget.reserved_bytes());
+
+    // Large additions reserve as many minimum chunks as they need
+    EXPECT_TRUE(charge.Add(&budget, 10 * min_chunk));
+    EXPECT_EQ(13 * min_chunk, budget.reserved_bytes());
+
+    EXPECT_EQ(13 * min_chunk, charge.TakeReservedBytes());
+    EXPECT_EQ(0, charge.TakeReservedBytes());
+    budget.Release(13 * min_chunk);
+
+    // Past the largest chunk, the reservation grows by the largest chunk
+    MemoryCharge large_charge;
+    EXPECT_TRUE(large_charge.Add(&budget, 2 * MemoryBudget::kMaxChargeChunkBytes));
+    EXPECT_TRUE(large_charge.Add(&budget, 1));
+    EXPECT_EQ(3 * MemoryBudget::kMaxChargeChunkBytes, budget.reserved_bytes());
+
+    // Without a budget, everything is accepted
+    EXPECT_TRUE(charge.Add(nullptr, 1 << 30));
+}
+
+TEST(MemoryCharge, TestSmallSpans)
+{
+    // A small span holds no more than the smallest chunk
+    MemoryBudget budget(1 << 20, MemoryBudgetPolicy::kDropAttributes);
+    for(int i = 0; i < 100; ++i){
+        MemoryCharge charge;
+        EXPECT_TRUE(charge.Add(&budget, 40));
+        EXPECT_TRUE(charge.Add(&budget, 40));
+    }
+    EXPECT_EQ(100 * MemoryBudget::kMinChargeChunkBytes, budget.reserved_bytes());
+}
+
+TEST(MemoryCharge, TestDropsSpan)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropSpans);
+    MemoryCharge charge;
+    EXPECT_TRUE(charge.Add(&budget, 100));
+    EXPECT_FALSE(charge.Add(&budget, 1024));
+    EXPECT_TRUE(charge.dropped());
+
+    // A dropped span takes nothing more, even what its reserved chunk still covers
+    EXPECT_FALSE(charge.Add(&budget, 1));
+    budget.Release(charge.TakeReservedBytes());
+    EXPECT_EQ(0, budget.reserved_bytes());
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
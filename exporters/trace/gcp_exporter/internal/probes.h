@@ -0,0 +1,54 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Static tracepoints (USDT) on the hot paths of the exporter, under the gcp_exporter
+ * provider. They are compiled in with --define gcp_exporter_usdt=1, which requires
+ * sys/sdt.h, and compile to nothing otherwise. Compiled in, each is a single nop until a
+ * tracer attaches to it, for instance:
+ *
+ *   bpftrace -e 'usdt:/path/to/binary:gcp_exporter:rpc_done { @[arg2] = hist(arg1); }'
+ *
+ * Probes and their arguments:
+ *
+ *   make_recordable(int compact)
+ *   string_truncated(size_t size, int limit)       - a name or attribute value was cut
+ *   export_start(size_t num_spans)
+ *   export_done(size_t num_spans, int result)      - result is an sdk::trace::ExportResult
+ *   request_built(int num_spans, size_t num_input) - spans in the request, out of those given
+ *   rpc_start(int num_spans, size_t channel)
+ *   rpc_done(int num_spans, int request_bytes, int status_code)
+ *
+ * Arguments are only computed from values the code at the probe already has.
+ */
+
+#ifdef GCP_EXPORTER_ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define GCP_EXPORTER_PROBE1(name, a) DTRACE_PROBE1(gcp_exporter, name, a)
+#define GCP_EXPORTER_PROBE2(name, a, b) DTRACE_PROBE2(gcp_exporter, name, a, b)
+#define GCP_EXPORTER_PROBE3(name, a, b, c) DTRACE_PROBE3(gcp_exporter, name, a, b, c)
+
+#else
+
+#define GCP_EXPORTER_PROBE1(name, a) do {} while(0)
+#define GCP_EXPORTER_PROBE2(name, a, b) do {} while(0)
+#define GCP_EXPORTER_PROBE3(name, a, b, c) do {} while(0)
+
+#endif
@@ -15,6 +15,12 @@
  */
 
 #include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+#include "exporters/trace/gcp_exporter/internal/stack_trace.h"
+#include "exporters/trace/gcp_exporter/internal/thread_staging.h"
+
+#include <algorithm>
+#include <limits>
 
 OPENTELEMETRY_BEGIN_NAMESPACE
 namespace exporter
@@ -22,102 +28,185 @@ namespace exporter
 namespace gcp
 {
 
-constexpr size_t kAttributeStringLen = 256;
-constexpr size_t kDisplayNameStringLen = 128;
+static_assert(sizeof(Recordable) <= staging::kMaxObjectSize, "Recordable must fit in a staged slot");
 
+const RuntimeConfig &RecordableOptions::Config(const RecordableOptions *options) noexcept
+{
+    static const RuntimeConfig default_config;
+    return options && options->config ? options->config->Get() : default_config;
+}
 
-// Taken from the Unilib namespace 
-// Link: http://35.193.25.4/TensorFlow/models/research/syntaxnet/util/utf8/unilib_utf8_utils.h
-bool IsTrailByte(char x)
+void *Recordable::operator new(std::size_t size)
 {
-    return static_cast<signed char>(x) < -0x40;
+    return staging::AllocateFromHeap(size);
 }
 
-void SetTruncatableString(const int limit,
-                          nostd::string_view string_name,
-                          google::devtools::cloudtrace::v2::TruncatableString* str) 
-{ 
-    if (limit < 0 || string_name.size() < limit) 
-    {
-        str->set_value(string_name.data());
-        str->set_truncated_byte_count(0);
-        return;
-    }
+void *Recordable::operator new(std::size_t size, ThreadStagingTag)
+{
+    return staging::Allocate(size);
+}
 
-    // If limit points to beginning of utf8 character, truncate at the limit,
-    // backtrack to the beginning of utf8 character otherwise.
-    int truncation_pos = limit;
+void Recordable::operator delete(void *ptr) noexcept
+{
+    staging::Free(ptr);
+}
 
-    while (truncation_pos > 0 && IsTrailByte(string_name[truncation_pos])) 
-    {
-        --truncation_pos;
-    }
+void Recordable::operator delete(void *ptr, ThreadStagingTag) noexcept
+{
+    staging::Free(ptr);
+}
+
+Recordable::Recordable(const std::array<uint8_t, 16> &trace_id, google::devtools::cloudtrace::v2::Span span) noexcept :
+    span_(std::move(span)), trace_id_(trace_id) {}
+
+Recordable::Recordable() noexcept = default;
+
+Recordable::Recordable(const RecordableOptions *options) noexcept : options_(options) {}
 
-    const size_t original_size = string_name.size();
-    auto truncated_str = string_name.substr(0, truncation_pos);
-    str->set_value(std::string(truncated_str));
-    str->set_truncated_byte_count(original_size - str->value().size());
+Recordable::~Recordable()
+{
+    // Spans the exporter never took, such as those a processor dropped
+    if(options_ && options_->memory_budget){
+        options_->memory_budget->Release(charge_.TakeReservedBytes());
+    }
 }
 
 void Recordable::SetIds(trace::TraceId trace_id,
                         trace::SpanId span_id,
                         trace::SpanId parent_span_id) noexcept
 {
-    std::array<char, 2*trace::TraceId::kSize> hex_trace_buf; 
-    trace_id.ToLowerBase16(hex_trace_buf);
-    const std::string hex_trace(hex_trace_buf.data(), 2*trace::TraceId::kSize);
+    // The name holds the project, so it is only built once the exporter knows it
+    trace_id.CopyBytesTo(trace_id_);
 
     std::array<char, 2*trace::SpanId::kSize> hex_span_buf; 
     span_id.ToLowerBase16(hex_span_buf);
-    const std::string hex_span(hex_span_buf.data(), 2*trace::SpanId::kSize);
+    span_.set_span_id(hex_span_buf.data(), hex_span_buf.size());
 
     std::array<char, 2*trace::SpanId::kSize> hex_parent_span_buf; 
     parent_span_id.ToLowerBase16(hex_parent_span_buf);
-    const std::string hex_parent_span(hex_parent_span_buf.data(), 2*trace::SpanId::kSize);
+    span_.set_parent_span_id(hex_parent_span_buf.data(), hex_parent_span_buf.size());
+}
 
-    // Get Project Id
-    const std::string project_id(getenv(kGCPEnvVar));
+void Recordable::ToProto(nostd::string_view project_id, google::devtools::cloudtrace::v2::Span *span) const
+{
+    *span = span_;
+    char hex_trace[2 * 16];
+    EncodeLowerBase16(trace_id_.data(), trace_id_.size(), hex_trace);
 
-    span_.set_name(kProjectsPathStr + project_id + kTracesPathStr + hex_trace + kSpansPathStr + hex_span);
-    span_.set_span_id(hex_span);
-    span_.set_parent_span_id(hex_parent_span);
+    std::string* name = span->mutable_name();
+    name->reserve(sizeof(kProjectsPathStr) + project_id.size() + sizeof(kTracesPathStr) + 
+                  sizeof(hex_trace) + sizeof(kSpansPathStr) + span_.span_id().size());
+    name->append(kProjectsPathStr);
+    name->append(project_id.data(), project_id.size());
+    name->append(kTracesPathStr);
+    name->append(hex_trace, sizeof(hex_trace));
+    name->append(kSpansPathStr);
+    name->append(span_.span_id());
 }
 
 void Recordable::SetAttribute(nostd::string_view key,
                               const common::AttributeValue &value) noexcept
+{
+    nostd::visit(AttributeValueSetter<Recordable>{
+        this, key, RecordableOptions::Config(options_).attribute_string_len}, value);
+}
+
+google::devtools::cloudtrace::v2::AttributeValue *Recordable::MutableAttribute(nostd::string_view key,
+                                                                             size_t value_size) noexcept
 {
     // Get the protobuf span's map
-    auto* map = span_.mutable_attributes()->mutable_attribute_map();
+    auto* attributes = span_.mutable_attributes();
+    auto* map = attributes->mutable_attribute_map();
+    std::string key_string(key.data(), key.size());
+    google::devtools::cloudtrace::v2::AttributeValue* attribute = nullptr;
+    const auto it = map->find(key_string);
+    if(it != map->end()){
+        // Setting a key again only grows the span by the size of the new value over the old one
+        const size_t old_size = it->second.has_string_value() ? it->second.string_value().value().size()
+                                                              : kScalarValueBytes;
+        if(value_size <= old_size || Charge(value_size - old_size)){
+            attribute = &it->second;
+        } else {
+            // The old value is stale, so it goes as well
+            map->erase(it);
+        }
+    } else if(Charge(kAttributeOverheadBytes + key.size() + value_size)){
+        attribute = &(*map)[std::move(key_string)];
+    }
+    if(!attribute){
+        if(!dropped()){
+            attributes->set_dropped_attributes_count(attributes->dropped_attributes_count() + 1);
+        }
+        return nullptr;
+    }
+    // A priority attribute the budget dropped does not make the span a priority span
+    if(!priority_ && options_ && options_->IsPriorityKey(key)){
+        priority_ = true;
+    }
+    return attribute;
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, bool value) noexcept
+{
+    if(auto* attribute = MutableAttribute(key, kScalarValueBytes)){
+        attribute->set_bool_value(value);
+    }
+}
 
-    if(nostd::holds_alternative<bool>(value))
-    {
-        (*map)[key.data()].set_bool_value(nostd::get<bool>(value));
-    } 
-    else if (nostd::holds_alternative<int>(value))
-    {
-        (*map)[key.data()].set_int_value(nostd::get<int>(value));
+void Recordable::SetTypedAttribute(nostd::string_view key, int value) noexcept
+{
+    if(auto* attribute = MutableAttribute(key, kScalarValueBytes)){
+        attribute->set_int_value(value);
     }
-    else if (nostd::holds_alternative<int64_t>(value))
-    {
-        (*map)[key.data()].set_int_value(nostd::get<int64_t>(value));
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, int64_t value) noexcept
+{
+    if(auto* attribute = MutableAttribute(key, kScalarValueBytes)){
+        attribute->set_int_value(value);
     }
-    else if (nostd::holds_alternative<unsigned int>(value))
-    {
-        (*map)[key.data()].set_int_value(nostd::get<unsigned int>(value));
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept
+{
+    if(auto* attribute = MutableAttribute(key, kScalarValueBytes)){
+        attribute->set_int_value(value);
     }
-    else if (nostd::holds_alternative<uint64_t>(value))
-    {
-        (*map)[key.data()].set_int_value(nostd::get<uint64_t>(value));
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept
+{
+    // Cloud Trace integers are signed, so larger values are kept exact as strings
+    if(value > static_cast<uint64_t>(std::numeric_limits<int64_t>::max())){
+        SetTypedAttribute(key, nostd::string_view(std::to_string(value)));
+        return;
+    }
+    if(auto* attribute = MutableAttribute(key, kScalarValueBytes)){
+        attribute->set_int_value(static_cast<int64_t>(value));
     }
-    else if (nostd::holds_alternative<int64_t>(value))
-    {
-        (*map)[key.data()].set_int_value(nostd::get<int64_t>(value));
-    } 
-    else if (nostd::holds_alternative<nostd::string_view>(value))
-    {
-        SetTruncatableString(kAttributeStringLen,
-                             nostd::get<nostd::string_view>(value), 
-                             (*map)[key.data()].mutable_string_value());
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, double value) noexcept
+{
+    // Cloud Trace has no floating point attribute type
+    SetTypedAttribute(key, nostd::string_view(FormatDouble(value)));
+}
+
+void Recordable::SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept
+{
+    const size_t truncated_size = TruncatedSize(
+        RecordableOptions::Config(options_).attribute_string_len, value);
+    SetTruncatedAttribute(key, value.substr(0, truncated_size), value.size() - truncated_size);
+}
+
+void Recordable::SetTruncatedAttribute(nostd::string_view key,
+                                       nostd::string_view value,
+                                       size_t truncated_byte_count) noexcept
+{
+    if(auto* attribute = MutableAttribute(key, value.size())){
+        auto* str = attribute->mutable_string_value();
+        str->set_value(value.data(), value.size());
+        str->set_truncated_byte_count(truncated_byte_count);
     }
 }
 
@@ -125,9 +214,19 @@ void Recordable::AddEvent(nostd::string_view name,
                           core::SystemTimestamp timestamp,
                           const opentelemetry::common::KeyValueIterable &attributes) noexcept
 {
-    (void)name;
-    (void)timestamp;
-    (void)attributes;
+    // Cloud Trace records events as annotations
+    google::devtools::cloudtrace::v2::Span_TimeEvent event;
+    MakeAnnotation(name, timestamp.time_since_epoch().count(), attributes,
+                   RecordableOptions::Config(options_).attribute_string_len, &event);
+
+    auto* time_events = span_.mutable_time_events();
+    if(!Charge(event.ByteSizeLong())){
+        if(!dropped()){
+            time_events->set_dropped_annotations_count(time_events->dropped_annotations_count() + 1);
+        }
+        return;
+    }
+    time_events->add_time_event()->Swap(&event);
 }
 
 void Recordable::AddLink(
@@ -140,18 +239,38 @@ void Recordable::AddLink(
 
 void Recordable::SetStatus(trace::CanonicalCode code, nostd::string_view description) noexcept
 {
-    (void)code;
-    (void)description;
+    if(code != trace::CanonicalCode::OK){
+        priority_ = true;
+        if(!stack_ && options_ && options_->stack_capture == StackCapture::kOnError){
+            stack_ = CaptureStack(1, options_->max_stack_frames);
+        }
+    }
+    // The code is kept past the budget, the message only if it fits
+    if(!Charge(description.size())){
+        description = nostd::string_view();
+    }
+    // The canonical codes share their values with google.rpc.Code
+    auto* status = span_.mutable_status();
+    status->set_code(static_cast<int32_t>(code));
+    status->set_message(description.data(), description.size());
 }
 
 void Recordable::SetName(nostd::string_view name) noexcept
 {
-    SetTruncatableString(kDisplayNameStringLen, name,
+    // Names are bounded, and kept past the budget unless the whole span is dropped
+    const size_t limit = RecordableOptions::Config(options_).display_name_string_len;
+    if(!Charge(std::min(name.size(), limit), true)){
+        return;
+    }
+    SetTruncatableString(limit, name,
                          span_.mutable_display_name());
 }
 
 void Recordable::SetStartTime(opentelemetry::core::SystemTimestamp start_time) noexcept
 {
+    if(options_ && options_->stack_capture == StackCapture::kOnStart){
+        stack_ = CaptureStack(1, options_->max_stack_frames);
+    }
     const std::chrono::nanoseconds unix_time_nanoseconds(start_time.time_since_epoch().count());
     const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(unix_time_nanoseconds);
     span_.mutable_start_time()->set_seconds(seconds.count());
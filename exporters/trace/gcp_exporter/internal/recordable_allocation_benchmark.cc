@@ -0,0 +1,114 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/allocation_counter.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <memory>
+#include <vector>
+
+// Number of spans kept alive at once, as in a buffered batch
+constexpr int kNumSpans = 200;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter 
+{
+namespace gcp 
+{
+
+/**
+ * Builds batches of recordables of the given shape, and reports their heap cost alongside
+ * the time taken:
+ *  - allocs_per_span: calls to operator new made to build one span
+ *  - retained_bytes_per_span: heap bytes held by one span while it is buffered
+ *  - encoded_bytes_per_span: size of one span once encoded on the wire
+ */
+size_t EncodedSize(const Recordable &recordable)
+{
+  return recordable.span().ByteSizeLong();
+}
+
+size_t EncodedSize(const CompactRecordable &recordable)
+{
+  google::devtools::cloudtrace::v2::Span span;
+  recordable.ToProto("test_project", &span);
+  return span.ByteSizeLong();
+}
+
+template <typename RecordableT>
+void RunFootprintBenchmark(benchmark::State& state, const SpanShape &shape)
+{
+  setenv(kGCPEnvVar, "test_project", 1);
+  const SpanGenerator generator(shape);
+
+  AllocationStats cost;
+  size_t encoded_bytes = 0;
+  int64_t num_spans = 0;
+  for(auto _ : state)
+  {
+    std::vector<std::unique_ptr<RecordableT>> recordables;
+    recordables.reserve(kNumSpans);
+
+    const AllocationStats before = GetAllocationStats();
+    for(int i = 0; i < kNumSpans; ++i){
+      recordables.emplace_back(new RecordableT);
+      generator.Fill(*recordables.back());
+    }
+    const AllocationStats batch_cost = GetAllocationStats() - before;
+
+    state.PauseTiming();
+    cost.allocations += batch_cost.allocations;
+    cost.live_bytes += batch_cost.live_bytes;
+    for(const auto& recordable: recordables){
+      encoded_bytes += EncodedSize(*recordable);
+    }
+    num_spans += kNumSpans;
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(num_spans);
+  state.counters["allocs_per_span"] = static_cast<double>(cost.allocations) / num_spans;
+  state.counters["retained_bytes_per_span"] = static_cast<double>(cost.live_bytes) / num_spans;
+  state.counters["encoded_bytes_per_span"] = static_cast<double>(encoded_bytes) / num_spans;
+}
+
+void BM_RecordableFootprint(benchmark::State& state, const SpanShape &shape)
+{
+  RunFootprintBenchmark<Recordable>(state, shape);
+}
+
+void BM_CompactRecordableFootprint(benchmark::State& state, const SpanShape &shape)
+{
+  RunFootprintBenchmark<CompactRecordable>(state, shape);
+}
+
+BENCHMARK_CAPTURE(BM_RecordableFootprint, EmptySpans, EmptySpanShape());
+BENCHMARK_CAPTURE(BM_RecordableFootprint, SparseSpans, SparseSpanShape());
+BENCHMARK_CAPTURE(BM_RecordableFootprint, DenseSpans, DenseSpanShape());
+BENCHMARK_CAPTURE(BM_CompactRecordableFootprint, EmptySpans, EmptySpanShape());
+BENCHMARK_CAPTURE(BM_CompactRecordableFootprint, SparseSpans, SparseSpanShape());
+BENCHMARK_CAPTURE(BM_CompactRecordableFootprint, DenseSpans, DenseSpanShape());
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
+
+// Run benchmarks
+BENCHMARK_MAIN();
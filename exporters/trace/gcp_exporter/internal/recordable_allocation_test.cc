@@ -0,0 +1,179 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/allocation_counter.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+// Number of spans measured for every shape, to average out one-off allocations
+constexpr int kNumSpans = 100;
+
+/**
+ * The heap cost of buffering one span of a given shape
+ */
+struct SpanFootprint
+{
+    double allocations_per_span;
+    double retained_bytes_per_span;
+    double encoded_bytes_per_span;
+};
+
+size_t EncodedSize(const Recordable &recordable)
+{
+    return recordable.span().ByteSizeLong();
+}
+
+size_t EncodedSize(const CompactRecordable &recordable)
+{
+    google::devtools::cloudtrace::v2::Span span;
+    recordable.ToProto("test_project", &span);
+    return span.ByteSizeLong();
+}
+
+template <typename RecordableT>
+SpanFootprint MeasureFootprint(const SpanShape &shape)
+{
+    const SpanGenerator generator(shape);
+    std::vector<std::unique_ptr<RecordableT>> recordables;
+    recordables.reserve(kNumSpans);
+
+    const AllocationStats before = GetAllocationStats();
+    for(int i = 0; i < kNumSpans; ++i){
+        recordables.emplace_back(new RecordableT);
+        generator.Fill(*recordables.back());
+    }
+    const AllocationStats cost = GetAllocationStats() - before;
+
+    size_t encoded_bytes = 0;
+    for(const auto& recordable: recordables){
+        encoded_bytes += EncodedSize(*recordable);
+    }
+
+    SpanFootprint footprint;
+    footprint.allocations_per_span = static_cast<double>(cost.allocations) / kNumSpans;
+    footprint.retained_bytes_per_span = static_cast<double>(cost.live_bytes) / kNumSpans;
+    footprint.encoded_bytes_per_span = static_cast<double>(encoded_bytes) / kNumSpans;
+    return footprint;
+}
+
+class RecordableAllocationTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        setenv(kGCPEnvVar, "test_project", 1);
+    }
+};
+
+// The limits below sit a little above the current costs. Lower them along with any change
+// that removes allocations, so that the savings cannot silently regress.
+
+TEST_F(RecordableAllocationTest, EmptySpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<Recordable>(EmptySpanShape());
+    EXPECT_LE(footprint.allocations_per_span, 1);
+    EXPECT_LE(footprint.retained_bytes_per_span, 256);
+}
+
+TEST_F(RecordableAllocationTest, SparseSpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<Recordable>(SparseSpanShape());
+    EXPECT_LE(footprint.allocations_per_span, 20);
+    EXPECT_LE(footprint.retained_bytes_per_span, 640);
+    EXPECT_LE(footprint.encoded_bytes_per_span, 160);
+}
+
+TEST_F(RecordableAllocationTest, DenseSpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<Recordable>(DenseSpanShape());
+    EXPECT_LE(footprint.allocations_per_span, 200);
+    EXPECT_LE(footprint.retained_bytes_per_span, 12288);
+    EXPECT_LE(footprint.encoded_bytes_per_span, 2560);
+}
+
+TEST_F(RecordableAllocationTest, CompactEmptySpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<CompactRecordable>(EmptySpanShape());
+    EXPECT_LE(footprint.allocations_per_span, 1);
+    EXPECT_LE(footprint.retained_bytes_per_span, 384);
+}
+
+TEST_F(RecordableAllocationTest, CompactSparseSpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<CompactRecordable>(SparseSpanShape());
+    EXPECT_LE(footprint.allocations_per_span, 1);
+    EXPECT_LE(footprint.retained_bytes_per_span, 384);
+    EXPECT_LE(footprint.encoded_bytes_per_span, 160);
+}
+
+TEST_F(RecordableAllocationTest, CompactDenseSpan)
+{
+    const SpanFootprint footprint = MeasureFootprint<CompactRecordable>(DenseSpanShape());
+    // The index of attribute keys, which keeps lookups constant time past the inline
+    // attributes, takes 2 KiB of the footprint for these 90 attributes
+    EXPECT_LE(footprint.allocations_per_span, 20);
+    EXPECT_LE(footprint.retained_bytes_per_span, 7680);
+    EXPECT_LE(footprint.encoded_bytes_per_span, 2560);
+}
+
+TEST_F(RecordableAllocationTest, CounterSeesAllocations)
+{
+    const AllocationStats before = GetAllocationStats();
+    std::unique_ptr<int> value(new int(1));
+    const AllocationStats after = GetAllocationStats() - before;
+
+    EXPECT_EQ(1, after.allocations);
+    EXPECT_EQ(sizeof(int), after.live_bytes);
+}
+
+TEST_F(RecordableAllocationTest, CounterSeesAlignedAllocations)
+{
+    struct alignas(64) CacheLine
+    {
+        char bytes[64];
+    };
+
+    const AllocationStats before = GetAllocationStats();
+    std::unique_ptr<CacheLine> line(new CacheLine());
+    std::unique_ptr<CacheLine[]> lines(new CacheLine[2]());
+    const AllocationStats allocated = GetAllocationStats() - before;
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(line.get()) % alignof(CacheLine));
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(lines.get()) % alignof(CacheLine));
+    EXPECT_EQ(2, allocated.allocations);
+    EXPECT_EQ(3 * sizeof(CacheLine), allocated.live_bytes);
+
+    line.reset();
+    lines.reset();
+    const AllocationStats freed = GetAllocationStats() - before;
+    EXPECT_EQ(2, freed.deallocations);
+    EXPECT_EQ(0, freed.live_bytes);
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -15,10 +15,13 @@
  */
 
 #include "exporters/trace/gcp_exporter/recordable.h"
+#include "opentelemetry/common/key_value_iterable_view.h"
 #include "opentelemetry/context/runtime_context.h"
 
 #include <gtest/gtest.h>
 
+#include <map>
+
 
 OPENTELEMETRY_BEGIN_NAMESPACE
 namespace exporter
@@ -70,6 +73,177 @@ TEST(Recordable, TruncatableStringEnforcedDisplayName) {
     EXPECT_EQ(exactly_127_byte_long_string, rec.span().display_name().value()); 
 }
 
+TEST(Recordable, TestSetStatus)
+{
+    Recordable rec;
+    EXPECT_FALSE(rec.span().has_status());
+
+    rec.SetStatus(trace::CanonicalCode::DEADLINE_EXCEEDED, "Timed out");
+    EXPECT_EQ(4, rec.span().status().code());
+    EXPECT_EQ("Timed out", rec.span().status().message());
+}
+
+TEST(Recordable, TestPriority)
+{
+    const RecordableOptions options{{"priority_key"}};
+
+    Recordable ok_span(&options);
+    ok_span.SetStatus(trace::CanonicalCode::OK, "");
+    ok_span.SetAttribute("other_key", true);
+    EXPECT_FALSE(ok_span.priority());
+
+    Recordable error_span(&options);
+    error_span.SetStatus(trace::CanonicalCode::INTERNAL, "Failed");
+    EXPECT_TRUE(error_span.priority());
+
+    Recordable attribute_span(&options);
+    attribute_span.SetAttribute("priority_key", false);
+    EXPECT_TRUE(attribute_span.priority());
+
+    // Without options, only the status counts
+    Recordable no_options;
+    no_options.SetAttribute("priority_key", true);
+    EXPECT_FALSE(no_options.priority());
+}
+
+TEST(Recordable, TestPriorityAttributeDropped)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropAttributes);
+    RecordableOptions options{{"priority_key"}};
+    options.memory_budget = &budget;
+
+    // An attribute the budget drops does not make the span a priority span
+    Recordable rec(&options);
+    const std::string value(200, 'x');
+    for(int i = 0; i < 8; ++i){
+        rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+    }
+    rec.SetAttribute("priority_key", nostd::string_view(value));
+    EXPECT_FALSE(rec.priority());
+}
+
+TEST(Recordable, TestStackCapture)
+{
+    RecordableOptions options;
+    options.stack_capture = StackCapture::kOnError;
+
+    Recordable ok_span(&options);
+    ok_span.SetStartTime(core::SystemTimestamp(std::chrono::system_clock::now()));
+    ok_span.SetStatus(trace::CanonicalCode::OK, "");
+    EXPECT_EQ(nullptr, ok_span.stack());
+
+    Recordable error_span(&options);
+    error_span.SetStatus(trace::CanonicalCode::INTERNAL, "Failed");
+    EXPECT_NE(nullptr, error_span.stack());
+
+    options.stack_capture = StackCapture::kOnStart;
+    Recordable started_span(&options);
+    started_span.SetStartTime(core::SystemTimestamp(std::chrono::system_clock::now()));
+    EXPECT_NE(nullptr, started_span.stack());
+    // The stack is never part of the protobuf span itself
+    EXPECT_FALSE(started_span.span().has_stack_trace());
+}
+
+TEST(Recordable, TestAddEvent)
+{
+    Recordable rec;
+    const std::map<std::string, common::AttributeValue> attributes = {{"retry", true}, {"attempt", 2}};
+    rec.AddEvent("Retrying", core::SystemTimestamp(std::chrono::nanoseconds(1500000000)),
+                 common::KeyValueIterableView<std::map<std::string, common::AttributeValue>>(attributes));
+
+    ASSERT_EQ(1, rec.span().time_events().time_event_size());
+    const auto &event = rec.span().time_events().time_event(0);
+    EXPECT_EQ(1, event.time().seconds());
+    EXPECT_EQ(500000000, event.time().nanos());
+    EXPECT_EQ("Retrying", event.annotation().description().value());
+    const auto &map = event.annotation().attributes().attribute_map();
+    EXPECT_TRUE(map.at("retry").bool_value());
+    EXPECT_EQ(2, map.at("attempt").int_value());
+}
+
+TEST(Recordable, TestAddEventFollowsRuntimeStringLimit)
+{
+    RuntimeConfig config;
+    config.attribute_string_len = 4;
+    ConfigStore store(config);
+    RecordableOptions options;
+    options.config = &store;
+    Recordable rec(&options);
+    const std::map<std::string, common::AttributeValue> attributes = {{"reason", "deadline exceeded"}};
+    rec.AddEvent("Retrying", core::SystemTimestamp(std::chrono::nanoseconds(1500000000)),
+                 common::KeyValueIterableView<std::map<std::string, common::AttributeValue>>(attributes));
+
+    ASSERT_EQ(1, rec.span().time_events().time_event_size());
+    const auto &annotation = rec.span().time_events().time_event(0).annotation();
+    EXPECT_EQ("Retr", annotation.description().value());
+    EXPECT_EQ("dead", annotation.attributes().attribute_map().at("reason").string_value().value());
+    EXPECT_EQ(13, annotation.attributes().attribute_map().at("reason").string_value().truncated_byte_count());
+}
+
+TEST(Recordable, TestMemoryBudget)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropAttributes);
+    RecordableOptions options;
+    options.memory_budget = &budget;
+    const std::string value(200, 'x');
+    {
+        Recordable rec(&options);
+        rec.SetName("Test Span");
+        for(int i = 0; i < 8; ++i){
+            rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+        }
+        // Three attributes fit in the budget, since the next chunk would double the span's
+        // reservation, and the others are counted as dropped
+        EXPECT_EQ(3, rec.span().attributes().attribute_map_size());
+        EXPECT_EQ(5, rec.span().attributes().dropped_attributes_count());
+        EXPECT_EQ("Test Span", rec.span().display_name().value());
+        EXPECT_FALSE(rec.dropped());
+        EXPECT_EQ(768, budget.reserved_bytes());
+    }
+    // A recordable destroyed without being exported gives its bytes back
+    EXPECT_EQ(0, budget.reserved_bytes());
+
+    MemoryBudget span_budget(1024, MemoryBudgetPolicy::kDropSpans);
+    options.memory_budget = &span_budget;
+    Recordable rec(&options);
+    for(int i = 0; i < 8; ++i){
+        rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+    }
+    EXPECT_TRUE(rec.dropped());
+    EXPECT_EQ(1024, rec.TakeReservedBytes());
+}
+
+TEST(Recordable, TestMemoryBudgetSetAttributeAgain)
+{
+    MemoryBudget budget(1024, MemoryBudgetPolicy::kDropAttributes);
+    RecordableOptions options;
+    options.memory_budget = &budget;
+    const std::string value(200, 'x');
+    Recordable rec(&options);
+    for(int i = 0; i < 4; ++i){
+        rec.SetAttribute("key_" + std::to_string(i), nostd::string_view(value));
+    }
+
+    // Setting a key again only charges the growth of its value
+    for(int i = 0; i < 100; ++i){
+        rec.SetAttribute("key_0", nostd::string_view(value));
+        rec.SetAttribute("key_1", i);
+    }
+    EXPECT_EQ(4, rec.span().attributes().attribute_map_size());
+    EXPECT_EQ(0, rec.span().attributes().dropped_attributes_count());
+
+    // A refused value drops the stale one too
+    rec.SetAttribute("key_1", nostd::string_view(std::string(400, 'y')));
+    EXPECT_EQ(3, rec.span().attributes().attribute_map_size());
+    EXPECT_EQ(0, rec.span().attributes().attribute_map().count("key_1"));
+    EXPECT_EQ(1, rec.span().attributes().dropped_attributes_count());
+
+    // The status message goes past the budget, the code does not
+    rec.SetStatus(trace::CanonicalCode::INTERNAL, std::string(1000, 'z'));
+    EXPECT_EQ(13, rec.span().status().code());
+    EXPECT_TRUE(rec.span().status().message().empty());
+}
+
 TEST(Recordable, TruncatableStringNotEnforcedAttributeString) { 
     Recordable rec;
     
@@ -162,9 +336,97 @@ TYPED_TEST(IntAttributeTest, SetIntSingleAttribute)
     EXPECT_EQ(nostd::get<IntType>(int_val), attr_map["int_key"].int_value());
 }
 
+TEST(Recordable, TestSetDoubleAttribute)
+{
+    Recordable rec;
+    rec.SetAttribute("double_key_1", common::AttributeValue(0.1));
+    rec.SetAttribute("double_key_2", common::AttributeValue(-2.5e10));
+
+    auto attr_map = rec.span().attributes().attribute_map();
+
+    EXPECT_EQ("0.1", attr_map["double_key_1"].string_value().value());
+    EXPECT_EQ("-25000000000", attr_map["double_key_2"].string_value().value());
+}
+
+TEST(Recordable, TestSetArrayAttribute)
+{
+    Recordable rec;
+
+    const bool bools[] = {true, false};
+    const int64_t ints[] = {1, -2, 3};
+    const double doubles[] = {0.5, 2};
+    const nostd::string_view strings[] = {"a", "quoted \"b\"", nostd::string_view("c\\\n\t\x01\0", 6)};
+
+    rec.SetAttribute("bool_array", common::AttributeValue(nostd::span<const bool>(bools)));
+    rec.SetAttribute("int_array", common::AttributeValue(nostd::span<const int64_t>(ints)));
+    rec.SetAttribute("double_array", common::AttributeValue(nostd::span<const double>(doubles)));
+    rec.SetAttribute("string_array", common::AttributeValue(nostd::span<const nostd::string_view>(strings)));
+
+    auto attr_map = rec.span().attributes().attribute_map();
+
+    EXPECT_EQ("[true,false]", attr_map["bool_array"].string_value().value());
+    EXPECT_EQ("[1,-2,3]", attr_map["int_array"].string_value().value());
+    EXPECT_EQ("[0.5,2]", attr_map["double_array"].string_value().value());
+    EXPECT_EQ("[\"a\",\"quoted \\\"b\\\"\",\"c\\\\\\n\\t\\u0001\\u0000\"]",
+              attr_map["string_array"].string_value().value());
+}
+
+TEST(Recordable, TestSetLargeUint64Attribute)
+{
+    Recordable rec;
+    rec.SetAttribute("max_int64", common::AttributeValue(uint64_t{9223372036854775807ULL}));
+    rec.SetAttribute("max_uint64", common::AttributeValue(uint64_t{18446744073709551615ULL}));
+
+    auto attr_map = rec.span().attributes().attribute_map();
+
+    EXPECT_EQ(9223372036854775807LL, attr_map["max_int64"].int_value());
+    EXPECT_EQ("18446744073709551615", attr_map["max_uint64"].string_value().value());
+}
+
+TEST(Recordable, TestTruncatedArrayStaysValidJson)
+{
+    RuntimeConfig config;
+    config.attribute_string_len = 12;
+    ConfigStore store(config);
+    RecordableOptions options;
+    options.config = &store;
+    Recordable rec(&options);
+
+    const int64_t ints[] = {100, 200, 300, 400};
+    const nostd::string_view strings[] = {"abcdefghijklmnop"};
+    rec.SetAttribute("int_array", common::AttributeValue(nostd::span<const int64_t>(ints)));
+    rec.SetAttribute("string_array", common::AttributeValue(nostd::span<const nostd::string_view>(strings)));
+
+    auto attr_map = rec.span().attributes().attribute_map();
+
+    // "[100,200,300,400]" keeps the elements that fit with the closing bracket
+    EXPECT_EQ("[100,200]", attr_map["int_array"].string_value().value());
+    EXPECT_EQ(8, attr_map["int_array"].string_value().truncated_byte_count());
+    EXPECT_EQ("[]", attr_map["string_array"].string_value().value());
+    EXPECT_EQ(18, attr_map["string_array"].string_value().truncated_byte_count());
+}
+
+TEST(Recordable, TestSetAttributesWithSchema)
+{
+    static const AttributeSchema<nostd::string_view, int64_t, bool, double> kSchema(
+        "http.method", "http.status_code", "retried", "ratio");
+
+    Recordable rec;
+    rec.SetAttributes(kSchema, "GET", 200, true, 0.25);
+
+    auto attr_map = rec.span().attributes().attribute_map();
+
+    ASSERT_EQ(4, attr_map.size());
+    EXPECT_EQ("GET", attr_map["http.method"].string_value().value());
+    EXPECT_EQ(200, attr_map["http.status_code"].int_value());
+    EXPECT_TRUE(attr_map["retried"].bool_value());
+    EXPECT_EQ("0.25", attr_map["ratio"].string_value().value());
+}
+
 TEST(Recordable, TestSetIds)
 {
-    setenv("GOOGLE_CLOUD_PROJECT_ID", "test_project", 1);
+    // The project comes from the exporter, not from the environment
+    unsetenv(kGCPEnvVar);
 
     const opentelemetry::trace::TraceId trace_id(
     std::array<const uint8_t, opentelemetry::trace::TraceId::kSize>(
@@ -181,11 +443,14 @@ TEST(Recordable, TestSetIds)
     Recordable rec;
 
     rec.SetIds(trace_id, span_id, parent_span_id);
+    EXPECT_EQ("", rec.span().name());
 
+    google::devtools::cloudtrace::v2::Span span;
+    rec.ToProto("test_project", &span);
     EXPECT_EQ("projects/test_project/traces/00010002010301040105010603070000/spans/0102030405060708", 
-               rec.span().name());
-    EXPECT_EQ("0102030405060708", rec.span().span_id());
-    EXPECT_EQ("0405000101010103", rec.span().parent_span_id());
+               span.name());
+    EXPECT_EQ("0102030405060708", span.span_id());
+    EXPECT_EQ("0405000101010103", span.parent_span_id());
 }
 
 
@@ -0,0 +1,284 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Replays a capture of real traffic (see GcpExporterOptions::capture_path) through the
+ * exporter, against a mock stub. Every captured span is rebuilt with MakeRecordable and the
+ * recordable setters, events included, and every captured batch is exported as one batch.
+ *
+ * The capture is read from the file named by the GCP_EXPORTER_CAPTURE environment variable.
+ * Without it, a synthetic capture mixing the test span shapes is replayed instead.
+ *
+ * Paced benchmarks wait out the recorded gaps between batches, untimed, so they take as long
+ * as the capture did.
+ */
+
+#include <benchmark/benchmark.h>
+#include "exporters/trace/gcp_exporter/gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/span_capture.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+#include "opentelemetry/common/key_value_iterable_view.h"
+
+#include <unistd.h>
+
+#include <cstdlib>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter 
+{
+namespace gcp 
+{
+
+/* ################################## CAPTURE LOADING ##################################### */
+
+/* A captured batch, parsed ahead of the replay */
+struct ReplayedBatch
+{
+    int64_t capture_time_nanos;
+    cloudtrace_v2::BatchWriteSpansRequest request;
+};
+
+/**
+ * Writes a synthetic capture: batches of 200 spans, 10ms apart, in which one span in ten is
+ * dense, one in three sparse, and the rest have a handful of attributes
+ * 
+ * @return The path of the capture
+ */
+std::string WriteSyntheticCapture()
+{
+    const std::string path = "/tmp/gcp_exporter_replay." + std::to_string(getpid()) + ".capture";
+    auto writer = SpanCaptureWriter::Open(path);
+    if(!writer){
+        return std::string();
+    }
+
+    SpanShape few_attributes = SparseSpanShape();
+    few_attributes.num_int_attributes = 2;
+    few_attributes.num_str_attributes = 4;
+    few_attributes.num_bool_attributes = 1;
+    const SpanGenerator dense(DenseSpanShape()), sparse(SparseSpanShape()), few(few_attributes);
+
+    constexpr int64_t kBatchIntervalNanos = 10000000;
+    for(int batch = 0; batch < 50; ++batch){
+        cloudtrace_v2::BatchWriteSpansRequest request;
+        request.set_name("projects/replay_project");
+        for(int i = 0; i < 200; ++i){
+            Recordable rec;
+            (i % 10 == 0 ? dense : i % 3 == 0 ? sparse : few).Fill(rec);
+            *request.add_spans() = rec.span();
+        }
+        writer->Write(batch * kBatchIntervalNanos, request);
+    }
+    return path;
+}
+
+/**
+ * Loads and parses the capture to replay, once per process
+ */
+const std::vector<ReplayedBatch> &CapturedBatches()
+{
+    static const std::vector<ReplayedBatch> batches = []{
+        std::vector<ReplayedBatch> batches;
+        const char *capture_path = getenv("GCP_EXPORTER_CAPTURE");
+        const std::string path = capture_path ? capture_path : WriteSyntheticCapture();
+        auto reader = SpanCaptureReader::Open(path);
+        if(!capture_path){
+            unlink(path.c_str());
+        }
+        if(!reader){
+            return batches;
+        }
+        CapturedRequest captured;
+        while(reader->Next(&captured)){
+            batches.emplace_back();
+            batches.back().capture_time_nanos = captured.capture_time_nanos;
+            batches.back().request.ParseFromArray(captured.payload.data(), static_cast<int>(captured.payload.size()));
+        }
+        return batches;
+    }();
+    return batches;
+}
+
+/* ################################## SPAN REBUILDING ##################################### */
+
+/**
+ * Decodes lower case hex into bytes
+ */
+template <size_t N>
+void DecodeHex(nostd::string_view hex, std::array<uint8_t, N> *bytes)
+{
+    bytes->fill(0);
+    for(size_t i = 0; i < N && 2 * i + 1 < hex.size(); ++i){
+        const auto nibble = [](char c){ return static_cast<uint8_t>(c <= '9' ? c - '0' : c - 'a' + 10); };
+        (*bytes)[i] = static_cast<uint8_t>(nibble(hex[2 * i]) << 4 | nibble(hex[2 * i + 1]));
+    }
+}
+
+/**
+ * Converts captured attributes back to the values instrumentation set them with
+ * 
+ * @param captured - The captured attributes
+ * @param attributes - Receives the values, whose strings point into the captured attributes
+ */
+void ReplayAttributes(const cloudtrace_v2::Span_Attributes &captured,
+                      std::map<std::string, common::AttributeValue> *attributes)
+{
+    for(const auto& attribute: captured.attribute_map()){
+        switch(attribute.second.value_case()){
+            case cloudtrace_v2::AttributeValue::kStringValue:
+                (*attributes)[attribute.first] = nostd::string_view(attribute.second.string_value().value());
+                break;
+            case cloudtrace_v2::AttributeValue::kIntValue:
+                (*attributes)[attribute.first] = static_cast<int64_t>(attribute.second.int_value());
+                break;
+            case cloudtrace_v2::AttributeValue::kBoolValue:
+                (*attributes)[attribute.first] = attribute.second.bool_value();
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * Sets everything a captured span holds on a recordable, as instrumentation would have
+ */
+void ReplaySpan(const cloudtrace_v2::Span &span, sdk::trace::Recordable &recordable)
+{
+    std::array<uint8_t, trace::TraceId::kSize> trace_id;
+    std::array<uint8_t, trace::SpanId::kSize> span_id, parent_span_id;
+    const size_t traces = span.name().find(kTracesPathStr);
+    DecodeHex(traces == std::string::npos ? nostd::string_view() 
+                                          : nostd::string_view(span.name()).substr(traces + sizeof(kTracesPathStr) - 1),
+              &trace_id);
+    DecodeHex(span.span_id(), &span_id);
+    DecodeHex(span.parent_span_id(), &parent_span_id);
+    recordable.SetIds(trace::TraceId(trace_id), trace::SpanId(span_id), trace::SpanId(parent_span_id));
+
+    recordable.SetName(span.display_name().value());
+    const int64_t start_nanos = span.start_time().seconds() * 1000000000LL + span.start_time().nanos();
+    const int64_t end_nanos = span.end_time().seconds() * 1000000000LL + span.end_time().nanos();
+    recordable.SetStartTime(core::SystemTimestamp(std::chrono::nanoseconds(start_nanos)));
+    recordable.SetDuration(std::chrono::nanoseconds(end_nanos - start_nanos));
+
+    std::map<std::string, common::AttributeValue> attributes;
+    ReplayAttributes(span.attributes(), &attributes);
+    for(const auto& attribute: attributes){
+        recordable.SetAttribute(attribute.first, attribute.second);
+    }
+    for(const auto& time_event: span.time_events().time_event()){
+        // Message events have no recordable setter
+        if(!time_event.has_annotation()){
+            continue;
+        }
+        const auto &annotation = time_event.annotation();
+        std::map<std::string, common::AttributeValue> event_attributes;
+        ReplayAttributes(annotation.attributes(), &event_attributes);
+        const int64_t event_nanos = time_event.time().seconds() * 1000000000LL + time_event.time().nanos();
+        recordable.AddEvent(annotation.description().value(), core::SystemTimestamp(std::chrono::nanoseconds(event_nanos)),
+                            common::KeyValueIterableView<std::map<std::string, common::AttributeValue>>(event_attributes));
+    }
+    if(span.has_status()){
+        recordable.SetStatus(static_cast<trace::CanonicalCode>(span.status().code()), span.status().message());
+    }
+}
+
+/* ################################# FIXTURE CLASS ####################################### */
+
+class ReplayBenchmark : public benchmark::Fixture 
+{
+public:
+  /**
+   * Replays the whole capture once per iteration. Only rebuilding the spans and exporting
+   * them is timed.
+   * 
+   * @param state - The benchmark state
+   * @param compact - Whether the exporter makes compact recordables
+   * @param paced - Whether to wait out the recorded gaps between batches
+   */
+  void RunReplay(benchmark::State& state, bool compact, bool paced)
+  {
+    const auto &batches = CapturedBatches();
+    if(batches.empty()){
+      state.SkipWithError("No capture to replay");
+      return;
+    }
+
+    GcpExporterOptions options;
+    options.compact_recordables = compact;
+    GcpExporter exporter(std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>(new MockStub()),
+                         "replay_project", options);
+
+    int64_t num_spans = 0;
+    std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+    for(auto _ : state)
+    {
+      for(size_t i = 0; i < batches.size(); ++i){
+        if(paced && i > 0){
+          state.PauseTiming();
+          std::this_thread::sleep_for(std::chrono::nanoseconds(
+              batches[i].capture_time_nanos - batches[i - 1].capture_time_nanos));
+          state.ResumeTiming();
+        }
+
+        const auto &request = batches[i].request;
+        recordables.clear();
+        for(const auto& span: request.spans()){
+          recordables.push_back(exporter.MakeRecordable());
+          ReplaySpan(span, *recordables.back());
+        }
+        exporter.Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(),
+                                                                            recordables.size()));
+        num_spans += request.spans_size();
+      }
+    }
+    state.SetItemsProcessed(num_spans);
+    state.counters["batches"] = static_cast<double>(batches.size());
+  }
+};
+
+/* ################################## BENCHMARKS ######################################## */
+
+BENCHMARK_DEFINE_F(ReplayBenchmark, ReplayTest)(benchmark::State& state) {
+  RunReplay(state, false, false);
+}
+BENCHMARK_REGISTER_F(ReplayBenchmark, ReplayTest);
+
+
+BENCHMARK_DEFINE_F(ReplayBenchmark, CompactReplayTest)(benchmark::State& state) {
+  RunReplay(state, true, false);
+}
+BENCHMARK_REGISTER_F(ReplayBenchmark, CompactReplayTest);
+
+
+BENCHMARK_DEFINE_F(ReplayBenchmark, PacedReplayTest)(benchmark::State& state) {
+  RunReplay(state, false, true);
+}
+BENCHMARK_REGISTER_F(ReplayBenchmark, PacedReplayTest)->Iterations(1);
+
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
+
+// Run benchmarks
+BENCHMARK_MAIN();
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/internal/request_hedger.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Number of latencies recorded between two computations of the percentile */
+constexpr size_t kRecomputeInterval = 16;
+
+LatencyTracker::LatencyTracker(double percentile, size_t window):
+    percentile_(std::min(std::max(percentile, 0.0), 1.0)), samples_(std::max(window, kMinSamples)),
+    percentile_us_(0) {}
+
+void LatencyTracker::Record(std::chrono::microseconds latency)
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    samples_[next_sample_] = latency.count();
+    next_sample_ = (next_sample_ + 1) % samples_.size();
+    ++num_recorded_;
+    if(num_recorded_ < kMinSamples || num_recorded_ % kRecomputeInterval != 0){
+        return;
+    }
+    std::vector<int64_t> recent(samples_.begin(), samples_.begin() + std::min(num_recorded_, samples_.size()));
+    const size_t rank = std::min(static_cast<size_t>(std::ceil(percentile_ * recent.size())), recent.size()) - 1;
+    std::nth_element(recent.begin(), recent.begin() + rank, recent.end());
+    percentile_us_.store(recent[rank], std::memory_order_relaxed);
+}
+
+size_t LatencyTracker::num_recorded() const
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    return num_recorded_;
+}
+
+HedgeBudget::HedgeBudget(double ratio, size_t max_tokens):
+    ratio_milli_(static_cast<int64_t>(ratio * 1000)), max_milli_(static_cast<int64_t>(max_tokens) * 1000),
+    milli_tokens_(0) {}
+
+void HedgeBudget::OnRequest() noexcept
+{
+    int64_t tokens = milli_tokens_.load(std::memory_order_relaxed);
+    while(tokens < max_milli_ && 
+          !milli_tokens_.compare_exchange_weak(tokens, std::min(tokens + ratio_milli_, max_milli_),
+                                               std::memory_order_relaxed)){
+    }
+}
+
+bool HedgeBudget::TryAcquire() noexcept
+{
+    int64_t tokens = milli_tokens_.load(std::memory_order_relaxed);
+    while(tokens >= 1000){
+        if(milli_tokens_.compare_exchange_weak(tokens, tokens - 1000, std::memory_order_relaxed)){
+            return true;
+        }
+    }
+    return false;
+}
+
+RequestHedger::RequestHedger(double percentile, std::chrono::milliseconds min_delay, double budget_ratio,
+                             size_t max_burst):
+    min_delay_(min_delay), latencies_(percentile), budget_(budget_ratio, max_burst), num_hedges_(0),
+    num_hedge_wins_(0) {}
+
+std::chrono::microseconds RequestHedger::HedgeDelay() const noexcept
+{
+    const auto percentile = latencies_.Percentile();
+    if(percentile.count() == 0){
+        return percentile;
+    }
+    return std::max(percentile, std::chrono::duration_cast<std::chrono::microseconds>(min_delay_));
+}
+
+grpc::Status RequestHedger::Send(google::devtools::cloudtrace::v2::TraceService::StubInterface *primary,
+                                 google::devtools::cloudtrace::v2::TraceService::StubInterface *secondary,
+                                 const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request,
+                                 const std::function<void(grpc::ClientContext*)> &configure)
+{
+    struct Call
+    {
+        grpc::ClientContext context;
+        google::protobuf::Empty response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>> reader;
+        bool done = false;
+        std::chrono::steady_clock::time_point finished;
+    };
+    Call calls[2];
+    grpc::CompletionQueue cq;
+    const auto start = std::chrono::steady_clock::now();
+    auto start_call = [&](Call *call, google::devtools::cloudtrace::v2::TraceService::StubInterface *stub){
+        if(configure){
+            configure(&call->context);
+        }
+        call->reader = stub->AsyncBatchWriteSpans(&call->context, request, &cq);
+        call->reader->Finish(&call->response, &call->status, call);
+    };
+    budget_.OnRequest();
+    start_call(&calls[0], primary);
+    size_t num_pending = 1;
+
+    void* tag;
+    bool ok;
+    Call* winner = nullptr;
+    const auto delay = HedgeDelay();
+    if(secondary && delay.count() > 0){
+        // gRPC deadlines are on the system clock
+        const auto deadline = std::chrono::system_clock::now() + (delay - (std::chrono::steady_clock::now() - start));
+        if(cq.AsyncNext(&tag, &ok, deadline) == grpc::CompletionQueue::GOT_EVENT){
+            winner = static_cast<Call*>(tag);
+            winner->done = true;
+            winner->finished = std::chrono::steady_clock::now();
+            --num_pending;
+        } else if(budget_.TryAcquire()){
+            start_call(&calls[1], secondary);
+            ++num_pending;
+            num_hedges_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    // A failed call leaves the other one a chance to succeed
+    while((!winner || !winner->status.ok()) && num_pending > 0){
+        cq.Next(&tag, &ok);
+        winner = static_cast<Call*>(tag);
+        winner->done = true;
+        winner->finished = std::chrono::steady_clock::now();
+        --num_pending;
+    }
+    // Only the primary call's latency is tracked: that of a winning hedge would understate
+    // it, and a primary call about to be cancelled for the hedge has none
+    if(calls[0].done){
+        latencies_.Record(std::chrono::duration_cast<std::chrono::microseconds>(calls[0].finished - start));
+    }
+    if(winner == &calls[1] && winner->status.ok()){
+        num_hedge_wins_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // The call still in flight is no longer needed, but must complete before it is freed
+    for(auto& call: calls){
+        if(call.reader && !call.done){
+            call.context.TryCancel();
+        }
+    }
+    while(num_pending > 0){
+        cq.Next(&tag, &ok);
+        --num_pending;
+    }
+    cq.Shutdown();
+    while(cq.Next(&tag, &ok)){
+    }
+    return winner->status;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,153 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
+#include "opentelemetry/version.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Tracks a percentile of the latencies of the most recent requests
+ */
+class LatencyTracker
+{
+public:
+    /* Number of latencies recorded before the percentile is known */
+    static constexpr size_t kMinSamples = 16;
+
+    /**
+     * @param percentile - The percentile to track, in (0, 1)
+     * @param window - Number of recent latencies the percentile is computed over
+     */
+    explicit LatencyTracker(double percentile, size_t window = 256);
+
+    void Record(std::chrono::microseconds latency);
+
+    /* The percentile of the recent latencies, zero until kMinSamples were recorded */
+    std::chrono::microseconds Percentile() const noexcept
+    {
+        return std::chrono::microseconds(percentile_us_.load(std::memory_order_relaxed));
+    }
+
+    /* Number of latencies recorded since the tracker was created */
+    size_t num_recorded() const;
+
+private:
+    const double percentile_;
+
+    mutable std::mutex mu_;
+    std::vector<int64_t> samples_;
+    size_t next_sample_ = 0;
+    size_t num_recorded_ = 0;
+
+    /* Recomputed every few samples, so that reading it costs a load */
+    std::atomic<int64_t> percentile_us_;
+};
+
+/**
+ * A token bucket capping hedges to a fraction of the requests sent. Every request adds a
+ * fraction of a token, every hedge takes a whole one.
+ */
+class HedgeBudget
+{
+public:
+    /**
+     * @param ratio - The fraction of a token every request adds
+     * @param max_tokens - The most tokens saved up, the largest burst of hedges
+     */
+    HedgeBudget(double ratio, size_t max_tokens);
+
+    void OnRequest() noexcept;
+
+    /* Takes a token, returning false if there is none */
+    bool TryAcquire() noexcept;
+
+private:
+    /* Tokens are counted in thousandths */
+    const int64_t ratio_milli_;
+    const int64_t max_milli_;
+    std::atomic<int64_t> milli_tokens_;
+};
+
+/**
+ * Sends requests on a primary stub, and sends a request again on a secondary stub if it is
+ * still in flight after a percentile of the recent latencies. The first successful response
+ * wins, and the other call is cancelled. Thread safe.
+ */
+class RequestHedger
+{
+public:
+    /**
+     * @param percentile - The percentile of the recent latencies requests are hedged after
+     * @param min_delay - The shortest delay requests are hedged after
+     * @param budget_ratio - The fraction of the requests that may be hedged
+     * @param max_burst - The most hedges allowed in a row
+     */
+    RequestHedger(double percentile, std::chrono::milliseconds min_delay, double budget_ratio, size_t max_burst);
+
+    /**
+     * Sends a request, hedging it if it is slow and the budget allows
+     * 
+     * @param primary - The stub to send the request on first
+     * @param secondary - The stub to send the hedge on
+     * @param request - The request to send
+     * @param configure - Called on the context of each call before it starts, may be empty
+     * @return The status of the first successful call, or of the last call if none succeeded
+     */
+    grpc::Status Send(google::devtools::cloudtrace::v2::TraceService::StubInterface *primary,
+                      google::devtools::cloudtrace::v2::TraceService::StubInterface *secondary,
+                      const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request,
+                      const std::function<void(grpc::ClientContext*)> &configure);
+
+    /* The delay requests are hedged after, zero while too few latencies were recorded */
+    std::chrono::microseconds HedgeDelay() const noexcept;
+
+    /* The latencies of the primary calls that completed before being cancelled */
+    const LatencyTracker &latencies() const noexcept { return latencies_; }
+
+    /* Number of hedges sent, and of hedges that won over their primary call */
+    uint64_t num_hedges() const noexcept { return num_hedges_.load(std::memory_order_relaxed); }
+    uint64_t num_hedge_wins() const noexcept { return num_hedge_wins_.load(std::memory_order_relaxed); }
+
+private:
+    const std::chrono::microseconds min_delay_;
+    LatencyTracker latencies_;
+    HedgeBudget budget_;
+
+    std::atomic<uint64_t> num_hedges_;
+    std::atomic<uint64_t> num_hedge_wins_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,140 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/internal/request_hedger.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+TEST(LatencyTracker, TestPercentile)
+{
+    LatencyTracker tracker(0.9);
+    for(int i = 1; i < static_cast<int>(LatencyTracker::kMinSamples); ++i){
+        tracker.Record(std::chrono::milliseconds(i));
+    }
+    EXPECT_EQ(0, tracker.Percentile().count());
+
+    for(int i = LatencyTracker::kMinSamples; i <= 96; ++i){
+        tracker.Record(std::chrono::milliseconds(i));
+    }
+    EXPECT_EQ(std::chrono::microseconds(std::chrono::milliseconds(87)), tracker.Percentile());
+}
+
+TEST(HedgeBudget, TestTokens)
+{
+    HedgeBudget budget(0.5, 2);
+    EXPECT_FALSE(budget.TryAcquire());
+    budget.OnRequest();
+    EXPECT_FALSE(budget.TryAcquire());
+    budget.OnRequest();
+    EXPECT_TRUE(budget.TryAcquire());
+    EXPECT_FALSE(budget.TryAcquire());
+
+    // Unused tokens are saved up to the burst
+    for(int i = 0; i < 100; ++i){
+        budget.OnRequest();
+    }
+    EXPECT_TRUE(budget.TryAcquire());
+    EXPECT_TRUE(budget.TryAcquire());
+    EXPECT_FALSE(budget.TryAcquire());
+}
+
+/**
+ * Two stubs on channels of their own to a local server
+ */
+class HedgerTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        server_.reset(new LocalTraceServer());
+        for(int i = 0; i < 2; ++i){
+            stubs_.push_back(cloudtrace_v2::TraceService::NewStub(server_->MakeChannel(std::chrono::milliseconds(0))));
+        }
+        request_.set_name("projects/test_project");
+        request_.add_spans()->set_span_id("0000000000000001");
+    }
+
+    /* Sends enough quick requests for the hedger to know their latency */
+    void WarmUp(RequestHedger &hedger)
+    {
+        for(size_t i = 0; i < LatencyTracker::kMinSamples; ++i){
+            EXPECT_TRUE(hedger.Send(stubs_[0].get(), stubs_[1].get(), request_, nullptr).ok());
+        }
+        EXPECT_GT(hedger.HedgeDelay().count(), 0);
+    }
+
+    std::unique_ptr<LocalTraceServer> server_;
+    std::vector<std::unique_ptr<cloudtrace_v2::TraceService::Stub>> stubs_;
+    cloudtrace_v2::BatchWriteSpansRequest request_;
+};
+
+TEST_F(HedgerTest, TestHedgesSlowRequest)
+{
+    RequestHedger hedger(0.5, std::chrono::milliseconds(1), 1.0, 10);
+    WarmUp(hedger);
+    const int num_calls = server_->num_calls();
+
+    server_->DelayNextCalls({std::chrono::milliseconds(10000)});
+    int num_configured = 0;
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(hedger.Send(stubs_[0].get(), stubs_[1].get(), request_,
+                            [&num_configured](grpc::ClientContext*){ ++num_configured; }).ok());
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+    EXPECT_EQ(2, num_configured);
+    EXPECT_EQ(num_calls + 2, server_->num_calls());
+    EXPECT_EQ(1, hedger.num_hedges());
+    EXPECT_EQ(1, hedger.num_hedge_wins());
+    // The cancelled primary call has no latency, and the hedge's is not the primary's
+    EXPECT_EQ(LatencyTracker::kMinSamples, hedger.latencies().num_recorded());
+
+    // The slow call was cancelled rather than left to run
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while(server_->num_cancelled_calls() == 0 && std::chrono::steady_clock::now() < deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    EXPECT_EQ(1, server_->num_cancelled_calls());
+}
+
+TEST_F(HedgerTest, TestBudgetLimitsHedges)
+{
+    RequestHedger hedger(0.5, std::chrono::milliseconds(1), 0.0, 10);
+    WarmUp(hedger);
+
+    // Without budget, a slow request is waited for
+    server_->DelayNextCalls({std::chrono::milliseconds(200)});
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_TRUE(hedger.Send(stubs_[0].get(), stubs_[1].get(), request_, nullptr).ok());
+    EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(200));
+    EXPECT_EQ(0, hedger.num_hedges());
+    EXPECT_EQ(LatencyTracker::kMinSamples + 1, hedger.latencies().num_recorded());
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
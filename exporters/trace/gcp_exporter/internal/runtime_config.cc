@@ -0,0 +1,233 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/runtime_config.h"
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+ConfigStore::ConfigStore(const RuntimeConfig &config) : current_(nullptr), version_(0)
+{
+    Update(config);
+}
+
+ConfigStore::~ConfigStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(watch_mu_);
+        stopping_ = true;
+    }
+    watch_cv_.notify_all();
+    if(watch_thread_.joinable()){
+        watch_thread_.join();
+    }
+}
+
+void ConfigStore::Update(const RuntimeConfig &config)
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    Publish(config);
+}
+
+void ConfigStore::Publish(const RuntimeConfig &config)
+{
+    std::unique_ptr<RuntimeConfig> snapshot(new RuntimeConfig(config));
+    snapshot->attribute_string_len = std::min(snapshot->attribute_string_len, kAttributeStringLen);
+    snapshot->display_name_string_len = std::min(snapshot->display_name_string_len, kDisplayNameStringLen);
+
+    current_.store(snapshot.get(), std::memory_order_release);
+    snapshots_.push_back(std::move(snapshot));
+    if(snapshots_.size() > kMaxSnapshots){
+        snapshots_.pop_front();
+    }
+    version_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+ * Strips the spaces at both ends of a string
+ */
+std::string Trim(const std::string &str)
+{
+    const size_t begin = str.find_first_not_of(" \t\r");
+    if(begin == std::string::npos){
+        return "";
+    }
+    return str.substr(begin, str.find_last_not_of(" \t\r") - begin + 1);
+}
+
+bool ParseSize(const std::string &value, size_t *out)
+{
+    char* end = nullptr;
+    const unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+    if(value.empty() || value[0] == '-' || *end != '\0'){
+        return false;
+    }
+    *out = static_cast<size_t>(parsed);
+    return true;
+}
+
+/**
+ * Parses a fraction, refusing infinities, NaN and anything outside [0, 1]
+ */
+bool ParseRatio(const std::string &value, double *out)
+{
+    char* end = nullptr;
+    const double parsed = strtod(value.c_str(), &end);
+    if(value.empty() || *end != '\0' || !std::isfinite(parsed) || parsed < 0.0 || parsed > 1.0){
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+bool ParseBool(const std::string &value, bool *out)
+{
+    if(value == "true" || value == "1"){
+        *out = true;
+    } else if(value == "false" || value == "0"){
+        *out = false;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ConfigStore::Parse(const std::string &text, RuntimeConfig *config)
+{
+    RuntimeConfig parsed = *config;
+    std::istringstream lines(text);
+    std::string line;
+    bool ended = false;
+    while(std::getline(lines, line)){
+        line = Trim(line.substr(0, line.find('#')));
+        if(line.empty()){
+            continue;
+        }
+        // Nothing may follow the end line
+        if(ended){
+            return false;
+        }
+        if(line == "end"){
+            ended = true;
+            continue;
+        }
+        const size_t equals = line.find('=');
+        if(equals == std::string::npos){
+            return false;
+        }
+        const std::string name = Trim(line.substr(0, equals));
+        const std::string value = Trim(line.substr(equals + 1));
+        bool ok = false;
+        if(name == "attribute_string_len"){
+            ok = ParseSize(value, &parsed.attribute_string_len);
+        } else if(name == "display_name_string_len"){
+            ok = ParseSize(value, &parsed.display_name_string_len);
+        } else if(name == "export_ratio"){
+            ok = ParseRatio(value, &parsed.export_ratio);
+        } else if(name == "parallel_export_threshold"){
+            ok = ParseSize(value, &parsed.parallel_export_threshold);
+        } else if(name == "max_export_shards"){
+            ok = ParseSize(value, &parsed.max_export_shards);
+        } else if(name == "compression"){
+            ok = ParseBool(value, &parsed.compression);
+        }
+        if(!ok){
+            return false;
+        }
+    }
+    if(!ended){
+        return false;
+    }
+    *config = parsed;
+    return true;
+}
+
+bool ConfigStore::LoadFile(const std::string &path)
+{
+    std::ifstream file(path);
+    if(!file){
+        return false;
+    }
+    std::stringstream text;
+    text << file.rdbuf();
+    // Held from reading the current config to publishing the new one, so that an update
+    // made in between is not lost
+    std::lock_guard<std::mutex> lock(mu_);
+    RuntimeConfig config = Get();
+    if(!Parse(text.str(), &config)){
+        return false;
+    }
+    Publish(config);
+    return true;
+}
+
+void ConfigStore::WatchFile(const std::string &path, std::chrono::milliseconds poll_interval)
+{
+    std::lock_guard<std::mutex> lock(watch_mu_);
+    if(watch_thread_.joinable()){
+        return;
+    }
+    watch_thread_ = std::thread(&ConfigStore::WatchLoop, this, path, poll_interval);
+}
+
+/**
+ * Returns what tells versions of a file apart, or all zeros if the file is missing
+ */
+std::pair<int64_t, int64_t> FileVersion(const std::string &path)
+{
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0){
+        return {0, 0};
+    }
+    return {static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec,
+            static_cast<int64_t>(info.st_size)};
+}
+
+void ConfigStore::WatchLoop(std::string path, std::chrono::milliseconds poll_interval)
+{
+    std::pair<int64_t, int64_t> loaded_version(0, 0);
+    std::unique_lock<std::mutex> lock(watch_mu_);
+    while(!stopping_){
+        const auto version = FileVersion(path);
+        if(version != loaded_version){
+            lock.unlock();
+            // A file caught halfway through being written lacks its end line, and is read
+            // again once it changes
+            LoadFile(path);
+            loaded_version = version;
+            lock.lock();
+        }
+        watch_cv_.wait_for(lock, poll_interval, [this]{ return stopping_; });
+    }
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/runtime_config.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <unistd.h>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+TEST(ConfigStore, TestUpdate)
+{
+    ConfigStore store;
+    const RuntimeConfig &initial = store.Get();
+    EXPECT_EQ(1, store.version());
+
+    RuntimeConfig config;
+    config.export_ratio = 0.25;
+    config.compression = false;
+    store.Update(config);
+    EXPECT_EQ(0.25, store.Get().export_ratio);
+    EXPECT_FALSE(store.Get().compression);
+    EXPECT_EQ(2, store.version());
+
+    // Snapshots read before the update stay valid
+    EXPECT_EQ(1.0, initial.export_ratio);
+}
+
+TEST(ConfigStore, TestTruncationLimitsAreCapped)
+{
+    RuntimeConfig config;
+    config.attribute_string_len = 4096;
+    config.display_name_string_len = 16;
+    ConfigStore store(config);
+    EXPECT_EQ(256, store.Get().attribute_string_len);
+    EXPECT_EQ(16, store.Get().display_name_string_len);
+}
+
+TEST(ConfigStore, TestParse)
+{
+    RuntimeConfig config;
+    EXPECT_TRUE(ConfigStore::Parse("# Halve the traffic\n"
+                                   "export_ratio = 0.5\n"
+                                   "\n"
+                                   "  max_export_shards=4  # on small hosts\n"
+                                   "compression = false\n"
+                                   "attribute_string_len = 64\n"
+                                   "end\n",
+                                   &config));
+    EXPECT_EQ(0.5, config.export_ratio);
+    EXPECT_EQ(4, config.max_export_shards);
+    EXPECT_FALSE(config.compression);
+    EXPECT_EQ(64, config.attribute_string_len);
+    EXPECT_EQ(128, config.display_name_string_len);
+
+    // A bad line leaves the whole config unchanged
+    const char* bad_texts[] = {"export_ratio = 0.1\nunknown_field = 1\nend\n",
+                               "export_ratio = 0.1\nmax_export_shards = -1\nend\n",
+                               "export_ratio = 0.1\ncompression = maybe\nend\n",
+                               "export_ratio = 0.1\nexport_ratio\nend\n",
+                               "export_ratio = 0.1x\nend\n",
+                               "export_ratio = nan\nend\n",
+                               "export_ratio = inf\nend\n",
+                               "export_ratio = 1.5\nend\n",
+                               "export_ratio = -0.1\nend\n",
+                               // Cut short, as when read halfway through being written
+                               "export_ratio = 0.1\ncompression = false\n",
+                               "export_ratio = 0.1\nend\ncompression = false\n"};
+    for(const char* text: bad_texts){
+        EXPECT_FALSE(ConfigStore::Parse(text, &config)) << text;
+        EXPECT_EQ(0.5, config.export_ratio);
+    }
+}
+
+class ConfigStoreTestPeer : public ::testing::Test
+{
+public:
+    size_t NumSnapshots(ConfigStore &store)
+    {
+        std::lock_guard<std::mutex> lock(store.mu_);
+        return store.snapshots_.size();
+    }
+};
+
+TEST_F(ConfigStoreTestPeer, TestOldSnapshotsAreReclaimed)
+{
+    ConfigStore store;
+    const RuntimeConfig *first = &store.Get();
+    for(size_t i = 1; i < ConfigStore::kMaxSnapshots; ++i){
+        RuntimeConfig config;
+        config.max_export_shards = i;
+        store.Update(config);
+    }
+    // The first snapshot is still kept, until one more is published
+    EXPECT_EQ(0, first->max_export_shards);
+    EXPECT_EQ(ConfigStore::kMaxSnapshots - 1, store.Get().max_export_shards);
+    EXPECT_EQ(ConfigStore::kMaxSnapshots, store.version());
+    EXPECT_EQ(ConfigStore::kMaxSnapshots, NumSnapshots(store));
+    store.Update(RuntimeConfig());
+    EXPECT_EQ(ConfigStore::kMaxSnapshots, NumSnapshots(store));
+}
+
+TEST(ConfigStore, TestLoadFileKeepsConcurrentUpdates)
+{
+    char path[] = "/tmp/runtime_config_testXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    std::ofstream(path) << "export_ratio = 0.5\nend\n";
+
+    // Each update changes a field the file leaves out, which every load must carry over
+    ConfigStore store;
+    std::thread updater([&store]{
+        for(size_t i = 1; i <= 1000; ++i){
+            RuntimeConfig config = store.Get();
+            config.max_export_shards = i;
+            store.Update(config);
+        }
+    });
+    for(int i = 0; i < 1000; ++i){
+        EXPECT_TRUE(store.LoadFile(path));
+    }
+    updater.join();
+    EXPECT_EQ(1000, store.Get().max_export_shards);
+    remove(path);
+}
+
+TEST(ConfigStore, TestWatchFile)
+{
+    char path[] = "/tmp/runtime_config_testXXXXXX";
+    const int fd = mkstemp(path);
+    ASSERT_NE(-1, fd);
+    close(fd);
+    std::ofstream(path) << "export_ratio = 0.5\nend\n";
+
+    {
+        ConfigStore store;
+        store.WatchFile(path, std::chrono::milliseconds(10));
+        for(int i = 0; i < 500 && store.Get().export_ratio != 0.5; ++i){
+            usleep(10000);
+        }
+        EXPECT_EQ(0.5, store.Get().export_ratio);
+
+        // Changing the size marks the file as changed even within the mtime resolution
+        std::ofstream(path) << "export_ratio = 0.25\ncompression = false\nend\n";
+        for(int i = 0; i < 500 && store.Get().compression; ++i){
+            usleep(10000);
+        }
+        EXPECT_EQ(0.25, store.Get().export_ratio);
+        EXPECT_FALSE(store.Get().compression);
+    }
+    remove(path);
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,75 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/service_channels.h"
+
+#include <algorithm>
+
+
+constexpr char kGoogleTraceAddress[] = "cloudtrace.googleapis.com";
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Establishes gRPC communication channel to the Google Trace Address
+ * 
+ * @param channel_index - Distinguishes the channels of a pool, so that each gets its own connection
+ * @param keepalive_interval - Interval between HTTP/2 keepalive pings, zero for none
+ * @return The channel, which connects on first use
+ */
+std::shared_ptr<grpc::ChannelInterface> MakeChannel(size_t channel_index, std::chrono::milliseconds keepalive_interval)
+{
+    grpc::ChannelArguments args;
+    args.SetUserAgentPrefix("opentelemetry-cpp/" OPENTELEMETRY_VERSION);
+    // Channels with different arguments never share a connection
+    args.SetInt("gcp_exporter.channel_index", static_cast<int>(channel_index));
+    if(keepalive_interval.count() > 0){
+        args.SetInt(GRPC_ARG_KEEPALIVE_TIME_MS, static_cast<int>(keepalive_interval.count()));
+        args.SetInt(GRPC_ARG_KEEPALIVE_PERMIT_WITHOUT_CALLS, 1);
+        args.SetInt(GRPC_ARG_HTTP2_MAX_PINGS_WITHOUT_DATA, 0);
+    }
+    return grpc::CreateCustomChannel(kGoogleTraceAddress, 
+                                     grpc::GoogleDefaultCredentials(),
+                                     args);
+}
+
+std::vector<std::shared_ptr<grpc::ChannelInterface>> MakeChannels(size_t num_channels,
+                                                                  std::chrono::milliseconds keepalive_interval)
+{
+    std::vector<std::shared_ptr<grpc::ChannelInterface>> channels;
+    for(size_t i = 0; i < std::max<size_t>(num_channels, 1); ++i){
+        channels.push_back(MakeChannel(i, keepalive_interval));
+    }
+    return channels;
+}
+
+StubPool MakeServiceStubs(const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels)
+{
+    StubPool stubs;
+    for(const auto& channel: channels){
+        stubs.emplace_back(google::devtools::cloudtrace::v2::TraceService::NewStub(channel));
+    }
+    return stubs;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,54 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
+#include "opentelemetry/version.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <chrono>
+#include <memory>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+using StubPool = std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>>;
+
+/**
+ * Establishes a pool of channels to the Google Trace Address
+ * 
+ * @param num_channels - Number of channels in the pool, at least one is made
+ * @param keepalive_interval - Interval between HTTP/2 keepalive pings, zero for none
+ * @return The channels, which connect on first use
+ */
+std::vector<std::shared_ptr<grpc::ChannelInterface>> MakeChannels(size_t num_channels,
+                                                                  std::chrono::milliseconds keepalive_interval);
+
+/**
+ * Makes a cloudtrace v2 API trace service stub per channel, to communicate over via gRPC
+ */
+StubPool MakeServiceStubs(const std::vector<std::shared_ptr<grpc::ChannelInterface>> &channels);
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
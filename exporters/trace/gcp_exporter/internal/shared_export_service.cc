@@ -0,0 +1,80 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/shared_export_service.h"
+#include "exporters/trace/gcp_exporter/internal/batch_queue.h"
+#include "exporters/trace/gcp_exporter/internal/service_channels.h"
+
+#include <mutex>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+std::shared_ptr<SharedExportService> SharedExportService::Get(const SharedExportServiceOptions &options)
+{
+    static std::mutex mu;
+    static std::weak_ptr<SharedExportService> process_service;
+
+    std::lock_guard<std::mutex> lock(mu);
+    auto service = process_service.lock();
+    if(!service){
+        service = std::make_shared<SharedExportService>(options);
+        process_service = service;
+    }
+    return service;
+}
+
+SharedExportService::SharedExportService(const SharedExportServiceOptions &options):
+    SharedExportService(MakeServiceStubs(MakeChannels(options.num_channels, options.keepalive_interval)), options) {}
+
+SharedExportService::SharedExportService(
+        std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>> stubs,
+        const SharedExportServiceOptions &options):
+    trace_service_stubs_(std::move(stubs)), next_stub_(0)
+{
+    // One request in flight per channel
+    queue_.reset(new BatchQueue(options.max_batch_size, options.max_delay, trace_service_stubs_.size(),
+                                [this](const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request){
+                                    return SendRequest(request);
+                                }));
+}
+
+SharedExportService::~SharedExportService()
+{
+    // Flush before the stubs go
+    queue_.reset();
+}
+
+std::shared_future<bool> SharedExportService::Submit(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request)
+{
+    return queue_->Submit(request);
+}
+
+bool SharedExportService::SendRequest(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept
+{
+    google::protobuf::Empty response;
+    grpc::ClientContext context;
+    const size_t stub_index = next_stub_.fetch_add(1, std::memory_order_relaxed) % trace_service_stubs_.size();
+    return trace_service_stubs_[stub_index]->BatchWriteSpans(&context, request, &response).ok();
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,279 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/shm_ring.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+// Atomics in shared memory must not fall back on process-local locks
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Shared memory rings need lock-free 64 bit atomics");
+
+constexpr uint64_t kRingMagic = 0x676370726e673031;  // "gcprng01"
+constexpr size_t kCacheLineSize = 64;
+
+/**
+ * The layout at the start of the shared memory. The positions sit on their own cache lines
+ * so that pushers and poppers do not false share.
+ */
+struct ShmRingHeader
+{
+    /* Written last by the creator, once everything else is initialized */
+    std::atomic<uint64_t> magic;
+    uint32_t capacity;
+    uint32_t slot_size;
+    int32_t creator_pid;
+
+    alignas(kCacheLineSize) std::atomic<uint64_t> enqueue_position;
+    alignas(kCacheLineSize) std::atomic<uint64_t> dequeue_position;
+    alignas(kCacheLineSize) std::atomic<uint64_t> dropped;
+};
+
+/**
+ * The layout at the start of every slot, followed by the message
+ */
+struct SlotHeader
+{
+    std::atomic<uint64_t> sequence;
+    uint64_t size;
+};
+
+/**
+ * Rounds a size up to a multiple of the cache line size
+ */
+size_t CacheAligned(size_t size)
+{
+    return (size + kCacheLineSize - 1) / kCacheLineSize * kCacheLineSize;
+}
+
+/**
+ * Returns the shared memory object path of a ring name
+ */
+std::string ShmPath(const std::string &name)
+{
+    return "/" + name;
+}
+
+ShmRing::ShmRing(std::string name, void *memory, size_t mapped_size, uint32_t capacity, uint32_t slot_size) :
+    name_(std::move(name)), memory_(memory), mapped_size_(mapped_size),
+    header_(static_cast<ShmRingHeader*>(memory)), capacity_(capacity), slot_size_(slot_size) {}
+
+ShmRing::~ShmRing()
+{
+    munmap(memory_, mapped_size_);
+}
+
+std::unique_ptr<ShmRing> ShmRing::Create(const std::string &name, uint32_t capacity,
+                                         uint32_t max_message_size)
+{
+    // The largest power of two a uint32_t holds, past which rounding up would overflow
+    constexpr uint32_t kMaxCapacity = 1u << 31;
+    if(capacity > kMaxCapacity){
+        return nullptr;
+    }
+    uint32_t rounded_capacity = 1;
+    while(rounded_capacity < capacity){
+        rounded_capacity <<= 1;
+    }
+    const size_t slot_size = CacheAligned(sizeof(SlotHeader) + max_message_size);
+    const size_t mapped_size = CacheAligned(sizeof(ShmRingHeader)) + rounded_capacity * slot_size;
+
+    // A leftover object of the same name belongs to a process that is gone
+    const std::string path = ShmPath(name);
+    shm_unlink(path.c_str());
+    const int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if(fd < 0){
+        return nullptr;
+    }
+    if(ftruncate(fd, mapped_size) != 0){
+        close(fd);
+        shm_unlink(path.c_str());
+        return nullptr;
+    }
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        shm_unlink(path.c_str());
+        return nullptr;
+    }
+
+    // The object starts zero filled, so only the non-zero fields need setting
+    std::unique_ptr<ShmRing> ring(new ShmRing(name, memory, mapped_size, rounded_capacity,
+                                              static_cast<uint32_t>(slot_size)));
+    ring->header_->capacity = rounded_capacity;
+    ring->header_->slot_size = static_cast<uint32_t>(slot_size);
+    ring->header_->creator_pid = getpid();
+    for(uint64_t i = 0; i < rounded_capacity; ++i){
+        reinterpret_cast<SlotHeader*>(ring->SlotAt(i))->sequence.store(i, std::memory_order_relaxed);
+    }
+    ring->header_->magic.store(kRingMagic, std::memory_order_release);
+    return ring;
+}
+
+std::unique_ptr<ShmRing> ShmRing::Open(const std::string &name)
+{
+    const int fd = shm_open(ShmPath(name).c_str(), O_RDWR, 0);
+    if(fd < 0){
+        return nullptr;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < sizeof(ShmRingHeader)){
+        close(fd);
+        return nullptr;
+    }
+    const size_t mapped_size = info.st_size;
+    void *memory = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED){
+        return nullptr;
+    }
+
+    const ShmRingHeader &header = *static_cast<const ShmRingHeader*>(memory);
+    if(header.magic.load(std::memory_order_acquire) != kRingMagic){
+        munmap(memory, mapped_size);
+        return nullptr;
+    }
+    // Read the layout once, and check it against what was actually mapped
+    const uint32_t capacity = header.capacity;
+    const uint32_t slot_size = header.slot_size;
+    const bool valid_capacity = capacity > 0 && (capacity & (capacity - 1)) == 0;
+    const bool valid_slot_size = slot_size > sizeof(SlotHeader) && slot_size % kCacheLineSize == 0;
+    if(!valid_capacity || !valid_slot_size || 
+       CacheAligned(sizeof(ShmRingHeader)) + static_cast<size_t>(capacity) * slot_size > mapped_size){
+        munmap(memory, mapped_size);
+        return nullptr;
+    }
+    return std::unique_ptr<ShmRing>(new ShmRing(name, memory, mapped_size, capacity, slot_size));
+}
+
+void ShmRing::Unlink(const std::string &name) noexcept
+{
+    shm_unlink(ShmPath(name).c_str());
+}
+
+char *ShmRing::SlotAt(uint64_t position) const noexcept
+{
+    const uint64_t index = position & (capacity_ - 1);
+    return static_cast<char*>(memory_) + CacheAligned(sizeof(ShmRingHeader)) + index * slot_size_;
+}
+
+bool ShmRing::TryPush(size_t size, nostd::function_ref<void(char *)> write) noexcept
+{
+    if(size > max_message_size()){
+        header_->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    uint64_t position = header_->enqueue_position.load(std::memory_order_relaxed);
+    SlotHeader *slot;
+    for(;;){
+        slot = reinterpret_cast<SlotHeader*>(SlotAt(position));
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const int64_t difference = static_cast<int64_t>(sequence - position);
+        if(difference == 0){
+            // The slot is free for this lap: claim it
+            if(header_->enqueue_position.compare_exchange_weak(position, position + 1, 
+                                                               std::memory_order_relaxed)){
+                break;
+            }
+        } else if(difference < 0){
+            // The slot still holds the message of the previous lap: the ring is full
+            header_->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        } else {
+            position = header_->enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    write(reinterpret_cast<char*>(slot + 1));
+    slot->size = size;
+    slot->sequence.store(position + 1, std::memory_order_release);
+    return true;
+}
+
+bool ShmRing::TryPush(nostd::string_view message) noexcept
+{
+    return TryPush(message.size(), [&message](char *slot){
+        memcpy(slot, message.data(), message.size());
+    });
+}
+
+bool ShmRing::TryPop(std::string *message) noexcept
+{
+    uint64_t position = header_->dequeue_position.load(std::memory_order_relaxed);
+    SlotHeader *slot;
+    for(;;){
+        slot = reinterpret_cast<SlotHeader*>(SlotAt(position));
+        const uint64_t sequence = slot->sequence.load(std::memory_order_acquire);
+        const int64_t difference = static_cast<int64_t>(sequence - (position + 1));
+        if(difference == 0){
+            // The slot holds a published message: claim it
+            if(header_->dequeue_position.compare_exchange_weak(position, position + 1, 
+                                                               std::memory_order_relaxed)){
+                break;
+            }
+        } else if(difference < 0){
+            // Nothing published yet at this position: the ring is empty
+            return false;
+        } else {
+            position = header_->dequeue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Never trust a size written by another process beyond the slot
+    const size_t size = slot->size <= max_message_size() ? slot->size : 0;
+    message->assign(reinterpret_cast<const char*>(slot + 1), size);
+    slot->sequence.store(position + capacity_, std::memory_order_release);
+    return true;
+}
+
+uint64_t ShmRing::dropped() const noexcept
+{
+    return header_->dropped.load(std::memory_order_relaxed);
+}
+
+pid_t ShmRing::creator_pid() const noexcept
+{
+    return header_->creator_pid;
+}
+
+bool ShmRing::empty() const noexcept
+{
+    return header_->dequeue_position.load(std::memory_order_relaxed) >=
+           header_->enqueue_position.load(std::memory_order_relaxed);
+}
+
+size_t ShmRing::max_message_size() const noexcept
+{
+    return slot_size_ - sizeof(SlotHeader);
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,127 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "opentelemetry/nostd/function_ref.h"
+#include "opentelemetry/nostd/string_view.h"
+#include "opentelemetry/version.h"
+
+#include <sys/types.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+struct ShmRingHeader;
+
+/**
+ * A bounded queue of messages in a named POSIX shared memory object, so that processes can
+ * hand messages to each other without a syscall or a lock. Every message sits in one fixed
+ * size slot, claimed and published with the slot sequence numbers of Dmitry Vyukov's bounded
+ * queue, so any number of threads of any number of processes can push and pop at once.
+ */
+class ShmRing
+{
+public:
+    /**
+     * Creates a ring, replacing any stale object of the same name
+     * 
+     * @param name - The shared memory object name, without the leading slash
+     * @param capacity - Number of slots, rounded up to a power of two, at most 2^31
+     * @param max_message_size - Largest message a slot holds
+     * @return The ring, or null if the capacity is too large or the shared memory could
+     * not be set up
+     */
+    static std::unique_ptr<ShmRing> Create(const std::string &name, uint32_t capacity,
+                                           uint32_t max_message_size);
+
+    /**
+     * Maps a ring created by another process
+     * 
+     * @param name - The shared memory object name, without the leading slash
+     * @return The ring, or null if it does not exist or is not fully initialized yet
+     */
+    static std::unique_ptr<ShmRing> Open(const std::string &name);
+
+    /**
+     * Removes the name of a ring. Processes which mapped it keep using it.
+     */
+    static void Unlink(const std::string &name) noexcept;
+
+    ~ShmRing();
+
+    /**
+     * Pushes a message written straight into its slot
+     * 
+     * @param size - Size of the message
+     * @param write - Called with the slot to write exactly 'size' bytes to
+     * @return Whether the message was pushed, false if the ring is full or it is too large
+     */
+    bool TryPush(size_t size, nostd::function_ref<void(char *)> write) noexcept;
+
+    /* Pushes a copy of a message */
+    bool TryPush(nostd::string_view message) noexcept;
+
+    /**
+     * Pops the oldest message
+     * 
+     * @param message - Replaced with the popped message
+     * @return Whether a message was popped, false if the ring is empty
+     */
+    bool TryPop(std::string *message) noexcept;
+
+    /* Number of messages pushers had to drop, because the ring was full or they were too large */
+    uint64_t dropped() const noexcept;
+
+    /* Whether every message pushed has been popped */
+    bool empty() const noexcept;
+
+    /* The process that created the ring */
+    pid_t creator_pid() const noexcept;
+
+    size_t capacity() const noexcept { return capacity_; }
+    size_t max_message_size() const noexcept;
+    const std::string &name() const noexcept { return name_; }
+
+private:
+    ShmRing(std::string name, void *memory, size_t mapped_size, uint32_t capacity, uint32_t slot_size);
+
+    /* Returns the slot a position maps to */
+    char *SlotAt(uint64_t position) const noexcept;
+
+    const std::string name_;
+    void *const memory_;
+    const size_t mapped_size_;
+    ShmRingHeader *const header_;
+
+    /* The layout, as set up by Create or checked by Open. The copies in the shared header
+       are never read again, since another process could change them. */
+    const uint32_t capacity_;
+    const uint32_t slot_size_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
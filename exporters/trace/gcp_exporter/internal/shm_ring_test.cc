@@ -0,0 +1,220 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/shm_ring.h"
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <set>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Returns a ring name no other test process uses
+ */
+std::string TestRingName(const std::string &test)
+{
+    return "gcp_exporter_shm_ring_test." + test + "." + std::to_string(getpid());
+}
+
+TEST(ShmRing, TestPushPop)
+{
+    const std::string name = TestRingName("push_pop");
+    auto ring = ShmRing::Create(name, 5, 100);
+    ASSERT_NE(nullptr, ring);
+    EXPECT_EQ(8, ring->capacity());
+    EXPECT_GE(ring->max_message_size(), 100);
+    EXPECT_EQ(getpid(), ring->creator_pid());
+
+    std::string message;
+    EXPECT_FALSE(ring->TryPop(&message));
+    EXPECT_TRUE(ring->TryPush("first"));
+    EXPECT_TRUE(ring->TryPush(""));
+    EXPECT_TRUE(ring->TryPush("third"));
+
+    ASSERT_TRUE(ring->TryPop(&message));
+    EXPECT_EQ("first", message);
+    ASSERT_TRUE(ring->TryPop(&message));
+    EXPECT_EQ("", message);
+    ASSERT_TRUE(ring->TryPop(&message));
+    EXPECT_EQ("third", message);
+    EXPECT_FALSE(ring->TryPop(&message));
+
+    ShmRing::Unlink(name);
+}
+
+TEST(ShmRing, TestTooLargeCapacityIsRejected)
+{
+    const std::string name = TestRingName("too_large");
+    EXPECT_EQ(nullptr, ShmRing::Create(name, (1u << 31) + 1, 100));
+    EXPECT_EQ(nullptr, ShmRing::Open(name));
+}
+
+TEST(ShmRing, TestFullRingAndLargeMessagesAreDropped)
+{
+    const std::string name = TestRingName("full");
+    auto ring = ShmRing::Create(name, 4, 16);
+    ASSERT_NE(nullptr, ring);
+
+    for(int lap = 0; lap < 3; ++lap){
+        for(size_t i = 0; i < ring->capacity(); ++i){
+            EXPECT_TRUE(ring->TryPush(std::to_string(i)));
+        }
+        EXPECT_FALSE(ring->TryPush("overflow"));
+
+        std::string message;
+        for(size_t i = 0; i < ring->capacity(); ++i){
+            ASSERT_TRUE(ring->TryPop(&message));
+            EXPECT_EQ(std::to_string(i), message);
+        }
+    }
+    EXPECT_FALSE(ring->TryPush(std::string(ring->max_message_size() + 1, 'x')));
+    EXPECT_EQ(4, ring->dropped());
+
+    ShmRing::Unlink(name);
+}
+
+TEST(ShmRing, TestOpenSharesTheRing)
+{
+    const std::string name = TestRingName("open");
+    EXPECT_EQ(nullptr, ShmRing::Open(name));
+
+    auto producer = ShmRing::Create(name, 16, 64);
+    auto consumer = ShmRing::Open(name);
+    ASSERT_NE(nullptr, producer);
+    ASSERT_NE(nullptr, consumer);
+    EXPECT_EQ(producer->capacity(), consumer->capacity());
+
+    EXPECT_TRUE(producer->TryPush("hello"));
+    std::string message;
+    ASSERT_TRUE(consumer->TryPop(&message));
+    EXPECT_EQ("hello", message);
+
+    ShmRing::Unlink(name);
+    EXPECT_EQ(nullptr, ShmRing::Open(name));
+}
+
+TEST(ShmRing, TestLayoutChangedByAnotherProcessIsIgnored)
+{
+    const std::string name = TestRingName("layout");
+    auto producer = ShmRing::Create(name, 4, 64);
+    auto consumer = ShmRing::Open(name);
+    ASSERT_NE(nullptr, producer);
+    ASSERT_NE(nullptr, consumer);
+    EXPECT_TRUE(consumer->empty());
+
+    // Overwrite the capacity and slot size, which follow the 8 byte magic
+    const int fd = shm_open(("/" + name).c_str(), O_RDWR, 0);
+    ASSERT_GE(fd, 0);
+    void *memory = mmap(nullptr, 16, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    ASSERT_NE(MAP_FAILED, memory);
+    static_cast<uint32_t*>(memory)[2] = 1u << 30;
+    static_cast<uint32_t*>(memory)[3] = 1u << 30;
+    munmap(memory, 16);
+
+    EXPECT_EQ(4, consumer->capacity());
+    EXPECT_EQ(producer->max_message_size(), consumer->max_message_size());
+    for(int i = 0; i < 10; ++i){
+        EXPECT_TRUE(producer->TryPush("message"));
+        EXPECT_FALSE(consumer->empty());
+        std::string message;
+        ASSERT_TRUE(consumer->TryPop(&message));
+        EXPECT_EQ("message", message);
+    }
+    EXPECT_TRUE(consumer->empty());
+    ShmRing::Unlink(name);
+}
+
+TEST(ShmRing, TestConcurrentPushers)
+{
+    constexpr int kNumThreads = 4;
+    constexpr int kMessagesPerThread = 20000;
+    const std::string name = TestRingName("concurrent");
+    auto ring = ShmRing::Create(name, 256, 32);
+    ASSERT_NE(nullptr, ring);
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < kNumThreads; ++t){
+        threads.emplace_back([&ring, t]{
+            for(int i = 0; i < kMessagesPerThread; ++i){
+                const std::string message = std::to_string(t) + ":" + std::to_string(i);
+                while(!ring->TryPush(message)){
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+
+    std::set<std::string> received;
+    std::string message;
+    while(received.size() < kNumThreads * kMessagesPerThread){
+        if(ring->TryPop(&message)){
+            EXPECT_TRUE(received.insert(message).second) << "Duplicate message " << message;
+        }
+    }
+    for(auto& thread: threads){
+        thread.join();
+    }
+    EXPECT_FALSE(ring->TryPop(&message));
+
+    ShmRing::Unlink(name);
+}
+
+TEST(ShmRing, TestPushFromAnotherProcess)
+{
+    const std::string name = TestRingName("fork");
+    auto ring = ShmRing::Create(name, 64, 64);
+    ASSERT_NE(nullptr, ring);
+
+    const pid_t child = fork();
+    ASSERT_GE(child, 0);
+    if(child == 0){
+        auto child_ring = ShmRing::Open(name);
+        bool ok = child_ring != nullptr;
+        for(int i = 0; ok && i < 10; ++i){
+            ok = child_ring->TryPush("from child " + std::to_string(i));
+        }
+        _exit(ok ? 0 : 1);
+    }
+    int status;
+    ASSERT_EQ(child, waitpid(child, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    std::string message;
+    for(int i = 0; i < 10; ++i){
+        ASSERT_TRUE(ring->TryPop(&message));
+        EXPECT_EQ("from child " + std::to_string(i), message);
+    }
+
+    ShmRing::Unlink(name);
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,195 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/shm_transport.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/shm_ring.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Every message of a ring is a span's trace id followed by the encoded span */
+constexpr size_t kTraceIdSize = 16;
+
+/* ############################### EXPORTER FUNCTIONS ################################ */
+
+ShmRingExporter::ShmRingExporter(const ShmTransportOptions &options) :
+    ring_(ShmRing::Create(options.ring_prefix + std::to_string(getpid()), options.ring_capacity,
+                          kTraceIdSize + options.max_span_size)),
+    drain_timeout_(options.drain_timeout), shut_down_(false) {}
+
+ShmRingExporter::~ShmRingExporter()
+{
+    Shutdown();
+}
+
+void ShmRingExporter::Shutdown(std::chrono::microseconds timeout) noexcept
+{
+    if(!ring_ || shut_down_.exchange(true)){
+        return;
+    }
+    // Without an agent running, nothing else would remove the ring while this process lives
+    const auto deadline = std::chrono::steady_clock::now() +
+                          (timeout.count() > 0 ? timeout : std::chrono::microseconds(drain_timeout_));
+    while(!ring_->empty() && std::chrono::steady_clock::now() < deadline){
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    ShmRing::Unlink(ring_->name());
+}
+
+std::unique_ptr<sdk::trace::Recordable> ShmRingExporter::MakeRecordable() noexcept
+{
+    return std::unique_ptr<sdk::trace::Recordable>(new Recordable);
+}
+
+sdk::trace::ExportResult ShmRingExporter::Export(
+      const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept
+{
+    if(!ring_){
+        return sdk::trace::ExportResult::kFailure;
+    }
+
+    bool all_pushed = true;
+    for(auto& recordable: spans){
+        const auto &rec = *static_cast<Recordable*>(recordable.get());
+        const auto &span = rec.span();
+        // Encode straight into the slot, which the agent reads in place: the trace id, then
+        // the span, whose name the agent's exporter addresses to its own project
+        const size_t size = kTraceIdSize + span.ByteSizeLong();
+        all_pushed &= ring_->TryPush(size, [&rec, &span](char *slot){
+            memcpy(slot, rec.trace_id().data(), kTraceIdSize);
+            span.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(slot + kTraceIdSize));
+        });
+        recordable.reset();
+    }
+
+    if(all_pushed){
+        return sdk::trace::ExportResult::kSuccess;
+    } else {
+        return sdk::trace::ExportResult::kFailure;
+    }
+}
+
+std::string ShmRingExporter::ring_name() const
+{
+    return ring_ ? ring_->name() : std::string();
+}
+
+/* ################################ AGENT FUNCTIONS ################################## */
+
+ShmRingAgent::ShmRingAgent(std::unique_ptr<sdk::trace::SpanExporter> exporter,
+                           const ShmRingAgentOptions &options) :
+    exporter_(std::move(exporter)), options_(options), num_failed_spans_(0) {}
+
+ShmRingAgent::~ShmRingAgent() = default;
+
+void ShmRingAgent::DiscoverRings() noexcept
+{
+    DIR *directory = opendir(options_.shm_directory.c_str());
+    if(directory == nullptr){
+        return;
+    }
+    while(const dirent *entry = readdir(directory)){
+        const std::string name(entry->d_name);
+        if(name.compare(0, options_.ring_prefix.size(), options_.ring_prefix) != 0 || rings_.count(name)){
+            continue;
+        }
+        // Rings still being set up are picked up on a later poll
+        auto ring = ShmRing::Open(name);
+        if(ring){
+            rings_.emplace(name, std::move(ring));
+        }
+    }
+    closedir(directory);
+}
+
+size_t ShmRingAgent::Poll() noexcept
+{
+    DiscoverRings();
+
+    size_t num_exported = 0;
+    std::vector<std::unique_ptr<sdk::trace::Recordable>> batch;
+    batch.reserve(options_.max_batch_size);
+    const auto flush = [&]{
+        if(batch.empty()){
+            return;
+        }
+        const auto result = exporter_->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(batch.data(),
+                                                                                                batch.size()));
+        if(result != sdk::trace::ExportResult::kSuccess){
+            num_failed_spans_.fetch_add(batch.size(), std::memory_order_relaxed);
+        }
+        num_exported += batch.size();
+        batch.clear();
+    };
+
+    std::string message;
+    for(auto it = rings_.begin(); it != rings_.end();){
+        ShmRing &ring = *it->second;
+        // Checked before draining, so that nothing can be pushed after the last pop
+        const bool creator_exited = kill(ring.creator_pid(), 0) != 0 && errno == ESRCH;
+
+        while(ring.TryPop(&message)){
+            google::devtools::cloudtrace::v2::Span span;
+            if(message.size() < kTraceIdSize ||
+               !span.ParseFromArray(message.data() + kTraceIdSize, static_cast<int>(message.size() - kTraceIdSize))){
+                continue;
+            }
+            std::array<uint8_t, kTraceIdSize> trace_id;
+            memcpy(trace_id.data(), message.data(), kTraceIdSize);
+            batch.emplace_back(new Recordable(trace_id, std::move(span)));
+            if(batch.size() >= options_.max_batch_size){
+                flush();
+            }
+        }
+
+        if(creator_exited){
+            ShmRing::Unlink(it->first);
+            it = rings_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    flush();
+    return num_exported;
+}
+
+void ShmRingAgent::Run(const std::atomic<bool> &stop) noexcept
+{
+    while(!stop.load(std::memory_order_relaxed)){
+        if(Poll() == 0){
+            std::this_thread::sleep_for(options_.poll_interval);
+        }
+    }
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
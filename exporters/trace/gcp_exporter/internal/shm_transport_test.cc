@@ -0,0 +1,244 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/shm_transport.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+#include "exporters/trace/gcp_exporter/internal/shm_ring.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * An exporter keeping the display names of the spans it is handed, and the names they are
+ * addressed by in the project "agent_project"
+ */
+class CollectingExporter final : public sdk::trace::SpanExporter
+{
+public:
+    CollectingExporter(std::vector<std::string> *names, std::vector<std::string> *span_names,
+                       std::vector<size_t> *batch_sizes, sdk::trace::ExportResult result) :
+        names_(names), span_names_(span_names), batch_sizes_(batch_sizes), result_(result) {}
+
+    std::unique_ptr<sdk::trace::Recordable> MakeRecordable() noexcept override
+    {
+        return std::unique_ptr<sdk::trace::Recordable>(new Recordable);
+    }
+
+    sdk::trace::ExportResult Export(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept override
+    {
+        for(auto& recordable: spans){
+            const auto *span = static_cast<Recordable*>(recordable.get());
+            names_->push_back(span->span().display_name().value());
+            google::devtools::cloudtrace::v2::Span addressed;
+            span->ToProto("agent_project", &addressed);
+            span_names_->push_back(addressed.name());
+        }
+        batch_sizes_->push_back(spans.size());
+        return result_;
+    }
+
+    void Shutdown(std::chrono::microseconds) noexcept override {}
+
+private:
+    std::vector<std::string> *names_;
+    std::vector<std::string> *span_names_;
+    std::vector<size_t> *batch_sizes_;
+    const sdk::trace::ExportResult result_;
+};
+
+class ShmTransportTest : public ::testing::Test
+{
+protected:
+    ShmTransportTest() : prefix_("gcp_exporter_shm_transport_test." + std::to_string(getpid()) + ".")
+    {
+        // Only the agent's exporter knows the project
+        unsetenv(kGCPEnvVar);
+    }
+
+    std::unique_ptr<ShmRingAgent> MakeAgent(size_t max_batch_size = 512,
+                                            sdk::trace::ExportResult result = sdk::trace::ExportResult::kSuccess)
+    {
+        ShmRingAgentOptions options;
+        options.ring_prefix = prefix_;
+        options.max_batch_size = max_batch_size;
+        return std::unique_ptr<ShmRingAgent>(new ShmRingAgent(
+            std::unique_ptr<sdk::trace::SpanExporter>(new CollectingExporter(&names_, &span_names_, &batch_sizes_,
+                                                                             result)), 
+            options));
+    }
+
+    /**
+     * Exports spans named "<name_prefix><i>" through an exporter
+     */
+    static sdk::trace::ExportResult ExportSpans(ShmRingExporter &exporter, const std::string &name_prefix, 
+                                                int num_spans)
+    {
+        const SpanGenerator generator(DenseSpanShape());
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> recordables;
+        for(int i = 0; i < num_spans; ++i){
+            recordables.push_back(exporter.MakeRecordable());
+            generator.Fill(*recordables.back());
+            recordables.back()->SetName(name_prefix + std::to_string(i));
+        }
+        return exporter.Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(recordables.data(), 
+                                                                                   recordables.size()));
+    }
+
+    const std::string prefix_;
+    std::vector<std::string> names_;
+    std::vector<std::string> span_names_;
+    std::vector<size_t> batch_sizes_;
+};
+
+TEST_F(ShmTransportTest, TestSpansReachTheAgent)
+{
+    ShmTransportOptions options;
+    options.ring_prefix = prefix_;
+    ShmRingExporter exporter(options);
+    ASSERT_EQ(prefix_ + std::to_string(getpid()), exporter.ring_name());
+
+    auto agent = MakeAgent(4);
+    EXPECT_EQ(0, agent->Poll());
+    EXPECT_EQ(1, agent->num_rings());
+
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, ExportSpans(exporter, "span ", 10));
+    EXPECT_EQ(10, agent->Poll());
+    ASSERT_EQ(10, names_.size());
+    for(int i = 0; i < 10; ++i){
+        EXPECT_EQ("span " + std::to_string(i), names_[i]);
+    }
+    EXPECT_EQ(std::vector<size_t>({4, 4, 2}), batch_sizes_);
+
+    // The ring of a live process is kept
+    EXPECT_EQ(1, agent->num_rings());
+    ShmRing::Unlink(exporter.ring_name());
+}
+
+TEST_F(ShmTransportTest, TestSpansAreAddressedByTheAgent)
+{
+    ShmTransportOptions options;
+    options.ring_prefix = prefix_;
+    ShmRingExporter exporter(options);
+    auto agent = MakeAgent();
+    EXPECT_EQ(0, agent->Poll());
+
+    // The exporting process has no project, and the trace id travels with the span
+    const opentelemetry::trace::TraceId trace_id(
+    std::array<const uint8_t, opentelemetry::trace::TraceId::kSize>(
+        {0, 1, 0, 2, 1, 3, 1, 4, 1, 5, 1, 6, 3, 7, 0, 0}));
+    const opentelemetry::trace::SpanId span_id(
+    std::array<const uint8_t, opentelemetry::trace::SpanId::kSize>(
+        {1, 2, 3, 4, 5, 6, 7, 8}));
+    std::unique_ptr<sdk::trace::Recordable> recordable = exporter.MakeRecordable();
+    recordable->SetIds(trace_id, span_id, opentelemetry::trace::SpanId());
+    recordable->SetName("span");
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess,
+              exporter.Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1)));
+
+    EXPECT_EQ(1, agent->Poll());
+    EXPECT_EQ(std::vector<std::string>({"projects/agent_project/traces/00010002010301040105010603070000/spans/"
+                                        "0102030405060708"}), span_names_);
+    ShmRing::Unlink(exporter.ring_name());
+}
+
+TEST_F(ShmTransportTest, TestFullRingFailsExport)
+{
+    ShmTransportOptions options;
+    options.ring_prefix = prefix_;
+    options.ring_capacity = 8;
+    ShmRingExporter exporter(options);
+
+    EXPECT_EQ(sdk::trace::ExportResult::kFailure, ExportSpans(exporter, "span ", 9));
+    auto agent = MakeAgent();
+    EXPECT_EQ(8, agent->Poll());
+    ShmRing::Unlink(exporter.ring_name());
+}
+
+TEST_F(ShmTransportTest, TestFailedExportsAreCounted)
+{
+    ShmTransportOptions options;
+    options.ring_prefix = prefix_;
+    ShmRingExporter exporter(options);
+
+    EXPECT_EQ(sdk::trace::ExportResult::kSuccess, ExportSpans(exporter, "span ", 6));
+    auto agent = MakeAgent(4, sdk::trace::ExportResult::kFailure);
+    EXPECT_EQ(6, agent->Poll());
+    EXPECT_EQ(6, agent->num_failed_spans());
+}
+
+TEST_F(ShmTransportTest, TestShutdownRemovesTheRing)
+{
+    ShmTransportOptions options;
+    options.ring_prefix = prefix_;
+    options.drain_timeout = std::chrono::milliseconds(1);
+    {
+        ShmRingExporter exporter(options);
+        auto agent = MakeAgent();
+        EXPECT_EQ(0, agent->Poll());
+        EXPECT_EQ(1, agent->num_rings());
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess, ExportSpans(exporter, "span ", 3));
+
+        // The agent keeps draining a ring removed after it mapped it
+        exporter.Shutdown();
+        EXPECT_EQ(nullptr, ShmRing::Open(exporter.ring_name()));
+        EXPECT_EQ(3, agent->Poll());
+    }
+
+    // Without any agent, destroying the exporter removes the ring too
+    std::string ring_name;
+    {
+        ShmRingExporter exporter(options);
+        ring_name = exporter.ring_name();
+        EXPECT_EQ(sdk::trace::ExportResult::kSuccess, ExportSpans(exporter, "span ", 3));
+    }
+    EXPECT_EQ(nullptr, ShmRing::Open(ring_name));
+}
+
+TEST_F(ShmTransportTest, TestRingsOfExitedProcessesAreDrainedAndRemoved)
+{
+    auto agent = MakeAgent();
+    for(int child_index = 0; child_index < 3; ++child_index){
+        const pid_t child = fork();
+        ASSERT_GE(child, 0);
+        if(child == 0){
+            ShmTransportOptions options;
+            options.ring_prefix = prefix_;
+            ShmRingExporter exporter(options);
+            const auto result = ExportSpans(exporter, "child span ", 5);
+            _exit(result == sdk::trace::ExportResult::kSuccess ? 0 : 1);
+        }
+        int status;
+        ASSERT_EQ(child, waitpid(child, &status, 0));
+        ASSERT_EQ(0, WEXITSTATUS(status));
+    }
+
+    EXPECT_EQ(15, agent->Poll());
+    EXPECT_EQ(0, agent->num_rings());
+    EXPECT_EQ(0, agent->Poll());
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,341 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Drives an exporter continuously, against a stub that fails and delays some of its calls,
+ * and fails if memory keeps growing or throughput decays over the run. Meant to be run by
+ * hand, for as long as slow leaks need to show:
+ *
+ *   GCP_EXPORTER_SOAK_SECONDS=3600 bazel test :soak_test --test_output=streamed
+ *
+ * Environment variables, all optional:
+ *
+ *   GCP_EXPORTER_SOAK_SECONDS     - Duration of the run (default 20)
+ *   GCP_EXPORTER_SOAK_MAX_GROWTH  - Fraction RSS and heap in use may grow by, from the end of
+ *                                   the warm-up to the end of the run, on top of a fixed
+ *                                   4 MiB (default 0.2)
+ *   GCP_EXPORTER_SOAK_MAX_DECAY   - Fraction throughput may drop by over the same span
+ *                                   (default 0.3)
+ *   GCP_EXPORTER_SOAK_FAILURE_RATE - Fraction of the calls that fail (default 0.05)
+ *   GCP_EXPORTER_SOAK_LATENCY_US  - Latency of every call (default 200)
+ */
+
+#include "exporters/trace/gcp_exporter/gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <gtest/gtest.h>
+#include <malloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Memory growth always tolerated, for the batches in flight when a sample is taken */
+constexpr double kMemorySlackBytes = 4 << 20;
+
+/**
+ * Reads a numeric environment variable
+ */
+double EnvOr(const char *name, double default_value)
+{
+    const char *value = getenv(name);
+    return value ? atof(value) : default_value;
+}
+
+/**
+ * A stub that delays every call and fails a fixed fraction of them
+ */
+class FlakyStub final : public cloudtrace_v2::TraceService::StubInterface
+{
+public:
+    FlakyStub(double failure_rate, std::chrono::microseconds latency) :
+        failure_period_(failure_rate > 0 ? static_cast<uint64_t>(1 / failure_rate) : 0), latency_(latency) {}
+
+    grpc::Status BatchWriteSpans(grpc::ClientContext*, const cloudtrace_v2::BatchWriteSpansRequest&, 
+                                 google::protobuf::Empty*) override
+    {
+        std::this_thread::sleep_for(latency_);
+        const uint64_t call = num_calls_++;
+        if(failure_period_ > 0 && call % failure_period_ == 0){
+            return grpc::Status(grpc::StatusCode::UNAVAILABLE, "Injected failure");
+        }
+        return grpc::Status::OK;
+    }
+
+    grpc::Status CreateSpan(grpc::ClientContext*, const cloudtrace_v2::Span&, cloudtrace_v2::Span*) override
+    {
+        return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
+    }
+
+private:
+    grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* AsyncBatchWriteSpansRaw(
+        grpc::ClientContext*, const cloudtrace_v2::BatchWriteSpansRequest&, grpc::CompletionQueue*) override
+    {
+        return nullptr;
+    }
+
+    grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* PrepareAsyncBatchWriteSpansRaw(
+        grpc::ClientContext*, const cloudtrace_v2::BatchWriteSpansRequest&, grpc::CompletionQueue*) override
+    {
+        return nullptr;
+    }
+
+    grpc::ClientAsyncResponseReaderInterface<cloudtrace_v2::Span>* AsyncCreateSpanRaw(
+        grpc::ClientContext*, const cloudtrace_v2::Span&, grpc::CompletionQueue*) override
+    {
+        return nullptr;
+    }
+
+    grpc::ClientAsyncResponseReaderInterface<cloudtrace_v2::Span>* PrepareAsyncCreateSpanRaw(
+        grpc::ClientContext*, const cloudtrace_v2::Span&, grpc::CompletionQueue*) override
+    {
+        return nullptr;
+    }
+
+    const uint64_t failure_period_;
+    const std::chrono::microseconds latency_;
+    std::atomic<uint64_t> num_calls_{0};
+};
+
+/* One point of the time series sampled during the run */
+struct SoakSample
+{
+    double seconds;
+    size_t rss_bytes;
+    size_t heap_bytes;
+    double spans_per_second;
+};
+
+/**
+ * Reads the resident set size of the process
+ */
+size_t ResidentBytes()
+{
+    size_t total_pages = 0, resident_pages = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if(!statm){
+        return 0;
+    }
+    if(fscanf(statm, "%zu %zu", &total_pages, &resident_pages) != 2){
+        resident_pages = 0;
+    }
+    fclose(statm);
+    return resident_pages * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+/**
+ * Reads the bytes the allocator has handed out and not had back
+ */
+size_t HeapBytesInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return mallinfo2().uordblks;
+#elif defined(__GLIBC__)
+    return static_cast<unsigned int>(mallinfo().uordblks);
+#else
+    return 0;
+#endif
+}
+
+/**
+ * Returns the median of the samples of a field, over a range of samples
+ */
+template <typename T>
+double Median(const std::vector<SoakSample> &samples, size_t begin, size_t end, T SoakSample::*field)
+{
+    std::vector<double> values;
+    for(size_t i = begin; i < end; ++i){
+        values.push_back(static_cast<double>(samples[i].*field));
+    }
+    std::sort(values.begin(), values.end());
+    return values.empty() ? 0 : values[values.size() / 2];
+}
+
+/**
+ * Hands batches of recordables made on producer threads to the exporting thread, so that
+ * recordables are freed on another thread than the one that made them, as behind a batch
+ * span processor
+ */
+class RecordableBatchQueue
+{
+public:
+    explicit RecordableBatchQueue(size_t capacity) : capacity_(capacity) {}
+
+    void Push(std::vector<std::unique_ptr<sdk::trace::Recordable>> batch)
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        not_full_.wait(lock, [this]{ return batches_.size() < capacity_ || closed_; });
+        batches_.push_back(std::move(batch));
+        not_empty_.notify_one();
+    }
+
+    bool Pop(std::vector<std::unique_ptr<sdk::trace::Recordable>> *batch)
+    {
+        std::unique_lock<std::mutex> lock(mu_);
+        not_empty_.wait(lock, [this]{ return !batches_.empty() || closed_; });
+        if(batches_.empty()){
+            return false;
+        }
+        *batch = std::move(batches_.front());
+        batches_.pop_front();
+        not_full_.notify_one();
+        return true;
+    }
+
+    void Close()
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        closed_ = true;
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    std::mutex mu_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<std::vector<std::unique_ptr<sdk::trace::Recordable>>> batches_;
+    bool closed_ = false;
+};
+
+class SoakTest : public ::testing::Test
+{
+public:
+    std::unique_ptr<GcpExporter> MakeExporter(cloudtrace_v2::TraceService::StubInterface* stub,
+                                              const GcpExporterOptions &options)
+    {
+        return std::unique_ptr<GcpExporter>(new GcpExporter(
+            std::unique_ptr<cloudtrace_v2::TraceService::StubInterface>(stub), "soak_project", options));
+    }
+};
+
+TEST_F(SoakTest, TestSteadyMemoryAndThroughput)
+{
+    setenv(kGCPEnvVar, "soak_project", 1);
+    const double duration_seconds = EnvOr("GCP_EXPORTER_SOAK_SECONDS", 20);
+    const double max_growth = EnvOr("GCP_EXPORTER_SOAK_MAX_GROWTH", 0.2);
+    const double max_decay = EnvOr("GCP_EXPORTER_SOAK_MAX_DECAY", 0.3);
+    const double failure_rate = EnvOr("GCP_EXPORTER_SOAK_FAILURE_RATE", 0.05);
+    const std::chrono::microseconds latency(static_cast<int64_t>(EnvOr("GCP_EXPORTER_SOAK_LATENCY_US", 200)));
+
+    // Exercise the paths long-lived state hides in: staging chunks, worker threads, the
+    // compression estimates and the per-thread metrics shards
+    GcpExporterOptions options;
+    options.thread_local_staging = true;
+    options.compact_recordables = true;
+    options.num_export_threads = 2;
+    options.parallel_export_threshold = 256;
+    options.compression_codec = std::make_shared<GzipCodec>();
+    options.span_metrics = std::make_shared<SpanMetricsAggregator>(std::vector<std::string>({"str_key_0"}));
+    auto exporter = MakeExporter(new FlakyStub(failure_rate, latency), options);
+
+    std::atomic<bool> stopping(false);
+    std::atomic<uint64_t> num_spans_exported(0);
+    RecordableBatchQueue queue(8);
+
+    std::vector<std::thread> producers;
+    for(int p = 0; p < 2; ++p){
+        producers.emplace_back([&, p]{
+            SpanShape few_attributes = SparseSpanShape();
+            few_attributes.num_str_attributes = 4;
+            few_attributes.num_int_attributes = 2;
+            few_attributes.has_error_status = (p == 1);
+            const SpanGenerator dense(DenseSpanShape()), few(few_attributes);
+            for(size_t batch_size = 100; !stopping.load(); batch_size = batch_size % 900 + 100){
+                std::vector<std::unique_ptr<sdk::trace::Recordable>> batch;
+                for(size_t i = 0; i < batch_size; ++i){
+                    batch.push_back(exporter->MakeRecordable());
+                    (i % 16 == 0 ? dense : few).Fill(*batch.back());
+                }
+                queue.Push(std::move(batch));
+            }
+        });
+    }
+    std::thread export_thread([&]{
+        std::vector<std::unique_ptr<sdk::trace::Recordable>> batch;
+        while(queue.Pop(&batch)){
+            exporter->Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(batch.data(), batch.size()));
+            num_spans_exported += batch.size();
+            batch.clear();
+        }
+    });
+
+    // Sample about twenty times over the run
+    const auto sample_interval = std::chrono::duration<double>(std::max(duration_seconds / 20, 0.25));
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<SoakSample> samples;
+    uint64_t last_num_spans = 0;
+    auto last_time = start;
+    while(std::chrono::steady_clock::now() - start < std::chrono::duration<double>(duration_seconds)){
+        std::this_thread::sleep_for(sample_interval);
+        const auto now = std::chrono::steady_clock::now();
+        const uint64_t num_spans = num_spans_exported.load();
+        samples.push_back({std::chrono::duration<double>(now - start).count(), ResidentBytes(), HeapBytesInUse(),
+                           (num_spans - last_num_spans) / std::chrono::duration<double>(now - last_time).count()});
+        last_num_spans = num_spans;
+        last_time = now;
+        options.span_metrics->Collect();
+        printf("soak t=%7.1fs rss=%8zu KiB heap=%8zu KiB spans/s=%10.0f\n", samples.back().seconds,
+               samples.back().rss_bytes / 1024, samples.back().heap_bytes / 1024, samples.back().spans_per_second);
+        fflush(stdout);
+    }
+
+    stopping = true;
+    queue.Close();
+    for(auto& producer: producers){
+        producer.join();
+    }
+    export_thread.join();
+
+    // Compare the quarter of the run after the warm-up quarter with the last quarter
+    ASSERT_GE(samples.size(), 4);
+    const size_t quarter = samples.size() / 4;
+    const size_t warm_begin = quarter, warm_end = 2 * quarter, last_begin = samples.size() - quarter;
+
+    const double warm_rss = Median(samples, warm_begin, warm_end, &SoakSample::rss_bytes);
+    const double last_rss = Median(samples, last_begin, samples.size(), &SoakSample::rss_bytes);
+    EXPECT_LE(last_rss, warm_rss * (1 + max_growth) + kMemorySlackBytes) << "RSS grew from " << warm_rss << " to " << last_rss;
+
+    const double warm_heap = Median(samples, warm_begin, warm_end, &SoakSample::heap_bytes);
+    const double last_heap = Median(samples, last_begin, samples.size(), &SoakSample::heap_bytes);
+    EXPECT_LE(last_heap, warm_heap * (1 + max_growth) + kMemorySlackBytes) << "Heap in use grew from " << warm_heap << " to " << last_heap;
+
+    const double warm_rate = Median(samples, warm_begin, warm_end, &SoakSample::spans_per_second);
+    const double last_rate = Median(samples, last_begin, samples.size(), &SoakSample::spans_per_second);
+    EXPECT_GT(warm_rate, 0);
+    EXPECT_GE(last_rate, warm_rate * (1 - max_decay)) << "Throughput fell from " << warm_rate << " to " << last_rate;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/span_batch.h"
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+constexpr size_t kTraceIdSize = 16;
+constexpr size_t kSpanIdSize = 8;
+constexpr int64_t kNanosPerSecond = 1000000000;
+constexpr int32_t kNoStatus = -1;
+
+void SpanBatch::Reserve(size_t num_spans)
+{
+    trace_ids_.reserve(num_spans * kTraceIdSize);
+    span_ids_.reserve(num_spans * kSpanIdSize);
+    parent_span_ids_.reserve(num_spans * kSpanIdSize);
+    start_time_nanos_.reserve(num_spans);
+    end_time_nanos_.reserve(num_spans);
+    name_offsets_.reserve(num_spans);
+    name_sizes_.reserve(num_spans);
+    name_truncated_byte_counts_.reserve(num_spans);
+    status_codes_.reserve(num_spans);
+    status_message_offsets_.reserve(num_spans);
+    status_message_sizes_.reserve(num_spans);
+    attribute_runs_.reserve(num_spans + 1);
+    dropped_attributes_counts_.reserve(num_spans);
+}
+
+void SpanBatch::Append(const CompactRecordable &recordable)
+{
+    if (attribute_runs_.empty())
+    {
+        attribute_runs_.push_back(0);
+    }
+
+    trace_ids_.insert(trace_ids_.end(), recordable.trace_id().begin(), recordable.trace_id().end());
+    span_ids_.insert(span_ids_.end(), recordable.span_id().begin(), recordable.span_id().end());
+    parent_span_ids_.insert(parent_span_ids_.end(), recordable.parent_span_id().begin(), 
+                            recordable.parent_span_id().end());
+    start_time_nanos_.push_back(recordable.start_time_nanos());
+    end_time_nanos_.push_back(recordable.end_time_nanos());
+
+    const nostd::string_view name = recordable.name();
+    name_offsets_.push_back(static_cast<uint32_t>(strings_.size()));
+    name_sizes_.push_back(static_cast<uint32_t>(name.size()));
+    name_truncated_byte_counts_.push_back(recordable.name_truncated_byte_count());
+    strings_.append(name.data(), name.size());
+
+    const nostd::string_view status_message = recordable.status_message();
+    status_codes_.push_back(recordable.has_status() ? recordable.status_code() : kNoStatus);
+    status_message_offsets_.push_back(static_cast<uint32_t>(strings_.size()));
+    status_message_sizes_.push_back(static_cast<uint32_t>(status_message.size()));
+    strings_.append(status_message.data(), status_message.size());
+
+    for (size_t i = 0; i < recordable.num_attributes(); ++i)
+    {
+        CompactRecordable::Attribute attribute = recordable.attribute(i);
+        const nostd::string_view key = recordable.SlabString(attribute.key_offset, attribute.key_size);
+        attribute.key_offset = static_cast<uint32_t>(strings_.size());
+        strings_.append(key.data(), key.size());
+        if (attribute.type == CompactRecordable::AttributeType::kString)
+        {
+            const nostd::string_view value = recordable.SlabString(attribute.string_value.offset,
+                                                                   attribute.string_value.size);
+            attribute.string_value.offset = static_cast<uint32_t>(strings_.size());
+            strings_.append(value.data(), value.size());
+        }
+        attributes_.push_back(attribute);
+    }
+    attribute_runs_.push_back(static_cast<uint32_t>(attributes_.size()));
+    dropped_attributes_counts_.push_back(recordable.dropped_attributes_count());
+
+    if (recordable.time_events())
+    {
+        time_events_.emplace_back(static_cast<uint32_t>(size() - 1), *recordable.time_events());
+    }
+}
+
+void SpanBatch::Clear() noexcept
+{
+    trace_ids_.clear();
+    span_ids_.clear();
+    parent_span_ids_.clear();
+    start_time_nanos_.clear();
+    end_time_nanos_.clear();
+    name_offsets_.clear();
+    name_sizes_.clear();
+    name_truncated_byte_counts_.clear();
+    status_codes_.clear();
+    status_message_offsets_.clear();
+    status_message_sizes_.clear();
+    attribute_runs_.clear();
+    attributes_.clear();
+    dropped_attributes_counts_.clear();
+    time_events_.clear();
+    strings_.clear();
+}
+
+/**
+ * Splits a column of Unix nanoseconds into seconds and non-negative nanos
+ */
+void SplitTimestamps(const std::vector<int64_t> &unix_nanos, std::vector<int64_t> *seconds,
+                     std::vector<int32_t> *nanos)
+{
+    const size_t size = unix_nanos.size();
+    seconds->resize(size);
+    nanos->resize(size);
+    int64_t* seconds_out = seconds->data();
+    int32_t* nanos_out = nanos->data();
+    for (size_t i = 0; i < size; ++i)
+    {
+        // Floor division, so that timestamps before the epoch keep non-negative nanos
+        const int64_t value = unix_nanos[i];
+        const int64_t quotient = value / kNanosPerSecond;
+        const int64_t remainder = value % kNanosPerSecond;
+        const int64_t borrow = remainder < 0 ? 1 : 0;
+        seconds_out[i] = quotient - borrow;
+        nanos_out[i] = static_cast<int32_t>(remainder + borrow * kNanosPerSecond);
+    }
+}
+
+void SpanBatch::ToRequest(nostd::string_view project_id,
+                          google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request) const
+{
+    const size_t num_spans = size();
+
+    // Column passes: encode all the ids and split all the timestamps up front
+    std::string hex_trace_ids(2 * trace_ids_.size(), '\0');
+    EncodeLowerBase16(trace_ids_.data(), trace_ids_.size(), &hex_trace_ids[0]);
+    std::string hex_span_ids(2 * span_ids_.size(), '\0');
+    EncodeLowerBase16(span_ids_.data(), span_ids_.size(), &hex_span_ids[0]);
+    std::string hex_parent_span_ids(2 * parent_span_ids_.size(), '\0');
+    EncodeLowerBase16(parent_span_ids_.data(), parent_span_ids_.size(), &hex_parent_span_ids[0]);
+
+    std::vector<int64_t> start_seconds, end_seconds;
+    std::vector<int32_t> start_nanos, end_nanos;
+    SplitTimestamps(start_time_nanos_, &start_seconds, &start_nanos);
+    SplitTimestamps(end_time_nanos_, &end_seconds, &end_nanos);
+
+    std::string name_prefix(kProjectsPathStr);
+    name_prefix.append(project_id.data(), project_id.size());
+    name_prefix.append(kTracesPathStr);
+
+    // Emit pass
+    request->set_name(kProjectsPathStr + std::string(project_id.data(), project_id.size()));
+    request->mutable_spans()->Reserve(static_cast<int>(num_spans));
+    auto next_time_events = time_events_.begin();
+    for (size_t i = 0; i < num_spans; ++i)
+    {
+        auto* span = request->add_spans();
+        const char* hex_trace = hex_trace_ids.data() + i * 2 * kTraceIdSize;
+        const char* hex_span = hex_span_ids.data() + i * 2 * kSpanIdSize;
+
+        std::string* name = span->mutable_name();
+        name->reserve(name_prefix.size() + 2 * kTraceIdSize + sizeof(kSpansPathStr) + 2 * kSpanIdSize);
+        name->append(name_prefix);
+        name->append(hex_trace, 2 * kTraceIdSize);
+        name->append(kSpansPathStr);
+        name->append(hex_span, 2 * kSpanIdSize);
+        span->set_span_id(hex_span, 2 * kSpanIdSize);
+        span->set_parent_span_id(hex_parent_span_ids.data() + i * 2 * kSpanIdSize, 2 * kSpanIdSize);
+
+        auto* display_name = span->mutable_display_name();
+        display_name->set_value(strings_.data() + name_offsets_[i], name_sizes_[i]);
+        display_name->set_truncated_byte_count(name_truncated_byte_counts_[i]);
+
+        span->mutable_start_time()->set_seconds(start_seconds[i]);
+        span->mutable_start_time()->set_nanos(start_nanos[i]);
+        span->mutable_end_time()->set_seconds(end_seconds[i]);
+        span->mutable_end_time()->set_nanos(end_nanos[i]);
+
+        if (status_codes_[i] != kNoStatus)
+        {
+            span->mutable_status()->set_code(status_codes_[i]);
+            span->mutable_status()->set_message(strings_.data() + status_message_offsets_[i], 
+                                                status_message_sizes_[i]);
+        }
+
+        if (next_time_events != time_events_.end() && next_time_events->first == i)
+        {
+            *span->mutable_time_events() = next_time_events->second;
+            ++next_time_events;
+        }
+        if (dropped_attributes_counts_[i] > 0)
+        {
+            span->mutable_attributes()->set_dropped_attributes_count(dropped_attributes_counts_[i]);
+        }
+
+        const uint32_t attributes_begin = attribute_runs_[i];
+        const uint32_t attributes_end = attribute_runs_[i + 1];
+        if (attributes_begin == attributes_end)
+        {
+            continue;
+        }
+        auto* map = span->mutable_attributes()->mutable_attribute_map();
+        for (uint32_t j = attributes_begin; j < attributes_end; ++j)
+        {
+            const CompactRecordable::Attribute &attribute = attributes_[j];
+            auto &value = (*map)[std::string(strings_.data() + attribute.key_offset, attribute.key_size)];
+            switch (attribute.type)
+            {
+                case CompactRecordable::AttributeType::kBool:
+                    value.set_bool_value(attribute.bool_value);
+                    break;
+                case CompactRecordable::AttributeType::kInt:
+                    value.set_int_value(attribute.int_value);
+                    break;
+                case CompactRecordable::AttributeType::kString:
+                    value.mutable_string_value()->set_value(strings_.data() + attribute.string_value.offset,
+                                                            attribute.string_value.size);
+                    value.mutable_string_value()->set_truncated_byte_count(attribute.truncated_byte_count);
+                    break;
+            }
+        }
+    }
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
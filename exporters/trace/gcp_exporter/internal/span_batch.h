@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * A batch of spans stored column-wise: every field of every span lives in one contiguous
+ * array, and all the strings in one buffer. Building the request then runs as a few passes
+ * over whole columns (hex encoding of the ids, splitting of the timestamps) instead of
+ * chasing pointers span by span.
+ */
+class SpanBatch
+{
+public:
+    /**
+     * Reserves room for a number of spans in every column
+     */
+    void Reserve(size_t num_spans);
+
+    /**
+     * Copies the fields of a span into the columns
+     * 
+     * @param recordable - The span to append, which can be freed right after
+     */
+    void Append(const CompactRecordable &recordable);
+
+    /* Number of spans in the batch */
+    size_t size() const noexcept { return start_time_nanos_.size(); }
+
+    /* Removes all the spans, keeping the allocated columns for reuse */
+    void Clear() noexcept;
+
+    /**
+     * Builds the request holding every span of the batch
+     * 
+     * @param project_id - The Id of the Google Cloud project to export the spans to
+     * @param request - The request to populate
+     */
+    void ToRequest(nostd::string_view project_id,
+                   google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request) const;
+
+private:
+    /* Span ids, laid out back to back */
+    std::vector<uint8_t> trace_ids_;
+    std::vector<uint8_t> span_ids_;
+    std::vector<uint8_t> parent_span_ids_;
+
+    /* Timestamps in nanoseconds since the Unix epoch */
+    std::vector<int64_t> start_time_nanos_;
+    std::vector<int64_t> end_time_nanos_;
+
+    /* Display names, as ranges of 'strings_' */
+    std::vector<uint32_t> name_offsets_;
+    std::vector<uint32_t> name_sizes_;
+    std::vector<uint32_t> name_truncated_byte_counts_;
+
+    /* Status codes, -1 for spans without a status, and messages as ranges of 'strings_' */
+    std::vector<int32_t> status_codes_;
+    std::vector<uint32_t> status_message_offsets_;
+    std::vector<uint32_t> status_message_sizes_;
+
+    /* The attributes of span i are attributes_[attribute_runs_[i], attribute_runs_[i + 1]) */
+    std::vector<uint32_t> attribute_runs_;
+
+    /* The attributes of all the spans, with offsets into 'strings_' */
+    std::vector<CompactRecordable::Attribute> attributes_;
+    std::vector<uint32_t> dropped_attributes_counts_;
+
+    /* The annotations of the spans that have any, by index of the span, in span order */
+    std::vector<std::pair<uint32_t, google::devtools::cloudtrace::v2::Span_TimeEvents>> time_events_;
+
+    /* All the strings of all the spans */
+    std::string strings_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,147 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <benchmark/benchmark.h>
+#include "exporters/trace/gcp_exporter/internal/span_batch.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <memory>
+#include <vector>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter 
+{
+namespace gcp 
+{
+
+/*
+ * Compares the ways of turning a batch of recordables into a BatchWriteSpansRequest:
+ *  - PointerPerSpan: every Recordable owns a protobuf span, moved into the request
+ *  - CompactPerSpan: every CompactRecordable materializes its own span
+ *  - Columnar: the CompactRecordables are gathered into a SpanBatch, which builds the request
+ * Only the conversion is timed: the recordables are built with the timer paused.
+ */
+
+/* ############################### BENCHMARK ARGUMENTS ################################### */
+
+/**
+ * Crosses the batch sizes with the span shapes: {batch size, dense}
+ */
+void ConversionArgs(benchmark::internal::Benchmark* benchmark)
+{
+  for(int64_t batch_size: {200, 2000, 20000}){
+    for(int64_t dense: {0, 1}){
+      benchmark->Args({batch_size, dense});
+    }
+  }
+}
+
+/**
+ * Fills a batch of recordables of the shape selected by the benchmark arguments
+ */
+template <class RecordableT>
+void FillBatch(const benchmark::State& state, std::vector<std::unique_ptr<RecordableT>> *recordables)
+{
+  const SpanGenerator generator(state.range(1) ? DenseSpanShape() : SparseSpanShape());
+  recordables->resize(state.range(0));
+  for(auto& recordable: *recordables){
+    recordable.reset(new RecordableT);
+    generator.Fill(*recordable);
+  }
+}
+
+/* ################################## BENCHMARKS ######################################## */
+
+void BM_PointerPerSpan(benchmark::State& state)
+{
+  setenv(kGCPEnvVar, "test_project", 1);
+  std::vector<std::unique_ptr<Recordable>> recordables;
+  for(auto _ : state)
+  {
+    state.PauseTiming();
+    FillBatch(state, &recordables);
+    state.ResumeTiming();
+
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    request.set_name("projects/test_project");
+    request.mutable_spans()->Reserve(recordables.size());
+    for(auto& recordable: recordables){
+      *request.add_spans() = std::move(recordable->span());
+      recordable.reset();
+    }
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_PointerPerSpan)->Apply(ConversionArgs);
+
+
+void BM_CompactPerSpan(benchmark::State& state)
+{
+  std::vector<std::unique_ptr<CompactRecordable>> recordables;
+  for(auto _ : state)
+  {
+    state.PauseTiming();
+    FillBatch(state, &recordables);
+    state.ResumeTiming();
+
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    request.set_name("projects/test_project");
+    request.mutable_spans()->Reserve(recordables.size());
+    for(auto& recordable: recordables){
+      recordable->ToProto("test_project", request.add_spans());
+      recordable.reset();
+    }
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_CompactPerSpan)->Apply(ConversionArgs);
+
+
+void BM_Columnar(benchmark::State& state)
+{
+  std::vector<std::unique_ptr<CompactRecordable>> recordables;
+  for(auto _ : state)
+  {
+    state.PauseTiming();
+    FillBatch(state, &recordables);
+    state.ResumeTiming();
+
+    SpanBatch batch;
+    batch.Reserve(recordables.size());
+    for(auto& recordable: recordables){
+      batch.Append(*recordable);
+      recordable.reset();
+    }
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    batch.ToRequest("test_project", &request);
+    benchmark::DoNotOptimize(request);
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_Columnar)->Apply(ConversionArgs);
+
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
+
+// Run benchmarks
+BENCHMARK_MAIN();
@@ -0,0 +1,149 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/span_batch.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <google/protobuf/util/message_differencer.h>
+#include <gtest/gtest.h>
+
+#include <memory>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Builds a span with ids, timestamps and a name that depend on its index
+ */
+std::unique_ptr<CompactRecordable> MakeIndexedSpan(const SpanGenerator &generator, int index)
+{
+    std::unique_ptr<CompactRecordable> rec(new CompactRecordable);
+    generator.Fill(*rec);
+
+    const uint8_t byte = static_cast<uint8_t>(index);
+    rec->SetIds(trace::TraceId(std::array<const uint8_t, trace::TraceId::kSize>(
+                    {byte, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, byte})),
+                trace::SpanId(std::array<const uint8_t, trace::SpanId::kSize>(
+                    {1, 2, 3, 4, 5, 6, 7, byte})),
+                trace::SpanId(std::array<const uint8_t, trace::SpanId::kSize>(
+                    {byte, 2, 3, 4, 5, 6, 7, 8})));
+    rec->SetName("span_" + std::to_string(index));
+    rec->SetStartTime(core::SystemTimestamp(std::chrono::nanoseconds(1500000000000 + 333333333 * index)));
+    rec->SetDuration(std::chrono::nanoseconds(700000000 * index));
+    return rec;
+}
+
+/**
+ * Checks that a batch emits the same spans as converting each recordable on its own
+ */
+void ExpectSameRequest(const std::vector<SpanShape> &shapes)
+{
+    SpanBatch batch;
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest expected;
+    expected.set_name("projects/test_project");
+    for(size_t i = 0; i < shapes.size(); ++i){
+        const SpanGenerator generator(shapes[i]);
+        auto rec = MakeIndexedSpan(generator, static_cast<int>(i));
+        rec->ToProto("test_project", expected.add_spans());
+        batch.Append(*rec);
+    }
+    ASSERT_EQ(shapes.size(), batch.size());
+
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    batch.ToRequest("test_project", &request);
+
+    EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(expected, request))
+        << "Expected:\n" << expected.DebugString() << "Actual:\n" << request.DebugString();
+}
+
+TEST(SpanBatch, MatchesPerSpanConversionForSparseSpans)
+{
+    ExpectSameRequest(std::vector<SpanShape>(20, SparseSpanShape()));
+}
+
+TEST(SpanBatch, MatchesPerSpanConversionForDenseSpans)
+{
+    ExpectSameRequest(std::vector<SpanShape>(5, DenseSpanShape()));
+}
+
+TEST(SpanBatch, MatchesPerSpanConversionForMixedSpans)
+{
+    SpanShape truncated = SparseSpanShape();
+    truncated.num_str_attributes = 2;
+    truncated.str_value_length = 300;
+    SpanShape error = SparseSpanShape();
+    error.has_error_status = true;
+    SpanShape events = SparseSpanShape();
+    events.num_events = 2;
+    ExpectSameRequest({EmptySpanShape(), DenseSpanShape(), error, events, SparseSpanShape(), truncated, 
+                       events, EmptySpanShape()});
+}
+
+TEST(SpanBatch, TestEmptyBatch)
+{
+    SpanBatch batch;
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    batch.ToRequest("test_project", &request);
+
+    EXPECT_EQ("projects/test_project", request.name());
+    EXPECT_EQ(0, request.spans_size());
+}
+
+TEST(SpanBatch, TestTimestampsBeforeEpoch)
+{
+    CompactRecordable rec;
+    rec.SetStartTime(core::SystemTimestamp(std::chrono::nanoseconds(-1500000000123)));
+    rec.SetDuration(std::chrono::nanoseconds(123));
+
+    SpanBatch batch;
+    batch.Append(rec);
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    batch.ToRequest("test_project", &request);
+
+    ASSERT_EQ(1, request.spans_size());
+    EXPECT_EQ(-1501, request.spans(0).start_time().seconds());
+    EXPECT_EQ(999999877, request.spans(0).start_time().nanos());
+    EXPECT_EQ(-1500, request.spans(0).end_time().seconds());
+    EXPECT_EQ(0, request.spans(0).end_time().nanos());
+}
+
+TEST(SpanBatch, TestClear)
+{
+    const SpanGenerator generator(DenseSpanShape());
+    SpanBatch batch;
+    batch.Append(*MakeIndexedSpan(generator, 1));
+    batch.Clear();
+    EXPECT_EQ(0, batch.size());
+
+    // Attribute runs restart from the first span after a clear
+    auto rec = MakeIndexedSpan(generator, 2);
+    batch.Append(*rec);
+    google::devtools::cloudtrace::v2::BatchWriteSpansRequest request;
+    batch.ToRequest("test_project", &request);
+
+    google::devtools::cloudtrace::v2::Span expected;
+    rec->ToProto("test_project", &expected);
+    ASSERT_EQ(1, request.spans_size());
+    EXPECT_TRUE(google::protobuf::util::MessageDifferencer::Equals(expected, request.spans(0)));
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
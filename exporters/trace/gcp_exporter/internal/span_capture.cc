@@ -0,0 +1,172 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/span_capture.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+constexpr size_t kTimeSize = 8;
+constexpr size_t kMaxVarintSize = 10;
+
+/* ################################ WRITER FUNCTIONS ################################# */
+
+SpanCaptureWriter::SpanCaptureWriter(FILE *file, uint64_t max_bytes) :
+    file_(file), max_bytes_(max_bytes), num_bytes_(kCaptureMagicSize) {}
+
+SpanCaptureWriter::~SpanCaptureWriter()
+{
+    fclose(file_);
+}
+
+std::unique_ptr<SpanCaptureWriter> SpanCaptureWriter::Open(const std::string &path, uint64_t max_bytes)
+{
+    FILE *file = fopen(path.c_str(), "wb");
+    if(file == nullptr){
+        return nullptr;
+    }
+    if(fwrite(kCaptureMagic, 1, kCaptureMagicSize, file) != kCaptureMagicSize){
+        fclose(file);
+        return nullptr;
+    }
+    return std::unique_ptr<SpanCaptureWriter>(new SpanCaptureWriter(file, max_bytes));
+}
+
+bool SpanCaptureWriter::Write(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept
+{
+    const auto now = std::chrono::system_clock::now().time_since_epoch();
+    return Write(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), request);
+}
+
+bool SpanCaptureWriter::Write(int64_t capture_time_nanos,
+                              const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept
+{
+    const size_t size = request.ByteSizeLong();
+    std::string record(kTimeSize + kMaxVarintSize + size, '\0');
+    char *out = &record[0];
+    uint64_t time = static_cast<uint64_t>(capture_time_nanos);
+    for(size_t i = 0; i < kTimeSize; ++i){
+        *out++ = static_cast<char>(time & 0xff);
+        time >>= 8;
+    }
+    uint64_t varint = size;
+    while(varint >= 0x80){
+        *out++ = static_cast<char>(varint | 0x80);
+        varint >>= 7;
+    }
+    *out++ = static_cast<char>(varint);
+    request.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(out));
+    out += size;
+    const size_t record_size = out - record.data();
+
+    std::lock_guard<std::mutex> lock(mu_);
+    // Once a request is left out, so are the later ones, so that a capture is never missing
+    // requests from its middle
+    if(full_ || (max_bytes_ > 0 && num_bytes_ + record_size > max_bytes_)){
+        full_ = true;
+        return false;
+    }
+    num_bytes_ += record_size;
+    return fwrite(record.data(), 1, record_size, file_) == record_size;
+}
+
+void SpanCaptureWriter::Flush() noexcept
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    fflush(file_);
+}
+
+/* ################################ READER FUNCTIONS ################################# */
+
+SpanCaptureReader::SpanCaptureReader(const char *data, size_t size) :
+    data_(data), size_(size), position_(kCaptureMagicSize) {}
+
+SpanCaptureReader::~SpanCaptureReader()
+{
+    munmap(const_cast<char*>(data_), size_);
+}
+
+std::unique_ptr<SpanCaptureReader> SpanCaptureReader::Open(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        return nullptr;
+    }
+    struct stat info;
+    if(fstat(fd, &info) != 0 || static_cast<size_t>(info.st_size) < kCaptureMagicSize){
+        close(fd);
+        return nullptr;
+    }
+    void *data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED){
+        return nullptr;
+    }
+    std::unique_ptr<SpanCaptureReader> reader(new SpanCaptureReader(static_cast<const char*>(data), info.st_size));
+    if(memcmp(data, kCaptureMagic, kCaptureMagicSize) != 0){
+        return nullptr;
+    }
+    return reader;
+}
+
+bool SpanCaptureReader::Next(CapturedRequest *request) noexcept
+{
+    size_t position = position_;
+    if(size_ - position < kTimeSize){
+        return false;
+    }
+    uint64_t time = 0;
+    for(size_t i = 0; i < kTimeSize; ++i){
+        time |= static_cast<uint64_t>(static_cast<uint8_t>(data_[position + i])) << (8 * i);
+    }
+    position += kTimeSize;
+
+    uint64_t size = 0;
+    for(int shift = 0;; shift += 7){
+        if(position == size_ || shift >= 64){
+            return false;
+        }
+        const uint8_t byte = static_cast<uint8_t>(data_[position++]);
+        size |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0){
+            break;
+        }
+    }
+    if(size > size_ - position){
+        return false;
+    }
+
+    request->capture_time_nanos = static_cast<int64_t>(time);
+    request->payload = nostd::string_view(data_ + position, size);
+    position_ = position + size;
+    return true;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,144 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.pb.h"
+#include "opentelemetry/nostd/string_view.h"
+#include "opentelemetry/version.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/*
+ * Capture files hold the requests an exporter sent, to replay real traffic offline:
+ *
+ *   file   := "GCPCAP01" record*
+ *   record := capture time (8 bytes, little endian nanoseconds since the Unix epoch)
+ *             request size (varint)
+ *             request (serialized BatchWriteSpansRequest)
+ *
+ * A record cut short, by a crash while writing, ends the file.
+ */
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* The bytes every capture file starts with */
+constexpr char kCaptureMagic[] = "GCPCAP01";
+constexpr size_t kCaptureMagicSize = sizeof(kCaptureMagic) - 1;
+
+/**
+ * Appends requests to a capture file. Thread safe: requests are serialized on the calling
+ * thread, and only appending the record to the file is done under a lock.
+ */
+class SpanCaptureWriter
+{
+public:
+    /**
+     * Opens a capture file, truncating it
+     * 
+     * @param path - The path of the capture file
+     * @param max_bytes - Size the file stops growing at, the request that would cross it and
+     * every later one being left out. Zero for no limit.
+     * @return The writer, or null if the file could not be opened
+     */
+    static std::unique_ptr<SpanCaptureWriter> Open(const std::string &path, uint64_t max_bytes = 0);
+
+    ~SpanCaptureWriter();
+
+    /**
+     * Appends a request, stamped with the current time
+     * 
+     * @param request - The request to append
+     * @return Whether the request was written
+     */
+    bool Write(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept;
+
+    /**
+     * Appends a request stamped with a given time
+     */
+    bool Write(int64_t capture_time_nanos,
+               const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept;
+
+    /* Pushes the buffered records to the file */
+    void Flush() noexcept;
+
+private:
+    SpanCaptureWriter(FILE *file, uint64_t max_bytes);
+
+    /* Guards the file, its size, and whether it is full */
+    std::mutex mu_;
+    FILE *const file_;
+    const uint64_t max_bytes_;
+    uint64_t num_bytes_;
+    bool full_ = false;
+};
+
+/* One request read from a capture file */
+struct CapturedRequest
+{
+    int64_t capture_time_nanos;
+
+    /* The serialized request, pointing into the mapped file */
+    nostd::string_view payload;
+};
+
+/**
+ * Reads the requests of a capture file, mapped in memory so that payloads are not copied
+ */
+class SpanCaptureReader
+{
+public:
+    /**
+     * Maps a capture file
+     * 
+     * @param path - The path of the capture file
+     * @return The reader, or null if the file could not be mapped or is not a capture
+     */
+    static std::unique_ptr<SpanCaptureReader> Open(const std::string &path);
+
+    ~SpanCaptureReader();
+
+    /**
+     * Reads the next request
+     * 
+     * @param request - Set to the next request, valid as long as the reader
+     * @return Whether there was one more complete request
+     */
+    bool Next(CapturedRequest *request) noexcept;
+
+    /* Starts reading from the first request again */
+    void Rewind() noexcept { position_ = kCaptureMagicSize; }
+
+private:
+    SpanCaptureReader(const char *data, size_t size);
+
+    const char *const data_;
+    const size_t size_;
+    size_t position_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/span_capture.h"
+
+#include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <fstream>
+#include <iterator>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Returns a capture path no other test process uses
+ */
+std::string TestCapturePath(const std::string &test)
+{
+    return "/tmp/gcp_exporter_span_capture_test." + test + "." + std::to_string(getpid());
+}
+
+/**
+ * Makes a request holding spans with the given display names
+ */
+cloudtrace_v2::BatchWriteSpansRequest MakeRequest(const std::vector<std::string> &names)
+{
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    request.set_name("projects/test_project");
+    for(const auto& name: names){
+        request.add_spans()->mutable_display_name()->set_value(name);
+    }
+    return request;
+}
+
+/**
+ * Reads the display names of every request left in a capture
+ */
+std::vector<std::vector<std::string>> ReadNames(SpanCaptureReader &reader, std::vector<int64_t> *times)
+{
+    std::vector<std::vector<std::string>> names;
+    CapturedRequest captured;
+    while(reader.Next(&captured)){
+        cloudtrace_v2::BatchWriteSpansRequest request;
+        EXPECT_TRUE(request.ParseFromArray(captured.payload.data(), static_cast<int>(captured.payload.size())));
+        EXPECT_EQ("projects/test_project", request.name());
+        names.emplace_back();
+        for(const auto& span: request.spans()){
+            names.back().push_back(span.display_name().value());
+        }
+        times->push_back(captured.capture_time_nanos);
+    }
+    return names;
+}
+
+TEST(SpanCapture, TestRoundTrip)
+{
+    const std::string path = TestCapturePath("round_trip");
+    {
+        auto writer = SpanCaptureWriter::Open(path);
+        ASSERT_NE(nullptr, writer);
+        EXPECT_TRUE(writer->Write(100, MakeRequest({"a", "b"})));
+        EXPECT_TRUE(writer->Write(200, MakeRequest({})));
+        EXPECT_TRUE(writer->Write(1LL << 40, MakeRequest({std::string(1000, 'c')})));
+    }
+
+    auto reader = SpanCaptureReader::Open(path);
+    ASSERT_NE(nullptr, reader);
+    std::vector<int64_t> times;
+    const std::vector<std::vector<std::string>> expected = {{"a", "b"}, {}, {std::string(1000, 'c')}};
+    EXPECT_EQ(expected, ReadNames(*reader, &times));
+    EXPECT_EQ(std::vector<int64_t>({100, 200, 1LL << 40}), times);
+
+    // Rewinding replays the same requests
+    reader->Rewind();
+    times.clear();
+    EXPECT_EQ(expected, ReadNames(*reader, &times));
+    unlink(path.c_str());
+}
+
+TEST(SpanCapture, TestCurrentTimeStamp)
+{
+    const std::string path = TestCapturePath("current_time");
+    const int64_t before = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    {
+        auto writer = SpanCaptureWriter::Open(path);
+        ASSERT_NE(nullptr, writer);
+        EXPECT_TRUE(writer->Write(MakeRequest({"a"})));
+    }
+
+    auto reader = SpanCaptureReader::Open(path);
+    ASSERT_NE(nullptr, reader);
+    CapturedRequest captured;
+    ASSERT_TRUE(reader->Next(&captured));
+    EXPECT_GE(captured.capture_time_nanos, before);
+    EXPECT_FALSE(reader->Next(&captured));
+    unlink(path.c_str());
+}
+
+TEST(SpanCapture, TestMaxBytes)
+{
+    const std::string path = TestCapturePath("max_bytes");
+    {
+        auto writer = SpanCaptureWriter::Open(path, 64);
+        ASSERT_NE(nullptr, writer);
+        EXPECT_TRUE(writer->Write(1, MakeRequest({"a"})));
+        EXPECT_FALSE(writer->Write(2, MakeRequest({std::string(64, 'b')})));
+        // A request that would still fit is left out once the file is full
+        EXPECT_FALSE(writer->Write(3, MakeRequest({"c"})));
+    }
+
+    auto reader = SpanCaptureReader::Open(path);
+    ASSERT_NE(nullptr, reader);
+    std::vector<int64_t> times;
+    EXPECT_EQ(std::vector<std::vector<std::string>>({{"a"}}), ReadNames(*reader, &times));
+    unlink(path.c_str());
+}
+
+TEST(SpanCapture, TestTruncatedRecordIgnored)
+{
+    const std::string path = TestCapturePath("truncated");
+    {
+        auto writer = SpanCaptureWriter::Open(path);
+        ASSERT_NE(nullptr, writer);
+        EXPECT_TRUE(writer->Write(1, MakeRequest({"kept"})));
+        EXPECT_TRUE(writer->Write(2, MakeRequest({"cut short"})));
+    }
+    // Cut the second record short
+    std::ifstream in(path, std::ios::binary);
+    std::string contents((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(contents.data(), contents.size() - 3);
+    }
+
+    auto reader = SpanCaptureReader::Open(path);
+    ASSERT_NE(nullptr, reader);
+    std::vector<int64_t> times;
+    EXPECT_EQ(std::vector<std::vector<std::string>>({{"kept"}}), ReadNames(*reader, &times));
+    unlink(path.c_str());
+}
+
+TEST(SpanCapture, TestNotACapture)
+{
+    const std::string path = TestCapturePath("not_a_capture");
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << "GCPCAP99 and then some";
+    }
+    EXPECT_EQ(nullptr, SpanCaptureReader::Open(path));
+    unlink(path.c_str());
+
+    EXPECT_EQ(nullptr, SpanCaptureReader::Open(TestCapturePath("missing")));
+    EXPECT_EQ(nullptr, SpanCaptureWriter::Open("/nonexistent_directory/capture"));
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,391 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/span_metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <unordered_map>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+namespace
+{
+
+// Separates the name and the attribute values in series keys
+constexpr char kKeySeparator = '\x1f';
+
+/**
+ * Adds to a counter only the owning thread writes
+ */
+inline void Increment(std::atomic<uint64_t> &counter, uint64_t value) noexcept
+{
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * Returns the index of the histogram bucket a duration falls in
+ */
+size_t DurationBucket(int64_t duration_nanos) noexcept
+{
+    return std::lower_bound(kDurationBoundsNanos.begin(), kDurationBoundsNanos.end(), duration_nanos) -
+           kDurationBoundsNanos.begin();
+}
+
+std::atomic<uint64_t> next_aggregator_id(0);
+
+/* A shard of the current thread, which expires with its aggregator's list of shards */
+struct ThreadShard
+{
+    void *shard;
+    std::weak_ptr<void> shard_list;
+    void (*retire)(const std::shared_ptr<void> &shard_list, void *shard) noexcept;
+};
+
+/**
+ * Shards of the current thread, by aggregator id, which are retired when the thread exits
+ */
+struct ThreadShards
+{
+    std::unordered_map<uint64_t, ThreadShard> shards;
+
+    ~ThreadShards()
+    {
+        for(auto& entry: shards){
+            if(auto shard_list = entry.second.shard_list.lock()){
+                entry.second.retire(shard_list, entry.second.shard);
+            }
+        }
+    }
+};
+
+thread_local ThreadShards tls_shards;
+
+/**
+ * Formats the value of an attribute as the series key holds it
+ */
+nostd::string_view AttributeValueView(const google::devtools::cloudtrace::v2::AttributeValue &value,
+                                      std::string *scratch) noexcept
+{
+    switch(value.value_case()){
+        case google::devtools::cloudtrace::v2::AttributeValue::kStringValue:
+            return value.string_value().value();
+        case google::devtools::cloudtrace::v2::AttributeValue::kIntValue:
+            *scratch = std::to_string(value.int_value());
+            return *scratch;
+        case google::devtools::cloudtrace::v2::AttributeValue::kBoolValue:
+            return value.bool_value() ? "true" : "false";
+        default:
+            return nostd::string_view();
+    }
+}
+
+} // namespace
+
+/**
+ * The counters of one series in one shard. Only the owning thread writes them, so updates
+ * are plain loads and stores; they are atomic only so that collection can read them at the
+ * same time.
+ */
+struct SpanMetricsAggregator::Series
+{
+    std::string name;
+    std::vector<std::string> attribute_values;
+    std::atomic<uint64_t> count{0};
+    std::atomic<uint64_t> error_count{0};
+    std::atomic<uint64_t> duration_sum_nanos{0};
+    std::array<std::atomic<uint64_t>, kNumDurationBounds + 1> duration_buckets;
+
+    Series()
+    {
+        for(auto& bucket: duration_buckets){
+            bucket.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /* Adds the counters of another series, which nobody writes any more */
+    void Merge(const Series &other) noexcept
+    {
+        Increment(count, other.count.load(std::memory_order_relaxed));
+        Increment(error_count, other.error_count.load(std::memory_order_relaxed));
+        Increment(duration_sum_nanos, other.duration_sum_nanos.load(std::memory_order_relaxed));
+        for(size_t i = 0; i < duration_buckets.size(); ++i){
+            Increment(duration_buckets[i], other.duration_buckets[i].load(std::memory_order_relaxed));
+        }
+    }
+};
+
+/**
+ * The series of one thread. The owning thread looks series up without locking, since it is
+ * the only one to modify the map; it takes the lock to add a series, so that collection
+ * never iterates the map while it rehashes.
+ */
+struct SpanMetricsAggregator::Shard
+{
+    std::mutex mu;
+    std::unordered_map<std::string, std::unique_ptr<Series>> series;
+
+    /* Counts the spans of the series the shard could not add, null until there is one */
+    std::unique_ptr<Series> overflow;
+};
+
+/**
+ * The shards of an aggregator. The lock guards the list and the retired shard, which
+ * is only written under it, not the content of the live shards.
+ */
+struct SpanMetricsAggregator::ShardList
+{
+    std::mutex mu;
+    std::vector<std::unique_ptr<Shard>> live;
+
+    /* The series of the threads that exited */
+    Shard retired;
+};
+
+SpanMetricsAggregator::SpanMetricsAggregator(std::vector<std::string> attribute_keys, size_t max_series) :
+    id_(next_aggregator_id.fetch_add(1, std::memory_order_relaxed)), 
+    attribute_keys_(std::move(attribute_keys)), max_series_(max_series), shards_(new ShardList) {}
+
+SpanMetricsAggregator::~SpanMetricsAggregator() = default;
+
+SpanMetricsAggregator::Shard &SpanMetricsAggregator::LocalShard() noexcept
+{
+    auto &shards = tls_shards.shards;
+    auto it = shards.find(id_);
+    if(it != shards.end()){
+        return *static_cast<Shard*>(it->second.shard);
+    }
+
+    // Drops the shards of the aggregators destroyed since, before adding one
+    for(auto expired = shards.begin(); expired != shards.end();){
+        if(expired->second.shard_list.expired()){
+            expired = shards.erase(expired);
+        } else {
+            ++expired;
+        }
+    }
+    std::unique_ptr<Shard> shard(new Shard);
+    Shard *local = shard.get();
+    {
+        std::lock_guard<std::mutex> lock(shards_->mu);
+        shards_->live.push_back(std::move(shard));
+    }
+    shards.emplace(id_, ThreadShard{local, shards_, &SpanMetricsAggregator::RetireShard});
+    return *local;
+}
+
+void SpanMetricsAggregator::RetireShard(const std::shared_ptr<void> &shard_list, void *shard) noexcept
+{
+    auto &list = *static_cast<ShardList*>(shard_list.get());
+    std::lock_guard<std::mutex> lock(list.mu);
+    const auto it = std::find_if(list.live.begin(), list.live.end(),
+                                 [shard](const std::unique_ptr<Shard> &live){ return live.get() == shard; });
+    if(it == list.live.end()){
+        return;
+    }
+    for(auto& entry: (*it)->series){
+        auto &retired = list.retired.series[entry.first];
+        if(!retired){
+            retired.reset(new Series);
+            retired->name = entry.second->name;
+            retired->attribute_values = entry.second->attribute_values;
+        }
+        retired->Merge(*entry.second);
+    }
+    if((*it)->overflow){
+        if(!list.retired.overflow){
+            list.retired.overflow.reset(new Series);
+        }
+        list.retired.overflow->Merge(*(*it)->overflow);
+    }
+    list.live.erase(it);
+}
+
+size_t SpanMetricsAggregator::NumThreadShards() noexcept
+{
+    return tls_shards.shards.size();
+}
+
+size_t SpanMetricsAggregator::NumLiveShards() const noexcept
+{
+    std::lock_guard<std::mutex> lock(shards_->mu);
+    return shards_->live.size();
+}
+
+SpanMetricsAggregator::Series &SpanMetricsAggregator::AddSeries(Shard &shard, const std::string &key,
+                                                                nostd::string_view name,
+                                                                const std::vector<nostd::string_view> &attribute_values) noexcept
+{
+    bool counted;
+    {
+        // A key already recorded by another thread counts once
+        std::lock_guard<std::mutex> lock(keys_mu_);
+        counted = keys_.count(key) > 0;
+        if(!counted && keys_.size() < max_series_){
+            keys_.insert(key);
+            counted = true;
+        }
+    }
+    if(!counted){
+        if(!shard.overflow){
+            std::unique_ptr<Series> overflow(new Series);
+            std::lock_guard<std::mutex> lock(shard.mu);
+            shard.overflow = std::move(overflow);
+        }
+        return *shard.overflow;
+    }
+
+    std::unique_ptr<Series> series(new Series);
+    series->name.assign(name.data(), name.size());
+    for(const auto& value: attribute_values){
+        series->attribute_values.emplace_back(value.data(), value.size());
+    }
+    std::lock_guard<std::mutex> lock(shard.mu);
+    return *shard.series.emplace(key, std::move(series)).first->second;
+}
+
+void SpanMetricsAggregator::Record(nostd::string_view name, 
+                                   const std::vector<nostd::string_view> &attribute_values,
+                                   int64_t duration_nanos, bool error) noexcept
+{
+    // Reused across calls, so that looking up an existing series does not allocate
+    thread_local std::string key;
+    key.assign(name.data(), name.size());
+    for(const auto& value: attribute_values){
+        key += kKeySeparator;
+        key.append(value.data(), value.size());
+    }
+
+    Shard &shard = LocalShard();
+    auto it = shard.series.find(key);
+    Series &series = it != shard.series.end() ? *it->second : AddSeries(shard, key, name, attribute_values);
+    Increment(series.count, 1);
+    if(error){
+        Increment(series.error_count, 1);
+    }
+    if(duration_nanos > 0){
+        Increment(series.duration_sum_nanos, static_cast<uint64_t>(duration_nanos));
+    }
+    Increment(series.duration_buckets[DurationBucket(duration_nanos)], 1);
+}
+
+void SpanMetricsAggregator::Record(const Recordable &recordable) noexcept
+{
+    const auto &span = recordable.span();
+    const int64_t duration_nanos = 
+        (span.end_time().seconds() - span.start_time().seconds()) * 1000000000LL + 
+        (span.end_time().nanos() - span.start_time().nanos());
+    const bool error = span.has_status() && span.status().code() != 0;
+
+    thread_local std::vector<std::string> scratch;
+    thread_local std::vector<nostd::string_view> values;
+    scratch.resize(attribute_keys_.size());
+    values.clear();
+    const auto &map = span.attributes().attribute_map();
+    for(size_t i = 0; i < attribute_keys_.size(); ++i){
+        const auto it = map.find(attribute_keys_[i]);
+        values.push_back(it == map.end() ? nostd::string_view() : AttributeValueView(it->second, &scratch[i]));
+    }
+    Record(span.display_name().value(), values, duration_nanos, error);
+}
+
+void SpanMetricsAggregator::Record(const CompactRecordable &recordable) noexcept
+{
+    const int64_t duration_nanos = recordable.end_time_nanos() - recordable.start_time_nanos();
+    const bool error = recordable.has_status() && recordable.status_code() != 0;
+
+    thread_local std::vector<std::string> scratch;
+    thread_local std::vector<nostd::string_view> values;
+    scratch.resize(attribute_keys_.size());
+    values.assign(attribute_keys_.size(), nostd::string_view());
+    for(size_t i = 0; i < attribute_keys_.size(); ++i){
+        const auto *attribute = recordable.FindAttribute(attribute_keys_[i]);
+        if(!attribute){
+            continue;
+        }
+        switch(attribute->type){
+            case CompactRecordable::AttributeType::kString:
+                values[i] = recordable.SlabString(attribute->string_value.offset, attribute->string_value.size);
+                break;
+            case CompactRecordable::AttributeType::kInt:
+                scratch[i] = std::to_string(attribute->int_value);
+                values[i] = scratch[i];
+                break;
+            case CompactRecordable::AttributeType::kBool:
+                values[i] = attribute->bool_value ? "true" : "false";
+                break;
+        }
+    }
+    Record(recordable.name(), values, duration_nanos, error);
+}
+
+std::vector<SpanMetrics> SpanMetricsAggregator::Collect() const
+{
+    const auto merge = [](const Series &series, SpanMetrics *metrics){
+        metrics->count += series.count.load(std::memory_order_relaxed);
+        metrics->error_count += series.error_count.load(std::memory_order_relaxed);
+        metrics->duration_sum_nanos += series.duration_sum_nanos.load(std::memory_order_relaxed);
+        for(size_t i = 0; i < metrics->duration_buckets.size(); ++i){
+            metrics->duration_buckets[i] += series.duration_buckets[i].load(std::memory_order_relaxed);
+        }
+    };
+
+    std::map<std::string, SpanMetrics> merged;
+    SpanMetrics overflow;
+    overflow.overflow = true;
+    std::lock_guard<std::mutex> shards_lock(shards_->mu);
+    std::vector<Shard*> shards;
+    for(const auto& shard: shards_->live){
+        shards.push_back(shard.get());
+    }
+    shards.push_back(&shards_->retired);
+    for(auto* shard: shards){
+        std::lock_guard<std::mutex> lock(shard->mu);
+        for(const auto& entry: shard->series){
+            const Series &series = *entry.second;
+            auto inserted = merged.emplace(entry.first, SpanMetrics());
+            SpanMetrics &metrics = inserted.first->second;
+            if(inserted.second){
+                metrics.name = series.name;
+                metrics.attribute_values = series.attribute_values;
+            }
+            merge(series, &metrics);
+        }
+        if(shard->overflow){
+            merge(*shard->overflow, &overflow);
+        }
+    }
+
+    std::vector<SpanMetrics> result;
+    result.reserve(merged.size() + 1);
+    for(auto& entry: merged){
+        result.push_back(std::move(entry.second));
+    }
+    if(overflow.count > 0){
+        result.push_back(std::move(overflow));
+    }
+    return result;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/span_metrics.h"
+
+#include <gtest/gtest.h>
+
+#include <thread>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Sets the fields the metrics are derived from on a recordable
+ */
+void FillSpan(sdk::trace::Recordable &recordable, nostd::string_view name, 
+              nostd::string_view method, int64_t status_code, int64_t duration_nanos, bool error)
+{
+    recordable.SetName(name);
+    recordable.SetAttribute("http.method", method);
+    recordable.SetAttribute("http.status_code", status_code);
+    recordable.SetAttribute("ignored", true);
+    recordable.SetStartTime(core::SystemTimestamp(std::chrono::nanoseconds(1500000000000)));
+    recordable.SetDuration(std::chrono::nanoseconds(duration_nanos));
+    if(error){
+        recordable.SetStatus(trace::CanonicalCode::INTERNAL, "error");
+    }
+}
+
+TEST(SpanMetricsAggregator, TestSeriesAreKeyedByNameAndAttributes)
+{
+    setenv(kGCPEnvVar, "test_project", 1);
+    SpanMetricsAggregator aggregator({"http.method", "http.status_code"});
+
+    Recordable get_ok;
+    FillSpan(get_ok, "GET /users", "GET", 200, 2000, false);
+    Recordable get_error;
+    FillSpan(get_error, "GET /users", "GET", 500, 3000000, true);
+    CompactRecordable post;
+    FillSpan(post, "GET /users", "POST", 200, 500, false);
+    CompactRecordable get_ok_compact;
+    FillSpan(get_ok_compact, "GET /users", "GET", 200, 5000, false);
+
+    aggregator.Record(get_ok);
+    aggregator.Record(get_error);
+    aggregator.Record(post);
+    aggregator.Record(get_ok_compact);
+
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(3, metrics.size());
+
+    EXPECT_EQ("GET /users", metrics[0].name);
+    EXPECT_EQ(std::vector<std::string>({"GET", "200"}), metrics[0].attribute_values);
+    EXPECT_EQ(2, metrics[0].count);
+    EXPECT_EQ(0, metrics[0].error_count);
+    EXPECT_EQ(7000, metrics[0].duration_sum_nanos);
+    EXPECT_EQ(1, metrics[0].duration_buckets[1]);
+    EXPECT_EQ(1, metrics[0].duration_buckets[2]);
+
+    EXPECT_EQ(std::vector<std::string>({"GET", "500"}), metrics[1].attribute_values);
+    EXPECT_EQ(1, metrics[1].count);
+    EXPECT_EQ(1, metrics[1].error_count);
+    EXPECT_EQ(1, metrics[1].duration_buckets[6]);
+
+    EXPECT_EQ(std::vector<std::string>({"POST", "200"}), metrics[2].attribute_values);
+    EXPECT_EQ(1, metrics[2].duration_buckets[0]);
+}
+
+TEST(SpanMetricsAggregator, TestMissingAttributes)
+{
+    SpanMetricsAggregator aggregator({"missing"});
+    CompactRecordable rec;
+    rec.SetName("span");
+    aggregator.Record(rec);
+
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(1, metrics.size());
+    EXPECT_EQ(std::vector<std::string>({""}), metrics[0].attribute_values);
+}
+
+TEST(SpanMetricsAggregator, TestDurationBuckets)
+{
+    SpanMetricsAggregator aggregator;
+    aggregator.Record("span", {}, 1000, false);
+    aggregator.Record("span", {}, 1001, false);
+    aggregator.Record("span", {}, 268435456000LL, false);
+    aggregator.Record("span", {}, 268435456001LL, false);
+
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(1, metrics.size());
+    EXPECT_EQ(1, metrics[0].duration_buckets[0]);
+    EXPECT_EQ(1, metrics[0].duration_buckets[1]);
+    EXPECT_EQ(1, metrics[0].duration_buckets[kNumDurationBounds - 1]);
+    EXPECT_EQ(1, metrics[0].duration_buckets[kNumDurationBounds]);
+}
+
+TEST(SpanMetricsAggregator, TestShardsAreMergedAcrossThreads)
+{
+    constexpr int kNumThreads = 4;
+    constexpr int kSpansPerThread = 10000;
+    SpanMetricsAggregator aggregator({"thread"});
+
+    std::vector<std::thread> threads;
+    for(int t = 0; t < kNumThreads; ++t){
+        threads.emplace_back([&aggregator, t]{
+            const std::string odd_even = t % 2 ? "odd" : "even";
+            for(int i = 0; i < kSpansPerThread; ++i){
+                aggregator.Record("span", {odd_even}, 100, i % 10 == 0);
+            }
+        });
+    }
+    // Collecting while threads record sees consistent, if partial, counts
+    for(const auto& metrics: aggregator.Collect()){
+        EXPECT_LE(metrics.count, 2 * kSpansPerThread);
+    }
+    for(auto& thread: threads){
+        thread.join();
+    }
+
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(2, metrics.size());
+    for(const auto& series: metrics){
+        EXPECT_EQ(2 * kSpansPerThread, series.count);
+        EXPECT_EQ(2 * kSpansPerThread / 10, series.error_count);
+        EXPECT_EQ(2 * kSpansPerThread, series.duration_buckets[0]);
+    }
+}
+
+TEST(SpanMetricsAggregator, TestOverflowSeries)
+{
+    SpanMetricsAggregator aggregator({"user.id"}, 2);
+    for(const char *user: {"alice", "bob", "carol", "dave", "alice"}){
+        aggregator.Record("GET /profile", {user}, 100, false);
+    }
+    aggregator.Record("GET /profile", {"erin"}, 100, true);
+
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(3, metrics.size());
+    EXPECT_EQ(std::vector<std::string>({"alice"}), metrics[0].attribute_values);
+    EXPECT_EQ(2, metrics[0].count);
+    EXPECT_EQ(std::vector<std::string>({"bob"}), metrics[1].attribute_values);
+    EXPECT_EQ(1, metrics[1].count);
+    EXPECT_TRUE(metrics[2].overflow);
+    EXPECT_EQ("", metrics[2].name);
+    EXPECT_EQ(3, metrics[2].count);
+    EXPECT_EQ(1, metrics[2].error_count);
+}
+
+TEST(SpanMetricsAggregator, TestSeriesCountOnceAcrossThreads)
+{
+    SpanMetricsAggregator aggregator({}, 2);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t){
+        threads.emplace_back([&aggregator]{
+            aggregator.Record("first", {}, 100, false);
+            aggregator.Record("second", {}, 100, false);
+        });
+    }
+    for(auto& thread: threads){
+        thread.join();
+    }
+
+    // Every thread records the same two series, which stay under the limit
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(2, metrics.size());
+    EXPECT_EQ(4, metrics[0].count);
+    EXPECT_EQ(4, metrics[1].count);
+}
+
+class SpanMetricsAggregatorTestPeer : public ::testing::Test
+{
+public:
+    size_t NumThreadShards() { return SpanMetricsAggregator::NumThreadShards(); }
+    size_t NumLiveShards(const SpanMetricsAggregator &aggregator) { return aggregator.NumLiveShards(); }
+};
+
+TEST_F(SpanMetricsAggregatorTestPeer, TestShardsOfExitedThreadsAreRetired)
+{
+    SpanMetricsAggregator aggregator({}, 1);
+    for(int i = 0; i < 10; ++i){
+        std::thread([&aggregator]{
+            aggregator.Record("span", {}, 100, false);
+            aggregator.Record("other span", {}, 100, true);
+        }).join();
+    }
+    EXPECT_EQ(0, NumLiveShards(aggregator));
+
+    aggregator.Record("span", {}, 100, false);
+    EXPECT_EQ(1, NumLiveShards(aggregator));
+
+    // The counts of the exited threads are kept
+    const auto metrics = aggregator.Collect();
+    ASSERT_EQ(2, metrics.size());
+    EXPECT_EQ("span", metrics[0].name);
+    EXPECT_EQ(11, metrics[0].count);
+    EXPECT_TRUE(metrics[1].overflow);
+    EXPECT_EQ(10, metrics[1].count);
+    EXPECT_EQ(10, metrics[1].error_count);
+}
+
+TEST_F(SpanMetricsAggregatorTestPeer, TestThreadShardsOfDestroyedAggregatorsAreDropped)
+{
+    for(int i = 0; i < 100; ++i){
+        SpanMetricsAggregator aggregator;
+        aggregator.Record("span", {}, 100, false);
+    }
+    // Every aggregator is destroyed, but only the shard of the last one is left, until the
+    // thread records into another
+    EXPECT_EQ(1, NumThreadShards());
+}
+
+TEST(SpanMetricsAggregator, TestAggregatorsAreIndependent)
+{
+    std::unique_ptr<SpanMetricsAggregator> first(new SpanMetricsAggregator);
+    first->Record("first", {}, 100, false);
+    first.reset();
+
+    SpanMetricsAggregator second;
+    second.Record("second", {}, 100, false);
+    const auto metrics = second.Collect();
+    ASSERT_EQ(1, metrics.size());
+    EXPECT_EQ("second", metrics[0].name);
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
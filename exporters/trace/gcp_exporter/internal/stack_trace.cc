@@ -0,0 +1,218 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/internal/stack_trace.h"
+#include "exporters/trace/gcp_exporter/internal/attribute_util.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Cloud Trace limits, in bytes, on the strings of a stack frame */
+constexpr int kFunctionNameStringLen = 1024;
+constexpr int kModuleStringLen = 256;
+
+namespace
+{
+
+constexpr uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+constexpr uint64_t kFnvPrime = 1099511628211ull;
+
+/**
+ * Adds the bytes of a value to an FNV-1a hash
+ */
+inline void HashValue(uint64_t value, uint64_t *hash) noexcept
+{
+    for(int i = 0; i < 8; ++i){
+        *hash = (*hash ^ (value & 0xff)) * kFnvPrime;
+        value >>= 8;
+    }
+}
+
+/* The module of a return address and the offset in it, which stay the same across processes
+   loading the same binaries anywhere in their address space */
+struct FrameIdentity
+{
+    void *address = nullptr;
+    uint64_t module_hash = 0;
+    uintptr_t offset = 0;
+};
+
+/* Frames the thread identified recently, by address, so that hot call sites skip dladdr */
+constexpr size_t kFrameCacheSize = 256;
+thread_local FrameIdentity tls_frame_cache[kFrameCacheSize];
+
+/**
+ * Returns the module and offset of a return address. Addresses outside any module are
+ * identified by themselves.
+ */
+const FrameIdentity &IdentifyFrame(void *address) noexcept
+{
+    const uintptr_t bits = reinterpret_cast<uintptr_t>(address);
+    FrameIdentity &identity = tls_frame_cache[(bits >> 2) % kFrameCacheSize];
+    if(identity.address == address){
+        return identity;
+    }
+    identity.address = address;
+    identity.module_hash = kFnvOffsetBasis;
+    identity.offset = bits;
+    Dl_info info;
+    if(dladdr(address, &info) != 0 && info.dli_fname){
+        for(const char* c = info.dli_fname; *c; ++c){
+            identity.module_hash = (identity.module_hash ^ static_cast<uint8_t>(*c)) * kFnvPrime;
+        }
+        identity.offset = bits - reinterpret_cast<uintptr_t>(info.dli_fbase);
+    }
+    return identity;
+}
+
+} // namespace
+
+std::unique_ptr<CapturedStack> CaptureStack(int skip, int max_frames) noexcept
+{
+    void* frames[kMaxStackFrames + 16];
+    skip = std::max(skip, 0) + 1;
+    const int capacity = std::min(std::min(max_frames, kMaxStackFrames) + skip, kMaxStackFrames + 16);
+    const int num_frames = backtrace(frames, capacity);
+    if(num_frames <= skip){
+        return nullptr;
+    }
+
+    std::unique_ptr<CapturedStack> stack(new CapturedStack());
+    stack->frames.assign(frames + skip, frames + num_frames);
+    // FNV-1a over the module and offset of every frame, so that the same code path hashes the
+    // same in every process running the same binaries, whatever their load addresses. The
+    // hash id then deduplicates across the processes exporting to one project.
+    uint64_t hash = kFnvOffsetBasis;
+    for(void* frame: stack->frames){
+        const FrameIdentity &identity = IdentifyFrame(frame);
+        HashValue(identity.module_hash, &hash);
+        HashValue(identity.offset, &hash);
+    }
+    // Zero means no hash id on the wire
+    stack->hash_id = static_cast<int64_t>(hash == 0 ? 1 : hash);
+    return stack;
+}
+
+StackTraceCache::StackTraceCache(size_t capacity) : capacity_(capacity) {}
+
+void StackTraceCache::Fill(const std::string &project,
+                           const CapturedStack &stack,
+                           google::devtools::cloudtrace::v2::StackTrace *stack_trace)
+{
+    stack_trace->set_stack_trace_hash_id(stack.hash_id);
+    if(capacity_ > 0){
+        std::lock_guard<std::mutex> lock(mu_);
+        const auto it = index_.find(SentStack(project, stack.hash_id));
+        if(it != index_.end()){
+            lru_.splice(lru_.begin(), lru_, it->second);
+            return;
+        }
+    }
+
+    // Symbolizing is the expensive part, and happens once per stack outside the lock
+    auto* frames = stack_trace->mutable_stack_frames();
+    frames->mutable_frame()->Reserve(stack.frames.size());
+    for(void* address: stack.frames){
+        SymbolizeFrame(address, frames->add_frame());
+    }
+}
+
+void StackTraceCache::Remember(const std::string &project, const std::vector<int64_t> &hash_ids)
+{
+    if(capacity_ == 0){
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mu_);
+    for(int64_t hash_id: hash_ids){
+        SentStack sent(project, hash_id);
+        const auto it = index_.find(sent);
+        if(it != index_.end()){
+            lru_.splice(lru_.begin(), lru_, it->second);
+            continue;
+        }
+        lru_.push_front(std::move(sent));
+        index_[lru_.front()] = lru_.begin();
+        if(lru_.size() > capacity_){
+            index_.erase(lru_.back());
+            lru_.pop_back();
+        }
+    }
+}
+
+size_t StackTraceCache::size() const
+{
+    std::lock_guard<std::mutex> lock(mu_);
+    return lru_.size();
+}
+
+std::vector<int64_t> FullStackHashIds(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request)
+{
+    std::vector<int64_t> hash_ids;
+    for(const auto& span: request.spans()){
+        if(span.has_stack_trace() && span.stack_trace().has_stack_frames()){
+            hash_ids.push_back(span.stack_trace().stack_trace_hash_id());
+        }
+    }
+    return hash_ids;
+}
+
+void SymbolizeFrame(void *address, google::devtools::cloudtrace::v2::StackTrace_StackFrame *frame)
+{
+    char buf[32];
+    Dl_info info;
+    if(dladdr(address, &info) == 0){
+        snprintf(buf, sizeof(buf), "%p", address);
+        SetTruncatableString(kFunctionNameStringLen, buf, frame->mutable_function_name());
+        return;
+    }
+
+    if(info.dli_fname){
+        SetTruncatableString(kModuleStringLen, info.dli_fname, frame->mutable_load_module()->mutable_module());
+    }
+    if(!info.dli_sname){
+        const uintptr_t offset = reinterpret_cast<uintptr_t>(address) - reinterpret_cast<uintptr_t>(info.dli_fbase);
+        snprintf(buf, sizeof(buf), "+0x%zx", static_cast<size_t>(offset));
+        SetTruncatableString(kFunctionNameStringLen, buf, frame->mutable_function_name());
+        return;
+    }
+
+    int status = 0;
+    char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    if(status == 0 && demangled){
+        SetTruncatableString(kFunctionNameStringLen, demangled, frame->mutable_function_name());
+        SetTruncatableString(kFunctionNameStringLen, info.dli_sname, frame->mutable_original_function_name());
+    } else {
+        SetTruncatableString(kFunctionNameStringLen, info.dli_sname, frame->mutable_function_name());
+    }
+    free(demangled);
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
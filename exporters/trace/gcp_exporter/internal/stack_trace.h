@@ -0,0 +1,136 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.pb.h"
+#include "opentelemetry/version.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Cloud Trace limit on the number of frames of a stack trace */
+constexpr int kMaxStackFrames = 128;
+
+/**
+ * The raw return addresses of a stack, captured while a span is recorded and only
+ * symbolized on the export thread
+ */
+struct CapturedStack
+{
+    /* Identifies the stack on the wire, derived from its frames */
+    int64_t hash_id = 0;
+
+    /* Return addresses, innermost first */
+    std::vector<void*> frames;
+};
+
+/**
+ * Captures the stack of the calling thread
+ * 
+ * @param skip - Number of innermost frames to leave out, besides CaptureStack's own
+ * @param max_frames - Maximum number of frames to capture, at most kMaxStackFrames
+ * @return The stack, null if no frame was captured
+ */
+std::unique_ptr<CapturedStack> CaptureStack(int skip, int max_frames) noexcept;
+
+/**
+ * Remembers the stacks each project has received in full, so that a stack seen again is
+ * sent to that project as its hash id alone. A stack is only remembered once the request
+ * sending it succeeded, so that no request references a stack the project may not have.
+ * The least recently sent stacks are forgotten first. Thread safe.
+ */
+class StackTraceCache
+{
+public:
+    /**
+     * @param capacity - Number of stacks remembered, zero to send every stack in full
+     */
+    explicit StackTraceCache(size_t capacity);
+
+    /**
+     * Sets the stack trace of a span: only its hash id if the project received the stack
+     * before, its symbolized frames otherwise
+     * 
+     * @param project - The name of the request the span is sent in, which names its project
+     * @param stack - The stack captured for the span
+     * @param stack_trace - The stack trace to set
+     */
+    void Fill(const std::string &project,
+              const CapturedStack &stack,
+              google::devtools::cloudtrace::v2::StackTrace *stack_trace);
+
+    /**
+     * Remembers the stacks a request sent in full, once it succeeded
+     * 
+     * @param project - The name of the request, which names its project
+     * @param hash_ids - The hash ids of the stacks sent in full (see FullStackHashIds)
+     */
+    void Remember(const std::string &project, const std::vector<int64_t> &hash_ids);
+
+    /* Number of stacks remembered */
+    size_t size() const;
+
+private:
+    const size_t capacity_;
+
+    mutable std::mutex mu_;
+
+    /* A stack received by a project */
+    using SentStack = std::pair<std::string, int64_t>;
+
+    struct SentStackHash
+    {
+        size_t operator()(const SentStack &sent) const noexcept
+        {
+            return std::hash<std::string>()(sent.first) ^ std::hash<int64_t>()(sent.second);
+        }
+    };
+
+    /* The stacks sent, most recently sent first */
+    std::list<SentStack> lru_;
+    std::unordered_map<SentStack, std::list<SentStack>::iterator, SentStackHash> index_;
+};
+
+/**
+ * Returns the hash ids of the stacks a request sends in full
+ */
+std::vector<int64_t> FullStackHashIds(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request);
+
+/**
+ * Symbolizes a return address from the dynamic symbol table of its module. Functions
+ * missing from it, such as those of executables linked without -rdynamic, are named by
+ * their offset in the module.
+ */
+void SymbolizeFrame(void *address, google::devtools::cloudtrace::v2::StackTrace_StackFrame *frame);
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
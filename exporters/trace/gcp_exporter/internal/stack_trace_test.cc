@@ -0,0 +1,167 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "exporters/trace/gcp_exporter/internal/stack_trace.h"
+
+#include <gtest/gtest.h>
+
+#include <dlfcn.h>
+
+namespace cloudtrace_v2 = google::devtools::cloudtrace::v2;
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Two distinct call sites, kept out of line so that their stacks differ */
+__attribute__((noinline)) std::unique_ptr<CapturedStack> CaptureFromSiteA()
+{
+    return CaptureStack(0, kMaxStackFrames);
+}
+
+__attribute__((noinline)) std::unique_ptr<CapturedStack> CaptureFromSiteB()
+{
+    return CaptureStack(0, kMaxStackFrames);
+}
+
+/**
+ * Makes a one frame stack with the given hash id
+ */
+CapturedStack MakeStack(int64_t hash_id)
+{
+    CapturedStack stack;
+    stack.hash_id = hash_id;
+    stack.frames.push_back(reinterpret_cast<void*>(&CaptureFromSiteA));
+    return stack;
+}
+
+TEST(StackTrace, TestCaptureStack)
+{
+    std::vector<std::unique_ptr<CapturedStack>> stacks;
+    for(int i = 0; i < 2; ++i){
+        stacks.push_back(CaptureFromSiteA());
+    }
+    stacks.push_back(CaptureFromSiteB());
+    for(const auto& stack: stacks){
+        ASSERT_NE(nullptr, stack);
+        EXPECT_FALSE(stack->frames.empty());
+        EXPECT_NE(0, stack->hash_id);
+    }
+    // The same call site hashes the same, another one does not
+    EXPECT_EQ(stacks[0]->hash_id, stacks[1]->hash_id);
+    EXPECT_NE(stacks[0]->hash_id, stacks[2]->hash_id);
+
+    auto limited = CaptureStack(0, 2);
+    ASSERT_NE(nullptr, limited);
+    EXPECT_LE(limited->frames.size(), 2);
+}
+
+TEST(StackTrace, TestHashIgnoresLoadAddresses)
+{
+    auto stack = CaptureFromSiteA();
+    ASSERT_NE(nullptr, stack);
+
+    // The hash covers the module path and the offset in it, never the address itself
+    uint64_t expected = 14695981039346656037ull;
+    const auto hash_value = [&expected](uint64_t value){
+        for(int i = 0; i < 8; ++i){
+            expected = (expected ^ (value & 0xff)) * 1099511628211ull;
+            value >>= 8;
+        }
+    };
+    for(void* frame: stack->frames){
+        Dl_info info;
+        ASSERT_NE(0, dladdr(frame, &info));
+        ASSERT_NE(nullptr, info.dli_fname);
+        uint64_t module_hash = 14695981039346656037ull;
+        for(const char* c = info.dli_fname; *c; ++c){
+            module_hash = (module_hash ^ static_cast<uint8_t>(*c)) * 1099511628211ull;
+        }
+        hash_value(module_hash);
+        hash_value(reinterpret_cast<uintptr_t>(frame) - reinterpret_cast<uintptr_t>(info.dli_fbase));
+    }
+    EXPECT_EQ(static_cast<int64_t>(expected), stack->hash_id);
+}
+
+TEST(StackTrace, TestSendsStackOnce)
+{
+    StackTraceCache cache(16);
+    const auto stack = CaptureFromSiteA();
+    ASSERT_NE(nullptr, stack);
+
+    cloudtrace_v2::StackTrace first;
+    cache.Fill("projects/a", *stack, &first);
+    EXPECT_EQ(stack->hash_id, first.stack_trace_hash_id());
+    EXPECT_EQ(static_cast<int>(stack->frames.size()), first.stack_frames().frame_size());
+    for(const auto& frame: first.stack_frames().frame()){
+        EXPECT_FALSE(frame.function_name().value().empty());
+    }
+
+    // Until the request sending it succeeds, the stack is sent in full again
+    cloudtrace_v2::StackTrace pending;
+    cache.Fill("projects/a", *stack, &pending);
+    EXPECT_TRUE(pending.has_stack_frames());
+    EXPECT_EQ(0, cache.size());
+
+    cache.Remember("projects/a", {stack->hash_id});
+    cloudtrace_v2::StackTrace second;
+    cache.Fill("projects/a", *stack, &second);
+    EXPECT_EQ(stack->hash_id, second.stack_trace_hash_id());
+    EXPECT_FALSE(second.has_stack_frames());
+    EXPECT_EQ(1, cache.size());
+
+    // Another project has not received the stack
+    cloudtrace_v2::StackTrace other_project;
+    cache.Fill("projects/b", *stack, &other_project);
+    EXPECT_TRUE(other_project.has_stack_frames());
+}
+
+TEST(StackTrace, TestEvictsLeastRecentlySent)
+{
+    StackTraceCache cache(2);
+    cache.Remember("projects/a", {1, 2});
+    // Sending the first stack again makes the second one the least recently sent
+    cloudtrace_v2::StackTrace stack_trace;
+    cache.Fill("projects/a", MakeStack(1), &stack_trace);
+    cache.Remember("projects/a", {3});
+    EXPECT_EQ(2, cache.size());
+
+    cloudtrace_v2::StackTrace first;
+    cache.Fill("projects/a", MakeStack(1), &first);
+    EXPECT_FALSE(first.has_stack_frames());
+    cloudtrace_v2::StackTrace second;
+    cache.Fill("projects/a", MakeStack(2), &second);
+    EXPECT_TRUE(second.has_stack_frames());
+}
+
+TEST(StackTrace, TestFullStackHashIds)
+{
+    StackTraceCache cache(16);
+    cache.Remember("projects/a", {2});
+    cloudtrace_v2::BatchWriteSpansRequest request;
+    cache.Fill("projects/a", MakeStack(1), request.add_spans()->mutable_stack_trace());
+    cache.Fill("projects/a", MakeStack(2), request.add_spans()->mutable_stack_trace());
+    request.add_spans();
+    EXPECT_EQ(std::vector<int64_t>({1}), FullStackHashIds(request));
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,150 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+/*
+ * Measures the latency of the first export of a new exporter, against a localhost stand-in
+ * for Cloud Trace. Its credentials take kTokenFetchDelay to fetch their token, on the first
+ * call. Localhost has no name resolution or TLS handshake to pay for, so the gap between lazy
+ * and eager connection is smaller here than against the real service.
+ */
+
+#include <benchmark/benchmark.h>
+#include "exporters/trace/gcp_exporter/gcp_exporter.h"
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+
+#include <stdlib.h>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter 
+{
+namespace gcp 
+{
+
+constexpr std::chrono::milliseconds kTokenFetchDelay(20);
+
+/* ################################# FIXTURE CLASS ####################################### */
+
+class StartupBenchmark : public benchmark::Fixture 
+{
+public:
+  void SetUp(const ::benchmark::State&) override
+  {
+    setenv(kGCPEnvVar, "startup_project", 1);
+    server_.reset(new LocalTraceServer());
+  }
+
+  void TearDown(const ::benchmark::State&) override
+  {
+    server_.reset();
+  }
+
+  /**
+   * Makes an exporter sending to the local server over a new channel
+   */
+  std::unique_ptr<GcpExporter> MakeExporter(const GcpExporterOptions &options)
+  {
+    return std::unique_ptr<GcpExporter>(new GcpExporter(
+        std::vector<std::shared_ptr<grpc::ChannelInterface>>({server_->MakeChannel(kTokenFetchDelay)}),
+        "startup_project", options));
+  }
+
+  /**
+   * Exports a single span
+   */
+  void ExportSpan(GcpExporter &exporter)
+  {
+    auto recordable = exporter.MakeRecordable();
+    generator_.Fill(*recordable);
+    exporter.Export(nostd::span<std::unique_ptr<sdk::trace::Recordable>>(&recordable, 1));
+  }
+
+  /**
+   * Times the first export of new exporters, or their second export, once everything
+   * is connected
+   * 
+   * @param state - The benchmark state
+   * @param eager - Whether the exporters connect in their constructor
+   * @param warm - Whether to time the second export instead of the first
+   */
+  void RunFirstExport(benchmark::State& state, bool eager, bool warm)
+  {
+    GcpExporterOptions options;
+    options.eager_connect = eager;
+    for(auto _ : state)
+    {
+      state.PauseTiming();
+      auto exporter = MakeExporter(options);
+      if(warm){
+        ExportSpan(*exporter);
+      }
+      state.ResumeTiming();
+
+      ExportSpan(*exporter);
+
+      state.PauseTiming();
+      exporter.reset();
+      state.ResumeTiming();
+    }
+  }
+
+protected:
+  std::unique_ptr<LocalTraceServer> server_;
+  const SpanGenerator generator_{SparseSpanShape()};
+};
+
+/* ################################## BENCHMARKS ######################################## */
+
+BENCHMARK_DEFINE_F(StartupBenchmark, LazyFirstExport)(benchmark::State& state) {
+  RunFirstExport(state, false, false);
+}
+BENCHMARK_REGISTER_F(StartupBenchmark, LazyFirstExport)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+
+BENCHMARK_DEFINE_F(StartupBenchmark, EagerFirstExport)(benchmark::State& state) {
+  RunFirstExport(state, true, false);
+}
+BENCHMARK_REGISTER_F(StartupBenchmark, EagerFirstExport)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+
+BENCHMARK_DEFINE_F(StartupBenchmark, WarmExport)(benchmark::State& state) {
+  RunFirstExport(state, false, true);
+}
+BENCHMARK_REGISTER_F(StartupBenchmark, WarmExport)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+
+/* Times the constructor itself, which takes on the connection and the token fetch when eager */
+BENCHMARK_DEFINE_F(StartupBenchmark, EagerConstruction)(benchmark::State& state) {
+  GcpExporterOptions options;
+  options.eager_connect = true;
+  for(auto _ : state)
+  {
+    auto exporter = MakeExporter(options);
+    state.PauseTiming();
+    exporter.reset();
+    state.ResumeTiming();
+  }
+}
+BENCHMARK_REGISTER_F(StartupBenchmark, EagerConstruction)->UseRealTime()->Unit(benchmark::kMicrosecond);
+
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
+
+// Run benchmarks
+BENCHMARK_MAIN();
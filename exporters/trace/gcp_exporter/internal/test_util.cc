@@ -0,0 +1,240 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/test_util.h"
+#include "opentelemetry/common/key_value_iterable_view.h"
+
+#include <grpcpp/security/credentials.h>
+#include <grpcpp/security/server_credentials.h>
+
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+const trace::TraceId kTraceId(
+    std::array<const uint8_t, trace::TraceId::kSize>({0, 1, 0, 2, 1, 3, 1, 4, 1, 5, 1, 6, 3, 7, 0, 0}));
+
+const trace::SpanId kSpanId(
+    std::array<const uint8_t, trace::SpanId::kSize>({1, 2, 3, 4, 5, 6, 7, 8}));
+
+const trace::SpanId kParentSpanId(
+    std::array<const uint8_t, trace::SpanId::kSize>({4, 5, 0, 1, 1, 1, 1, 3}));
+
+const std::map<std::string, common::AttributeValue> kNoAttributes;
+
+/**
+ * Pads or cuts a key to the length requested by the shape
+ */
+std::string MakeKey(const std::string &key, size_t length)
+{
+    if(length == 0){
+        return key;
+    }
+    // Pad in front so that keys stay distinct when cut
+    std::string padded(length > key.size() ? length - key.size() : 0, 'k');
+    padded += key;
+    return padded.substr(padded.size() - length);
+}
+
+SpanShape EmptySpanShape()
+{
+    return SpanShape();
+}
+
+SpanShape SparseSpanShape()
+{
+    SpanShape shape;
+    shape.has_fields = true;
+    return shape;
+}
+
+SpanShape DenseSpanShape()
+{
+    SpanShape shape = SparseSpanShape();
+    shape.num_int_attributes = 30;
+    shape.num_str_attributes = 30;
+    shape.num_bool_attributes = 30;
+    return shape;
+}
+
+SpanGenerator::SpanGenerator(const SpanShape &shape) : shape_(shape)
+{
+    for(int i = 0; i < shape_.num_int_attributes; ++i){
+        int_keys_.push_back(MakeKey("int_key_" + std::to_string(i), shape_.key_length));
+    }
+    for(int i = 0; i < shape_.num_str_attributes; ++i){
+        str_keys_.push_back(MakeKey("str_key_" + std::to_string(i), shape_.key_length));
+        std::string value = "string_val_" + std::to_string(i);
+        value.resize(shape_.str_value_length, 'x');
+        str_values_.push_back(value);
+    }
+    for(int i = 0; i < shape_.num_bool_attributes; ++i){
+        bool_keys_.push_back(MakeKey("bool_key_" + std::to_string(i), shape_.key_length));
+    }
+    for(int i = 0; i < shape_.num_events; ++i){
+        event_names_.push_back("event_" + std::to_string(i));
+    }
+}
+
+void SpanGenerator::Fill(sdk::trace::Recordable &recordable) const noexcept
+{
+    if(shape_.has_fields){
+        recordable.SetName("Test Span");
+        recordable.SetIds(kTraceId, kSpanId, kParentSpanId);
+        recordable.SetStartTime(core::SystemTimestamp());
+        recordable.SetDuration(std::chrono::nanoseconds(100));
+    }
+    if(shape_.has_error_status){
+        recordable.SetStatus(trace::CanonicalCode::INTERNAL, "Test error");
+    }
+    for(size_t i = 0; i < int_keys_.size(); ++i){
+        recordable.SetAttribute(int_keys_[i], static_cast<int64_t>(i));
+    }
+    for(size_t i = 0; i < str_keys_.size(); ++i){
+        recordable.SetAttribute(str_keys_[i], nostd::string_view(str_values_[i]));
+    }
+    for(size_t i = 0; i < bool_keys_.size(); ++i){
+        recordable.SetAttribute(bool_keys_[i], true);
+    }
+
+    const common::KeyValueIterableView<std::map<std::string, common::AttributeValue>> no_attributes(kNoAttributes);
+    for(const auto& event_name: event_names_){
+        recordable.AddEvent(event_name, core::SystemTimestamp(), no_attributes);
+    }
+}
+
+/**
+ * Counts the calls it serves
+ */
+class LocalTraceServer::Service final : public google::devtools::cloudtrace::v2::TraceService::Service
+{
+public:
+    grpc::Status BatchWriteSpans(grpc::ServerContext* context,
+                                 const google::devtools::cloudtrace::v2::BatchWriteSpansRequest* request,
+                                 google::protobuf::Empty*) override
+    {
+        ++num_calls;
+        if(request->spans_size() == 0){
+            ++num_empty_calls;
+        }
+        std::chrono::milliseconds delay(0);
+        {
+            std::lock_guard<std::mutex> lock(delays_mu);
+            if(!delays.empty()){
+                delay = delays.front();
+                delays.pop_front();
+            }
+        }
+        const auto deadline = std::chrono::steady_clock::now() + delay;
+        while(std::chrono::steady_clock::now() < deadline){
+            if(context->IsCancelled()){
+                ++num_cancelled_calls;
+                return grpc::Status::CANCELLED;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        return grpc::Status::OK;
+    }
+
+    std::atomic<int> num_calls{0};
+    std::atomic<int> num_empty_calls{0};
+    std::atomic<int> num_cancelled_calls{0};
+
+    std::mutex delays_mu;
+    std::deque<std::chrono::milliseconds> delays;
+};
+
+/**
+ * Call credentials which take a while to fetch their token, once
+ */
+class SlowTokenPlugin final : public grpc::MetadataCredentialsPlugin
+{
+public:
+    explicit SlowTokenPlugin(std::chrono::milliseconds fetch_delay) : fetch_delay_(fetch_delay) {}
+
+    grpc::Status GetMetadata(grpc::string_ref, grpc::string_ref, const grpc::AuthContext&,
+                             std::multimap<grpc::string, grpc::string>* metadata) override
+    {
+        if(!has_token_.exchange(true)){
+            std::this_thread::sleep_for(fetch_delay_);
+        }
+        metadata->insert(std::make_pair("authorization", "Bearer test-token"));
+        return grpc::Status::OK;
+    }
+
+private:
+    const std::chrono::milliseconds fetch_delay_;
+    std::atomic<bool> has_token_{false};
+};
+
+LocalTraceServer::LocalTraceServer() : service_(new Service())
+{
+    grpc::ServerBuilder builder;
+    // Local credentials let the channels attach call credentials without TLS
+    builder.AddListeningPort("localhost:0", grpc::experimental::LocalServerCredentials(LOCAL_TCP), &port_);
+    builder.RegisterService(service_.get());
+    server_ = builder.BuildAndStart();
+}
+
+LocalTraceServer::~LocalTraceServer()
+{
+    server_->Shutdown();
+}
+
+std::shared_ptr<grpc::Channel> LocalTraceServer::MakeChannel(std::chrono::milliseconds token_fetch_delay) const
+{
+    static std::atomic<int> next_channel_id(0);
+    grpc::ChannelArguments args;
+    args.SetInt("gcp_exporter.test_channel_id", next_channel_id++);
+    auto credentials = grpc::CompositeChannelCredentials(
+        grpc::experimental::LocalCredentials(LOCAL_TCP),
+        grpc::MetadataCredentialsFromPlugin(std::unique_ptr<grpc::MetadataCredentialsPlugin>(
+            new SlowTokenPlugin(token_fetch_delay))));
+    return grpc::CreateCustomChannel("localhost:" + std::to_string(port_), credentials, args);
+}
+
+int LocalTraceServer::num_calls() const noexcept
+{
+    return service_->num_calls.load();
+}
+
+int LocalTraceServer::num_empty_calls() const noexcept
+{
+    return service_->num_empty_calls.load();
+}
+
+int LocalTraceServer::num_cancelled_calls() const noexcept
+{
+    return service_->num_cancelled_calls.load();
+}
+
+void LocalTraceServer::DelayNextCalls(std::vector<std::chrono::milliseconds> delays)
+{
+    std::lock_guard<std::mutex> lock(service_->delays_mu);
+    service_->delays.insert(service_->delays.end(), delays.begin(), delays.end());
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,193 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
+#include "opentelemetry/sdk/trace/recordable.h"
+
+#include <grpcpp/grpcpp.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Describes what the spans generated by a SpanGenerator hold
+ */
+struct SpanShape
+{
+    /* Whether to set the name, the ids and the timestamps */
+    bool has_fields = false;
+
+    /* Number of attributes of each type */
+    int num_int_attributes = 0;
+    int num_str_attributes = 0;
+    int num_bool_attributes = 0;
+
+    /* Length in bytes of every string attribute value */
+    size_t str_value_length = 12;
+
+    /* Length in bytes of every attribute key, zero to keep the natural "<type>_key_<n>" */
+    size_t key_length = 0;
+
+    /* Whether to set an error status */
+    bool has_error_status = false;
+
+    /* Number of events */
+    int num_events = 0;
+};
+
+/* A span with nothing set */
+SpanShape EmptySpanShape();
+
+/* A span with a name, ids and timestamps but no attributes */
+SpanShape SparseSpanShape();
+
+/* A span with a name, ids, timestamps and 30 attributes of each type */
+SpanShape DenseSpanShape();
+
+/**
+ * Populates recordables with spans of a given shape. All the keys and values are built up
+ * front, so that filling a recordable only measures the cost of the recordable itself.
+ */
+class SpanGenerator
+{
+public:
+    explicit SpanGenerator(const SpanShape &shape);
+
+    /**
+     * Sets all the fields and attributes of the shape on a recordable
+     * 
+     * @param recordable - The recordable to populate
+     */
+    void Fill(sdk::trace::Recordable &recordable) const noexcept;
+
+private:
+    const SpanShape shape_;
+    std::vector<std::string> int_keys_;
+    std::vector<std::string> str_keys_;
+    std::vector<std::string> bool_keys_;
+    std::vector<std::string> str_values_;
+    std::vector<std::string> event_names_;
+};
+
+/**
+ * This class implements a mock functionality of the StubInterface for benchmarking purposes
+ */
+class MockStub final : public google::devtools::cloudtrace::v2::TraceService::StubInterface 
+{
+public:
+  grpc::Status BatchWriteSpans(grpc::ClientContext*,
+                               const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&, 
+                               google::protobuf::Empty*) override
+  {
+    return grpc::Status::OK;
+  }
+
+  grpc::Status CreateSpan(grpc::ClientContext*, 
+                          const google::devtools::cloudtrace::v2::Span&, 
+                          google::devtools::cloudtrace::v2::Span*) override
+  {
+    return grpc::Status(grpc::StatusCode::UNIMPLEMENTED, "");
+  }
+
+private:
+  grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* AsyncBatchWriteSpansRaw(
+      grpc::ClientContext*, const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&, 
+      grpc::CompletionQueue*) override
+  {
+    return nullptr;
+  }
+
+  grpc::ClientAsyncResponseReaderInterface<google::protobuf::Empty>* PrepareAsyncBatchWriteSpansRaw(
+      grpc::ClientContext*, const google::devtools::cloudtrace::v2::BatchWriteSpansRequest&, 
+      grpc::CompletionQueue*) override
+  {
+    return nullptr;
+  }
+
+  grpc::ClientAsyncResponseReaderInterface<google::devtools::cloudtrace::v2::Span>* AsyncCreateSpanRaw(
+      grpc::ClientContext*, const google::devtools::cloudtrace::v2::Span&, 
+      grpc::CompletionQueue*) override
+  {
+    return nullptr;
+  }
+
+  grpc::ClientAsyncResponseReaderInterface<google::devtools::cloudtrace::v2::Span>* PrepareAsyncCreateSpanRaw(
+      grpc::ClientContext*, const google::devtools::cloudtrace::v2::Span&, 
+      grpc::CompletionQueue*) override
+  {
+    return nullptr;
+  }
+};
+
+/**
+ * A stand-in for Cloud Trace, serving on a free localhost port
+ */
+class LocalTraceServer
+{
+public:
+    LocalTraceServer();
+
+    ~LocalTraceServer();
+
+    /**
+     * Makes a channel to the server, with its own connection and call credentials. Like
+     * Google credentials, they fetch a token on the first call and reuse it afterwards.
+     * 
+     * @param token_fetch_delay - How long fetching the token takes
+     * @return The channel, which connects on first use
+     */
+    std::shared_ptr<grpc::Channel> MakeChannel(std::chrono::milliseconds token_fetch_delay) const;
+
+    /* Number of BatchWriteSpans calls served */
+    int num_calls() const noexcept;
+
+    /* Number of BatchWriteSpans calls served that held no span */
+    int num_empty_calls() const noexcept;
+
+    /* Number of BatchWriteSpans calls the client cancelled while they were delayed */
+    int num_cancelled_calls() const noexcept;
+
+    /**
+     * Delays the next BatchWriteSpans calls served, in the order they arrive. A delayed call
+     * ends early if the client cancels it.
+     * 
+     * @param delays - How long each call waits before it is answered
+     */
+    void DelayNextCalls(std::vector<std::chrono::milliseconds> delays);
+
+private:
+    class Service;
+
+    std::unique_ptr<Service> service_;
+    std::unique_ptr<grpc::Server> server_;
+    int port_ = 0;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,215 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/thread_staging.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+namespace staging
+{
+
+constexpr size_t kCacheLineSize = 64;
+
+static_assert(kSlotSize % kCacheLineSize == 0, "Slots must be cache line aligned");
+static_assert(kHeaderSize >= alignof(std::max_align_t), "Header must preserve alignment");
+
+struct ThreadCache;
+
+/* Header stored in front of every block. A null owner marks a heap block. */
+struct BlockHeader
+{
+    ThreadCache* owner;
+};
+
+/* Overlays the payload of a block sitting in a free list */
+struct FreeBlock
+{
+    FreeBlock* next;
+};
+
+/**
+ * The chunks owned by one thread. It outlives its thread for as long as any of its blocks
+ * is still allocated.
+ */
+struct alignas(kCacheLineSize) ThreadCache
+{
+    ~ThreadCache()
+    {
+        for(void* chunk: chunks){
+            free(chunk);
+        }
+    }
+
+    /* Blocks freed by the owning thread, only touched by the owning thread */
+    FreeBlock* local_free = nullptr;
+    std::vector<void*> chunks;
+
+    /* Blocks freed by other threads, waiting to be taken back by the owning thread */
+    alignas(kCacheLineSize) std::atomic<FreeBlock*> remote_free{nullptr};
+
+    /* Number of live blocks, plus one held by the owning thread until it exits */
+    alignas(kCacheLineSize) std::atomic<size_t> refs{1};
+};
+
+/**
+ * Drops one reference to the cache, deleting it along with its chunks on the last one
+ */
+void Unref(ThreadCache* cache) noexcept
+{
+    if(cache->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        cache->~ThreadCache();
+        free(cache);
+    }
+}
+
+/**
+ * Allocates a cache on its own cache lines, which plain 'new' does not guarantee before C++17
+ */
+ThreadCache* NewThreadCache()
+{
+    void* mem = nullptr;
+    if(posix_memalign(&mem, kCacheLineSize, sizeof(ThreadCache)) != 0){
+        throw std::bad_alloc();
+    }
+    return new (mem) ThreadCache;
+}
+
+/* The cache of the calling thread, null until it first allocates or once it has exited */
+thread_local ThreadCache* tls_cache = nullptr;
+
+/**
+ * Releases the calling thread's reference to its cache when the thread exits
+ */
+struct ThreadCacheOwner
+{
+    ~ThreadCacheOwner()
+    {
+        if(tls_cache != nullptr){
+            ThreadCache* cache = tls_cache;
+            tls_cache = nullptr;
+            Unref(cache);
+        }
+    }
+};
+
+ThreadCache* GetThreadCache()
+{
+    thread_local ThreadCacheOwner owner;
+    if(tls_cache == nullptr){
+        tls_cache = NewThreadCache();
+    }
+    return tls_cache;
+}
+
+void *BlockToPayload(BlockHeader* header)
+{
+    return reinterpret_cast<char*>(header) + kHeaderSize;
+}
+
+BlockHeader* PayloadToBlock(void *ptr)
+{
+    return reinterpret_cast<BlockHeader*>(static_cast<char*>(ptr) - kHeaderSize);
+}
+
+/**
+ * Carves a new chunk into slots and threads them onto the local free list
+ */
+void AddChunk(ThreadCache* cache)
+{
+    void* chunk = nullptr;
+    if(posix_memalign(&chunk, kCacheLineSize, kSlotSize * kSlotsPerChunk) != 0){
+        throw std::bad_alloc();
+    }
+    cache->chunks.push_back(chunk);
+
+    char* slots = static_cast<char*>(chunk);
+    for(size_t i = 0; i < kSlotsPerChunk; ++i){
+        auto header = reinterpret_cast<BlockHeader*>(slots + i * kSlotSize);
+        header->owner = cache;
+        auto block = static_cast<FreeBlock*>(BlockToPayload(header));
+        block->next = cache->local_free;
+        cache->local_free = block;
+    }
+}
+
+void *Allocate(size_t size)
+{
+    if(size > kMaxObjectSize){
+        return AllocateFromHeap(size);
+    }
+
+    ThreadCache* cache = GetThreadCache();
+    if(cache->local_free == nullptr){
+        // Take back every block other threads have returned in one go
+        cache->local_free = cache->remote_free.exchange(nullptr, std::memory_order_acquire);
+    }
+    if(cache->local_free == nullptr){
+        AddChunk(cache);
+    }
+
+    FreeBlock* block = cache->local_free;
+    cache->local_free = block->next;
+    cache->refs.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+void *AllocateFromHeap(size_t size)
+{
+    auto header = static_cast<BlockHeader*>(::operator new(kHeaderSize + size));
+    header->owner = nullptr;
+    return BlockToPayload(header);
+}
+
+void Free(void *ptr) noexcept
+{
+    if(ptr == nullptr){
+        return;
+    }
+
+    BlockHeader* header = PayloadToBlock(ptr);
+    ThreadCache* cache = header->owner;
+    if(cache == nullptr){
+        ::operator delete(header);
+        return;
+    }
+
+    auto block = static_cast<FreeBlock*>(ptr);
+    if(cache == tls_cache){
+        block->next = cache->local_free;
+        cache->local_free = block;
+    } else {
+        block->next = cache->remote_free.load(std::memory_order_relaxed);
+        while(!cache->remote_free.compare_exchange_weak(block->next, block,
+                                                        std::memory_order_release,
+                                                        std::memory_order_relaxed)) {}
+    }
+    Unref(cache);
+}
+
+} // staging
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
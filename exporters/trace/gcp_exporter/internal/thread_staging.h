@@ -0,0 +1,75 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "opentelemetry/version.h"
+
+#include <cstddef>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+namespace staging
+{
+
+/* Size of every staged slot, header included. A multiple of the cache line size so that
+   objects staged next to each other never share a cache line. */
+constexpr size_t kSlotSize = 512;
+
+/* Bytes reserved in front of every block to remember where it came from */
+constexpr size_t kHeaderSize = 16;
+
+/* Largest object that fits in a staged slot */
+constexpr size_t kMaxObjectSize = kSlotSize - kHeaderSize;
+
+/* Number of slots carved out of every chunk */
+constexpr size_t kSlotsPerChunk = 64;
+
+/**
+ * Allocates a block from the chunks owned by the calling thread. Blocks freed by other
+ * threads are recycled back to the owning thread, so steady state allocation neither takes
+ * a lock nor touches the global allocator. Objects larger than 'kMaxObjectSize' are
+ * allocated from the heap.
+ * 
+ * @param size - Size in bytes of the object to allocate
+ * @return The allocated block, to be released with Free()
+ */
+void *Allocate(size_t size);
+
+/**
+ * Allocates a block from the global heap, with the same header as a staged block, which
+ * lets Free() tell the two apart
+ * 
+ * @param size - Size in bytes of the object to allocate
+ * @return The allocated block, to be released with Free()
+ */
+void *AllocateFromHeap(size_t size);
+
+/**
+ * Releases a block returned by Allocate() or AllocateFromHeap(), from any thread
+ * 
+ * @param ptr - The block to release, may be null
+ */
+void Free(void *ptr) noexcept;
+
+} // staging
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
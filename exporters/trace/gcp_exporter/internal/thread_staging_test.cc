@@ -0,0 +1,97 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/thread_staging.h"
+
+#include <gtest/gtest.h>
+#include <cstdint>
+#include <future>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+namespace staging
+{
+
+TEST(ThreadStaging, BlocksAreCacheLineAligned)
+{
+    void* first = Allocate(100);
+    void* second = Allocate(100);
+
+    EXPECT_EQ(0, (reinterpret_cast<uintptr_t>(first) - kHeaderSize) % 64);
+    EXPECT_EQ(0, (reinterpret_cast<uintptr_t>(second) - kHeaderSize) % 64);
+
+    Free(first);
+    Free(second);
+}
+
+TEST(ThreadStaging, LocalFreeIsReused)
+{
+    void* block = Allocate(100);
+    Free(block);
+    EXPECT_EQ(block, Allocate(100));
+    Free(block);
+}
+
+TEST(ThreadStaging, RemoteFreeIsRecycledToOwningThread)
+{
+    std::promise<std::vector<void*>> allocated;
+    std::promise<void> freed;
+    std::promise<void*> reallocated;
+
+    std::thread owner([&]{
+        // Use up the whole chunk so that the local free list is empty
+        std::vector<void*> blocks;
+        for(size_t i = 0; i < kSlotsPerChunk; ++i){
+            blocks.push_back(Allocate(100));
+        }
+        allocated.set_value(blocks);
+        freed.get_future().wait();
+        // The block freed by the other thread is taken back rather than a new chunk
+        reallocated.set_value(Allocate(100));
+    });
+
+    std::vector<void*> blocks = allocated.get_future().get();
+    Free(blocks[0]);
+    freed.set_value();
+    EXPECT_EQ(blocks[0], reallocated.get_future().get());
+    owner.join();
+
+    // Freeing the last blocks after the owner has exited releases its chunks
+    for(void* block: blocks){
+        Free(block);
+    }
+}
+
+TEST(ThreadStaging, LargeObjectsFallBackToHeap)
+{
+    void* block = Allocate(kMaxObjectSize + 1);
+    ASSERT_NE(nullptr, block);
+    Free(block);
+
+    Free(AllocateFromHeap(10));
+    Free(nullptr);
+}
+
+}  // namespace staging
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/worker_pool.h"
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+WorkerPool::WorkerPool(size_t num_threads)
+{
+    threads_.reserve(num_threads);
+    for(size_t i = 0; i < num_threads; ++i){
+        threads_.emplace_back(&WorkerPool::WorkerLoop, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    Stop();
+}
+
+void WorkerPool::Stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mu_);
+        shutdown_ = true;
+    }
+    work_cv_.notify_all();
+    for(auto& thread: threads_){
+        thread.join();
+    }
+    threads_.clear();
+}
+
+void WorkerPool::Run(const std::vector<std::function<void()>> &tasks)
+{
+    if(tasks.empty()){
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mu_);
+    std::unique_lock<std::mutex> lock(mu_);
+    tasks_ = &tasks;
+    next_task_ = 0;
+    pending_tasks_ = tasks.size();
+    work_cv_.notify_all();
+
+    // The calling thread works on the job too, rather than idling until it is done
+    while(RunNextTask(lock)) {}
+
+    done_cv_.wait(lock, [this]{ return pending_tasks_ == 0; });
+    tasks_ = nullptr;
+}
+
+void WorkerPool::WorkerLoop()
+{
+    std::unique_lock<std::mutex> lock(mu_);
+    while(true){
+        work_cv_.wait(lock, [this]{
+            return shutdown_ || (tasks_ != nullptr && next_task_ < tasks_->size());
+        });
+        if(shutdown_){
+            return;
+        }
+        RunNextTask(lock);
+    }
+}
+
+bool WorkerPool::RunNextTask(std::unique_lock<std::mutex> &lock)
+{
+    if(tasks_ == nullptr || next_task_ >= tasks_->size()){
+        return false;
+    }
+    const auto& task = (*tasks_)[next_task_++];
+
+    lock.unlock();
+    task();
+    lock.lock();
+
+    if(--pending_tasks_ == 0){
+        done_cv_.notify_all();
+    }
+    return true;
+}
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,101 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "opentelemetry/version.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * A small, fixed-size pool of threads used to run the shards of a batch in parallel
+ */
+class WorkerPool
+{
+public:
+    /**
+     * Starts the worker threads
+     * 
+     * @param num_threads - Number of threads to spawn in addition to the calling thread
+     */
+    explicit WorkerPool(size_t num_threads);
+
+    /**
+     * Stops and joins all the worker threads
+     */
+    ~WorkerPool();
+
+    /**
+     * Stops and joins the worker threads, once they finish the task they are running. Later
+     * jobs run on the calling thread alone.
+     */
+    void Stop();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    /**
+     * Runs all the given tasks and blocks until every one of them has completed.
+     * The calling thread takes part in the work, and concurrent calls are serialized.
+     * 
+     * @param tasks - The tasks to run, each of which must not throw
+     */
+    void Run(const std::vector<std::function<void()>> &tasks);
+
+    /* Number of threads owned by the pool, excluding the calling thread, zero once stopped */
+    size_t size() const noexcept { return threads_.size(); }
+
+private:
+    /* Main loop of each worker thread */
+    void WorkerLoop();
+
+    /**
+     * Claims and runs the next pending task of the current job, if any
+     * 
+     * @param lock - Lock held on 'mu_', released while the task runs
+     * @return Whether a task was run
+     */
+    bool RunNextTask(std::unique_lock<std::mutex> &lock);
+
+    std::vector<std::thread> threads_;
+
+    /* Serializes calls to Run() */
+    std::mutex run_mu_;
+
+    /* Guards all the job state below */
+    std::mutex mu_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    const std::vector<std::function<void()>> *tasks_ = nullptr;
+    size_t next_task_ = 0;
+    size_t pending_tasks_ = 0;
+    bool shutdown_ = false;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "exporters/trace/gcp_exporter/internal/worker_pool.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+TEST(WorkerPool, RunsEveryTaskOnce)
+{
+    WorkerPool pool(3);
+    EXPECT_EQ(3, pool.size());
+
+    std::vector<std::atomic<int>> counters(50);
+    std::vector<std::function<void()>> tasks;
+    for(auto& counter: counters){
+        counter = 0;
+        tasks.emplace_back([&counter]{ ++counter; });
+    }
+
+    // Running the same job twice checks that the pool is reusable
+    pool.Run(tasks);
+    pool.Run(tasks);
+
+    for(auto& counter: counters){
+        EXPECT_EQ(2, counter.load());
+    }
+}
+
+TEST(WorkerPool, RunsOnCallingThreadWithoutWorkers)
+{
+    WorkerPool pool(0);
+    const auto caller = std::this_thread::get_id();
+
+    std::thread::id ran_on;
+    pool.Run({[&ran_on]{ ran_on = std::this_thread::get_id(); }});
+
+    EXPECT_EQ(caller, ran_on);
+}
+
+TEST(WorkerPool, RunsOnCallingThreadOnceStopped)
+{
+    WorkerPool pool(2);
+    pool.Stop();
+    EXPECT_EQ(0, pool.size());
+    const auto caller = std::this_thread::get_id();
+
+    std::vector<std::thread::id> ran_on(10);
+    std::vector<std::function<void()>> tasks;
+    for(auto& id: ran_on){
+        tasks.emplace_back([&id]{ id = std::this_thread::get_id(); });
+    }
+    pool.Run(tasks);
+
+    for(const auto& id: ran_on){
+        EXPECT_EQ(caller, id);
+    }
+}
+
+}  // namespace gcp
+}  // namespace exporter
+OPENTELEMETRY_END_NAMESPACE
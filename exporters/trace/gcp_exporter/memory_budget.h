@@ -0,0 +1,158 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "opentelemetry/version.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * What a recordable does with data that does not fit in its memory budget
+ */
+enum class MemoryBudgetPolicy
+{
+  /* Drops the attributes and events. Display names are bounded and always kept. */
+  kDropAttributes,
+  /* Drops the whole span. It keeps its place in the batch but is never exported. */
+  kDropSpans,
+  /* Keeps everything, and asks for an early flush each time the budget is exceeded */
+  kFlush,
+};
+
+/**
+ * Bounds the bytes held by the spans buffered in recordables, across every exporter and
+ * thread sharing the budget. Recordables reserve their bytes in chunks that grow with the
+ * span (see MemoryCharge), so the shared counter is touched a few times per span, and the
+ * exporter gives the bytes of a whole request back at once. The reserved bytes overstate the
+ * real usage of a buffered span by less than kMinChargeChunkBytes or half its reservation,
+ * and never by kMaxChargeChunkBytes or more.
+ */
+class MemoryBudget
+{
+public:
+  /* Bytes of the first chunk a recordable reserves, and the granularity of all of them */
+  static constexpr size_t kMinChargeChunkBytes = 128;
+
+  /* Bytes past which a recordable's chunks stop growing, unless the bytes missing need more */
+  static constexpr size_t kMaxChargeChunkBytes = 4096;
+
+  /**
+   * @param max_bytes - The budget
+   * @param policy - What recordables do with data past the budget
+   * @param flush - Called, for the kFlush policy, when a reservation takes the budget past
+   * max_bytes, and not again until the reserved bytes are back under it. It is called from
+   * the thread recording the span, so it should only signal the processor, for instance
+   * with ForceFlush on a batch processor, and never block on the export.
+   */
+  MemoryBudget(size_t max_bytes, MemoryBudgetPolicy policy, std::function<void()> flush = nullptr);
+
+  /**
+   * Reserves bytes, unless the policy refuses them
+   * 
+   * @param bytes - The number of bytes to reserve
+   * @param required - Whether to reserve the bytes even past the budget
+   * @return Whether the bytes were reserved
+   */
+  bool Reserve(size_t bytes, bool required = false) noexcept;
+
+  /* Gives reserved bytes back */
+  void Release(size_t bytes) noexcept;
+
+  size_t max_bytes() const noexcept { return max_bytes_; }
+  MemoryBudgetPolicy policy() const noexcept { return policy_; }
+
+  /* Number of bytes reserved */
+  size_t reserved_bytes() const noexcept { return reserved_bytes_.load(std::memory_order_relaxed); }
+
+  /* Number of reservations refused since the budget was created */
+  uint64_t num_refused() const noexcept { return num_refused_.load(std::memory_order_relaxed); }
+
+private:
+  const size_t max_bytes_;
+  const MemoryBudgetPolicy policy_;
+  const std::function<void()> flush_;
+
+  std::atomic<size_t> reserved_bytes_;
+  std::atomic<uint64_t> num_refused_;
+
+  /* Whether a flush was asked for since the budget was last exceeded */
+  std::atomic<bool> flush_requested_;
+};
+
+/**
+ * The bytes one recordable holds against a budget. Like the recordable, it is only used by
+ * one thread at a time.
+ */
+class MemoryCharge
+{
+public:
+  MemoryCharge() = default;
+  MemoryCharge(const MemoryCharge &) = delete;
+  MemoryCharge &operator=(const MemoryCharge &) = delete;
+
+  /**
+   * Accounts for bytes stored by the recordable, reserving another chunk from the budget
+   * when the ones reserved are used up. Each chunk is as large as the recordable's
+   * reservation so far, between kMinChargeChunkBytes and kMaxChargeChunkBytes, so small
+   * spans hold little more than they use.
+   * 
+   * @param budget - The budget, null for none
+   * @param bytes - The number of bytes stored
+   * @param required - Whether the bytes are kept even past the budget, under kDropAttributes
+   * @return Whether the recordable may store the bytes. Under kDropSpans, a refusal drops
+   * the span for good.
+   */
+  bool Add(MemoryBudget *budget, size_t bytes, bool required = false) noexcept
+  {
+    if(!budget){
+      return true;
+    }
+    used_bytes_ += bytes;
+    return (used_bytes_ <= reserved_bytes_ && !dropped_) || ReserveChunk(budget, bytes, required);
+  }
+
+  /* Whether a refusal dropped the span */
+  bool dropped() const noexcept { return dropped_; }
+
+  /**
+   * Returns the bytes reserved, leaving none, so that the exporter can give the bytes of a
+   * whole request back at once
+   */
+  size_t TakeReservedBytes() noexcept;
+
+private:
+  bool ReserveChunk(MemoryBudget *budget, size_t bytes, bool required) noexcept;
+
+  size_t used_bytes_ = 0;
+  size_t reserved_bytes_ = 0;
+  bool dropped_ = false;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
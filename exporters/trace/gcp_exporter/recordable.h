@@ -16,11 +16,18 @@
 
 #pragma once
 
+#include "exporters/trace/gcp_exporter/memory_budget.h"
+#include "exporters/trace/gcp_exporter/runtime_config.h"
 #include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
 #include "opentelemetry/sdk/trace/recordable.h"
 #include "opentelemetry/version.h"
 #include "opentelemetry/nostd/variant.h"
 
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+
 
 constexpr char kProjectsPathStr[] = "projects/";
 constexpr char kTracesPathStr[] = "/traces/";
@@ -33,11 +40,152 @@ namespace exporter
 {
 namespace gcp
 {
+
+/**
+ * Tag selecting the thread-local staging allocator, as in 'new (kThreadStaging) Recordable'.
+ * Staged recordables are carved out of cache line padded chunks owned by the allocating
+ * thread, and are recycled back to that thread when the exporter frees them.
+ */
+struct ThreadStagingTag {};
+constexpr ThreadStagingTag kThreadStaging{};
+
+/**
+ * A fixed set of attribute keys whose value types are known at compile time. Instrumentation
+ * that knows its attributes statically declares the schema once and sets all the values with
+ * Recordable::SetAttributes(), which converts each value without any variant dispatch.
+ * 
+ * Supported value types are bool, int, int64_t, unsigned int, uint64_t, double and
+ * nostd::string_view.
+ * 
+ * Example:
+ *   static const AttributeSchema<nostd::string_view, int64_t> kSchema("http.method", "http.status_code");
+ *   recordable.SetAttributes(kSchema, "GET", 200);
+ */
+template <typename... Ts>
+class AttributeSchema
+{
+public:
+  template <typename... Keys>
+  constexpr explicit AttributeSchema(Keys... keys) : keys_{{nostd::string_view(keys)...}}
+  {
+    static_assert(sizeof...(Keys) == sizeof...(Ts), "Expected exactly one key per value type");
+  }
+
+  const std::array<nostd::string_view, sizeof...(Ts)> &keys() const noexcept { return keys_; }
+
+private:
+  std::array<nostd::string_view, sizeof...(Ts)> keys_;
+};
+
+namespace detail
+{
+/* Keeps the value types of SetAttributes() from being deduced from its arguments */
+template <typename T>
+struct NonDeduced
+{
+  using type = T;
+};
+} // detail
+
+struct CapturedStack;
+
+/**
+ * When a recordable captures the stack of the thread recording its span
+ */
+enum class StackCapture
+{
+  kNone,
+  /* When the start time of the span is set, that is when the span starts */
+  kOnStart,
+  /* When the span gets a status other than OK, once */
+  kOnError,
+};
+
+/**
+ * Options shared by every recordable an exporter makes, which must outlive them
+ */
+struct RecordableOptions
+{
+  /* Keys of the attributes that make a span a priority span, as an error status does.
+     Every attribute set is checked against each of them, so keep the list short. */
+  std::vector<std::string> priority_attribute_keys;
+
+  bool IsPriorityKey(nostd::string_view key) const noexcept
+  {
+    for(const auto& priority_key: priority_attribute_keys){
+      if(key == priority_key){
+        return true;
+      }
+    }
+    return false;
+  }
+
+  /* When stacks are captured */
+  StackCapture stack_capture = StackCapture::kNone;
+
+  /* Maximum number of frames of a captured stack */
+  int max_stack_frames = 32;
+
+  /* The budget the bytes of the spans are charged to, null for none */
+  MemoryBudget *memory_budget = nullptr;
+
+  /* The config whose truncation limits apply to the spans, null for Cloud Trace's limits */
+  const ConfigStore *config = nullptr;
+
+  /* Returns the config spans recorded with the given options follow, which may be null */
+  static const RuntimeConfig &Config(const RecordableOptions *options) noexcept;
+};
+
 class Recordable final : public sdk::trace::Recordable
 {
 public:
+  static void *operator new(std::size_t size);
+  static void *operator new(std::size_t size, ThreadStagingTag);
+  static void operator delete(void *ptr) noexcept;
+  static void operator delete(void *ptr, ThreadStagingTag) noexcept;
+
+  Recordable() noexcept;
+
+  /**
+   * Wraps a span built elsewhere, such as one received from another process
+   * 
+   * @param trace_id - The id of the span's trace
+   * @param span - The span, whose name is left to ToProto
+   */
+  Recordable(const std::array<uint8_t, 16> &trace_id, google::devtools::cloudtrace::v2::Span span) noexcept;
+
+  /* Classifies the span with the given options */
+  explicit Recordable(const RecordableOptions *options) noexcept;
+
+  ~Recordable() override;
+
+  /* The span, without its name, which depends on the project it is exported to */
   const google::devtools::cloudtrace::v2::Span &span() const noexcept { return span_; }
 
+  const std::array<uint8_t, 16> &trace_id() const noexcept { return trace_id_; }
+
+  /**
+   * Builds the protobuf form of the span
+   * 
+   * @param project_id - The Id of the Google Cloud project the span name is addressed to
+   * @param span - The span to populate
+   */
+  void ToProto(nostd::string_view project_id, google::devtools::cloudtrace::v2::Span *span) const;
+
+  /* The stack captured while the span was recorded, null if none. It is not part of
+     span(), since only the exporter symbolizes it. */
+  const CapturedStack *stack() const noexcept { return stack_.get(); }
+
+  /* Whether the span was dropped for exceeding the memory budget */
+  bool dropped() const noexcept { return charge_.dropped(); }
+
+  /* Returns the bytes the span reserved from the memory budget, leaving none, for the
+     exporter to release with those of the rest of the request */
+  size_t TakeReservedBytes() noexcept { return charge_.TakeReservedBytes(); }
+
+  /* Whether the span has an error status or a priority attribute */
+  bool priority() const noexcept { return priority_; }
+
   void SetIds(opentelemetry::trace::TraceId trace_id,
                       opentelemetry::trace::SpanId span_id,
                       opentelemetry::trace::SpanId parent_span_id) noexcept override;
@@ -45,6 +193,30 @@ public:
   void SetAttribute(nostd::string_view key,
                             const opentelemetry::common::AttributeValue &value) noexcept override;
 
+  /**
+   * Sets the values of all the attributes of a schema, in the order of its keys
+   */
+  template <typename... Ts>
+  void SetAttributes(const AttributeSchema<Ts...> &schema,
+                     const typename detail::NonDeduced<Ts>::type &... values) noexcept
+  {
+    SetTypedAttributes(schema.keys(), 0, values...);
+  }
+
+  /* Typed setters, each converting straight to the matching protobuf attribute type */
+  void SetTypedAttribute(nostd::string_view key, bool value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, int value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, int64_t value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, unsigned int value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, uint64_t value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, double value) noexcept;
+  void SetTypedAttribute(nostd::string_view key, nostd::string_view value) noexcept;
+
+  /* Sets a string value already cut to fit, recording the number of bytes cut from it */
+  void SetTruncatedAttribute(nostd::string_view key,
+                             nostd::string_view value,
+                             size_t truncated_byte_count) noexcept;
+
   void AddEvent(
       nostd::string_view name,
       core::SystemTimestamp timestamp,
@@ -64,7 +236,34 @@ public:
   void SetDuration(std::chrono::nanoseconds duration) noexcept override;
 
 private:
+  template <size_t N>
+  void SetTypedAttributes(const std::array<nostd::string_view, N> &, size_t) noexcept {}
+
+  template <size_t N, typename T, typename... Rest>
+  void SetTypedAttributes(const std::array<nostd::string_view, N> &keys, size_t index,
+                          const T &value, const Rest &... rest) noexcept
+  {
+    SetTypedAttribute(keys[index], value);
+    SetTypedAttributes(keys, index + 1, rest...);
+  }
+
+  /* Returns the attribute stored under the key, inserting it if missing, or null if the
+     memory budget refuses the attribute */
+  google::devtools::cloudtrace::v2::AttributeValue *MutableAttribute(nostd::string_view key,
+                                                                     size_t value_size) noexcept;
+
+  /* Charges stored bytes to the memory budget, returning whether they may be stored */
+  bool Charge(size_t bytes, bool required = false) noexcept
+  {
+    return charge_.Add(options_ ? options_->memory_budget : nullptr, bytes, required);
+  }
+
   google::devtools::cloudtrace::v2::Span span_;
+  std::array<uint8_t, 16> trace_id_{};
+  const RecordableOptions *options_ = nullptr;
+  bool priority_ = false;
+  std::unique_ptr<CapturedStack> stack_;
+  MemoryCharge charge_;
 };
 
 } // gcp
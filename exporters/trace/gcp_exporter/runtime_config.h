@@ -0,0 +1,155 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#pragma once
+
+#include "opentelemetry/version.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/**
+ * Export tuning that can change while the process runs. Exporters and recordables sharing a
+ * ConfigStore read it in place of the matching GcpExporterOptions.
+ */
+struct RuntimeConfig
+{
+    /* Length in bytes string attribute values and event names are truncated to, at most
+       Cloud Trace's limit of 256 */
+    size_t attribute_string_len = 256;
+
+    /* Length in bytes display names are truncated to, at most Cloud Trace's limit of 128 */
+    size_t display_name_string_len = 128;
+
+    /* Fraction of the traces to export, in [0, 1] (see GcpExporterOptions::export_ratio) */
+    double export_ratio = 1.0;
+
+    /* Minimum number of spans a batch must hold to be split into sub-batches */
+    size_t parallel_export_threshold = 1000;
+
+    /* Largest number of sub-batches a batch is split into, bounded by the exporter's threads.
+       Zero for one per thread. */
+    size_t max_export_shards = 0;
+
+    /* Whether requests go through the exporter's compression codec, if it has one */
+    bool compression = true;
+};
+
+/**
+ * Holds the current RuntimeConfig. Every update publishes a new immutable snapshot, so that
+ * reading the config is a single atomic load, without any lock. The store keeps the last
+ * kMaxSnapshots snapshots, so a reader copies the fields it needs, or reads the config
+ * anew, instead of holding on to it.
+ */
+class ConfigStore
+{
+public:
+    /* Number of snapshots kept, the current one included */
+    static constexpr size_t kMaxSnapshots = 64;
+
+    explicit ConfigStore(const RuntimeConfig &config = RuntimeConfig());
+
+    /* Stops watching the file, if any */
+    ~ConfigStore();
+
+    /**
+     * Returns the current config, which stays valid until kMaxSnapshots - 1 more configs are
+     * published. Meant to be read right away, within the call that fetched it.
+     */
+    const RuntimeConfig &Get() const noexcept { return *current_.load(std::memory_order_acquire); }
+
+    /**
+     * Publishes a new config, with its truncation limits capped to Cloud Trace's
+     */
+    void Update(const RuntimeConfig &config);
+
+    /**
+     * Publishes the config read from a file, whose lines set fields as 'name = value', in
+     * any order, with '#' starting comments, and whose last line is 'end'. Fields left out
+     * keep their current value. The end line tells a complete file from one caught halfway
+     * through being written, which is refused; writing the file elsewhere and renaming it
+     * over the watched path also keeps readers from ever seeing it halfway.
+     * 
+     * @param path - The path of the file
+     * @return Whether the file was read and every line parsed, the config being left
+     * unchanged otherwise
+     */
+    bool LoadFile(const std::string &path);
+
+    /**
+     * Loads a file, then checks it periodically from a thread of the store's, and loads it
+     * again each time it changes
+     * 
+     * @param path - The path of the file
+     * @param poll_interval - The time between two checks
+     */
+    void WatchFile(const std::string &path, std::chrono::milliseconds poll_interval);
+
+    /**
+     * Parses the lines of a config file into a config
+     * 
+     * @param text - The contents of the file
+     * @param config - The config to set the fields of, holding the others' values
+     * @return Whether every line was parsed, and the text ends with the end line
+     */
+    static bool Parse(const std::string &text, RuntimeConfig *config);
+
+    /* Number of configs published since the store was created */
+    uint64_t version() const noexcept { return version_.load(std::memory_order_relaxed); }
+
+private:
+    /* Test Fixture Class meant for testing purposes only */
+    friend class ConfigStoreTestPeer;
+
+    /* Publishes a config, with mu_ held */
+    void Publish(const RuntimeConfig &config);
+
+    void WatchLoop(std::string path, std::chrono::milliseconds poll_interval);
+
+    std::atomic<const RuntimeConfig*> current_;
+    std::atomic<uint64_t> version_;
+
+    /* The last snapshots published, oldest first, kept for the readers still holding them.
+       The lock is held from reading the config an update is based on to publishing it. */
+    std::mutex mu_;
+    std::deque<std::unique_ptr<const RuntimeConfig>> snapshots_;
+
+    std::thread watch_thread_;
+    std::mutex watch_mu_;
+    std::condition_variable watch_cv_;
+    bool stopping_ = false;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,123 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "google/devtools/cloudtrace/v2/tracing.grpc.pb.h"
+#include "opentelemetry/version.h"
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+class BatchQueue;
+
+/**
+ * Struct to hold the tuning options of a SharedExportService
+ */
+struct SharedExportServiceOptions
+{
+    /* Number of gRPC channels requests are spread over, round robin. As many requests are
+       sent at once, each from a thread of the service's. */
+    size_t num_channels = 1;
+
+    /* Number of spans at which a coalesced request is sent without waiting any longer */
+    size_t max_batch_size = 1000;
+
+    /* Longest time spans wait for spans from other exporters to be sent with */
+    std::chrono::milliseconds max_delay{20};
+
+    /* Interval between HTTP/2 keepalive pings, zero to leave keepalive off */
+    std::chrono::milliseconds keepalive_interval{0};
+};
+
+/**
+ * Sends the requests of every exporter sharing it over one pool of channels, coalescing
+ * the requests submitted to the same project at about the same time into one. A process
+ * whose libraries each set up a tracer provider then has one set of channels and send
+ * threads in all, instead of one per exporter.
+ *
+ * Exporters share a service by holding it in GcpExporterOptions::shared_service. The
+ * process-wide one lives as long as an exporter holds it.
+ */
+class SharedExportService
+{
+public:
+    /**
+     * Returns the process-wide service, made with the given options if no exporter holds
+     * it already
+     * 
+     * @param options - The tuning options of the service, if it is made
+     * @return The process-wide service
+     */
+    static std::shared_ptr<SharedExportService> Get(const SharedExportServiceOptions &options = SharedExportServiceOptions());
+
+    /**
+     * Makes a service of its own, to share among a chosen set of exporters
+     * 
+     * @param options - The tuning options of the service
+     */
+    explicit SharedExportService(const SharedExportServiceOptions &options);
+
+    /* Sends every pending request */
+    ~SharedExportService();
+
+    /**
+     * Queues the spans of a request, to be sent with the other spans to its project
+     * 
+     * @param request - The request, addressed to its project by its name. Its spans are taken.
+     * @return Becomes whether the spans were sent successfully, once they are sent
+     */
+    std::shared_future<bool> Submit(google::devtools::cloudtrace::v2::BatchWriteSpansRequest *request);
+
+private:
+    /* Test Fixture Class meant for testing purposes only */
+    friend class GcpExporterTestPeer;
+
+    /**
+     * Internal constructor injecting the stubs to send over, for testing purposes
+     * 
+     * @param stubs - The stubs to send over, round robin
+     * @param options - The tuning options of the service
+     */
+    SharedExportService(std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>> stubs,
+                        const SharedExportServiceOptions &options);
+
+    /**
+     * Sends a coalesced request to the cloud, from one of the queue's threads
+     */
+    bool SendRequest(const google::devtools::cloudtrace::v2::BatchWriteSpansRequest &request) noexcept;
+
+    const std::vector<std::unique_ptr<google::devtools::cloudtrace::v2::TraceService::StubInterface>> trace_service_stubs_;
+
+    /* Index of the stub the next request is sent on */
+    std::atomic<size_t> next_stub_;
+
+    std::unique_ptr<BatchQueue> queue_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "opentelemetry/sdk/trace/exporter.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+class ShmRing;
+
+/* Prefix of the shared memory ring names, each process's ring being named <prefix><pid> */
+constexpr char kDefaultRingPrefix[] = "gcp_exporter_ring.";
+
+/**
+ * Struct to hold the options of the rings exporting processes write to
+ */
+struct ShmTransportOptions
+{
+    /* Prefix of the ring name, which the agent must be given too */
+    std::string ring_prefix = kDefaultRingPrefix;
+
+    /* Number of spans the ring holds before new spans are dropped, rounded up to a power
+       of two. The ring takes ring_capacity * (max_span_size + 64) bytes of shared memory,
+       4MiB by default. Past 2^31, no ring is created and every export fails. */
+    uint32_t ring_capacity = 1024;
+
+    /* Largest encoded span a ring slot holds; larger spans are dropped */
+    uint32_t max_span_size = 4032;
+
+    /* Longest time shutting down waits for the agent to drain the ring before removing it,
+       when Shutdown is given no timeout */
+    std::chrono::milliseconds drain_timeout{500};
+};
+
+/**
+ * An exporter that hands spans over to an export agent process instead of sending them
+ * itself. Every span is encoded straight into a slot of a shared memory ring owned by this
+ * process, so exporting takes neither a gRPC channel nor a syscall. The exporter removes
+ * its ring when shut down, and the agent removes those of processes that exited without
+ * shutting their exporter down, once drained. Each span travels with its trace id, and the
+ * agent's exporter addresses it to its own project, so exporting processes need no project
+ * configured.
+ */
+class ShmRingExporter final : public sdk::trace::SpanExporter
+{
+public:
+    explicit ShmRingExporter(const ShmTransportOptions &options = ShmTransportOptions());
+
+    /* Shuts down, if Shutdown was not called */
+    ~ShmRingExporter();
+
+    /**
+     * Creates a Recordable(Span) object
+     */
+    std::unique_ptr<sdk::trace::Recordable> MakeRecordable() noexcept override;
+
+    /**
+     * Pushes all gathered spans to the ring
+     * 
+     * @param spans - List of spans to hand over to the agent
+     * @return Failure if the ring could not be created or some spans were dropped
+     */
+    sdk::trace::ExportResult Export(const nostd::span<std::unique_ptr<sdk::trace::Recordable>> &spans) noexcept override;
+
+    /**
+     * Waits for the agent to drain the ring, up to the timeout, then removes the ring's name.
+     * An agent that mapped the ring still drains what is left.
+     * 
+     * @param timeout - The longest time to wait, zero for the drain_timeout option
+     */
+    void Shutdown(std::chrono::microseconds timeout = std::chrono::microseconds(0)) noexcept override;
+
+    /* The name of this process's ring, or empty if it could not be created */
+    std::string ring_name() const;
+
+private:
+    /* The ring spans are pushed to, null if it could not be created */
+    const std::unique_ptr<ShmRing> ring_;
+
+    const std::chrono::milliseconds drain_timeout_;
+
+    /* Whether the ring's name was removed */
+    std::atomic<bool> shut_down_;
+};
+
+/**
+ * Struct to hold the options of the export agent
+ */
+struct ShmRingAgentOptions
+{
+    /* Prefix of the names of the rings to drain */
+    std::string ring_prefix = kDefaultRingPrefix;
+
+    /* Directory listing the shared memory objects */
+    std::string shm_directory = "/dev/shm";
+
+    /* Largest number of spans handed to the exporter at once */
+    size_t max_batch_size = 512;
+
+    /* How long Run() waits after a poll that found no span */
+    std::chrono::milliseconds poll_interval = std::chrono::milliseconds(100);
+};
+
+/**
+ * Drains the rings of every ShmRingExporter on the host into one exporter. Spans are handed
+ * to the exporter as gcp::Recordable, so a GcpExporter used here must not be configured for
+ * compact recordables.
+ */
+class ShmRingAgent
+{
+public:
+    /**
+     * @param exporter - The exporter the spans of every ring are exported with
+     * @param options - The options of the agent
+     */
+    ShmRingAgent(std::unique_ptr<sdk::trace::SpanExporter> exporter, const ShmRingAgentOptions &options);
+
+    ~ShmRingAgent();
+
+    /**
+     * Maps the rings created since the last poll, exports the spans of every ring, and
+     * removes the rings of the processes that exited
+     * 
+     * @return Number of spans handed to the exporter
+     */
+    size_t Poll() noexcept;
+
+    /**
+     * Polls until asked to stop
+     * 
+     * @param stop - Set to true by another thread to return
+     */
+    void Run(const std::atomic<bool> &stop) noexcept;
+
+    /* Number of rings currently drained */
+    size_t num_rings() const noexcept { return rings_.size(); }
+
+    /* Number of spans drained that the exporter failed to export */
+    uint64_t num_failed_spans() const noexcept { return num_failed_spans_.load(std::memory_order_relaxed); }
+
+private:
+    /**
+     * Maps the rings listed in the shared memory directory that are not mapped yet
+     */
+    void DiscoverRings() noexcept;
+
+    const std::unique_ptr<sdk::trace::SpanExporter> exporter_;
+    const ShmRingAgentOptions options_;
+
+    /* The mapped rings, by name */
+    std::map<std::string, std::unique_ptr<ShmRing>> rings_;
+
+    std::atomic<uint64_t> num_failed_spans_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE
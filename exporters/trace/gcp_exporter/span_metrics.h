@@ -0,0 +1,165 @@
+/*
+ * Copyright 2021 Google
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "exporters/trace/gcp_exporter/compact_recordable.h"
+#include "exporters/trace/gcp_exporter/recordable.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+
+OPENTELEMETRY_BEGIN_NAMESPACE
+namespace exporter
+{
+namespace gcp
+{
+
+/* Upper bounds, in nanoseconds, of the span duration histogram buckets: 1us and every power
+   of 4 above it, up to about 4.5 minutes. Longer durations fall in one last bucket. */
+constexpr size_t kNumDurationBounds = 15;
+constexpr std::array<int64_t, kNumDurationBounds> kDurationBoundsNanos = {{
+    1000LL, 4000LL, 16000LL, 64000LL, 256000LL, 1024000LL, 4096000LL, 16384000LL, 65536000LL,
+    262144000LL, 1048576000LL, 4194304000LL, 16777216000LL, 67108864000LL, 268435456000LL}};
+
+/**
+ * Request rate, errors and durations of the spans sharing a display name and the values of
+ * the selected attributes, since the aggregator was created
+ */
+struct SpanMetrics
+{
+    /* The display name of the spans */
+    std::string name;
+
+    /* The values of the aggregator's attribute keys, in the same order, empty if unset */
+    std::vector<std::string> attribute_values;
+
+    /* Whether the series counts the spans of every series past the aggregator's limit, with
+       an empty name and no attribute values */
+    bool overflow = false;
+
+    /* Number of spans, and of spans with an error status */
+    uint64_t count = 0;
+    uint64_t error_count = 0;
+
+    /* Sum of the span durations */
+    uint64_t duration_sum_nanos = 0;
+
+    /* duration_buckets[i] counts the durations in (kDurationBoundsNanos[i-1], kDurationBoundsNanos[i]],
+       and the last bucket the durations above every bound */
+    std::array<uint64_t, kNumDurationBounds + 1> duration_buckets{};
+};
+
+/**
+ * Aggregates RED (rate, errors, duration) metrics from spans, keyed by display name and the
+ * values of a few selected attributes. Every thread records into its own shard without any
+ * lock or atomic read-modify-write; the shards are merged when the metrics are collected.
+ * Only creating a series in a shard takes a lock, and counts a new key against the limit on
+ * series. The shard of a thread that exits is folded into a retired shard.
+ */
+class SpanMetricsAggregator
+{
+public:
+    /**
+     * @param attribute_keys - The attributes whose values, along with the display name,
+     * split the spans into separate series
+     * @param max_series - Number of series past which the spans of new series are counted in
+     * a single overflow series instead
+     */
+    explicit SpanMetricsAggregator(std::vector<std::string> attribute_keys = {},
+                                   size_t max_series = 1000);
+
+    ~SpanMetricsAggregator();
+
+    /**
+     * Adds a span to the metrics
+     * 
+     * @param name - The display name of the span
+     * @param attribute_values - The values of the attribute keys, in the same order
+     * @param duration_nanos - The duration of the span
+     * @param error - Whether the span has an error status
+     */
+    void Record(nostd::string_view name, const std::vector<nostd::string_view> &attribute_values,
+                int64_t duration_nanos, bool error) noexcept;
+
+    /* Adds a span held by a recordable to the metrics */
+    void Record(const Recordable &recordable) noexcept;
+    void Record(const CompactRecordable &recordable) noexcept;
+
+    /**
+     * Merges the shards of every thread into one snapshot
+     * 
+     * @return The metrics of every series, sorted by name and attribute values, followed
+     * by the overflow series if any span was counted in it
+     */
+    std::vector<SpanMetrics> Collect() const;
+
+    /* The attributes that split the spans into series */
+    const std::vector<std::string> &attribute_keys() const noexcept { return attribute_keys_; }
+
+private:
+    /* Test Fixture Class meant for testing purposes only */
+    friend class SpanMetricsAggregatorTestPeer;
+
+    struct Series;
+    struct Shard;
+    struct ShardList;
+
+    /* Returns the shard of the calling thread, creating it on first use */
+    Shard &LocalShard() noexcept;
+
+    /* Returns the series of a shard a new key is counted in, creating it unless the limit
+       on series is reached */
+    Series &AddSeries(Shard &shard, const std::string &key, nostd::string_view name,
+                      const std::vector<nostd::string_view> &attribute_values) noexcept;
+
+    /* Folds the shard of an exiting thread into the retired shard of its aggregator's list */
+    static void RetireShard(const std::shared_ptr<void> &shard_list, void *shard) noexcept;
+
+    /* Number of aggregators the calling thread holds a shard of */
+    static size_t NumThreadShards() noexcept;
+
+    /* Number of shards of threads that have not exited */
+    size_t NumLiveShards() const noexcept;
+
+    /* Unique across aggregators, so that a thread never mistakes a destroyed aggregator's
+       shard for the shard of a new one at the same address */
+    const uint64_t id_;
+
+    const std::vector<std::string> attribute_keys_;
+
+    const size_t max_series_;
+
+    /* Distinct keys of the series of every shard, which the limit on series counts. A
+       shard only looks a key up here the first time it records it. */
+    std::mutex keys_mu_;
+    std::unordered_set<std::string> keys_;
+
+    /* Threads point to the list weakly, and drop the pointers to the shards of destroyed
+       aggregators */
+    const std::shared_ptr<ShardList> shards_;
+};
+
+} // gcp
+} // exporter
+OPENTELEMETRY_END_NAMESPACE